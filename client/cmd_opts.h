@@ -69,6 +69,9 @@ enum {
     SDP_ID,
     SERVICE_IDS,
     DISABLE_SDP_CTRL_CLIENT,
+    FANOUT,
+    AGENT_SOCKET,
+    RESOLVE_CACHE_TTL,
 
     /* Put GPG-related items below the following line */
     GPG_ENCRYPTION      = 0x200,
@@ -92,6 +95,7 @@ enum {
 static struct option cmd_opts[] =
 {
     {"allow-ip",            1, NULL, 'a'},
+    {"agent",               1, NULL, AGENT_SOCKET},
     {"access",              1, NULL, 'A'},
     {"save-packet-append",  0, NULL, 'b'},
     {"save-packet",         1, NULL, 'B'},
@@ -106,6 +110,7 @@ static struct option cmd_opts[] =
     {"destination",         1, NULL, 'D'},
     {"save-args-file",      1, NULL, 'E'},
     {"encryption-mode",     1, NULL, ENCRYPTION_MODE},
+    {"fanout",              1, NULL, FANOUT},
     {"fd",                  1, NULL, FD_SET_ALT},
     {"fw-timeout",          1, NULL, 'f'},
     {"fault-injection-tag", 1, NULL, FAULT_INJECTION_TAG },
@@ -147,6 +152,7 @@ static struct option cmd_opts[] =
     {"resolve-ip-https",    0, NULL, 'R'}, /* synonym, default is HTTPS */
     {"resolve-http-only",   0, NULL, RESOLVE_HTTP_ONLY},
     {"resolve-url",         1, NULL, RESOLVE_URL},
+    {"resolve-cache-ttl",   1, NULL, RESOLVE_CACHE_TTL},
     {"sdp-id",              1, NULL, SDP_ID},
     {"services",            1, NULL, SERVICE_IDS},
     {"server-resolve-ipv4", 0, NULL, SERVER_RESOLVE_IPV4},
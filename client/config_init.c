@@ -52,6 +52,22 @@
 #define POSITION_TO_BITMASK(x)      ((uint32_t)(1) << ((x) % 32))       /*!< Macro do get a bitmask from a position */
 #define BITMASK_ARRAY_SIZE          2                                   /*!< Number of 32bits integer used to handle bitmask in the fko_var_bitmask_t structure */
 #define LF_CHAR                     0x0A                                /*!< Hexadecimal value associated to the LF char */
+#define RC_CACHE_SUFFIX             ".cache"                            /*!< Suffix added to the rc file path for its compiled cache */
+#define RC_CACHE_MAGIC              "FKORCC01"                          /*!< Identifies an rc cache file and its format version */
+#define RC_CACHE_MIN_SIZE           8192                                /*!< rc files smaller than this are parsed without a cache */
+#define RC_CACHE_MAX_SIZE           (16*1024*1024)                      /*!< Upper bound on the size of an rc cache */
+#define RC_CACHE_ENTRY_INVALID      0x1                                 /*!< rc cache entry holding an improperly formatted line */
+#define RC_CACHE_BUF_LEN(h)         (sizeof(rc_cache_hdr_t) \
+                                    + (uint64_t)(h)->num_stanzas * sizeof(rc_cache_stanza_t) \
+                                    + (uint64_t)(h)->hash_size * sizeof(uint32_t) \
+                                    + (uint64_t)(h)->num_entries * sizeof(rc_cache_entry_t) \
+                                    + (h)->str_len)                     /*!< Size of an rc cache given its header */
+
+#if HAVE_STRUCT_STAT_ST_MTIM
+  #define RC_CACHE_MTIME_NSEC(st)   ((st)->st_mtim.tv_nsec)
+#else
+  #define RC_CACHE_MTIME_NSEC(st)   0
+#endif
 
 #ifdef HAVE_C_UNIT_TESTS
   #include "cunit_common.h"
@@ -88,6 +104,71 @@ typedef struct fko_var
     unsigned int    pos;        /*!< Variable position from the fwknop_cli_arg_t enumeration */
 } fko_var_t;
 
+#ifndef WIN32
+/**
+ * Header of the compiled rc cache file.
+ *
+ * The cache holds every stanza of an rc file already split into variable
+ * names and values, and an open addressing hash table over the (case
+ * insensitive) stanza names. It is only used while the device, inode, size
+ * and modification time of the rc file match the ones recorded here.
+ */
+typedef struct rc_cache_hdr
+{
+    char        magic[8];           /*!< RC_CACHE_MAGIC */
+    uint64_t    rc_dev;             /*!< Device of the rc file */
+    uint64_t    rc_ino;             /*!< Inode of the rc file */
+    uint64_t    rc_size;            /*!< Size of the rc file */
+    int64_t     rc_mtime_sec;       /*!< Modification time of the rc file */
+    int64_t     rc_mtime_nsec;      /*!< Nanoseconds part of the modification time */
+    uint32_t    num_stanzas;        /*!< Number of distinct stanza names */
+    uint32_t    num_entries;        /*!< Number of variables over all stanzas */
+    uint32_t    hash_size;          /*!< Number of hash table slots (power of 2) */
+    uint32_t    str_len;            /*!< Length of the string table */
+} rc_cache_hdr_t;
+
+/**
+ * A stanza in the rc cache. The variables of all sections that share the
+ * stanza name are stored contiguously in rc file order.
+ */
+typedef struct rc_cache_stanza
+{
+    uint32_t    name_off;           /*!< Offset of the name in the string table */
+    uint32_t    first_entry;        /*!< Index of the first variable */
+    uint32_t    num_entries;        /*!< Number of variables */
+    uint32_t    reserved;
+} rc_cache_stanza_t;
+
+/**
+ * A variable in the rc cache
+ */
+typedef struct rc_cache_entry
+{
+    uint32_t    name_off;           /*!< Offset of the variable name */
+    uint32_t    val_off;            /*!< Offset of the value, or of the raw line if invalid */
+    uint32_t    line_num;           /*!< Line number in the rc file */
+    uint32_t    flags;              /*!< RC_CACHE_ENTRY_INVALID */
+} rc_cache_entry_t;
+
+/**
+ * The rc cache in use by this process. It is kept across calls so that
+ * the default and named stanzas (and each --fanout target) are read from
+ * a single load.
+ */
+typedef struct rc_cache
+{
+    char                rcfile[MAX_PATH_LEN];   /*!< rc file the cache belongs to */
+    unsigned char      *buf;                    /*!< Cache contents */
+    rc_cache_hdr_t     *hdr;
+    rc_cache_stanza_t  *stanzas;
+    uint32_t           *hash;                   /*!< Stanza index + 1, 0 for an empty slot */
+    rc_cache_entry_t   *entries;
+    char               *strs;
+} rc_cache_t;
+
+static rc_cache_t rc_cache;
+#endif
+
 enum
 {
     FWKNOP_CLI_FIRST_ARG = 0,
@@ -140,6 +221,7 @@ enum
     FWKNOP_CLI_ARG_SERVICE_IDS,
     FWKNOP_CLI_ARG_DISABLE_SDP_CTRL_CLIENT,
     FWKNOP_CLI_ARG_SDP_CTRL_CLIENT_CONF,
+    FWKNOP_CLI_ARG_RESOLVE_CACHE_TTL,
     FWKNOP_CLI_LAST_ARG
 } fwknop_cli_arg_t;
 
@@ -193,7 +275,8 @@ static fko_var_t fko_var_array[FWKNOP_CLI_LAST_ARG] =
     { "SDP_ID",            FWKNOP_CLI_ARG_SDP_ID         },
     { "SERVICE_IDS",            FWKNOP_CLI_ARG_SERVICE_IDS           },
     { "DISABLE_CTRL_CLIENT",   FWKNOP_CLI_ARG_DISABLE_SDP_CTRL_CLIENT},
-    { "SDP_CTRL_CLIENT_CONF",  FWKNOP_CLI_ARG_SDP_CTRL_CLIENT_CONF  }
+    { "SDP_CTRL_CLIENT_CONF",  FWKNOP_CLI_ARG_SDP_CTRL_CLIENT_CONF  },
+    { "RESOLVE_CACHE_TTL",     FWKNOP_CLI_ARG_RESOLVE_CACHE_TTL     }
 
 };
 
@@ -554,7 +637,7 @@ is_rc_section(const char* line, uint16_t line_size, char* rc_section, uint16_t r
 }
 
 /**
- * @brief Grab a variable and its value from a rc line.
+ * @brief Split a rc line into a variable and its value.
  *
  * @param line  Line to parse for a variable
  * @param param Parameter structure where to store the variable name and its value
@@ -562,7 +645,7 @@ is_rc_section(const char* line, uint16_t line_size, char* rc_section, uint16_t r
  * @return 0 if no variable has been found, 1 otherwise.
  */
 static int
-is_rc_param(const char *line, rc_file_param_t *param)
+split_rc_param(const char *line, rc_file_param_t *param)
 {
     char    var[MAX_LINE_LEN] = {0};
     char    val[MAX_LINE_LEN] = {0};
@@ -572,11 +655,7 @@ is_rc_param(const char *line, rc_file_param_t *param)
 
     /* Fetch the variable and its value */
     if(sscanf(line, "%s %[^ ;\t\n\r#]", var, val) != 2)
-    {
-        log_msg(LOG_VERBOSITY_WARNING,
-            "*Invalid entry in '%s'", line);
         return 0;
-    }
 
     /* Remove any colon that may be on the end of the var */
     if((ndx = strrchr(var, ':')) != NULL)
@@ -596,6 +675,27 @@ is_rc_param(const char *line, rc_file_param_t *param)
     return 1;
 }
 
+/**
+ * @brief Grab a variable and its value from a rc line.
+ *
+ * @param line  Line to parse for a variable
+ * @param param Parameter structure where to store the variable name and its value
+ *
+ * @return 0 if no variable has been found, 1 otherwise.
+ */
+static int
+is_rc_param(const char *line, rc_file_param_t *param)
+{
+    if(split_rc_param(line, param) == 0)
+    {
+        log_msg(LOG_VERBOSITY_WARNING,
+            "*Invalid entry in '%s'", line);
+        return 0;
+    }
+
+    return 1;
+}
+
 /**
  * @brief Dump available stanzas from a fwknoprc file
  *
@@ -1225,6 +1325,16 @@ parse_rc_param(fko_cli_options_t *options, const char *var_name, char * val)
         }
         strlcpy(options->resolve_url, val, tmpint);
     }
+    /* Resolve cache TTL */
+    else if (var->pos == FWKNOP_CLI_ARG_RESOLVE_CACHE_TTL)
+    {
+        tmpint = strtol_wrapper(val, 0, MAX_RESOLVE_CACHE_TTL,
+                NO_EXIT_UPON_ERR, &is_err);
+        if(is_err == FKO_SUCCESS)
+            options->resolve_cache_ttl = tmpint;
+        else
+            parse_error = -1;
+    }
     /* Resolve the SPA server (via DNS) - accept IPv4 addresses only ? */
     else if (var->pos == FWKNOP_CLI_ARG_SERVER_RESOLVE_IPV4)
     {
@@ -1494,6 +1604,9 @@ add_single_var_to_rc(FILE* fhandle, short var_pos, fko_cli_options_t *options)
                 strlcpy(val, options->resolve_url, sizeof(val));
             else;
             break;
+        case FWKNOP_CLI_ARG_RESOLVE_CACHE_TTL :
+            snprintf(val, sizeof(val)-1, "%d", options->resolve_cache_ttl);
+            break;
         case FWKNOP_CLI_ARG_SERVER_RESOLVE_IPV4:
             bool_to_yesno(options->spa_server_resolve_ipv4, val, sizeof(val));
             break;
@@ -1578,6 +1691,662 @@ add_multiple_vars_to_rc(FILE* rc, fko_cli_options_t *options, fko_var_bitmask_t
     }
 }
 
+#ifndef WIN32
+/**
+ * @brief Hash a stanza name (FNV-1a over the lower cased name)
+ */
+static uint32_t
+rc_cache_hash(const char *name)
+{
+    uint32_t    hash = 2166136261U;
+
+    while(*name != '\0')
+    {
+        hash ^= (unsigned char)tolower((unsigned char)*name++);
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+/**
+ * @brief Look up a stanza by name in an rc cache hash table
+ *
+ * @return the stanza index, or -1 if there is no such stanza
+ */
+static int
+rc_cache_find(const uint32_t *hash, const uint32_t hash_size,
+        const rc_cache_stanza_t *stanzas, const char *strs, const char *name)
+{
+    uint32_t    slot, n;
+
+    slot = rc_cache_hash(name) & (hash_size - 1);
+    for(n=0; n < hash_size; n++)
+    {
+        if(hash[slot] == 0)
+            break;
+        if(strcasecmp(strs + stanzas[hash[slot]-1].name_off, name) == 0)
+            return hash[slot]-1;
+        slot = (slot + 1) & (hash_size - 1);
+    }
+    return -1;
+}
+
+/**
+ * @brief Check whether an rc cache was compiled from the rc file as it is now
+ */
+static int
+rc_cache_matches(const rc_cache_hdr_t *hdr, const struct stat *st)
+{
+    return hdr->rc_dev == (uint64_t)st->st_dev
+        && hdr->rc_ino == (uint64_t)st->st_ino
+        && hdr->rc_size == (uint64_t)st->st_size
+        && hdr->rc_mtime_sec == (int64_t)st->st_mtime
+        && hdr->rc_mtime_nsec == (int64_t)RC_CACHE_MTIME_NSEC(st);
+}
+
+/**
+ * @brief Zero out and free a buffer holding rc file contents
+ *
+ * Anything built from the rc file may hold keys.  zero_buf() takes at
+ * most MAX_SPA_ENCODED_MSG_SIZE bytes, so larger buffers are zeroed in
+ * pieces.
+ */
+static void
+rc_cache_zero_free(void *buf, const size_t len)
+{
+    size_t  off, n;
+
+    if(buf == NULL)
+        return;
+
+    for(off = 0; off < len; off += n)
+    {
+        n = len - off;
+        if(n > MAX_SPA_ENCODED_MSG_SIZE)
+            n = MAX_SPA_ENCODED_MSG_SIZE;
+
+        if(zero_buf((char *)buf + off, n) != FKO_SUCCESS)
+        {
+            log_msg(LOG_VERBOSITY_ERROR,
+                    "[*] Could not zero out sensitive data buffer.");
+            break;
+        }
+    }
+    free(buf);
+    return;
+}
+
+/**
+ * @brief Release the rc cache
+ *
+ * Called on exit as well, since the cache holds any keys set in the rc
+ * file.
+ */
+void
+rc_cache_free(void)
+{
+    if(rc_cache.buf != NULL)
+        rc_cache_zero_free(rc_cache.buf, RC_CACHE_BUF_LEN(rc_cache.hdr));
+
+    memset(&rc_cache, 0x0, sizeof(rc_cache));
+    return;
+}
+
+/**
+ * @brief Point the rc cache tables into its buffer after checking that
+ *        every table, offset and index in it is in bounds
+ *
+ * @return 1 if the cache buffer is sane, 0 otherwise
+ */
+static int
+rc_cache_map(unsigned char *buf, const size_t len)
+{
+    rc_cache_hdr_t     *hdr = (rc_cache_hdr_t *)buf;
+    rc_cache_stanza_t  *stanzas;
+    rc_cache_entry_t   *entries;
+    uint32_t           *hash;
+    char               *strs;
+    uint32_t            i;
+
+    if(len < sizeof(rc_cache_hdr_t)
+            || memcmp(hdr->magic, RC_CACHE_MAGIC, sizeof(hdr->magic)) != 0
+            || hdr->hash_size == 0
+            || (hdr->hash_size & (hdr->hash_size - 1)) != 0
+            || hdr->hash_size <= hdr->num_stanzas
+            || hdr->str_len == 0
+            || hdr->num_stanzas > RC_CACHE_MAX_SIZE
+            || hdr->num_entries > RC_CACHE_MAX_SIZE
+            || hdr->hash_size > RC_CACHE_MAX_SIZE
+            || hdr->str_len > RC_CACHE_MAX_SIZE
+            || RC_CACHE_BUF_LEN(hdr) != len)
+        return 0;
+
+    stanzas = (rc_cache_stanza_t *)(buf + sizeof(rc_cache_hdr_t));
+    hash    = (uint32_t *)(stanzas + hdr->num_stanzas);
+    entries = (rc_cache_entry_t *)(hash + hdr->hash_size);
+    strs    = (char *)(entries + hdr->num_entries);
+
+    if(strs[hdr->str_len-1] != '\0')
+        return 0;
+
+    for(i=0; i < hdr->num_stanzas; i++)
+        if(stanzas[i].name_off >= hdr->str_len
+                || stanzas[i].first_entry > hdr->num_entries
+                || stanzas[i].num_entries > hdr->num_entries - stanzas[i].first_entry)
+            return 0;
+
+    for(i=0; i < hdr->hash_size; i++)
+        if(hash[i] > hdr->num_stanzas)
+            return 0;
+
+    for(i=0; i < hdr->num_entries; i++)
+        if(entries[i].name_off >= hdr->str_len || entries[i].val_off >= hdr->str_len)
+            return 0;
+
+    rc_cache.buf     = buf;
+    rc_cache.hdr     = hdr;
+    rc_cache.stanzas = stanzas;
+    rc_cache.hash    = hash;
+    rc_cache.entries = entries;
+    rc_cache.strs    = strs;
+
+    return 1;
+}
+
+static void
+rc_cache_path(char *path, const size_t path_size, const char *rcfile)
+{
+    if(snprintf(path, path_size, "%s%s", rcfile, RC_CACHE_SUFFIX) >= (int)path_size)
+        path[0] = '\0';
+    return;
+}
+
+/**
+ * @brief Load the compiled cache of an rc file if it is still current
+ *
+ * The cache holds the same secrets as the rc file, so it is only trusted
+ * when it is a regular file owned by the user with permissions 0600.
+ *
+ * @return 1 if the cache was loaded, 0 otherwise
+ */
+static int
+rc_cache_load(const char *rcfile, const struct stat *rc_st)
+{
+    char            path[MAX_PATH_LEN] = {0};
+    unsigned char  *buf;
+    struct stat     st;
+    ssize_t         n;
+    size_t          len = 0;
+    int             fd;
+
+    rc_cache_path(path, sizeof(path), rcfile);
+    if(path[0] == '\0')
+        return 0;
+
+    if((fd = open(path, O_RDONLY|O_NOFOLLOW)) < 0)
+        return 0;
+
+    if(fstat(fd, &st) != 0 || ! S_ISREG(st.st_mode)
+            || st.st_uid != getuid()
+            || (st.st_mode & (S_IRWXG|S_IRWXO)) != 0
+            || st.st_size < (off_t)sizeof(rc_cache_hdr_t)
+            || st.st_size > RC_CACHE_MAX_SIZE)
+    {
+        log_msg(LOG_VERBOSITY_DEBUG, "rc_cache_load() : Ignoring %s", path);
+        close(fd);
+        return 0;
+    }
+
+    if((buf = malloc(st.st_size)) == NULL)
+    {
+        close(fd);
+        return 0;
+    }
+
+    while(len < (size_t)st.st_size)
+    {
+        n = read(fd, buf + len, st.st_size - len);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            break;
+        len += n;
+    }
+    close(fd);
+
+    if(len != (size_t)st.st_size || ! rc_cache_map(buf, len)
+            || ! rc_cache_matches(rc_cache.hdr, rc_st))
+    {
+        log_msg(LOG_VERBOSITY_DEBUG, "rc_cache_load() : %s is stale", path);
+        rc_cache_zero_free(buf, st.st_size);
+        memset(&rc_cache, 0x0, sizeof(rc_cache));
+        return 0;
+    }
+
+    strlcpy(rc_cache.rcfile, rcfile, sizeof(rc_cache.rcfile));
+    return 1;
+}
+
+/**
+ * @brief Write the rc cache next to its rc file
+ *
+ * This is best effort: if the rc file directory is not writable, the
+ * cache is simply rebuilt by the next fwknop invocation.
+ */
+static void
+rc_cache_save(void)
+{
+    char    path[MAX_PATH_LEN] = {0};
+    char    tmp_path[MAX_PATH_LEN] = {0};
+    size_t  len = RC_CACHE_BUF_LEN(rc_cache.hdr);
+    ssize_t res;
+    int     fd;
+
+    rc_cache_path(path, sizeof(path), rc_cache.rcfile);
+    if(path[0] == '\0'
+            || snprintf(tmp_path, sizeof(tmp_path), "%s.%ld", path,
+                (long)getpid()) >= (int)sizeof(tmp_path))
+        return;
+
+    if((fd = open(tmp_path, FWKNOPRC_OFLAGS|O_NOFOLLOW, FWKNOPRC_MODE)) < 0)
+    {
+        log_msg(LOG_VERBOSITY_DEBUG, "rc_cache_save() : Unable to create %s: %s",
+                tmp_path, strerror(errno));
+        return;
+    }
+
+    res = write(fd, rc_cache.buf, len);
+    if(close(fd) != 0 || res != (ssize_t)len || rename(tmp_path, path) != 0)
+    {
+        log_msg(LOG_VERBOSITY_DEBUG, "rc_cache_save() : Unable to write %s: %s",
+                path, strerror(errno));
+        unlink(tmp_path);
+    }
+    return;
+}
+
+/**
+ * Growable tables used while compiling an rc file
+ */
+typedef struct rc_cache_build
+{
+    rc_cache_stanza_t  *stanzas;
+    uint32_t            num_stanzas;
+    uint32_t           *hash;
+    uint32_t            hash_size;
+    rc_cache_entry_t   *entries;
+    uint32_t           *entry_stanza;   /*!< Stanza index of each entry */
+    uint32_t            num_entries;
+    char               *strs;
+    uint32_t            str_len;
+    uint32_t            str_alloc;
+} rc_cache_build_t;
+
+static int
+rc_cache_add_str(rc_cache_build_t *b, const char *str, uint32_t *off)
+{
+    size_t  len = strlen(str) + 1;
+    char   *strs;
+
+    if(b->str_len + len > RC_CACHE_MAX_SIZE)
+        return 0;
+
+    /* Not realloc(), which would leave the old copy behind unzeroed
+    */
+    if(b->str_len + len > b->str_alloc)
+    {
+        if((strs = malloc((b->str_alloc + len) * 2)) == NULL)
+            return 0;
+        if(b->strs != NULL)
+            memcpy(strs, b->strs, b->str_len);
+        rc_cache_zero_free(b->strs, b->str_alloc);
+        b->strs = strs;
+        b->str_alloc = (b->str_alloc + len) * 2;
+    }
+    memcpy(b->strs + b->str_len, str, len);
+    *off = b->str_len;
+    b->str_len += len;
+    return 1;
+}
+
+/**
+ * @brief Rebuild the stanza hash table with room for twice as many names
+ */
+static int
+rc_cache_grow_hash(rc_cache_build_t *b)
+{
+    uint32_t   *hash, size, slot, i;
+    void       *stanzas;
+
+    size = b->hash_size ? b->hash_size * 2 : 16;
+    if((hash = calloc(size, sizeof(uint32_t))) == NULL)
+        return 0;
+    if((stanzas = realloc(b->stanzas, (size/2) * sizeof(rc_cache_stanza_t))) == NULL)
+    {
+        free(hash);
+        return 0;
+    }
+    b->stanzas = stanzas;
+
+    for(i=0; i < b->num_stanzas; i++)
+    {
+        slot = rc_cache_hash(b->strs + b->stanzas[i].name_off) & (size - 1);
+        while(hash[slot] != 0)
+            slot = (slot + 1) & (size - 1);
+        hash[slot] = i+1;
+    }
+    free(b->hash);
+    b->hash      = hash;
+    b->hash_size = size;
+    return 1;
+}
+
+/**
+ * @brief Get the index of a stanza, adding it on first sight
+ *
+ * @return the stanza index, or -1 on error
+ */
+static int
+rc_cache_add_stanza(rc_cache_build_t *b, const char *name)
+{
+    uint32_t    slot;
+    int         idx;
+
+    if(b->hash_size != 0
+            && (idx = rc_cache_find(b->hash, b->hash_size,
+                    b->stanzas, b->strs, name)) >= 0)
+        return idx;
+
+    /* Keep the table at most half full
+    */
+    if((b->num_stanzas + 1) * 2 > b->hash_size && ! rc_cache_grow_hash(b))
+        return -1;
+
+    memset(&b->stanzas[b->num_stanzas], 0x0, sizeof(rc_cache_stanza_t));
+    if(! rc_cache_add_str(b, name, &b->stanzas[b->num_stanzas].name_off))
+        return -1;
+
+    slot = rc_cache_hash(name) & (b->hash_size - 1);
+    while(b->hash[slot] != 0)
+        slot = (slot + 1) & (b->hash_size - 1);
+    b->hash[slot] = ++b->num_stanzas;
+
+    return b->num_stanzas - 1;
+}
+
+static int
+rc_cache_add_entry(rc_cache_build_t *b, const int stanza, const char *name,
+        const char *val, const int line_num, const uint32_t flags)
+{
+    rc_cache_entry_t   *entries;
+    uint32_t           *entry_stanza;
+
+    if((b->num_entries & (b->num_entries - 1)) == 0)
+    {
+        /* Grow the entry tables at each power of two
+        */
+        if(b->num_entries >= RC_CACHE_MAX_SIZE / sizeof(rc_cache_entry_t))
+            return 0;
+        if((entries = realloc(b->entries,
+                        (b->num_entries ? b->num_entries * 2 : 1) * sizeof(*entries))) == NULL)
+            return 0;
+        b->entries = entries;
+        if((entry_stanza = realloc(b->entry_stanza,
+                        (b->num_entries ? b->num_entries * 2 : 1) * sizeof(*entry_stanza))) == NULL)
+            return 0;
+        b->entry_stanza = entry_stanza;
+    }
+
+    b->entries[b->num_entries].line_num = line_num;
+    b->entries[b->num_entries].flags    = flags;
+    b->entry_stanza[b->num_entries]     = stanza;
+
+    if(! rc_cache_add_str(b, name, &b->entries[b->num_entries].name_off)
+            || ! rc_cache_add_str(b, val, &b->entries[b->num_entries].val_off))
+        return 0;
+
+    b->num_entries++;
+    return 1;
+}
+
+/**
+ * @brief Lay the compiled tables out in a single cache buffer, with the
+ *        variables of each stanza grouped together in rc file order
+ */
+static int
+rc_cache_finish(rc_cache_build_t *b, const struct stat *st)
+{
+    rc_cache_hdr_t      hdr;
+    rc_cache_stanza_t  *stanzas;
+    rc_cache_entry_t   *entries;
+    unsigned char      *buf;
+    uint32_t           *next, i;
+
+    memset(&hdr, 0x0, sizeof(hdr));
+    memcpy(hdr.magic, RC_CACHE_MAGIC, sizeof(hdr.magic));
+    hdr.rc_dev        = st->st_dev;
+    hdr.rc_ino        = st->st_ino;
+    hdr.rc_size       = st->st_size;
+    hdr.rc_mtime_sec  = st->st_mtime;
+    hdr.rc_mtime_nsec = RC_CACHE_MTIME_NSEC(st);
+    hdr.num_stanzas   = b->num_stanzas;
+    hdr.num_entries   = b->num_entries;
+    hdr.hash_size     = b->hash_size;
+    hdr.str_len       = b->str_len;
+
+    if(b->hash_size == 0 || b->str_len == 0
+            || RC_CACHE_BUF_LEN(&hdr) > RC_CACHE_MAX_SIZE)
+        return 0;
+
+    if((buf = calloc(1, RC_CACHE_BUF_LEN(&hdr))) == NULL)
+        return 0;
+
+    if((next = calloc(b->num_stanzas, sizeof(uint32_t))) == NULL)
+    {
+        free(buf);
+        return 0;
+    }
+
+    memcpy(buf, &hdr, sizeof(hdr));
+    stanzas = (rc_cache_stanza_t *)(buf + sizeof(rc_cache_hdr_t));
+    memcpy(stanzas, b->stanzas, b->num_stanzas * sizeof(rc_cache_stanza_t));
+    memcpy(stanzas + b->num_stanzas, b->hash, b->hash_size * sizeof(uint32_t));
+    entries = (rc_cache_entry_t *)((uint32_t *)(stanzas + b->num_stanzas) + b->hash_size);
+    memcpy(entries + b->num_entries, b->strs, b->str_len);
+
+    for(i=0; i < b->num_entries; i++)
+        stanzas[b->entry_stanza[i]].num_entries++;
+
+    for(i=1; i < b->num_stanzas; i++)
+        stanzas[i].first_entry = stanzas[i-1].first_entry + stanzas[i-1].num_entries;
+
+    for(i=0; i < b->num_entries; i++)
+        entries[stanzas[b->entry_stanza[i]].first_entry
+            + next[b->entry_stanza[i]]++] = b->entries[i];
+
+    free(next);
+
+    if(! rc_cache_map(buf, RC_CACHE_BUF_LEN(&hdr)))
+    {
+        rc_cache_zero_free(buf, RC_CACHE_BUF_LEN(&hdr));
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Compile an rc file into the rc cache
+ *
+ * Every section is split into its variables here, but values are only
+ * interpreted (by parse_rc_param()) for the stanzas that are used.
+ *
+ * @return 1 on success, 0 otherwise
+ */
+static int
+rc_cache_build(const char *rcfile)
+{
+    FILE               *rc;
+    rc_cache_build_t    b;
+    rc_file_param_t     param;
+    struct stat         st;
+    char                line[MAX_LINE_LEN] = {0};
+    char                curr_stanza[MAX_LINE_LEN] = {0};
+    int                 line_num = 0, curr = -1, res = 1;
+
+    if ((rc = fopen(rcfile, "r")) == NULL)
+        return 0;
+
+    if(fstat(fileno(rc), &st) != 0)
+    {
+        fclose(rc);
+        return 0;
+    }
+
+    memset(&b, 0x0, sizeof(b));
+
+    while (res && (fgets(line, MAX_LINE_LEN, rc)) != NULL)
+    {
+        line_num++;
+        line[MAX_LINE_LEN-1] = '\0';
+
+        if(IS_EMPTY_LINE(line[0]))
+            continue;
+
+        if (is_rc_section(line, strlen(line), curr_stanza, sizeof(curr_stanza)))
+        {
+            if((curr = rc_cache_add_stanza(&b, curr_stanza)) < 0)
+                res = 0;
+        }
+        else if (curr < 0)
+            continue;
+        else if (split_rc_param(line, &param))
+            res = rc_cache_add_entry(&b, curr, param.name, param.val, line_num, 0);
+        else
+            res = rc_cache_add_entry(&b, curr, "", line, line_num,
+                    RC_CACHE_ENTRY_INVALID);
+    }
+    fclose(rc);
+
+    /* An rc file without any stanza still gets a (single, empty) one so
+     * that the cache is not rebuilt on every run
+    */
+    if(res && b.num_stanzas == 0 && rc_cache_add_stanza(&b, RC_SECTION_DEFAULT) < 0)
+        res = 0;
+
+    if(res && (res = rc_cache_finish(&b, &st)) == 1)
+        strlcpy(rc_cache.rcfile, rcfile, sizeof(rc_cache.rcfile));
+
+    free(b.stanzas);
+    free(b.hash);
+    free(b.entries);
+    free(b.entry_stanza);
+    rc_cache_zero_free(b.strs, b.str_alloc);
+
+    return res;
+}
+
+/**
+ * @brief Make sure the rc cache matches the rc file, loading or compiling
+ *        it as needed
+ *
+ * Small rc files are parsed directly as that is as fast as using a cache.
+ *
+ * @return 1 if the rc cache can be used, 0 otherwise
+ */
+static int
+rc_cache_ready(const char *rcfile)
+{
+    struct stat st;
+
+    if(stat(rcfile, &st) != 0 || st.st_size < RC_CACHE_MIN_SIZE)
+        return 0;
+
+    if(rc_cache.buf != NULL && strcmp(rc_cache.rcfile, rcfile) == 0
+            && rc_cache_matches(rc_cache.hdr, &st))
+        return 1;
+
+    rc_cache_free();
+
+    if(rc_cache_load(rcfile, &st))
+        return 1;
+
+    if(! rc_cache_build(rcfile))
+        return 0;
+
+    log_msg(LOG_VERBOSITY_DEBUG, "rc_cache_ready() : Compiled %s (%u stanzas)",
+            rcfile, rc_cache.hdr->num_stanzas);
+
+    rc_cache_save();
+    return 1;
+}
+
+/**
+ * @brief Process a section of the rc file from the rc cache
+ *
+ * This mirrors process_rc_section(), including its handling of invalid
+ * lines and parameter errors.
+ */
+static int
+process_cached_rc_section(const char *section_name, fko_cli_options_t *options,
+        const char *rcfile)
+{
+    rc_cache_stanza_t  *stanza;
+    rc_cache_entry_t   *entry;
+    rc_file_param_t     param;
+    uint32_t            i;
+    int                 idx, do_exit = 0;
+
+    log_msg(LOG_VERBOSITY_DEBUG,
+            "process_rc_section() : Using cached section '%s' ...", section_name);
+
+    if (rc_cache_find(rc_cache.hash, rc_cache.hdr->hash_size, rc_cache.stanzas,
+                rc_cache.strs, options->use_rc_stanza) >= 0)
+        options->got_named_stanza = 1;
+
+    if((idx = rc_cache_find(rc_cache.hash, rc_cache.hdr->hash_size,
+                    rc_cache.stanzas, rc_cache.strs, section_name)) < 0)
+        return 0;
+
+    stanza = &rc_cache.stanzas[idx];
+    for(i=0; i < stanza->num_entries; i++)
+    {
+        entry = &rc_cache.entries[stanza->first_entry + i];
+
+        /* We don't allow improperly formatted lines (is_rc_param() reports
+         * the line)
+        */
+        if(entry->flags & RC_CACHE_ENTRY_INVALID)
+        {
+            is_rc_param(rc_cache.strs + entry->val_off, &param);
+            do_exit = 1;
+            break;
+        }
+
+        strlcpy(param.name, rc_cache.strs + entry->name_off, sizeof(param.name));
+        strlcpy(param.val, rc_cache.strs + entry->val_off, sizeof(param.val));
+
+        if(parse_rc_param(options, param.name, param.val) < 0)
+        {
+            log_msg(LOG_VERBOSITY_WARNING,
+                "Parameter error in %s, line %i: var=%s, val=%s",
+                rcfile, entry->line_num, param.name, param.val);
+            do_exit = 1;
+        }
+    }
+
+    if (do_exit)
+        exit(EXIT_FAILURE);
+
+    return 0;
+}
+#else
+void
+rc_cache_free(void)
+{
+    return;
+}
+#endif
+
 /**
  * @brief Process the fwknoprc file and lookup a section to extract its settings.
  *
@@ -1604,6 +2373,13 @@ process_rc_section(char *section_name, fko_cli_options_t *options)
 
     set_rc_file(rcfile, options);
 
+#ifndef WIN32
+    /* Large rc files are read through their compiled cache
+    */
+    if(rc_cache_ready(rcfile))
+        return process_cached_rc_section(section_name, options, rcfile);
+#endif
+
     /* Open the rc file for reading, if it does not exist, then create
      * an initial .fwknoprc file with defaults and go on.
     */
@@ -1870,6 +2646,29 @@ static void
 validate_options(fko_cli_options_t *options)
 {
 
+    if (options->agent_socket[0] != 0x0 && options->fanout_list[0] == 0x0)
+    {
+        log_msg(LOG_VERBOSITY_ERROR,
+            "--agent requires --fanout to list the targets to serve");
+        exit(EXIT_FAILURE);
+    }
+
+    if (options->fanout_list[0] != 0x0)
+    {
+        if (options->use_rc_stanza[0] != 0x0
+                || options->save_rc_stanza
+                || options->key_gen)
+        {
+            log_msg(LOG_VERBOSITY_ERROR,
+                "--fanout cannot be combined with --named-config, --save-rc-stanza, or --key-gen");
+            exit(EXIT_FAILURE);
+        }
+
+        /* Each target is validated on its own when it is built
+        */
+        return;
+    }
+
     if ( (options->use_rc_stanza[0] != 0x0)
         && (options->got_named_stanza == 0)
         && (options->save_rc_stanza == 0) )
@@ -2056,6 +2855,18 @@ set_defaults(fko_cli_options_t *options)
 */
 void
 config_init(fko_cli_options_t *options, int argc, char **argv)
+{
+    config_init_target(options, argc, argv, NULL);
+}
+
+/* Initialize the configuration for a single --fanout target.  The target
+ * is used as a named stanza if the rc file has one by that name, and as the
+ * SPA server otherwise.  All other command-line switches apply as usual.
+ * With a NULL target this is the same as config_init().
+*/
+void
+config_init_target(fko_cli_options_t *options, int argc, char **argv,
+        const char *target)
 {
     int                 cmd_arg, index, is_err, rlen=0;
     fko_var_bitmask_t   var_bitmask;
@@ -2070,6 +2881,11 @@ config_init(fko_cli_options_t *options, int argc, char **argv)
     */
     set_defaults(options);
 
+    /* The command line has already been parsed once for fan-out targets
+    */
+    if(target != NULL)
+        optind = 0;
+
     /* First pass over cmd_line args to see if a named-stanza in the
      * rc file is used.
     */
@@ -2085,6 +2901,9 @@ config_init(fko_cli_options_t *options, int argc, char **argv)
             case 'n':
                 strlcpy(options->use_rc_stanza, optarg, sizeof(options->use_rc_stanza));
                 break;
+            case FANOUT:
+                strlcpy(options->fanout_list, optarg, sizeof(options->fanout_list));
+                break;
             case SAVE_RC_STANZA:
                 options->save_rc_stanza = 1;
                 break;
@@ -2107,6 +2926,14 @@ config_init(fko_cli_options_t *options, int argc, char **argv)
     /* Update the verbosity level for the log module */
     log_set_verbosity(LOG_DEFAULT_VERBOSITY + options->verbose);
 
+    /* Each fan-out target is looked up as a named stanza first
+    */
+    if(target != NULL)
+    {
+        options->fanout_list[0] = 0x0;
+        strlcpy(options->use_rc_stanza, target, sizeof(options->use_rc_stanza));
+    }
+
     /* Dump the configured stanzas from an rcfile */
     if (options->stanza_list == 1)
     {
@@ -2332,9 +3159,13 @@ config_init(fko_cli_options_t *options, int argc, char **argv)
                 add_var_to_bitmask(FWKNOP_CLI_ARG_NO_SAVE_ARGS, &var_bitmask);
                 break;
             case 'n':
+            case FANOUT:
                 /* We already handled this earlier, so we do nothing here
                 */
                 break;
+            case AGENT_SOCKET:
+                strlcpy(options->agent_socket, optarg, sizeof(options->agent_socket));
+                break;
             case 'N':
                 strlcpy(options->nat_access_str, optarg, sizeof(options->nat_access_str));
                 add_var_to_bitmask(FWKNOP_CLI_ARG_NAT_ACCESS, &var_bitmask);
@@ -2386,6 +3217,11 @@ config_init(fko_cli_options_t *options, int argc, char **argv)
                 strlcpy(options->resolve_url, optarg, rlen);
                 add_var_to_bitmask(FWKNOP_CLI_ARG_RESOLVE_URL, &var_bitmask);
                 break;
+            case RESOLVE_CACHE_TTL:
+                options->resolve_cache_ttl = strtol_wrapper(optarg, 0,
+                        MAX_RESOLVE_CACHE_TTL, EXIT_UPON_ERR, &is_err);
+                add_var_to_bitmask(FWKNOP_CLI_ARG_RESOLVE_CACHE_TTL, &var_bitmask);
+                break;
             case SDP_ID:
                 options->sdp_id = (uint32_t)strtol_wrapper(optarg, 0,
                         UINT32_MAX, EXIT_UPON_ERR, &is_err);
@@ -2539,6 +3375,27 @@ config_init(fko_cli_options_t *options, int argc, char **argv)
         }
     }
 
+    /* The destination of each fan-out target comes from its stanza or
+     * from the target itself.
+    */
+    if(bitmask_has_var(FWKNOP_CLI_ARG_SPA_SERVER, &var_bitmask)
+            && (target != NULL || options->fanout_list[0] != 0x0))
+    {
+        log_msg(LOG_VERBOSITY_ERROR,
+            "--destination cannot be combined with --fanout");
+        exit(EXIT_FAILURE);
+    }
+
+    if(target != NULL)
+    {
+        options->agent_socket[0] = 0x0;
+        if(! options->got_named_stanza)
+        {
+            options->use_rc_stanza[0] = 0x0;
+            strlcpy(options->spa_server_str, target, sizeof(options->spa_server_str));
+        }
+    }
+
     /* Now that we have all of our options set, we can validate them */
     validate_options(options);
 
@@ -2636,7 +3493,12 @@ usage(void)
       "                             HTTP connection is altered en-route by a third\n"
       "                             party.\n"
       "     --resolve-url           Override the default URL used for resolving\n"
-      "                             the source IP address.\n"
+      "                             the source IP address.  A comma separated\n"
+      "                             list of URLs is queried in parallel and the\n"
+      "                             first valid answer is used.\n"
+      "     --resolve-cache-ttl     Cache the IP resolved via -R for this many\n"
+      "                             seconds, or until the local network\n"
+      "                             configuration changes.\n"
       " -u, --user-agent            Set the HTTP User-Agent for resolving the\n"
       "                             external IP via -R, or for sending SPA\n"
       "                             packets over HTTP. The default is\n"
@@ -2716,6 +3578,13 @@ usage(void)
       "                             the variables for the specified stanza\n"
       "     --stanza-list           Dump a list of the stanzas found in\n"
       "                             $HOME/.fwknoprc\n"
+      "     --fanout                Send SPA packets to a comma-separated list\n"
+      "                             of targets at once. Each target is either a\n"
+      "                             named stanza in $HOME/.fwknoprc or an SPA\n"
+      "                             server hostname/IP.\n"
+      "     --agent                 Stay running and serve knocks for the\n"
+      "                             --fanout targets from pre-built SPA packets\n"
+      "                             over the given Unix socket path.\n"
       "     --nat-local             Access a local service via a forwarded port\n"
       "                             on the fwknopd server system.\n"
       "     --nat-port              Specify the port to forward to access a\n"
@@ -41,7 +41,10 @@
 /* Function Prototypes
 */
 void config_init(fko_cli_options_t *options, int argc, char **argv);
+void config_init_target(fko_cli_options_t *options, int argc, char **argv,
+        const char *target);
 void usage(void);
+void rc_cache_free(void);
 
 #ifdef HAVE_C_UNIT_TESTS
 int register_ts_config_init(void);
@@ -36,6 +36,13 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 
+#ifndef WIN32
+  #include <sys/socket.h>
+  #include <sys/un.h>
+  #include <poll.h>
+  #include <signal.h>
+#endif
+
 
 /* prototypes
 */
@@ -54,8 +61,10 @@ static int set_nat_access(fko_ctx_t ctx, fko_cli_options_t *options,
 static int set_access_buf(fko_ctx_t ctx, fko_cli_options_t *options,
         char *access_buf);
 static int get_rand_port(fko_ctx_t ctx);
-int resolve_ip_https(fko_cli_options_t *options);
-int resolve_ip_http(fko_cli_options_t *options);
+static int set_spa_ctx_options(fko_ctx_t ctx, fko_cli_options_t *options);
+static int run_fanout(fko_cli_options_t *options, int argc, char **argv);
+static int run_agent(fko_cli_options_t *options, int argc, char **argv);
+int resolve_ip(fko_cli_options_t *options);
 static pid_t run_sdp_ctrl_client(fko_cli_options_t *options);
 static void clean_exit(fko_ctx_t ctx, fko_cli_options_t *opts,
     char *key, int *key_len, char *hmac_key, int *hmac_key_len,
@@ -79,6 +88,45 @@ static int enable_fault_injections(fko_cli_options_t * const opts);
 #define HOSTNAME_BUFSIZE            64                  /*!< Maximum size of a hostname string */
 #define CTX_DUMP_BUFSIZE            4096                /*!< Maximum size allocated to a FKO context dump */
 
+/* A ready-to-send SPA packet kept by --agent mode
+*/
+typedef struct agent_packet
+{
+    fko_ctx_t       ctx;
+    time_t          created;
+    unsigned int    dst_port;
+    unsigned int    src_port;
+} agent_packet_t;
+
+/* State for each target in --fanout (and --agent) mode
+*/
+typedef struct fanout_target
+{
+    fko_cli_options_t   options;
+    fko_ctx_t           ctx;
+    char                key[MAX_KEY_LEN+1];
+    char                hmac_key[MAX_KEY_LEN+1];
+    int                 key_len;
+    int                 hmac_key_len;
+    int                 have_keys;
+    agent_packet_t      pool[AGENT_POOL_SIZE];
+    int                 pool_len;
+    time_t              retry_at;
+} fanout_target_t;
+
+static void free_fanout_targets(fanout_target_t *targets, const int count);
+
+#ifndef WIN32
+/* A local tool connected to the --agent socket
+*/
+typedef struct agent_client
+{
+    int     fd;
+    int     len;
+    char    buf[AGENT_MAX_REQUEST_LEN];
+} agent_client_t;
+#endif
+
 /**
  * @brief Check whether a string is an ipv6 address or not
  *
@@ -161,7 +209,6 @@ main(int argc, char **argv)
     fko_ctx_t           ctx2 = NULL;
     int                 res;
     char               *spa_data=NULL, *version=NULL;
-    char                access_buf[MAX_LINE_LEN] = {0};
     char                key[MAX_KEY_LEN+1]       = {0};
     char                hmac_key[MAX_KEY_LEN+1]  = {0};
     int                 key_len = 0, orig_key_len = 0, hmac_key_len = 0, enc_mode;
@@ -223,267 +270,24 @@ main(int argc, char **argv)
             hmac_key, &hmac_key_len, EXIT_SUCCESS);
     }
 
-    /* Set client timeout
+    /* Serve knocks for the --fanout targets until told to stop
     */
-    if(options.fw_timeout >= 0)
-    {
-        res = fko_set_spa_client_timeout(ctx, options.fw_timeout);
-        if(res != FKO_SUCCESS)
-        {
-            errmsg("fko_set_spa_client_timeout", res);
-            clean_exit(ctx, &options, key, &key_len,
-                hmac_key, &hmac_key_len, EXIT_FAILURE);
-        }
-    }
+    if(options.agent_socket[0] != 0x0)
+        clean_exit(ctx, &options, key, &key_len, hmac_key, &hmac_key_len,
+            run_agent(&options, argc, argv) ? EXIT_SUCCESS : EXIT_FAILURE);
 
-    /* Set the SPA packet message type based on command line options
+    /* Knock all of the --fanout targets and exit.  The SDP control client
+     * is not started in this mode.
     */
-    res = set_message_type(ctx, &options);
-    if(res != FKO_SUCCESS)
-    {
-        errmsg("fko_set_spa_message_type", res);
-        clean_exit(ctx, &options, key, &key_len,
-            hmac_key, &hmac_key_len, EXIT_FAILURE);
-    }
+    if(options.fanout_list[0] != 0x0)
+        clean_exit(ctx, &options, key, &key_len, hmac_key, &hmac_key_len,
+            run_fanout(&options, argc, argv) ? EXIT_SUCCESS : EXIT_FAILURE);
 
-    /* Adjust the SPA timestamp if necessary
+    /* Set the SPA message, encryption and digest details
     */
-    if(options.time_offset_plus > 0)
-    {
-        res = fko_set_timestamp(ctx, options.time_offset_plus);
-        if(res != FKO_SUCCESS)
-        {
-            errmsg("fko_set_timestamp", res);
-            clean_exit(ctx, &options, key, &key_len,
-                hmac_key, &hmac_key_len, EXIT_FAILURE);
-        }
-    }
-    if(options.time_offset_minus > 0)
-    {
-        res = fko_set_timestamp(ctx, -options.time_offset_minus);
-        if(res != FKO_SUCCESS)
-        {
-            errmsg("fko_set_timestamp", res);
-            clean_exit(ctx, &options, key, &key_len,
-                hmac_key, &hmac_key_len, EXIT_FAILURE);
-        }
-    }
-
-    if(options.server_command[0] != 0x0)
-    {
-        /* Set the access message to a command that the server will
-         * execute
-        */
-        snprintf(access_buf, MAX_LINE_LEN, "%s%s%s",
-                options.allow_ip_str, ",", options.server_command);
-    }
-    else
-    {
-        /* Resolve the client's public facing IP address if requestesd.
-         * if this fails, consider it fatal.
-        */
-        if (options.resolve_ip_http_https)
-        {
-            if(options.resolve_http_only)
-            {
-                if(resolve_ip_http(&options) < 0)
-                {
-                    clean_exit(ctx, &options, key, &key_len,
-                        hmac_key, &hmac_key_len, EXIT_FAILURE);
-                }
-            }
-            else
-            {
-                /* Default to HTTPS */
-                if(resolve_ip_https(&options) < 0)
-                {
-                    clean_exit(ctx, &options, key, &key_len,
-                        hmac_key, &hmac_key_len, EXIT_FAILURE);
-                }
-            }
-        }
-
-       /* Set a message string by combining the allow IP and either
-        * service IDs or port/protocol.  The fwknopd server allows no
-        * service or port/protocol to be specified as well, so in this
-        * case append the string "none/0" to the allow IP.
-        */
-        if(set_access_buf(ctx, &options, access_buf) != 1)
-            clean_exit(ctx, &options, key, &key_len,
-                    hmac_key, &hmac_key_len, EXIT_FAILURE);
-    }
-
-    log_msg(LOG_VERBOSITY_DEBUG, "fwknop main() : calling fko_set_spa_message...");
-    res = fko_set_spa_message(ctx, access_buf);
-    if(res != FKO_SUCCESS)
-    {
-        errmsg("fko_set_spa_message", res);
+    if(set_spa_ctx_options(ctx, &options) != 1)
         clean_exit(ctx, &options, key, &key_len,
-            hmac_key, &hmac_key_len, EXIT_FAILURE);
-    }
-    log_msg(LOG_VERBOSITY_DEBUG, "fwknop main() : returned from fko_set_spa_message");
-
-    /* Set NAT access string if service IDs were not requested
-    */
-    if (options.service_ids_str[0] == 0x0 &&
-       (options.nat_local || options.nat_access_str[0] != 0x0))
-    {
-        log_msg(LOG_VERBOSITY_DEBUG, "fwknop main() : calling set_nat_access...");
-        res = set_nat_access(ctx, &options, access_buf);
-        if(res != FKO_SUCCESS)
-        {
-            errmsg("fko_set_nat_access_str", res);
-            clean_exit(ctx, &options, key, &key_len,
-                    hmac_key, &hmac_key_len, EXIT_FAILURE);
-        }
-        log_msg(LOG_VERBOSITY_DEBUG, "fwknop main() : returned from set_nat_access");
-    }
-
-    /* Set username
-    */
-    if(options.spoof_user[0] != 0x0)
-    {
-        res = fko_set_username(ctx, options.spoof_user);
-        if(res != FKO_SUCCESS)
-        {
-            errmsg("fko_set_username", res);
-            clean_exit(ctx, &options, key, &key_len,
-                    hmac_key, &hmac_key_len, EXIT_FAILURE);
-        }
-    }
-
-    /* Set SDP mode on or off
-     */
-    log_msg(LOG_VERBOSITY_DEBUG, "fwknop main() : checking option disable_sdp_mode...");
-    if(options.disable_sdp_mode)
-    {
-        log_msg(LOG_VERBOSITY_DEBUG, "fwknop main() : calling fko_set_disable_sdp_mode...");
-        res = fko_set_disable_sdp_mode(ctx, options.disable_sdp_mode);
-        if(res != FKO_SUCCESS)
-        {
-            errmsg("fko_set_disable_sdp_mode", res);
-            clean_exit(ctx, &options, key, &key_len,
-                    hmac_key, &hmac_key_len, EXIT_FAILURE);
-        }
-        log_msg(LOG_VERBOSITY_DEBUG, "fwknop main() : returned from fko_set_disable_sdp_mode");
-    }
-    else
-    {
-        res = fko_set_sdp_id(ctx, options.sdp_id);
-        if(res != FKO_SUCCESS)
-        {
-            errmsg("fko_set_sdp_id", res);
-            clean_exit(ctx, &options, key, &key_len,
-                    hmac_key, &hmac_key_len, EXIT_FAILURE);
-        }
-    }
-    log_msg(LOG_VERBOSITY_DEBUG, "fwknop main() : finished checking option disable_sdp_mode");
-
-    /* Set up for using GPG if specified.
-    */
-    if(options.use_gpg)
-    {
-        /* If use-gpg-agent was not specified, then remove the GPG_AGENT_INFO
-         * ENV variable if it exists.
-        */
-#ifndef WIN32
-        if(!options.use_gpg_agent)
-            unsetenv("GPG_AGENT_INFO");
-#endif
-
-        res = fko_set_spa_encryption_type(ctx, FKO_ENCRYPTION_GPG);
-        if(res != FKO_SUCCESS)
-        {
-            errmsg("fko_set_spa_encryption_type", res);
-            clean_exit(ctx, &options, key, &key_len,
-                    hmac_key, &hmac_key_len, EXIT_FAILURE);
-        }
-
-        /* Set gpg path if necessary
-        */
-        if(strlen(options.gpg_exe) > 0)
-        {
-            res = fko_set_gpg_exe(ctx, options.gpg_exe);
-            if(res != FKO_SUCCESS)
-            {
-                errmsg("fko_set_gpg_exe", res);
-                clean_exit(ctx, &options, key, &key_len,
-                        hmac_key, &hmac_key_len, EXIT_FAILURE);
-            }
-        }
-
-        /* If a GPG home dir was specified, set it here.  Note: Setting
-         * this has to occur before calling any of the other GPG-related
-         * functions.
-        */
-        if(strlen(options.gpg_home_dir) > 0)
-        {
-            res = fko_set_gpg_home_dir(ctx, options.gpg_home_dir);
-            if(res != FKO_SUCCESS)
-            {
-                errmsg("fko_set_gpg_home_dir", res);
-                clean_exit(ctx, &options, key, &key_len,
-                        hmac_key, &hmac_key_len, EXIT_FAILURE);
-            }
-        }
-
-        res = fko_set_gpg_recipient(ctx, options.gpg_recipient_key);
-        if(res != FKO_SUCCESS)
-        {
-            errmsg("fko_set_gpg_recipient", res);
-
-            if(IS_GPG_ERROR(res))
-                log_msg(LOG_VERBOSITY_ERROR, "GPG ERR: %s", fko_gpg_errstr(ctx));
-            clean_exit(ctx, &options, key, &key_len,
-                    hmac_key, &hmac_key_len, EXIT_FAILURE);
-        }
-
-        if(strlen(options.gpg_signer_key) > 0)
-        {
-            res = fko_set_gpg_signer(ctx, options.gpg_signer_key);
-            if(res != FKO_SUCCESS)
-            {
-                errmsg("fko_set_gpg_signer", res);
-
-                if(IS_GPG_ERROR(res))
-                    log_msg(LOG_VERBOSITY_ERROR, "GPG ERR: %s", fko_gpg_errstr(ctx));
-                clean_exit(ctx, &options, key, &key_len,
-                        hmac_key, &hmac_key_len, EXIT_FAILURE);
-            }
-        }
-
-        res = fko_set_spa_encryption_mode(ctx, FKO_ENC_MODE_ASYMMETRIC);
-        if(res != FKO_SUCCESS)
-        {
-            errmsg("fko_set_spa_encryption_mode", res);
-            clean_exit(ctx, &options, key, &key_len,
-                    hmac_key, &hmac_key_len, EXIT_FAILURE);
-        }
-    }
-
-    if(options.encryption_mode && !options.use_gpg)
-    {
-        res = fko_set_spa_encryption_mode(ctx, options.encryption_mode);
-        if(res != FKO_SUCCESS)
-        {
-            errmsg("fko_set_spa_encryption_mode", res);
-            clean_exit(ctx, &options, key, &key_len,
-                    hmac_key, &hmac_key_len, EXIT_FAILURE);
-        }
-    }
-
-    /* Set Digest type.
-    */
-    if(options.digest_type)
-    {
-        res = fko_set_spa_digest_type(ctx, options.digest_type);
-        if(res != FKO_SUCCESS)
-        {
-            errmsg("fko_set_spa_digest_type", res);
-            clean_exit(ctx, &options, key, &key_len,
-                    hmac_key, &hmac_key_len, EXIT_FAILURE);
-        }
-    }
+                hmac_key, &hmac_key_len, EXIT_FAILURE);
 
     /* Acquire the necessary encryption/hmac keys
     */
@@ -1211,37 +1015,281 @@ set_message_type(fko_ctx_t ctx, fko_cli_options_t *options)
     return fko_set_spa_message_type(ctx, message_type);
 }
 
-/* Prompt for and receive a user password.
+/* Set everything in the context that comes before the keys: the message
+ * type and access string, NAT and username details, SDP mode, and the
+ * encryption and digest settings.
 */
 static int
-get_keys(fko_ctx_t ctx, fko_cli_options_t *options,
-    char *key, int *key_len, char *hmac_key, int *hmac_key_len)
+set_spa_ctx_options(fko_ctx_t ctx, fko_cli_options_t *options)
 {
-#if !AFL_FUZZING
-    char   *key_tmp = NULL, *hmac_key_tmp = NULL;
-#endif
-    int     use_hmac = 0, res = 0;
+    char    access_buf[MAX_LINE_LEN] = {0};
+    int     res;
 
-    memset(key, 0x0, MAX_KEY_LEN+1);
-    memset(hmac_key, 0x0, MAX_KEY_LEN+1);
+    /* Set client timeout
+    */
+    if(options->fw_timeout >= 0)
+    {
+        res = fko_set_spa_client_timeout(ctx, options->fw_timeout);
+        if(res != FKO_SUCCESS)
+        {
+            errmsg("fko_set_spa_client_timeout", res);
+            return 0;
+        }
+    }
 
-    if(options->have_key)
+    /* Set the SPA packet message type based on command line options
+    */
+    res = set_message_type(ctx, options);
+    if(res != FKO_SUCCESS)
     {
-        strlcpy(key, options->key, MAX_KEY_LEN+1);
-        *key_len = strlen(key);
+        errmsg("fko_set_spa_message_type", res);
+        return 0;
     }
-    else if(options->have_base64_key)
+
+    /* Adjust the SPA timestamp if necessary
+    */
+    if(options->time_offset_plus > 0)
     {
-        *key_len = fko_base64_decode(options->key_base64,
-                (unsigned char *) options->key);
-        if(*key_len > 0 && *key_len < MAX_KEY_LEN)
-        {
-            memcpy(key, options->key, *key_len);
-        }
-        else
+        res = fko_set_timestamp(ctx, options->time_offset_plus);
+        if(res != FKO_SUCCESS)
         {
-            log_msg(LOG_VERBOSITY_ERROR, "[*] Invalid key length: '%d', must be in [1,%d]",
-                    *key_len, MAX_KEY_LEN);
+            errmsg("fko_set_timestamp", res);
+            return 0;
+        }
+    }
+    if(options->time_offset_minus > 0)
+    {
+        res = fko_set_timestamp(ctx, -options->time_offset_minus);
+        if(res != FKO_SUCCESS)
+        {
+            errmsg("fko_set_timestamp", res);
+            return 0;
+        }
+    }
+
+    if(options->server_command[0] != 0x0)
+    {
+        /* Set the access message to a command that the server will
+         * execute
+        */
+        snprintf(access_buf, MAX_LINE_LEN, "%s%s%s",
+                options->allow_ip_str, ",", options->server_command);
+    }
+    else
+    {
+        /* Resolve the client's public facing IP address if requestesd.
+         * if this fails, consider it fatal.
+        */
+        if (options->resolve_ip_http_https)
+        {
+            if(resolve_ip(options) < 0)
+            {
+                return 0;
+            }
+        }
+
+       /* Set a message string by combining the allow IP and either
+        * service IDs or port/protocol.  The fwknopd server allows no
+        * service or port/protocol to be specified as well, so in this
+        * case append the string "none/0" to the allow IP.
+        */
+        if(set_access_buf(ctx, options, access_buf) != 1)
+            return 0;
+    }
+
+    log_msg(LOG_VERBOSITY_DEBUG, "fwknop main() : calling fko_set_spa_message...");
+    res = fko_set_spa_message(ctx, access_buf);
+    if(res != FKO_SUCCESS)
+    {
+        errmsg("fko_set_spa_message", res);
+        return 0;
+    }
+    log_msg(LOG_VERBOSITY_DEBUG, "fwknop main() : returned from fko_set_spa_message");
+
+    /* Set NAT access string if service IDs were not requested
+    */
+    if (options->service_ids_str[0] == 0x0 &&
+       (options->nat_local || options->nat_access_str[0] != 0x0))
+    {
+        log_msg(LOG_VERBOSITY_DEBUG, "fwknop main() : calling set_nat_access...");
+        res = set_nat_access(ctx, options, access_buf);
+        if(res != FKO_SUCCESS)
+        {
+            errmsg("fko_set_nat_access_str", res);
+            return 0;
+        }
+        log_msg(LOG_VERBOSITY_DEBUG, "fwknop main() : returned from set_nat_access");
+    }
+
+    /* Set username
+    */
+    if(options->spoof_user[0] != 0x0)
+    {
+        res = fko_set_username(ctx, options->spoof_user);
+        if(res != FKO_SUCCESS)
+        {
+            errmsg("fko_set_username", res);
+            return 0;
+        }
+    }
+
+    /* Set SDP mode on or off
+     */
+    log_msg(LOG_VERBOSITY_DEBUG, "fwknop main() : checking option disable_sdp_mode...");
+    if(options->disable_sdp_mode)
+    {
+        log_msg(LOG_VERBOSITY_DEBUG, "fwknop main() : calling fko_set_disable_sdp_mode...");
+        res = fko_set_disable_sdp_mode(ctx, options->disable_sdp_mode);
+        if(res != FKO_SUCCESS)
+        {
+            errmsg("fko_set_disable_sdp_mode", res);
+            return 0;
+        }
+        log_msg(LOG_VERBOSITY_DEBUG, "fwknop main() : returned from fko_set_disable_sdp_mode");
+    }
+    else
+    {
+        res = fko_set_sdp_id(ctx, options->sdp_id);
+        if(res != FKO_SUCCESS)
+        {
+            errmsg("fko_set_sdp_id", res);
+            return 0;
+        }
+    }
+    log_msg(LOG_VERBOSITY_DEBUG, "fwknop main() : finished checking option disable_sdp_mode");
+
+    /* Set up for using GPG if specified.
+    */
+    if(options->use_gpg)
+    {
+        /* If use-gpg-agent was not specified, then remove the GPG_AGENT_INFO
+         * ENV variable if it exists.
+        */
+#ifndef WIN32
+        if(!options->use_gpg_agent)
+            unsetenv("GPG_AGENT_INFO");
+#endif
+
+        res = fko_set_spa_encryption_type(ctx, FKO_ENCRYPTION_GPG);
+        if(res != FKO_SUCCESS)
+        {
+            errmsg("fko_set_spa_encryption_type", res);
+            return 0;
+        }
+
+        /* Set gpg path if necessary
+        */
+        if(strlen(options->gpg_exe) > 0)
+        {
+            res = fko_set_gpg_exe(ctx, options->gpg_exe);
+            if(res != FKO_SUCCESS)
+            {
+                errmsg("fko_set_gpg_exe", res);
+                return 0;
+            }
+        }
+
+        /* If a GPG home dir was specified, set it here.  Note: Setting
+         * this has to occur before calling any of the other GPG-related
+         * functions.
+        */
+        if(strlen(options->gpg_home_dir) > 0)
+        {
+            res = fko_set_gpg_home_dir(ctx, options->gpg_home_dir);
+            if(res != FKO_SUCCESS)
+            {
+                errmsg("fko_set_gpg_home_dir", res);
+                return 0;
+            }
+        }
+
+        res = fko_set_gpg_recipient(ctx, options->gpg_recipient_key);
+        if(res != FKO_SUCCESS)
+        {
+            errmsg("fko_set_gpg_recipient", res);
+
+            if(IS_GPG_ERROR(res))
+                log_msg(LOG_VERBOSITY_ERROR, "GPG ERR: %s", fko_gpg_errstr(ctx));
+            return 0;
+        }
+
+        if(strlen(options->gpg_signer_key) > 0)
+        {
+            res = fko_set_gpg_signer(ctx, options->gpg_signer_key);
+            if(res != FKO_SUCCESS)
+            {
+                errmsg("fko_set_gpg_signer", res);
+
+                if(IS_GPG_ERROR(res))
+                    log_msg(LOG_VERBOSITY_ERROR, "GPG ERR: %s", fko_gpg_errstr(ctx));
+                return 0;
+            }
+        }
+
+        res = fko_set_spa_encryption_mode(ctx, FKO_ENC_MODE_ASYMMETRIC);
+        if(res != FKO_SUCCESS)
+        {
+            errmsg("fko_set_spa_encryption_mode", res);
+            return 0;
+        }
+    }
+
+    if(options->encryption_mode && !options->use_gpg)
+    {
+        res = fko_set_spa_encryption_mode(ctx, options->encryption_mode);
+        if(res != FKO_SUCCESS)
+        {
+            errmsg("fko_set_spa_encryption_mode", res);
+            return 0;
+        }
+    }
+
+    /* Set Digest type.
+    */
+    if(options->digest_type)
+    {
+        res = fko_set_spa_digest_type(ctx, options->digest_type);
+        if(res != FKO_SUCCESS)
+        {
+            errmsg("fko_set_spa_digest_type", res);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/* Prompt for and receive a user password.
+*/
+static int
+get_keys(fko_ctx_t ctx, fko_cli_options_t *options,
+    char *key, int *key_len, char *hmac_key, int *hmac_key_len)
+{
+#if !AFL_FUZZING
+    char   *key_tmp = NULL, *hmac_key_tmp = NULL;
+#endif
+    int     use_hmac = 0, res = 0;
+
+    memset(key, 0x0, MAX_KEY_LEN+1);
+    memset(hmac_key, 0x0, MAX_KEY_LEN+1);
+
+    if(options->have_key)
+    {
+        strlcpy(key, options->key, MAX_KEY_LEN+1);
+        *key_len = strlen(key);
+    }
+    else if(options->have_base64_key)
+    {
+        *key_len = fko_base64_decode(options->key_base64,
+                (unsigned char *) options->key);
+        if(*key_len > 0 && *key_len < MAX_KEY_LEN)
+        {
+            memcpy(key, options->key, *key_len);
+        }
+        else
+        {
+            log_msg(LOG_VERBOSITY_ERROR, "[*] Invalid key length: '%d', must be in [1,%d]",
+                    *key_len, MAX_KEY_LEN);
             return 0;
         }
     }
@@ -1380,6 +1428,993 @@ get_keys(fko_ctx_t ctx, fko_cli_options_t *options,
     return 1;
 }
 
+/* Whether two fan-out targets get their keys from the same place, in which
+ * case the keys acquired for the first can be reused for the second.
+*/
+static int
+same_key_source(const fko_cli_options_t *a, const fko_cli_options_t *b)
+{
+    if(a->have_key != b->have_key
+            || a->have_base64_key != b->have_base64_key
+            || a->have_hmac_key != b->have_hmac_key
+            || a->have_hmac_base64_key != b->have_hmac_base64_key
+            || a->use_hmac != b->use_hmac
+            || a->hmac_type != b->hmac_type
+            || a->use_gpg != b->use_gpg
+            || a->use_gpg_agent != b->use_gpg_agent
+            || a->gpg_no_signing_pw != b->gpg_no_signing_pw)
+        return 0;
+
+    if(a->have_key)
+    {
+        if(strcmp(a->key, b->key) != 0)
+            return 0;
+    }
+    else if(a->have_base64_key)
+    {
+        if(strcmp(a->key_base64, b->key_base64) != 0)
+            return 0;
+    }
+    else if(strcmp(a->get_key_file, b->get_key_file) != 0
+            || strcmp(a->gpg_signer_key, b->gpg_signer_key) != 0)
+        return 0;
+
+    /* Key files hold one entry per SPA server
+    */
+    if((a->get_key_file[0] != 0x0 || a->get_hmac_key_file[0] != 0x0)
+            && strcmp(a->spa_server_str, b->spa_server_str) != 0)
+        return 0;
+
+    if(a->have_hmac_key)
+    {
+        if(strcmp(a->hmac_key, b->hmac_key) != 0)
+            return 0;
+    }
+    else if(a->have_hmac_base64_key)
+    {
+        if(strcmp(a->hmac_key_base64, b->hmac_key_base64) != 0)
+            return 0;
+    }
+    else if(a->use_hmac
+            && strcmp(a->get_hmac_key_file, b->get_hmac_key_file) != 0)
+        return 0;
+
+    return 1;
+}
+
+/* Acquire the keys for a fan-out target, reusing its own keys when its
+ * packet is rebuilt (agent mode) or those of an earlier target with the
+ * same key source, so that each key is prompted for (or read from its file)
+ * only once.
+*/
+static int
+get_fanout_keys(fanout_target_t *targets, const int idx)
+{
+    fanout_target_t *t = &targets[idx];
+    int              i, res;
+
+    for(i=0; i <= idx; i++)
+    {
+        if(! targets[i].have_keys
+                || (i != idx && ! same_key_source(&targets[i].options, &t->options)))
+            continue;
+
+        if(i != idx)
+        {
+            memcpy(t->key, targets[i].key, sizeof(t->key));
+            memcpy(t->hmac_key, targets[i].hmac_key, sizeof(t->hmac_key));
+            t->key_len      = targets[i].key_len;
+            t->hmac_key_len = targets[i].hmac_key_len;
+            t->have_keys    = 1;
+        }
+
+        if(t->options.have_hmac_key || t->options.have_hmac_base64_key
+                || t->options.use_hmac)
+        {
+            res = fko_set_spa_hmac_type(t->ctx, t->options.hmac_type);
+            if(res != FKO_SUCCESS)
+            {
+                errmsg("fko_set_spa_hmac_type", res);
+                return 0;
+            }
+        }
+        return 1;
+    }
+
+    if(get_keys(t->ctx, &t->options, t->key, &t->key_len,
+                t->hmac_key, &t->hmac_key_len) != 1)
+        return 0;
+
+    t->have_keys = 1;
+    return 1;
+}
+
+/* Build the SPA packet for one fan-out target.  The client's public IP
+ * only needs to be resolved once for all targets, so it is kept in
+ * resolved_ip after the first target that asks for it (the agent looks
+ * it up again in agent_resolve_ip()).
+*/
+static int
+build_fanout_target(fanout_target_t *targets, const int idx,
+        char *resolved_ip, int *saved_packet)
+{
+    fanout_target_t *t = &targets[idx];
+    char             dump_buf[CTX_DUMP_BUFSIZE];
+    int              res, key_len, tmp_port, resolving = 0;
+
+    res = fko_new(&t->ctx);
+    if(res != FKO_SUCCESS)
+    {
+        errmsg("fko_new", res);
+        return 0;
+    }
+
+    if(t->options.resolve_ip_http_https && t->options.server_command[0] == 0x0)
+    {
+        if(resolved_ip[0] != 0x0)
+        {
+            strlcpy(t->options.allow_ip_str, resolved_ip,
+                    sizeof(t->options.allow_ip_str));
+            resolving = -1;
+        }
+        else
+            resolving = 1;
+    }
+
+    /* Skip the lookup for an IP that is already known, but leave the
+     * target asking for -R
+    */
+    if(resolving < 0)
+        t->options.resolve_ip_http_https = 0;
+
+    res = set_spa_ctx_options(t->ctx, &t->options);
+
+    if(resolving < 0)
+        t->options.resolve_ip_http_https = 1;
+
+    if(res != 1)
+        return 0;
+
+    if(resolving > 0)
+        strlcpy(resolved_ip, t->options.allow_ip_str, MAX_IPV4_STR_LEN);
+
+    if(get_fanout_keys(targets, idx) != 1)
+        return 0;
+
+    key_len = t->key_len;
+    if(t->options.encryption_mode == FKO_ENC_MODE_CBC_LEGACY_IV
+            && key_len > 16)
+    {
+        log_msg(LOG_VERBOSITY_ERROR,
+                "WARNING: Encryption key in '-M legacy' mode must be <= 16 bytes long - truncating.");
+        key_len = 16;
+    }
+
+    res = fko_spa_data_final(t->ctx, t->key, key_len,
+            t->hmac_key, t->hmac_key_len);
+    if(res != FKO_SUCCESS)
+    {
+        errmsg("fko_spa_data_final", res);
+
+        if(IS_GPG_ERROR(res))
+            log_msg(LOG_VERBOSITY_ERROR, "GPG ERR: %s", fko_gpg_errstr(t->ctx));
+        return 0;
+    }
+
+    if (t->options.verbose || t->options.test)
+    {
+        res = dump_ctx_to_buffer(t->ctx, dump_buf, sizeof(dump_buf));
+        if (res == FKO_SUCCESS)
+            log_msg(LOG_VERBOSITY_NORMAL, "%s", dump_buf);
+        else
+            log_msg(LOG_VERBOSITY_WARNING, "Unable to dump FKO context: %s",
+                    fko_errstr(res));
+    }
+
+    /* All targets go to the same save file
+    */
+    if (t->options.save_packet_file[0] != 0x0)
+    {
+        if(*saved_packet)
+            t->options.save_packet_file_append = 1;
+        write_spa_packet_data(t->ctx, &t->options);
+        *saved_packet = 1;
+    }
+
+    if (t->options.rand_port)
+    {
+        if((tmp_port = get_rand_port(t->ctx)) < 0)
+            return 0;
+        t->options.spa_dst_port = tmp_port;
+    }
+
+    if ((t->options.spa_proto == FKO_PROTO_TCP_RAW
+            || t->options.spa_proto == FKO_PROTO_UDP_RAW
+            || t->options.spa_proto == FKO_PROTO_ICMP)
+            && !t->options.spa_src_port)
+    {
+        if((tmp_port = get_rand_port(t->ctx)) < 0)
+            return 0;
+        t->options.spa_src_port = tmp_port;
+    }
+
+    return 1;
+}
+
+/* Split the --fanout list (copied into list) into target names.  Returns
+ * the number of targets, or 0 if there are none or too many.
+*/
+static int
+parse_fanout_list(const char *fanout_list, char *list, char **names)
+{
+    char   *target, *next;
+    int     count = 0;
+
+    strlcpy(list, fanout_list, MAX_LINE_LEN);
+
+    for(target = list; target != NULL; target = next)
+    {
+        if((next = strchr(target, ',')) != NULL)
+            *next++ = 0x0;
+
+        if(*target == 0x0)
+            continue;
+
+        if(count == MAX_FANOUT_TARGETS)
+        {
+            log_msg(LOG_VERBOSITY_ERROR,
+                "[*] Too many --fanout targets, the maximum is %d",
+                MAX_FANOUT_TARGETS);
+            return 0;
+        }
+        names[count++] = target;
+    }
+
+    if(count == 0)
+        log_msg(LOG_VERBOSITY_ERROR, "[*] No --fanout targets given");
+
+    return count;
+}
+
+/* Knock every target in the --fanout list from this one invocation: build
+ * all of the SPA packets first, send them together, and then report the
+ * result for each target.  Returns 1 if every packet was sent.
+*/
+static int
+run_fanout(fko_cli_options_t *options, int argc, char **argv)
+{
+    fanout_target_t    *targets = NULL;
+    fko_ctx_t           ctx_list[MAX_FANOUT_TARGETS];
+    fko_cli_options_t  *opts_list[MAX_FANOUT_TARGETS];
+    int                 res_list[MAX_FANOUT_TARGETS];
+    int                 built_idx[MAX_FANOUT_TARGETS];
+    char               *names[MAX_FANOUT_TARGETS];
+    char                list[MAX_LINE_LEN] = {0};
+    char                resolved_ip[MAX_IPV4_STR_LEN] = {0};
+    int                 count, built = 0, sent = 0, saved_packet = 0, i;
+
+    if((count = parse_fanout_list(options->fanout_list, list, names)) == 0)
+        return 0;
+
+    if((targets = calloc(count, sizeof(fanout_target_t))) == NULL)
+    {
+        log_msg(LOG_VERBOSITY_ERROR, "[*] Memory allocation error.");
+        return 0;
+    }
+
+    for(i=0; i < count; i++)
+    {
+        config_init_target(&targets[i].options, argc, argv, names[i]);
+
+        if(build_fanout_target(targets, i, resolved_ip, &saved_packet) != 1)
+        {
+            log_msg(LOG_VERBOSITY_ERROR,
+                "[*] %s: SPA packet not built.", names[i]);
+            continue;
+        }
+        ctx_list[built]  = targets[i].ctx;
+        opts_list[built] = &targets[i].options;
+        built_idx[built] = i;
+        built++;
+    }
+
+    if(built > 0)
+        sent = send_spa_packet_list(ctx_list, opts_list, res_list, built);
+
+    for(i=0; i < built; i++)
+    {
+        if(res_list[i] < 0)
+            log_msg(LOG_VERBOSITY_ERROR, "[*] %s (%s): packet not sent.",
+                names[built_idx[i]], opts_list[i]->spa_server_str);
+        else
+            log_msg(LOG_VERBOSITY_NORMAL, "[+] %s (%s): bytes sent: %i",
+                names[built_idx[i]], opts_list[i]->spa_server_str, res_list[i]);
+    }
+
+    log_msg(LOG_VERBOSITY_NORMAL, "[+] SPA packets sent to %d of %d targets.",
+            sent, count);
+
+    free_fanout_targets(targets, count);
+
+    return sent == count;
+}
+
+/* Release everything held for the fan-out (or agent) targets
+*/
+static void
+free_fanout_targets(fanout_target_t *targets, const int count)
+{
+    int     i, j;
+
+    for(i=0; i < count; i++)
+    {
+        if(fko_destroy(targets[i].ctx) == FKO_ERROR_ZERO_OUT_DATA)
+            log_msg(LOG_VERBOSITY_ERROR,
+                    "[*] Could not zero out sensitive data buffer.");
+        for(j=0; j < targets[i].pool_len; j++)
+            if(fko_destroy(targets[i].pool[j].ctx) == FKO_ERROR_ZERO_OUT_DATA)
+                log_msg(LOG_VERBOSITY_ERROR,
+                        "[*] Could not zero out sensitive data buffer.");
+        free_configs(&targets[i].options);
+        zero_buf_wrapper(targets[i].key, targets[i].key_len);
+        zero_buf_wrapper(targets[i].hmac_key, targets[i].hmac_key_len);
+    }
+    free(targets);
+}
+
+#ifndef WIN32
+static volatile sig_atomic_t agent_stop = 0;
+
+static void
+agent_sig_handler(int sig)
+{
+    agent_stop = 1;
+}
+
+/* Build one more ready-to-send packet for an agent target
+*/
+static int
+agent_build_packet(fanout_target_t *targets, const int idx, char *resolved_ip)
+{
+    fanout_target_t *t = &targets[idx];
+    agent_packet_t  *pkt;
+    int              saved_packet = 1;
+
+    if(build_fanout_target(targets, idx, resolved_ip, &saved_packet) != 1)
+    {
+        if(fko_destroy(t->ctx) == FKO_ERROR_ZERO_OUT_DATA)
+            log_msg(LOG_VERBOSITY_ERROR,
+                    "[*] Could not zero out sensitive data buffer.");
+        t->ctx = NULL;
+        return 0;
+    }
+
+    pkt = &t->pool[t->pool_len++];
+    pkt->ctx      = t->ctx;
+    pkt->created  = time(NULL);
+    pkt->dst_port = t->options.spa_dst_port;
+    pkt->src_port = t->options.spa_src_port;
+    t->ctx = NULL;
+
+    return 1;
+}
+
+static void
+agent_drop_packets(fanout_target_t *t)
+{
+    int     i;
+
+    for(i=0; i < t->pool_len; i++)
+        if(fko_destroy(t->pool[i].ctx) == FKO_ERROR_ZERO_OUT_DATA)
+            log_msg(LOG_VERBOSITY_ERROR,
+                    "[*] Could not zero out sensitive data buffer.");
+    t->pool_len = 0;
+}
+
+/* Look up the external IP for the -R targets again.  With a resolve cache
+ * this is done on every pass since resolve_ip() only goes to the network
+ * once the cached IP has expired or the network has changed, otherwise
+ * every AGENT_RESOLVE_INTERVAL seconds.  Packets built for an IP that is
+ * no longer ours are dropped.
+*/
+static void
+agent_resolve_ip(fanout_target_t *targets, const int count,
+        char *resolved_ip, time_t *resolve_at)
+{
+    fanout_target_t *t = NULL;
+    time_t           now = time(NULL);
+    int              i;
+
+    for(i=0; i < count; i++)
+    {
+        if(targets[i].options.resolve_ip_http_https
+                && targets[i].options.server_command[0] == 0x0)
+        {
+            t = &targets[i];
+            break;
+        }
+    }
+
+    if(t == NULL || now < *resolve_at)
+        return;
+
+    if(resolve_ip(&t->options) < 0)
+    {
+        log_msg(LOG_VERBOSITY_ERROR,
+            "[*] Could not resolve the external IP, retrying in %d seconds.",
+            AGENT_BUILD_RETRY);
+        *resolve_at = now + AGENT_BUILD_RETRY;
+        return;
+    }
+
+    *resolve_at = t->options.resolve_cache_ttl > 0
+        ? now : now + AGENT_RESOLVE_INTERVAL;
+
+    if(strcmp(resolved_ip, t->options.allow_ip_str) == 0)
+        return;
+
+    if(resolved_ip[0] != 0x0)
+    {
+        log_msg(LOG_VERBOSITY_NORMAL,
+            "[+] External IP changed from %s to %s, rebuilding SPA packets",
+            resolved_ip, t->options.allow_ip_str);
+
+        for(i=0; i < count; i++)
+            if(targets[i].options.resolve_ip_http_https
+                    && targets[i].options.server_command[0] == 0x0)
+                agent_drop_packets(&targets[i]);
+    }
+
+    strlcpy(resolved_ip, t->options.allow_ip_str, MAX_IPV4_STR_LEN);
+}
+
+/* Drop pooled packets whose timestamps are getting too old for fwknopd
+*/
+static void
+agent_expire_packets(fanout_target_t *t, const time_t now)
+{
+    while(t->pool_len > 0 && now - t->pool[0].created >= AGENT_MAX_PACKET_AGE)
+    {
+        if(fko_destroy(t->pool[0].ctx) == FKO_ERROR_ZERO_OUT_DATA)
+            log_msg(LOG_VERBOSITY_ERROR,
+                    "[*] Could not zero out sensitive data buffer.");
+        t->pool_len--;
+        memmove(&t->pool[0], &t->pool[1], t->pool_len * sizeof(agent_packet_t));
+    }
+}
+
+/* Replace expired packets and top up the pool of every agent target.  A
+ * target whose packet cannot be built is left alone for a while.
+*/
+static void
+agent_refill(fanout_target_t *targets, const int count, char *resolved_ip)
+{
+    fanout_target_t *t;
+    time_t           now = time(NULL);
+    int              i;
+
+    for(i=0; i < count; i++)
+    {
+        t = &targets[i];
+        agent_expire_packets(t, now);
+
+        if(now < t->retry_at)
+            continue;
+
+        while(t->pool_len < AGENT_POOL_SIZE)
+        {
+            if(agent_build_packet(targets, i, resolved_ip) != 1)
+            {
+                log_msg(LOG_VERBOSITY_ERROR,
+                    "[*] %s: SPA packet not built, retrying in %d seconds.",
+                    t->options.spa_server_str, AGENT_BUILD_RETRY);
+                t->retry_at = now + AGENT_BUILD_RETRY;
+                break;
+            }
+        }
+    }
+}
+
+/* Hand out the oldest usable packet of an agent target, building one on the
+ * spot if the pool is empty.  The caller owns the returned context.
+*/
+static fko_ctx_t
+agent_take_packet(fanout_target_t *targets, const int idx, char *resolved_ip)
+{
+    fanout_target_t *t = &targets[idx];
+    fko_ctx_t        ctx;
+
+    agent_expire_packets(t, time(NULL));
+
+    if(t->pool_len == 0 && agent_build_packet(targets, idx, resolved_ip) != 1)
+        return NULL;
+
+    ctx = t->pool[0].ctx;
+    t->options.spa_dst_port = t->pool[0].dst_port;
+    t->options.spa_src_port = t->pool[0].src_port;
+
+    t->pool_len--;
+    memmove(&t->pool[0], &t->pool[1], t->pool_len * sizeof(agent_packet_t));
+
+    return ctx;
+}
+
+/* Identity of the rc file as last read, so that keys written to it by the
+ * SDP control client (or by hand) are picked up while the agent runs
+*/
+typedef struct agent_rc_stat
+{
+    dev_t   dev;
+    ino_t   ino;
+    off_t   size;
+    time_t  mtime;
+    long    mtime_nsec;
+} agent_rc_stat_t;
+
+static int
+agent_rc_stat(const char *rc_file, agent_rc_stat_t *rc_st)
+{
+    struct stat     st;
+
+    memset(rc_st, 0x0, sizeof(*rc_st));
+
+    if(rc_file[0] == 0x0 || stat(rc_file, &st) != 0)
+        return 0;
+
+    rc_st->dev   = st.st_dev;
+    rc_st->ino   = st.st_ino;
+    rc_st->size  = st.st_size;
+    rc_st->mtime = st.st_mtime;
+#if HAVE_STRUCT_STAT_ST_MTIM
+    rc_st->mtime_nsec = st.st_mtim.tv_nsec;
+#endif
+    return 1;
+}
+
+/* Returns 1 if the rc file has changed since last was taken and has not
+ * been written to for a second (so a file still being rewritten is not
+ * read half way through), and updates last.
+*/
+static int
+agent_rc_changed(const char *rc_file, agent_rc_stat_t *last)
+{
+    agent_rc_stat_t     cur;
+
+    if(agent_rc_stat(rc_file, &cur) != 1
+            || memcmp(&cur, last, sizeof(cur)) == 0
+            || time(NULL) - cur.mtime < 1)
+        return 0;
+
+    memcpy(last, &cur, sizeof(cur));
+    return 1;
+}
+
+/* Whether the keys configured for a target are different in b
+*/
+static int
+agent_keys_changed(const fko_cli_options_t *a, const fko_cli_options_t *b)
+{
+    return a->have_key != b->have_key
+        || a->have_base64_key != b->have_base64_key
+        || a->have_hmac_key != b->have_hmac_key
+        || a->have_hmac_base64_key != b->have_hmac_base64_key
+        || a->use_hmac != b->use_hmac
+        || a->hmac_type != b->hmac_type
+        || strcmp(a->key, b->key) != 0
+        || strcmp(a->key_base64, b->key_base64) != 0
+        || strcmp(a->hmac_key, b->hmac_key) != 0
+        || strcmp(a->hmac_key_base64, b->hmac_key_base64) != 0
+        || strcmp(a->get_key_file, b->get_key_file) != 0
+        || strcmp(a->get_hmac_key_file, b->get_hmac_key_file) != 0;
+}
+
+/* Read the configuration of every target again after the rc file has
+ * changed.  A target whose keys are different gets the new configuration,
+ * and its keys and pooled packets are dropped so that the pool is rebuilt
+ * with the new keys.  Keys typed in at a prompt are not asked for again.
+*/
+static void
+agent_reload_keys(fanout_target_t *targets, char **names, const int count,
+        int argc, char **argv)
+{
+    fanout_target_t    *t;
+    fko_cli_options_t  *opts;
+    int                 i, reloaded = 0;
+
+    if((opts = calloc(1, sizeof(fko_cli_options_t))) == NULL)
+    {
+        log_msg(LOG_VERBOSITY_ERROR, "[*] Memory allocation error.");
+        return;
+    }
+
+    for(i=0; i < count; i++)
+    {
+        t = &targets[i];
+        config_init_target(opts, argc, argv, names[i]);
+
+        if(! agent_keys_changed(&t->options, opts))
+        {
+            free_configs(opts);
+            continue;
+        }
+
+        free_configs(&t->options);
+        memcpy(&t->options, opts, sizeof(fko_cli_options_t));
+
+        /* the target owns the allocated strings now, only clear the keys
+        */
+        opts->resolve_url = NULL;
+        opts->wget_bin    = NULL;
+        free_configs(opts);
+
+        agent_drop_packets(t);
+
+        zero_buf_wrapper(t->key, t->key_len);
+        zero_buf_wrapper(t->hmac_key, t->hmac_key_len);
+        t->key_len      = 0;
+        t->hmac_key_len = 0;
+        t->have_keys    = 0;
+        t->retry_at     = 0;
+        reloaded++;
+    }
+
+    free(opts);
+
+    if(reloaded > 0)
+        log_msg(LOG_VERBOSITY_NORMAL,
+                "[+] Keys changed for %d target(s), rebuilding their SPA packets",
+                reloaded);
+}
+
+/* Make way for the agent socket.  A socket left behind by an agent that
+ * did not shut down cleanly is removed, but not a path that is something
+ * else, or a socket another agent is still listening on.  Returns 1 if
+ * the path is free to bind.
+*/
+static int
+agent_remove_stale_socket(const struct sockaddr_un *addr)
+{
+    struct stat     st;
+    int             fd, rv;
+
+    if(lstat(addr->sun_path, &st) != 0)
+    {
+        if(errno == ENOENT)
+            return 1;
+        log_msg(LOG_VERBOSITY_ERROR, "[*] Could not stat %s: %s",
+                addr->sun_path, strerror(errno));
+        return 0;
+    }
+
+    if(! S_ISSOCK(st.st_mode))
+    {
+        log_msg(LOG_VERBOSITY_ERROR,
+                "[*] %s exists and is not a socket, not removing it",
+                addr->sun_path);
+        return 0;
+    }
+
+    if((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+    {
+        log_msg(LOG_VERBOSITY_ERROR, "[*] Could not create agent socket: %s",
+                strerror(errno));
+        return 0;
+    }
+
+    rv = connect(fd, (const struct sockaddr *)addr, sizeof(*addr));
+    if(rv != 0)
+        rv = errno;
+    close(fd);
+
+    if(rv == 0)
+    {
+        log_msg(LOG_VERBOSITY_ERROR,
+                "[*] Another agent is already serving %s", addr->sun_path);
+        return 0;
+    }
+
+    if(rv != ECONNREFUSED)
+    {
+        log_msg(LOG_VERBOSITY_ERROR, "[*] Could not check %s: %s",
+                addr->sun_path, strerror(rv));
+        return 0;
+    }
+
+    if(unlink(addr->sun_path) != 0)
+    {
+        log_msg(LOG_VERBOSITY_ERROR, "[*] Could not remove stale socket %s: %s",
+                addr->sun_path, strerror(errno));
+        return 0;
+    }
+
+    return 1;
+}
+
+/* Handle one agent request line and put the reply in reply
+*/
+static void
+agent_handle_request(fanout_target_t *targets, char **names, const int count,
+        char *resolved_ip, const char *req, char *reply, const size_t reply_len)
+{
+    fko_ctx_t           ctx_list[MAX_FANOUT_TARGETS];
+    fko_cli_options_t  *opts_list[MAX_FANOUT_TARGETS];
+    int                 res_list[MAX_FANOUT_TARGETS];
+    const char         *arg;
+    int                 i, n = 0, matched = 0, sent = 0;
+
+    if(strncasecmp(req, AGENT_REQ_KNOCK, strlen(AGENT_REQ_KNOCK)) != 0
+            || (req[strlen(AGENT_REQ_KNOCK)] != 0x0
+                && req[strlen(AGENT_REQ_KNOCK)] != ' '))
+    {
+        snprintf(reply, reply_len, "ERR unknown request\n");
+        return;
+    }
+
+    for(arg = req + strlen(AGENT_REQ_KNOCK); *arg == ' '; arg++);
+
+    for(i=0; i < count; i++)
+    {
+        if(*arg != 0x0 && strcasecmp(arg, names[i]) != 0)
+            continue;
+
+        matched++;
+        if((ctx_list[n] = agent_take_packet(targets, i, resolved_ip)) != NULL)
+            opts_list[n++] = &targets[i].options;
+    }
+
+    if(matched == 0)
+    {
+        snprintf(reply, reply_len, "ERR unknown target\n");
+        return;
+    }
+
+    if(n > 0)
+        sent = send_spa_packet_list(ctx_list, opts_list, res_list, n);
+
+    for(i=0; i < n; i++)
+        if(fko_destroy(ctx_list[i]) == FKO_ERROR_ZERO_OUT_DATA)
+            log_msg(LOG_VERBOSITY_ERROR,
+                    "[*] Could not zero out sensitive data buffer.");
+
+    snprintf(reply, reply_len, "%s %d/%d\n",
+            sent == matched ? "OK" : "ERR", sent, matched);
+    return;
+}
+
+/* Read from an agent client and answer every complete request line.
+ * Returns 0 once the client should be disconnected.
+*/
+static int
+agent_serve_client(agent_client_t *client, fanout_target_t *targets,
+        char **names, const int count, char *resolved_ip)
+{
+    char        reply[AGENT_MAX_REQUEST_LEN];
+    char       *eol;
+    ssize_t     n;
+
+    n = read(client->fd, client->buf + client->len,
+            sizeof(client->buf) - 1 - client->len);
+    if(n <= 0)
+        return 0;
+
+    client->len += n;
+    client->buf[client->len] = 0x0;
+
+    while((eol = strchr(client->buf, '\n')) != NULL)
+    {
+        *eol = 0x0;
+        if(eol > client->buf && *(eol-1) == '\r')
+            *(eol-1) = 0x0;
+
+        agent_handle_request(targets, names, count, resolved_ip,
+                client->buf, reply, sizeof(reply));
+
+        if(write(client->fd, reply, strlen(reply)) < 0)
+            return 0;
+
+        client->len -= (eol + 1) - client->buf;
+        memmove(client->buf, eol + 1, client->len + 1);
+    }
+
+    if(client->len == sizeof(client->buf) - 1)
+    {
+        snprintf(reply, sizeof(reply), "ERR request too long\n");
+        if(write(client->fd, reply, strlen(reply)) < 0)
+            log_msg(LOG_VERBOSITY_DEBUG, "agent write error: %s", strerror(errno));
+        return 0;
+    }
+
+    return 1;
+}
+#endif /* !WIN32 */
+
+/* Run as a long-lived agent (--agent) for the --fanout targets.  Their keys
+ * stay in memory along with a small pool of ready SPA packets per target,
+ * and local tools ask for knocks over a Unix socket with a line
+ * "KNOCK [target]" (no target knocks them all), which is answered with
+ * "OK <sent>/<targets>" or "ERR ...".  Returns 1 on a clean shutdown.
+*/
+static int
+run_agent(fko_cli_options_t *options, int argc, char **argv)
+{
+#ifdef WIN32
+    log_msg(LOG_VERBOSITY_ERROR, "[*] --agent is not supported on Windows");
+    return 0;
+#else
+    fanout_target_t    *targets = NULL;
+    agent_client_t      clients[AGENT_MAX_CLIENTS];
+    struct pollfd       pfds[AGENT_MAX_CLIENTS+1];
+    struct sockaddr_un  addr;
+    struct sigaction    sa;
+    char               *names[MAX_FANOUT_TARGETS];
+    char                list[MAX_LINE_LEN] = {0};
+    char                resolved_ip[MAX_IPV4_STR_LEN] = {0};
+    time_t              resolve_at = 0;
+    agent_rc_stat_t     rc_st;
+    int                 count, listen_fd = -1, fd, rv, i, ret = 0;
+    mode_t              old_umask;
+
+    if((count = parse_fanout_list(options->fanout_list, list, names)) == 0)
+        return 0;
+
+    if(strlen(options->agent_socket) >= sizeof(addr.sun_path))
+    {
+        log_msg(LOG_VERBOSITY_ERROR, "[*] Agent socket path is too long: %s",
+                options->agent_socket);
+        return 0;
+    }
+
+    if((targets = calloc(count, sizeof(fanout_target_t))) == NULL)
+    {
+        log_msg(LOG_VERBOSITY_ERROR, "[*] Memory allocation error.");
+        return 0;
+    }
+
+    for(i=0; i < AGENT_MAX_CLIENTS; i++)
+        clients[i].fd = -1;
+
+    /* Acquire the keys and fill the pools before serving anything so that
+     * any key prompts happen now
+    */
+    for(i=0; i < count; i++)
+        config_init_target(&targets[i].options, argc, argv, names[i]);
+
+    agent_rc_stat(targets[0].options.rc_file, &rc_st);
+    agent_resolve_ip(targets, count, resolved_ip, &resolve_at);
+    agent_refill(targets, count, resolved_ip);
+
+    /* The SDP control client is started once and keeps its session up for
+     * as long as the agent runs
+    */
+    if(!options->disable_sdp_ctrl_client
+            && options->sdp_ctrl_client_config_file[0] != '\0'
+            && run_sdp_ctrl_client(options) == 0)
+    {
+        /* this is the child process, stop here */
+        ret = 1;
+        goto agent_cleanup;
+    }
+
+    memset(&addr, 0x0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strlcpy(addr.sun_path, options->agent_socket, sizeof(addr.sun_path));
+
+    if((listen_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+    {
+        log_msg(LOG_VERBOSITY_ERROR, "[*] Could not create agent socket: %s",
+                strerror(errno));
+        goto agent_cleanup;
+    }
+
+    if(! agent_remove_stale_socket(&addr))
+    {
+        close(listen_fd);
+        listen_fd = -1;
+        goto agent_cleanup;
+    }
+
+    old_umask = umask(0077);
+    rv = bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr));
+    umask(old_umask);
+
+    if(rv != 0 || listen(listen_fd, AGENT_MAX_CLIENTS) != 0)
+    {
+        log_msg(LOG_VERBOSITY_ERROR, "[*] Could not listen on %s: %s",
+                options->agent_socket, strerror(errno));
+        close(listen_fd);
+        listen_fd = -1;
+        goto agent_cleanup;
+    }
+
+    memset(&sa, 0x0, sizeof(sa));
+    sa.sa_handler = agent_sig_handler;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    log_msg(LOG_VERBOSITY_NORMAL, "[+] fwknop agent serving %d target(s) on %s",
+            count, options->agent_socket);
+
+    while(! agent_stop)
+    {
+        /* New keys (from the SDP controller, say) land in the rc file
+        */
+        if(agent_rc_changed(targets[0].options.rc_file, &rc_st))
+            agent_reload_keys(targets, names, count, argc, argv);
+
+        agent_resolve_ip(targets, count, resolved_ip, &resolve_at);
+        agent_refill(targets, count, resolved_ip);
+
+        pfds[0].fd     = listen_fd;
+        pfds[0].events = POLLIN;
+        for(i=0; i < AGENT_MAX_CLIENTS; i++)
+        {
+            pfds[i+1].fd      = clients[i].fd;
+            pfds[i+1].events  = POLLIN;
+            pfds[i+1].revents = 0;
+        }
+
+        rv = poll(pfds, AGENT_MAX_CLIENTS+1, AGENT_POLL_INTERVAL);
+        if(rv < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            log_msg(LOG_VERBOSITY_ERROR, "[*] Agent poll error: %s",
+                    strerror(errno));
+            break;
+        }
+
+        for(i=0; i < AGENT_MAX_CLIENTS; i++)
+        {
+            if(clients[i].fd < 0 || pfds[i+1].revents == 0)
+                continue;
+
+            if(! agent_serve_client(&clients[i], targets, names, count,
+                        resolved_ip))
+            {
+                close(clients[i].fd);
+                clients[i].fd = -1;
+            }
+        }
+
+        if((pfds[0].revents & POLLIN)
+                && (fd = accept(listen_fd, NULL, NULL)) >= 0)
+        {
+            for(i=0; i < AGENT_MAX_CLIENTS && clients[i].fd >= 0; i++);
+
+            if(i == AGENT_MAX_CLIENTS)
+            {
+                log_msg(LOG_VERBOSITY_WARNING,
+                        "[-] Too many agent clients, closing new connection.");
+                close(fd);
+            }
+            else
+            {
+                clients[i].fd  = fd;
+                clients[i].len = 0;
+            }
+        }
+    }
+
+    log_msg(LOG_VERBOSITY_NORMAL, "[+] fwknop agent shutting down");
+    ret = 1;
+
+agent_cleanup:
+    for(i=0; i < AGENT_MAX_CLIENTS; i++)
+        if(clients[i].fd >= 0)
+            close(clients[i].fd);
+
+    if(listen_fd >= 0)
+    {
+        close(listen_fd);
+        unlink(options->agent_socket);
+    }
+
+    free_fanout_targets(targets, count);
+    return ret;
+#endif
+}
+
 /* Display an FKO error message.
 */
 void
@@ -1511,6 +2546,7 @@ clean_exit(fko_ctx_t ctx, fko_cli_options_t *opts,
                 "[*] Could not zero out sensitive data buffer.");
     ctx = NULL;
     free_configs(opts);
+    rc_cache_free();
     zero_buf_wrapper(key, *key_len);
     zero_buf_wrapper(hmac_key, *hmac_key_len);
     *key_len = 0;
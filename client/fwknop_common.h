@@ -55,6 +55,25 @@
 #define TIME_OFFSET_HOURS       3600
 #define TIME_OFFSET_DAYS        86400
 
+/* For --fanout mode, the maximum number of targets and how long to wait
+ * for TCP connections to all of them to complete
+*/
+#define MAX_FANOUT_TARGETS      256
+#define FANOUT_CONNECT_TIMEOUT  3000  /* milliseconds */
+
+/* For --agent mode: the number of ready SPA packets kept per target and how
+ * long one may wait before it is replaced (well within the default fwknopd
+ * MAX_SPA_PACKET_AGE of 120 seconds)
+*/
+#define AGENT_POOL_SIZE         4
+#define AGENT_MAX_PACKET_AGE    60    /* seconds */
+#define AGENT_BUILD_RETRY       30    /* seconds */
+#define AGENT_RESOLVE_INTERVAL  60    /* seconds, -R without a resolve cache */
+#define AGENT_POLL_INTERVAL     1000  /* milliseconds */
+#define AGENT_MAX_CLIENTS       32
+#define AGENT_MAX_REQUEST_LEN   256
+#define AGENT_REQ_KNOCK         "KNOCK"
+
 /* For resolving allow IP - the default is to do this via HTTPS with
  * wget to https://www.cipherdyne.org/cgi-bin/myip, and if the user
  * permit it, to fall back to the same URL but via HTTP.
@@ -63,6 +82,7 @@
 #define HTTP_BACKUP_RESOLVE_HOST    "www.cipherdyne.com"
 #define HTTP_RESOLVE_URL            "/cgi-bin/myip"
 #define WGET_RESOLVE_URL_SSL        "https://" HTTP_RESOLVE_HOST HTTP_RESOLVE_URL
+#define WGET_BACKUP_RESOLVE_URL_SSL "https://" HTTP_BACKUP_RESOLVE_HOST HTTP_RESOLVE_URL
 #define HTTP_MAX_REQUEST_LEN        2000
 #define HTTP_MAX_RESPONSE_LEN       2000
 #define HTTP_MAX_USER_AGENT_LEN     100
@@ -70,6 +90,17 @@
 #define MAX_URL_HOST_LEN            256
 #define MAX_URL_PATH_LEN            1024
 
+/* Several resolver URLs are queried in parallel and the first valid answer
+ * wins.  With RESOLVE_CACHE_TTL set, the answer is cached in the user's
+ * home directory until it expires or the local network configuration
+ * changes.
+*/
+#define MAX_RESOLVE_URLS            8
+#define HTTP_RESOLVE_TIMEOUT        15      /* seconds */
+#define RESOLVE_CACHE_FILE          ".fwknop.resolve"
+#define MAX_RESOLVE_CACHE_TTL       86400   /* seconds */
+#define PROC_NET_ROUTE              "/proc/net/route"
+
 /* fwknop client configuration parameters and values
 */
 typedef struct fko_cli_options
@@ -129,6 +160,7 @@ typedef struct fko_cli_options
     int  resolve_ip_http_https;
     int  resolve_http_only;
     char *resolve_url;
+    int  resolve_cache_ttl;
     char http_user_agent[HTTP_MAX_USER_AGENT_LEN];
     unsigned char use_wget_user_agent;
     char *wget_bin;
@@ -161,6 +193,9 @@ typedef struct fko_cli_options
     int             time_offset_minus;
     int             fw_timeout;
 
+    char            fanout_list[MAX_LINE_LEN];  /* --fanout targets */
+    char            agent_socket[MAX_PATH_LEN]; /* --agent socket path */
+
     char            use_rc_stanza[MAX_LINE_LEN];
     unsigned char   got_named_stanza;
     unsigned char   save_rc_stanza;
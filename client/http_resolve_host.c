@@ -43,6 +43,14 @@
   #endif
   #include <netdb.h>
   #include <sys/wait.h>
+  #include <sys/stat.h>
+  #include <fcntl.h>
+  #include <poll.h>
+  #include <signal.h>
+  #include <net/if.h>
+  #if HAVE_GETIFADDRS
+    #include <ifaddrs.h>
+  #endif
 #endif
 
 #if AFL_FUZZING
@@ -56,16 +64,104 @@ struct url
     char    path[MAX_URL_PATH_LEN+1];
 };
 
+/* Build our HTTP request to resolve the external IP (this is similar to
+ * to contacting whatismyip.org, but using a different URL).
+*/
+static int
+build_http_request(const struct url *url, fko_cli_options_t *options,
+        char *http_buf, const size_t http_buf_size)
+{
+    snprintf(http_buf, http_buf_size,
+        "GET %s HTTP/1.0\r\nUser-Agent: %s\r\nAccept: */*\r\n"
+        "Host: %s\r\nConnection: close\r\n\r\n",
+        url->path,
+        options->http_user_agent,
+        url->host
+    );
+
+    return strlen(http_buf);
+}
+
+/* Check that a resolver response starts with a sane IPv4 address and, if
+ * so, make it the allow IP.  The resp buffer must have room for at least
+ * MAX_IPV4_STR_LEN+1 bytes.
+*/
+static int
+set_allow_ip_from_resp(char *resp, fko_cli_options_t *options)
+{
+    int     o1, o2, o3, o4, i;
+
+    /* Walk along the content to try to find the end of the IP address.
+     * Note: We are expecting the content to be just an IP address
+     *       (possibly followed by whitespace or other not-digit value).
+     */
+    for(i=0; i<MAX_IPV4_STR_LEN; i++) {
+        if(! isdigit(*(resp+i)) && *(resp+i) != '.')
+            break;
+    }
+
+    /* Terminate at the first non-digit and non-dot.
+    */
+    *(resp+i) = '\0';
+
+    /* Now that we have what we think is an IP address string.  We make
+     * sure the format and values are sane.
+     */
+    if((sscanf(resp, "%u.%u.%u.%u", &o1, &o2, &o3, &o4)) == 4
+            && o1 >= 0 && o1 <= 255
+            && o2 >= 0 && o2 <= 255
+            && o3 >= 0 && o3 <= 255
+            && o4 >= 0 && o4 <= 255)
+    {
+        strlcpy(options->allow_ip_str, resp, sizeof(options->allow_ip_str));
+        return(1);
+    }
+    return(-1);
+}
+
+static int
+http_response_to_ip(const struct url *url, char *http_response,
+        fko_cli_options_t *options)
+{
+    char   *ndx;
+
+    log_msg(LOG_VERBOSITY_DEBUG, "\nHTTP response: %s", http_response);
+
+    /* Move to the end of the HTTP header and to the start of the content.
+    */
+    ndx = strstr(http_response, "\r\n\r\n");
+    if(ndx == NULL)
+    {
+        log_msg(LOG_VERBOSITY_ERROR, "Did not find the end of HTTP header.");
+        return(-1);
+    }
+    ndx += 4;
+
+    if(set_allow_ip_from_resp(ndx, options) == 1)
+    {
+        log_msg(LOG_VERBOSITY_INFO,
+                    "\n[+] Resolved external IP (via http://%s%s) as: %s",
+                    url->host,
+                    url->path,
+                    options->allow_ip_str);
+
+        return(1);
+    }
+
+    log_msg(LOG_VERBOSITY_ERROR,
+        "[-] From http://%s%s\n    Invalid IP (%s) in HTTP response:\n\n%s",
+        url->host, url->path, ndx, http_response);
+    return(-1);
+}
+
 static int
 try_url(struct url *url, fko_cli_options_t *options)
 {
-    int     sock=-1, sock_success=0, res, error, http_buf_len, i;
+    int     sock=-1, sock_success=0, res, error, http_buf_len;
     int     bytes_read = 0, position = 0;
-    int     o1, o2, o3, o4;
     struct  addrinfo *result=NULL, *rp, hints;
     char    http_buf[HTTP_MAX_REQUEST_LEN]       = {0};
     char    http_response[HTTP_MAX_RESPONSE_LEN] = {0};
-    char   *ndx;
 
 #ifdef WIN32
     WSADATA wsa_data;
@@ -80,18 +176,8 @@ try_url(struct url *url, fko_cli_options_t *options)
     }
 #endif
 
-    /* Build our HTTP request to resolve the external IP (this is similar to
-     * to contacting whatismyip.org, but using a different URL).
-    */
-    snprintf(http_buf, HTTP_MAX_REQUEST_LEN,
-        "GET %s HTTP/1.0\r\nUser-Agent: %s\r\nAccept: */*\r\n"
-        "Host: %s\r\nConnection: close\r\n\r\n",
-        url->path,
-        options->http_user_agent,
-        url->host
-    );
-
-    http_buf_len = strlen(http_buf);
+    http_buf_len = build_http_request(url, options,
+            http_buf, sizeof(http_buf));
 
     memset(&hints, 0, sizeof(struct addrinfo));
 
@@ -186,57 +272,207 @@ try_url(struct url *url, fko_cli_options_t *options)
     close(sock);
 #endif
 
-    log_msg(LOG_VERBOSITY_DEBUG, "\nHTTP response: %s", http_response);
+    return http_response_to_ip(url, http_response, options);
+}
 
-    /* Move to the end of the HTTP header and to the start of the content.
-    */
-    ndx = strstr(http_response, "\r\n\r\n");
-    if(ndx == NULL)
+#ifndef WIN32
+/* Start a non-blocking connect to a resolver URL, returns the socket or -1
+*/
+static int
+start_url_connect(const struct url *url)
+{
+    int     sock = -1, flags, error;
+    struct  addrinfo *result=NULL, hints;
+
+    memset(&hints, 0, sizeof(struct addrinfo));
+
+    hints.ai_family   = AF_UNSPEC; /* Allow IPv4 or IPv6 */
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+
+    error = getaddrinfo(url->host, url->port, &hints, &result);
+    if (error != 0)
     {
-        log_msg(LOG_VERBOSITY_ERROR, "Did not find the end of HTTP header.");
+        log_msg(LOG_VERBOSITY_ERROR, "[-] %s: error in getaddrinfo: %s",
+                url->host, gai_strerror(error));
         return(-1);
     }
-    ndx += 4;
 
-    /* Walk along the content to try to find the end of the IP address.
-     * Note: We are expecting the content to be just an IP address
-     *       (possibly followed by whitespace or other not-digit value).
-     */
-    for(i=0; i<MAX_IPV4_STR_LEN; i++) {
-        if(! isdigit(*(ndx+i)) && *(ndx+i) != '.')
-            break;
+    sock = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+    if(sock >= 0)
+    {
+        if((flags = fcntl(sock, F_GETFL, 0)) < 0
+                || fcntl(sock, F_SETFL, flags | O_NONBLOCK) < 0
+                || (connect(sock, result->ai_addr, result->ai_addrlen) < 0
+                    && errno != EINPROGRESS))
+        {
+            close(sock);
+            sock = -1;
+        }
     }
+    if(sock < 0)
+        log_msg(LOG_VERBOSITY_ERROR, "[-] %s: could not connect: %s",
+                url->host, strerror(errno));
 
-    /* Terminate at the first non-digit and non-dot.
+    freeaddrinfo(result);
+    return(sock);
+}
+
+/* Query several resolver URLs at once and take the first valid answer,
+ * so that a slow or dead resolver does not hold up the SPA packet.
+*/
+static int
+try_urls(struct url *urls, const int count, fko_cli_options_t *options)
+{
+    struct pollfd   pfds[MAX_RESOLVE_URLS];
+    char            responses[MAX_RESOLVE_URLS][HTTP_MAX_RESPONSE_LEN];
+    int             resp_len[MAX_RESOLVE_URLS];
+    char            http_buf[HTTP_MAX_REQUEST_LEN] = {0};
+    struct timeval  deadline;
+    socklen_t       err_len;
+    int             i, n, rv, http_buf_len, sock_err, pending = 0, res = -1;
+
+#if AFL_FUZZING
+    /* Make sure to not generate any resolution requests when compiled
+     * for AFL fuzzing cycles
     */
-    *(ndx+i) = '\0';
+    strlcpy(options->allow_ip_str, AFL_SET_RESOLVE_HOST,
+            sizeof(options->allow_ip_str));
+    log_msg(LOG_VERBOSITY_INFO,
+                "\n[+] AFL fuzzing cycle, force IP resolution to: %s",
+                options->allow_ip_str);
 
-    /* Now that we have what we think is an IP address string.  We make
-     * sure the format and values are sane.
-     */
-    if((sscanf(ndx, "%u.%u.%u.%u", &o1, &o2, &o3, &o4)) == 4
-            && o1 >= 0 && o1 <= 255
-            && o2 >= 0 && o2 <= 255
-            && o3 >= 0 && o3 <= 255
-            && o4 >= 0 && o4 <= 255)
+    return(1);
+#endif
+
+    memset(responses, 0x0, sizeof(responses));
+
+    for(i=0; i < count; i++)
     {
-        strlcpy(options->allow_ip_str, ndx, sizeof(options->allow_ip_str));
+        resp_len[i]    = 0;
+        pfds[i].events = POLLOUT;
+        pfds[i].fd     = start_url_connect(&urls[i]);
+        if(pfds[i].fd >= 0)
+            pending++;
+    }
 
-        log_msg(LOG_VERBOSITY_INFO,
-                    "\n[+] Resolved external IP (via http://%s%s) as: %s",
-                    url->host,
-                    url->path,
-                    options->allow_ip_str);
+    gettimeofday(&deadline, NULL);
+    deadline.tv_sec += HTTP_RESOLVE_TIMEOUT;
 
-        return(1);
+    while(pending > 0 && res != 1)
+    {
+        rv = poll(pfds, count, time_left_ms(&deadline));
+        if(rv < 0 && errno == EINTR)
+            continue;
+        if(rv <= 0)
+        {
+            log_msg(LOG_VERBOSITY_ERROR,
+                    "[-] Timed out waiting for an IP resolution response.");
+            break;
+        }
+
+        for(i=0; i < count && res != 1; i++)
+        {
+            if(pfds[i].fd < 0 || pfds[i].revents == 0)
+                continue;
+
+            if(pfds[i].events == POLLOUT)
+            {
+                /* Connected (or failed to), send the request
+                */
+                sock_err = 0;
+                err_len  = sizeof(sock_err);
+                getsockopt(pfds[i].fd, SOL_SOCKET, SO_ERROR, &sock_err, &err_len);
+
+                if(sock_err == 0)
+                {
+                    http_buf_len = build_http_request(&urls[i], options,
+                            http_buf, sizeof(http_buf));
+
+                    log_msg(LOG_VERBOSITY_DEBUG, "\nHTTP request: %s", http_buf);
+
+                    if(send(pfds[i].fd, http_buf, http_buf_len, 0) == http_buf_len)
+                    {
+                        pfds[i].events = POLLIN;
+                        continue;
+                    }
+                    sock_err = errno;
+                }
+                log_msg(LOG_VERBOSITY_ERROR, "[-] %s: HTTP request failed: %s",
+                        urls[i].host, strerror(sock_err));
+            }
+            else
+            {
+                n = recv(pfds[i].fd, responses[i] + resp_len[i],
+                        HTTP_MAX_RESPONSE_LEN - 1 - resp_len[i], 0);
+                if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK
+                            || errno == EINTR))
+                    continue;
+
+                if(n > 0)
+                {
+                    resp_len[i] += n;
+                    if(resp_len[i] < HTTP_MAX_RESPONSE_LEN - 1)
+                        continue;
+                }
+
+                /* The server closed the connection (or the response
+                 * buffer is full), so the response is complete
+                */
+                if(resp_len[i] > 0
+                        && http_response_to_ip(&urls[i], responses[i], options) == 1)
+                    res = 1;
+            }
+            close(pfds[i].fd);
+            pfds[i].fd = -1;
+            pending--;
+        }
     }
-    else
+
+    for(i=0; i < count; i++)
+        if(pfds[i].fd >= 0)
+            close(pfds[i].fd);
+
+    return(res);
+}
+#endif
+
+/* Split a comma separated resolve-url list into its URLs in place.  Each
+ * URL is checked by parse_url(), so the list itself is not limited in
+ * length here.
+*/
+static int
+split_resolve_urls(char *url_list, char **urls)
+{
+    char   *ndx;
+    int     count = 0;
+
+    ndx = url_list;
+    while(ndx != NULL)
     {
-        log_msg(LOG_VERBOSITY_ERROR,
-            "[-] From http://%s%s\n    Invalid IP (%s) in HTTP response:\n\n%s",
-            url->host, url->path, ndx, http_response);
-        return(-1);
+        if(count == MAX_RESOLVE_URLS)
+        {
+            log_msg(LOG_VERBOSITY_ERROR,
+                    "[*] At most %d resolve-url values are supported.",
+                    MAX_RESOLVE_URLS);
+            return(-1);
+        }
+
+        while(*ndx == ' ')
+            ndx++;
+        urls[count] = ndx;
+
+        if((ndx = strchr(ndx, ',')) != NULL)
+            *ndx++ = '\0';
+
+        if(*urls[count] != '\0')
+            count++;
     }
+
+    if(count == 0)
+        log_msg(LOG_VERBOSITY_ERROR, "[*] resolve-url is empty.");
+
+    return(count > 0 ? count : -1);
 }
 
 static int
@@ -268,7 +504,7 @@ parse_url(char *res_url, struct url* url)
             return(-1);
         }
 
-        snprintf(url->port, sizeof(url->port)-1, "%u", port);
+        snprintf(url->port, sizeof(url->port), "%u", port);
 
         /* Get the offset we need to skip the port portion when we
          * extract the hostname part.
@@ -321,38 +557,199 @@ parse_url(char *res_url, struct url* url)
     return(0);
 }
 
+
+#if HAVE_EXECVPE
+/* We drive wget to resolve the external IP via SSL. This may not
+ * work on all platforms, but is a better strategy for now than
+ * requiring that fwknop link against an SSL library.  One wget runs
+ * per resolver URL and the first valid answer wins.
+*/
+static int
+run_wget_cmds(char wget_ssl_cmds[][MAX_URL_PATH_LEN], const int count,
+        fko_cli_options_t *options)
+{
+    char           *wget_argv[MAX_CMDLINE_ARGS]; /* for execvpe() */
+    int             wget_argc=0;
+    int             pipe_fd[2];
+    pid_t           pids[MAX_RESOLVE_URLS];
+    struct pollfd   pfds[MAX_RESOLVE_URLS];
+    char            resps[MAX_RESOLVE_URLS][MAX_IPV4_STR_LEN+1];
+    int             resp_len[MAX_RESOLVE_URLS];
+    struct timeval  deadline;
+    int             i, n, rv, running, status, pending = 0, res = -1;
+
+    memset(resps, 0x0, sizeof(resps));
+
+    for(i=0; i < count; i++)
+    {
+        pids[i]        = -1;
+        pfds[i].fd     = -1;
+        pfds[i].events = POLLIN;
+        resp_len[i]    = 0;
+
+        memset(wget_argv, 0x0, sizeof(wget_argv));
+        wget_argc = 0;
+
+        if(strtoargv(wget_ssl_cmds[i], wget_argv, &wget_argc, options) != 1)
+        {
+            log_msg(LOG_VERBOSITY_ERROR, "Error converting wget cmd str to argv");
+            continue;
+        }
+
+        if(pipe(pipe_fd) < 0)
+        {
+            log_msg(LOG_VERBOSITY_ERROR, "[*] pipe() error");
+            free_argv(wget_argv, &wget_argc);
+            continue;
+        }
+
+        pids[i] = fork();
+        if (pids[i] == 0)
+        {
+            close(pipe_fd[0]);
+            dup2(pipe_fd[1], STDOUT_FILENO);
+            dup2(pipe_fd[1], STDERR_FILENO);
+            execvpe(wget_argv[0], wget_argv, (char * const *)NULL); /* don't use env */
+            _exit(EXIT_FAILURE);
+        }
+
+        /* Only the parent process makes it here
+        */
+        close(pipe_fd[1]);
+        free_argv(wget_argv, &wget_argc);
+
+        if(pids[i] == -1)
+        {
+            log_msg(LOG_VERBOSITY_INFO, "[*] Could not fork() for wget.");
+            close(pipe_fd[0]);
+            continue;
+        }
+        pfds[i].fd = pipe_fd[0];
+        pending++;
+    }
+
+    gettimeofday(&deadline, NULL);
+    deadline.tv_sec += HTTP_RESOLVE_TIMEOUT;
+
+    while(pending > 0 && res != 1)
+    {
+        rv = poll(pfds, count, time_left_ms(&deadline));
+        if(rv < 0 && errno == EINTR)
+            continue;
+        if(rv <= 0)
+        {
+            log_msg(LOG_VERBOSITY_ERROR,
+                    "[-] Timed out waiting for an IP resolution response.");
+            break;
+        }
+
+        for(i=0; i < count && res != 1; i++)
+        {
+            if(pfds[i].fd < 0 || pfds[i].revents == 0)
+                continue;
+
+            /* Expecting one line of wget output that contains the
+             * resolved IP.
+            */
+            n = read(pfds[i].fd, resps[i] + resp_len[i],
+                    MAX_IPV4_STR_LEN - resp_len[i]);
+            if(n < 0 && errno == EINTR)
+                continue;
+            if(n > 0)
+            {
+                resp_len[i] += n;
+                if(resp_len[i] < MAX_IPV4_STR_LEN
+                        && memchr(resps[i], '\n', resp_len[i]) == NULL)
+                    continue;
+            }
+
+            close(pfds[i].fd);
+            pfds[i].fd = -1;
+            pending--;
+
+            if(resp_len[i] > 0 && set_allow_ip_from_resp(resps[i], options) == 1)
+            {
+                log_msg(LOG_VERBOSITY_INFO,
+                            "\n[+] Resolved external IP (via '%s') as: %s",
+                            wget_ssl_cmds[i], options->allow_ip_str);
+                res = 1;
+            }
+        }
+    }
+
+    /* Stop any wget that is still running and reap them all
+    */
+    for(i=0; i < count; i++)
+    {
+        running = pfds[i].fd >= 0;
+        if(running)
+            close(pfds[i].fd);
+        if(pids[i] > 0)
+        {
+            if(running)
+                kill(pids[i], SIGTERM);
+            waitpid(pids[i], &status, 0);
+        }
+    }
+
+    return(res);
+}
+
+#else /* fall back to popen() */
+static int
+popen_wget_cmd(const char *wget_ssl_cmd, fko_cli_options_t *options)
+{
+    FILE   *wget;
+    char    resp[MAX_IPV4_STR_LEN+1] = {0};
+    int     got_resp = 0;
+
+    wget = popen(wget_ssl_cmd, "r");
+    if(wget == NULL)
+    {
+        log_msg(LOG_VERBOSITY_ERROR, "[*] Could not run cmd: %s",
+                wget_ssl_cmd);
+        return -1;
+    }
+    /* Expecting one line of wget output that contains the resolved IP.
+     * */
+    if ((fgets(resp, sizeof(resp), wget)) != NULL)
+    {
+        got_resp = 1;
+    }
+    pclose(wget);
+
+    if(got_resp && set_allow_ip_from_resp(resp, options) == 1)
+    {
+        log_msg(LOG_VERBOSITY_INFO,
+                    "\n[+] Resolved external IP (via '%s') as: %s",
+                    wget_ssl_cmd, options->allow_ip_str);
+        return 1;
+    }
+    return -1;
+}
+#endif
+
 int
 resolve_ip_https(fko_cli_options_t *options)
 {
-    int     o1, o2, o3, o4, got_resp=0, i=0;
-    char   *ndx, resp[MAX_IPV4_STR_LEN+1] = {0};
+    char    wget_base_cmd[MAX_URL_PATH_LEN] = {0};
+    char    wget_ssl_cmds[MAX_RESOLVE_URLS][MAX_URL_PATH_LEN];
+    char   *url_list = NULL;
+    char   *urls[MAX_RESOLVE_URLS];
     struct  url url; /* for validation only */
-    char    wget_ssl_cmd[MAX_URL_PATH_LEN] = {0};  /* for verbose logging only */
-
-#if HAVE_EXECVPE
-    char   *wget_argv[MAX_CMDLINE_ARGS]; /* for execvpe() */
-    int     wget_argc=0;
-    int     pipe_fd[2];
-    pid_t   pid=0;
-    FILE   *output;
-    int     status;
-#else
-    FILE *wget;
-#endif
+    int     count = 0, i;
 
-#if HAVE_EXECVPE
-    memset(wget_argv, 0x0, sizeof(wget_argv));
-#endif
     memset(&url, 0x0, sizeof(url));
+    memset(wget_ssl_cmds, 0x0, sizeof(wget_ssl_cmds));
 
     if(options->wget_bin != NULL)
     {
-        strlcpy(wget_ssl_cmd, options->wget_bin, sizeof(wget_ssl_cmd));
+        strlcpy(wget_base_cmd, options->wget_bin, sizeof(wget_base_cmd));
     }
     else
     {
 #ifdef WGET_EXE
-        strlcpy(wget_ssl_cmd, WGET_EXE, sizeof(wget_ssl_cmd));
+        strlcpy(wget_base_cmd, WGET_EXE, sizeof(wget_base_cmd));
 #else
         log_msg(LOG_VERBOSITY_ERROR,
                 "[*] Use --wget-cmd <path> to specify path to the wget command.");
@@ -364,38 +761,61 @@ resolve_ip_https(fko_cli_options_t *options)
     */
     if(! options->use_wget_user_agent)
     {
-        strlcat(wget_ssl_cmd, " -U ", sizeof(wget_ssl_cmd));
-        strlcat(wget_ssl_cmd, options->http_user_agent, sizeof(wget_ssl_cmd));
+        strlcat(wget_base_cmd, " -U ", sizeof(wget_base_cmd));
+        strlcat(wget_base_cmd, options->http_user_agent, sizeof(wget_base_cmd));
     }
 
     /* We collect the IP from wget's stdout
     */
-    strlcat(wget_ssl_cmd,
-            " --secure-protocol=auto --quiet -O - ", sizeof(wget_ssl_cmd));
+    strlcat(wget_base_cmd,
+            " --secure-protocol=auto --quiet -O - ", sizeof(wget_base_cmd));
 
     if(options->resolve_url != NULL)
     {
-        if(strncasecmp(options->resolve_url, "https", 5) != 0)
+        if((url_list = strdup(options->resolve_url)) == NULL)
         {
-            log_msg(LOG_VERBOSITY_ERROR,
-                    "[-] Warning: IP resolution URL '%s' should begin with 'https://' in -R mode.",
-                    options->resolve_url);
+            log_msg(LOG_VERBOSITY_ERROR, "[*] Memory allocation error.");
+            return(-1);
         }
 
-        if(parse_url(options->resolve_url, &url) < 0)
+        count = split_resolve_urls(url_list, urls);
+        if(count < 0)
         {
-            log_msg(LOG_VERBOSITY_ERROR, "Error parsing resolve-url");
+            free(url_list);
             return(-1);
         }
-        /* tack on the original URL to the wget command
-        */
-        strlcat(wget_ssl_cmd, options->resolve_url, sizeof(wget_ssl_cmd));
+
+        for(i=0; i < count; i++)
+        {
+            if(strncasecmp(urls[i], "https", 5) != 0)
+            {
+                log_msg(LOG_VERBOSITY_ERROR,
+                        "[-] Warning: IP resolution URL '%s' should begin with 'https://' in -R mode.",
+                        urls[i]);
+            }
+
+            if(parse_url(urls[i], &url) < 0)
+            {
+                log_msg(LOG_VERBOSITY_ERROR, "Error parsing resolve-url");
+                free(url_list);
+                return(-1);
+            }
+            /* tack on the original URL to the wget command
+            */
+            snprintf(wget_ssl_cmds[i], MAX_URL_PATH_LEN, "%s%s",
+                    wget_base_cmd, urls[i]);
+        }
+        free(url_list);
     }
     else
     {
-        /* tack on the default URL to the wget command
+        /* tack on the default URLs to the wget command
         */
-        strlcat(wget_ssl_cmd, WGET_RESOLVE_URL_SSL, sizeof(wget_ssl_cmd));
+        snprintf(wget_ssl_cmds[0], MAX_URL_PATH_LEN, "%s%s",
+                wget_base_cmd, WGET_RESOLVE_URL_SSL);
+        snprintf(wget_ssl_cmds[1], MAX_URL_PATH_LEN, "%s%s",
+                wget_base_cmd, WGET_BACKUP_RESOLVE_URL_SSL);
+        count = 2;
     }
 
 #if AFL_FUZZING
@@ -412,152 +832,307 @@ resolve_ip_https(fko_cli_options_t *options)
 #endif
 
 #if HAVE_EXECVPE
-    if(strtoargv(wget_ssl_cmd, wget_argv, &wget_argc, options) != 1)
-    {
-        log_msg(LOG_VERBOSITY_ERROR, "Error converting wget cmd str to argv");
-        return(-1);
-    }
+    if(run_wget_cmds(wget_ssl_cmds, count, options) == 1)
+        return 1;
+#else
+    for(i=0; i < count; i++)
+        if(popen_wget_cmd(wget_ssl_cmds[i], options) == 1)
+            return 1;
+#endif
 
-    /* We drive wget to resolve the external IP via SSL. This may not
-     * work on all platforms, but is a better strategy for now than
-     * requiring that fwknop link against an SSL library.
-    */
-    if(pipe(pipe_fd) < 0)
-    {
-        log_msg(LOG_VERBOSITY_ERROR, "[*] pipe() error");
-        free_argv(wget_argv, &wget_argc);
-        return -1;
-    }
+    for(i=0; i < count; i++)
+        log_msg(LOG_VERBOSITY_ERROR,
+            "[-] Could not resolve IP via: '%s'", wget_ssl_cmds[i]);
+    return -1;
+}
 
-    pid = fork();
-    if (pid == 0)
-    {
-        close(pipe_fd[0]);
-        dup2(pipe_fd[1], STDOUT_FILENO);
-        dup2(pipe_fd[1], STDERR_FILENO);
-        execvpe(wget_argv[0], wget_argv, (char * const *)NULL); /* don't use env */
-    }
-    else if(pid == -1)
-    {
-        log_msg(LOG_VERBOSITY_INFO, "[*] Could not fork() for wget.");
-        free_argv(wget_argv, &wget_argc);
-        return -1;
-    }
+int
+resolve_ip_http(fko_cli_options_t *options)
+{
+    int     res = -1, count = 0, i;
+    char   *url_list = NULL;
+    char   *url_strs[MAX_RESOLVE_URLS];
+    struct  url urls[MAX_RESOLVE_URLS];
 
-    /* Only the parent process makes it here
-    */
-    close(pipe_fd[1]);
-    if ((output = fdopen(pipe_fd[0], "r")) != NULL)
+    memset(urls, 0, sizeof(urls));
+
+    if(options->resolve_url != NULL)
     {
-        if(fgets(resp, sizeof(resp), output) != NULL)
+        if((url_list = strdup(options->resolve_url)) == NULL)
+        {
+            log_msg(LOG_VERBOSITY_ERROR, "[*] Memory allocation error.");
+            return(-1);
+        }
+
+        count = split_resolve_urls(url_list, url_strs);
+        if(count < 0)
         {
-            got_resp = 1;
+            free(url_list);
+            return(-1);
         }
-        fclose(output);
+
+        for(i=0; i < count; i++)
+        {
+            /* we only enter this function when the user forces non-HTTPS
+             * IP resolution
+            */
+            if(strncasecmp(url_strs[i], "https", 5) == 0)
+            {
+                log_msg(LOG_VERBOSITY_ERROR,
+                        "[*] https is not supported for --resolve-http-only.");
+                free(url_list);
+                return(-1);
+            }
+
+            if(parse_url(url_strs[i], &urls[i]) < 0)
+            {
+                log_msg(LOG_VERBOSITY_ERROR, "Error parsing resolve-url");
+                free(url_list);
+                return(-1);
+            }
+        }
+        free(url_list);
     }
     else
     {
-        log_msg(LOG_VERBOSITY_INFO,
-                "[*] Could not fdopen() pipe output file descriptor.");
-        free_argv(wget_argv, &wget_argc);
-        return -1;
+        strlcpy(urls[0].port, "80", sizeof(urls[0].port));
+        strlcpy(urls[0].host, HTTP_RESOLVE_HOST, sizeof(urls[0].host));
+        strlcpy(urls[0].path, HTTP_RESOLVE_URL, sizeof(urls[0].path));
+
+        /* the backup url just switches the host to cipherdyne.com
+        */
+        urls[1] = urls[0];
+        strlcpy(urls[1].host, HTTP_BACKUP_RESOLVE_HOST, sizeof(urls[1].host));
+        count = 2;
     }
 
-    waitpid(pid, &status, 0);
+#ifdef WIN32
+    for(i=0; i < count && res != 1; i++)
+        res = try_url(&urls[i], options);
+#else
+    if(count == 1)
+        res = try_url(&urls[0], options);
+    else
+        res = try_urls(urls, count, options);
+#endif
 
-    free_argv(wget_argv, &wget_argc);
+    return(res);
+}
 
-#else /* fall back to popen() */
-    wget = popen(wget_ssl_cmd, "r");
-    if(wget == NULL)
+#ifndef WIN32
+static uint64_t
+fnv1a_64(uint64_t hash, const void *data, size_t len)
+{
+    const unsigned char *p = data;
+
+    while(len--)
     {
-        log_msg(LOG_VERBOSITY_ERROR, "[*] Could not run cmd: %s",
-                wget_ssl_cmd);
-        return -1;
+        hash ^= *p++;
+        hash *= 0x100000001b3ULL;
     }
-    /* Expecting one line of wget output that contains the resolved IP.
-     * */
-    if ((fgets(resp, sizeof(resp), wget)) != NULL)
+    return hash;
+}
+
+/* Fingerprint the local network configuration - the addresses of the
+ * interfaces that are up plus the default route where /proc/net/route
+ * exists - so that a cached external IP is dropped when it changes.
+*/
+static uint64_t
+network_fingerprint(void)
+{
+    uint64_t        hash = 0xcbf29ce484222325ULL;
+    FILE           *route;
+    char            line[MAX_LINE_LEN];
+    char            iface[MAX_LINE_LEN], dest[MAX_LINE_LEN], gw[MAX_LINE_LEN];
+#if HAVE_GETIFADDRS
+    struct ifaddrs *ifa_list = NULL, *ifa;
+
+    if(getifaddrs(&ifa_list) == 0)
     {
-        got_resp = 1;
+        for(ifa = ifa_list; ifa != NULL; ifa = ifa->ifa_next)
+        {
+            if(ifa->ifa_addr == NULL || ! (ifa->ifa_flags & IFF_UP))
+                continue;
+
+            if(ifa->ifa_addr->sa_family == AF_INET)
+            {
+                hash = fnv1a_64(hash, ifa->ifa_name, strlen(ifa->ifa_name));
+                hash = fnv1a_64(hash,
+                        &((struct sockaddr_in *)ifa->ifa_addr)->sin_addr,
+                        sizeof(struct in_addr));
+            }
+            else if(ifa->ifa_addr->sa_family == AF_INET6)
+            {
+                hash = fnv1a_64(hash, ifa->ifa_name, strlen(ifa->ifa_name));
+                hash = fnv1a_64(hash,
+                        &((struct sockaddr_in6 *)ifa->ifa_addr)->sin6_addr,
+                        sizeof(struct in6_addr));
+            }
+        }
+        freeifaddrs(ifa_list);
     }
-    pclose(wget);
 #endif
 
-    if(got_resp)
+    if((route = fopen(PROC_NET_ROUTE, "r")) != NULL)
     {
-        ndx = resp;
-        for(i=0; i<MAX_IPV4_STR_LEN; i++) {
-            if(! isdigit(*(ndx+i)) && *(ndx+i) != '.')
-                break;
+        while(fgets(line, sizeof(line), route) != NULL)
+        {
+            if(sscanf(line, "%s %s %s", iface, dest, gw) == 3
+                    && strcmp(dest, "00000000") == 0)
+            {
+                hash = fnv1a_64(hash, iface, strlen(iface));
+                hash = fnv1a_64(hash, gw, strlen(gw));
+            }
         }
-        *(ndx+i) = '\0';
+        fclose(route);
+    }
 
-        if((sscanf(ndx, "%u.%u.%u.%u", &o1, &o2, &o3, &o4)) == 4
-                && o1 >= 0 && o1 <= 255
-                && o2 >= 0 && o2 <= 255
-                && o3 >= 0 && o3 <= 255
-                && o4 >= 0 && o4 <= 255)
-        {
-            strlcpy(options->allow_ip_str, ndx, sizeof(options->allow_ip_str));
+    return hash;
+}
 
-            log_msg(LOG_VERBOSITY_INFO,
-                        "\n[+] Resolved external IP (via '%s') as: %s",
-                        wget_ssl_cmd, options->allow_ip_str);
-            return 1;
-        }
+static int
+get_resolve_cache_file(char *cache_file, const size_t cache_file_size)
+{
+    char   *homedir = getenv("HOME");
+
+    if(homedir == NULL)
+        return 0;
+
+    if(snprintf(cache_file, cache_file_size, "%s%c%s",
+                homedir, PATH_SEP, RESOLVE_CACHE_FILE) >= (int)cache_file_size)
+        return 0;
+
+    return 1;
+}
+
+/* Use the external IP cached by an earlier run if it has not expired and
+ * the network has not changed since
+*/
+static int
+get_cached_ip(fko_cli_options_t *options, const uint64_t fingerprint)
+{
+    char                cache_file[MAX_PATH_LEN] = {0};
+    char                ip_str[MAX_IPV4_STR_LEN+1] = {0};
+    unsigned long long  expires = 0, cached_fp = 0;
+    time_t              now = time(NULL);
+    struct stat         st;
+    FILE               *cache;
+    int                 fd, found = 0;
+
+    if(! get_resolve_cache_file(cache_file, sizeof(cache_file)))
+        return 0;
+
+    if((fd = open(cache_file, O_RDONLY | O_NOFOLLOW)) < 0)
+        return 0;
+
+    /* The cached IP ends up in the SPA packet, so only trust a file that
+     * nobody but the user could have written
+    */
+    if(fstat(fd, &st) != 0 || ! S_ISREG(st.st_mode)
+            || st.st_uid != getuid()
+            || (st.st_mode & (S_IRWXG|S_IRWXO)) != 0)
+    {
+        log_msg(LOG_VERBOSITY_WARNING,
+            "[-] Ignoring %s, it must be owned by the user with permissions 0600.",
+            cache_file);
+        close(fd);
+        return 0;
     }
-    log_msg(LOG_VERBOSITY_ERROR,
-        "[-] Could not resolve IP via: '%s'", wget_ssl_cmd);
-    return -1;
+
+    if((cache = fdopen(fd, "r")) == NULL)
+    {
+        close(fd);
+        return 0;
+    }
+
+    if(fscanf(cache, "%16s %llu %llx", ip_str, &expires, &cached_fp) == 3
+            && cached_fp == fingerprint
+            && (time_t)expires > now
+            && (time_t)expires - now <= options->resolve_cache_ttl
+            && is_valid_ipv4_addr(ip_str))
+    {
+        strlcpy(options->allow_ip_str, ip_str, sizeof(options->allow_ip_str));
+        log_msg(LOG_VERBOSITY_INFO,
+                "\n[+] Using cached external IP: %s (expires in %d seconds)",
+                options->allow_ip_str, (int)((time_t)expires - now));
+        found = 1;
+    }
+    fclose(cache);
+
+    return found;
 }
 
-int
-resolve_ip_http(fko_cli_options_t *options)
+static void
+save_cached_ip(fko_cli_options_t *options, const uint64_t fingerprint)
 {
-    int     res;
-    struct  url url;
+    char    cache_file[MAX_PATH_LEN] = {0};
+    char    tmp_file[MAX_PATH_LEN] = {0};
+    char    buf[MAX_LINE_LEN] = {0};
+    int     fd, len, res;
 
-    memset(&url, 0, sizeof(url));
+    if(! get_resolve_cache_file(cache_file, sizeof(cache_file)))
+        return;
 
-    if(options->resolve_url != NULL)
+    snprintf(tmp_file, sizeof(tmp_file), "%s.%ld", cache_file, (long)getpid());
+
+    len = snprintf(buf, sizeof(buf), "%s %llu %016llx\n", options->allow_ip_str,
+            (unsigned long long)(time(NULL) + options->resolve_cache_ttl),
+            (unsigned long long)fingerprint);
+
+    /* Write a new file and rename it into place so that a concurrent
+     * client never reads a partial entry
+    */
+    fd = open(tmp_file, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW, S_IRUSR | S_IWUSR);
+    if(fd < 0)
     {
-        /* we only enter this function when the user forces non-HTTPS
-         * IP resolution
-        */
-        if(strncasecmp(options->resolve_url, "https", 5) == 0)
-        {
-            log_msg(LOG_VERBOSITY_ERROR,
-                    "[*] https is not supported for --resolve-http-only.");
-            return(-1);
-        }
+        log_msg(LOG_VERBOSITY_WARNING,
+                "[-] Could not create resolve cache file %s: %s",
+                tmp_file, strerror(errno));
+        return;
+    }
 
-        if(parse_url(options->resolve_url, &url) < 0)
-        {
-            log_msg(LOG_VERBOSITY_ERROR, "Error parsing resolve-url");
-            return(-1);
-        }
+    res = write(fd, buf, len);
+    if(close(fd) != 0 || res != len || rename(tmp_file, cache_file) != 0)
+    {
+        log_msg(LOG_VERBOSITY_WARNING,
+                "[-] Could not write resolve cache file %s: %s",
+                cache_file, strerror(errno));
+        unlink(tmp_file);
+    }
+    return;
+}
+#endif
 
-        res = try_url(&url, options);
+/* Resolve the external IP of this system for -R, using the answer cached
+ * by an earlier run while it is still valid
+*/
+int
+resolve_ip(fko_cli_options_t *options)
+{
+    int         res;
+#ifndef WIN32
+    uint64_t    fingerprint = 0;
 
-    } else {
-        strlcpy(url.port, "80", sizeof(url.port));
-        strlcpy(url.host, HTTP_RESOLVE_HOST, sizeof(url.host));
-        strlcpy(url.path, HTTP_RESOLVE_URL, sizeof(url.path));
+    if(options->resolve_cache_ttl > 0)
+    {
+        fingerprint = network_fingerprint();
+        if(get_cached_ip(options, fingerprint))
+            return(1);
+    }
+#endif
 
-        res = try_url(&url, options);
-        if(res != 1)
-        {
-            /* try the backup url (just switches the host to cipherdyne.com)
-            */
-            strlcpy(url.host, HTTP_BACKUP_RESOLVE_HOST, sizeof(url.host));
+    /* Default to HTTPS unless the user asked for HTTP only
+    */
+    if(options->resolve_http_only)
+        res = resolve_ip_http(options);
+    else
+        res = resolve_ip_https(options);
 
 #ifndef WIN32
-            sleep(2);
+    if(res == 1 && options->resolve_cache_ttl > 0)
+        save_cached_ip(options, fingerprint);
 #endif
-            res = try_url(&url, options);
-        }
-    }
+
     return(res);
 }
 
@@ -31,6 +31,23 @@
 #include "spa_comm.h"
 #include "utils.h"
 
+#ifndef WIN32
+  #include <fcntl.h>
+  #include <poll.h>
+  #include <sys/time.h>
+
+/* Destination and payload of one --fanout target
+*/
+typedef struct spa_fanout_dst
+{
+    const fko_cli_options_t    *options;
+    char                       *spa_data;
+    int                         sd_len;
+    struct sockaddr_storage     addr;
+    socklen_t                   addr_len;
+} spa_fanout_dst_t;
+#endif
+
 static void
 dump_transmit_options(const fko_cli_options_t *options)
 {
@@ -749,6 +766,373 @@ send_spa_packet(fko_ctx_t ctx, fko_cli_options_t *options)
     return res;
 }
 
+#ifndef WIN32
+/* Resolve the SPA server of a fan-out target to a socket address
+*/
+static int
+resolve_fanout_dst(spa_fanout_dst_t *dst, const int socktype)
+{
+    struct  addrinfo *result=NULL, *rp, hints;
+    char    port_str[MAX_PORT_STR_LEN+1] = {0};
+    int     error, found = 0;
+
+    memset(&hints, 0, sizeof(struct addrinfo));
+
+    hints.ai_family   = dst->options->spa_server_resolve_ipv4 ? AF_INET : AF_UNSPEC;
+    hints.ai_socktype = socktype;
+
+    snprintf(port_str, MAX_PORT_STR_LEN+1, "%d", dst->options->spa_dst_port);
+
+    error = getaddrinfo(dst->options->spa_server_str, port_str, &hints, &result);
+    if (error != 0)
+    {
+        log_msg(LOG_VERBOSITY_ERROR, "[*] %s: error in getaddrinfo: %s",
+                dst->options->spa_server_str, gai_strerror(error));
+        return -1;
+    }
+
+    for (rp = result; rp != NULL; rp = rp->ai_next)
+    {
+        if((rp->ai_family == AF_INET || rp->ai_family == AF_INET6)
+                && rp->ai_addrlen <= sizeof(dst->addr))
+        {
+            memcpy(&dst->addr, rp->ai_addr, rp->ai_addrlen);
+            dst->addr_len = rp->ai_addrlen;
+            found = 1;
+            break;
+        }
+    }
+    freeaddrinfo(result);
+
+    if(! found)
+    {
+        log_msg(LOG_VERBOSITY_ERROR, "[*] %s: no usable address",
+                dst->options->spa_server_str);
+        return -1;
+    }
+    return 0;
+}
+
+static int
+set_sock_nonblocking(const int sock)
+{
+    int flags;
+
+    if((flags = fcntl(sock, F_GETFL, 0)) < 0)
+        return -1;
+    return fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+}
+
+/* Send the UDP fan-out packets of one address family through a single
+ * unconnected socket, batched with sendmmsg() where it is available.
+*/
+static void
+send_fanout_udp(spa_fanout_dst_t *dsts, const int *idx, const int n,
+        const int family, int *res_list)
+{
+    int             sock, sent = 0, rv;
+    struct pollfd   pfd;
+    spa_fanout_dst_t *dst;
+#if HAVE_SENDMMSG
+    struct mmsghdr *msgs = NULL;
+    struct iovec   *iov = NULL;
+    int             i;
+#endif
+
+    if(n == 0)
+        return;
+
+    sock = socket(family, SOCK_DGRAM, IPPROTO_UDP);
+    if(sock < 0 || set_sock_nonblocking(sock) < 0)
+    {
+        log_msg(LOG_VERBOSITY_ERROR, "[*] Could not create UDP socket: %s",
+                strerror(errno));
+        if(sock >= 0)
+            close(sock);
+        return;
+    }
+
+#if HAVE_SENDMMSG
+    msgs = calloc(n, sizeof(struct mmsghdr));
+    iov  = calloc(n, sizeof(struct iovec));
+    if(msgs == NULL || iov == NULL)
+    {
+        log_msg(LOG_VERBOSITY_ERROR, "[*] Memory allocation error.");
+        free(msgs);
+        free(iov);
+        close(sock);
+        return;
+    }
+
+    for(i=0; i < n; i++)
+    {
+        dst = &dsts[idx[i]];
+        iov[i].iov_base = dst->spa_data;
+        iov[i].iov_len  = dst->sd_len;
+        msgs[i].msg_hdr.msg_name    = &dst->addr;
+        msgs[i].msg_hdr.msg_namelen = dst->addr_len;
+        msgs[i].msg_hdr.msg_iov     = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen  = 1;
+    }
+#endif
+
+    while(sent < n)
+    {
+        dst = &dsts[idx[sent]];
+#if HAVE_SENDMMSG
+        rv = sendmmsg(sock, msgs + sent, n - sent, 0);
+        if(rv > 0)
+        {
+            for(i=sent; i < sent + rv; i++)
+                res_list[idx[i]] = msgs[i].msg_len;
+            sent += rv;
+            continue;
+        }
+#else
+        rv = sendto(sock, dst->spa_data, dst->sd_len, 0,
+                (struct sockaddr *)&dst->addr, dst->addr_len);
+        if(rv >= 0)
+        {
+            res_list[idx[sent++]] = rv;
+            continue;
+        }
+#endif
+        if(errno == EINTR)
+            continue;
+
+        if(errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            pfd.fd     = sock;
+            pfd.events = POLLOUT;
+            if(poll(&pfd, 1, FANOUT_CONNECT_TIMEOUT) > 0)
+                continue;
+
+            log_msg(LOG_VERBOSITY_ERROR,
+                    "[*] Timed out waiting to send UDP SPA packets.");
+            break;
+        }
+
+        /* A hard error only fails the packet at the head of the batch
+        */
+        log_msg(LOG_VERBOSITY_ERROR, "[*] %s: write error: %s",
+                dst->options->spa_server_str, strerror(errno));
+        sent++;
+    }
+
+#if HAVE_SENDMMSG
+    free(msgs);
+    free(iov);
+#endif
+    close(sock);
+    return;
+}
+
+/* Open non-blocking TCP connections to all of the TCP fan-out targets at
+ * once and send each SPA packet as soon as its connection completes.
+*/
+static void
+send_fanout_tcp(spa_fanout_dst_t *dsts, const int *idx, const int n,
+        int *res_list)
+{
+    struct pollfd      *pfds;
+    struct timeval      deadline;
+    spa_fanout_dst_t   *dst;
+    int                 i, rv, pending = 0, sock_err;
+    socklen_t           err_len;
+
+    if(n == 0)
+        return;
+
+    if((pfds = calloc(n, sizeof(struct pollfd))) == NULL)
+    {
+        log_msg(LOG_VERBOSITY_ERROR, "[*] Memory allocation error.");
+        return;
+    }
+
+    for(i=0; i < n; i++)
+    {
+        dst = &dsts[idx[i]];
+        pfds[i].fd     = socket(dst->addr.ss_family, SOCK_STREAM, IPPROTO_TCP);
+        pfds[i].events = POLLOUT;
+
+        if(pfds[i].fd < 0 || set_sock_nonblocking(pfds[i].fd) < 0
+                || (connect(pfds[i].fd, (struct sockaddr *)&dst->addr,
+                        dst->addr_len) < 0 && errno != EINPROGRESS))
+        {
+            log_msg(LOG_VERBOSITY_ERROR, "[*] %s: could not connect: %s",
+                    dst->options->spa_server_str, strerror(errno));
+            if(pfds[i].fd >= 0)
+                close(pfds[i].fd);
+            pfds[i].fd = -1;
+            continue;
+        }
+        pending++;
+    }
+
+    gettimeofday(&deadline, NULL);
+    deadline.tv_sec  += FANOUT_CONNECT_TIMEOUT / 1000;
+    deadline.tv_usec += (FANOUT_CONNECT_TIMEOUT % 1000) * 1000;
+
+    while(pending > 0)
+    {
+        rv = poll(pfds, n, time_left_ms(&deadline));
+        if(rv < 0 && errno == EINTR)
+            continue;
+        if(rv <= 0)
+            break;
+
+        for(i=0; i < n; i++)
+        {
+            if(pfds[i].fd < 0 || pfds[i].revents == 0)
+                continue;
+
+            dst      = &dsts[idx[i]];
+            sock_err = 0;
+            err_len  = sizeof(sock_err);
+            getsockopt(pfds[i].fd, SOL_SOCKET, SO_ERROR, &sock_err, &err_len);
+
+            if(sock_err != 0)
+                log_msg(LOG_VERBOSITY_ERROR, "[*] %s: could not connect: %s",
+                        dst->options->spa_server_str, strerror(sock_err));
+            else if((res_list[idx[i]] = send(pfds[i].fd, dst->spa_data,
+                            dst->sd_len, 0)) < 0)
+                log_msg(LOG_VERBOSITY_ERROR, "[*] %s: write error: %s",
+                        dst->options->spa_server_str, strerror(errno));
+            else if(res_list[idx[i]] != dst->sd_len)
+                log_msg(LOG_VERBOSITY_WARNING,
+                        "[#] Warning: bytes sent (%i) not spa data length (%i).",
+                        res_list[idx[i]], dst->sd_len);
+
+            close(pfds[i].fd);
+            pfds[i].fd = -1;
+            pending--;
+        }
+    }
+
+    for(i=0; i < n; i++)
+    {
+        if(pfds[i].fd < 0)
+            continue;
+        log_msg(LOG_VERBOSITY_ERROR, "[*] %s: connection timed out",
+                dsts[idx[i]].options->spa_server_str);
+        close(pfds[i].fd);
+    }
+
+    free(pfds);
+    return;
+}
+#endif /* !WIN32 */
+
+/* Send the SPA data of several contexts at once (--fanout mode).  UDP
+ * packets are batched per address family and TCP connections are made in
+ * parallel, while the other protocols fall back to send_spa_packet().  The
+ * number of bytes sent to each target (or -1) is stored in res_list, and
+ * the number of targets that were sent to is returned.
+*/
+int
+send_spa_packet_list(fko_ctx_t *ctx_list, fko_cli_options_t **opts_list,
+        int *res_list, const int count)
+{
+    int                 i, sent = 0;
+#ifndef WIN32
+    spa_fanout_dst_t   *dsts = NULL;
+    int                *idx  = NULL;
+    int                *udp4, *udp6, *tcp, *seq;
+    int                 n_udp4 = 0, n_udp6 = 0, n_tcp = 0, n_seq = 0;
+#endif
+
+    for(i=0; i < count; i++)
+        res_list[i] = -1;
+
+#if AFL_FUZZING
+    /* Make sure to never send SPA packets under AFL fuzzing cycles
+    */
+    log_msg(LOG_VERBOSITY_NORMAL,
+        "AFL fuzzing enabled, SPA packets not actually sent.");
+    for(i=0; i < count; i++)
+        res_list[i] = 0;
+    return count;
+#endif
+
+#ifdef WIN32
+    for(i=0; i < count; i++)
+        res_list[i] = send_spa_packet(ctx_list[i], opts_list[i]);
+#else
+    dsts = calloc(count, sizeof(spa_fanout_dst_t));
+    idx  = calloc(count * 4, sizeof(int));
+    if(dsts == NULL || idx == NULL)
+    {
+        log_msg(LOG_VERBOSITY_ERROR, "[*] Memory allocation error.");
+        free(dsts);
+        free(idx);
+        return 0;
+    }
+    udp4 = idx;
+    udp6 = idx + count;
+    tcp  = idx + count * 2;
+    seq  = idx + count * 3;
+
+    for(i=0; i < count; i++)
+    {
+        dsts[i].options = opts_list[i];
+
+        if(fko_get_spa_data(ctx_list[i], &dsts[i].spa_data) != FKO_SUCCESS)
+        {
+            log_msg(LOG_VERBOSITY_ERROR, "[*] %s: no SPA data to send",
+                    opts_list[i]->spa_server_str);
+            continue;
+        }
+        dsts[i].sd_len = strlen(dsts[i].spa_data);
+
+        if(opts_list[i]->spa_proto == FKO_PROTO_UDP)
+        {
+            if(opts_list[i]->test)
+                seq[n_seq++] = i;
+            else if(resolve_fanout_dst(&dsts[i], SOCK_DGRAM) == 0)
+            {
+                dump_transmit_options(opts_list[i]);
+                if(dsts[i].addr.ss_family == AF_INET)
+                    udp4[n_udp4++] = i;
+                else
+                    udp6[n_udp6++] = i;
+            }
+        }
+        else if(opts_list[i]->spa_proto == FKO_PROTO_TCP)
+        {
+            if(opts_list[i]->test)
+                seq[n_seq++] = i;
+            else if(resolve_fanout_dst(&dsts[i], SOCK_STREAM) == 0)
+            {
+                dump_transmit_options(opts_list[i]);
+                tcp[n_tcp++] = i;
+            }
+        }
+        else
+            seq[n_seq++] = i;
+    }
+
+    errno = 0;
+
+    send_fanout_udp(dsts, udp4, n_udp4, AF_INET, res_list);
+    send_fanout_udp(dsts, udp6, n_udp6, AF_INET6, res_list);
+    send_fanout_tcp(dsts, tcp, n_tcp, res_list);
+
+    /* HTTP, raw and ICMP packets (and test mode) go out one at a time
+    */
+    for(i=0; i < n_seq; i++)
+        res_list[seq[i]] = send_spa_packet(ctx_list[seq[i]], opts_list[seq[i]]);
+
+    free(dsts);
+    free(idx);
+#endif
+
+    for(i=0; i < count; i++)
+        if(res_list[i] >= 0)
+            sent++;
+
+    return sent;
+}
+
 /* Function to write SPA packet data to the filesystem
 */
 int write_spa_packet_data(fko_ctx_t ctx, const fko_cli_options_t *options)
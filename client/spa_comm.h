@@ -37,6 +37,8 @@
 /* Function Prototypes
 */
 int send_spa_packet(fko_ctx_t ctx, fko_cli_options_t *options);
+int send_spa_packet_list(fko_ctx_t *ctx_list, fko_cli_options_t **opts_list,
+        int *res_list, const int count);
 int write_spa_packet_data(fko_ctx_t ctx, const fko_cli_options_t *options);
 
 #endif  /* SPA_COMM_H */
@@ -384,4 +384,21 @@ free_argv(char **argv_new, int *argc_new)
     return;
 }
 
+#ifndef WIN32
+/* Milliseconds left until the given deadline (0 once it has passed)
+*/
+int
+time_left_ms(const struct timeval *deadline)
+{
+    struct timeval  now;
+    long            ms;
+
+    gettimeofday(&now, NULL);
+    ms = (deadline->tv_sec - now.tv_sec) * 1000
+        + (deadline->tv_usec - now.tv_usec) / 1000;
+
+    return ms > 0 ? (int)ms : 0;
+}
+#endif
+
 /***EOF***/
@@ -44,6 +44,7 @@
     #include <sys/socket.h>
   #endif
   #include <netdb.h>
+  #include <sys/time.h>
 #endif
 
 #define PROTOCOL_BUFSIZE    16      /*!< Maximum number of chars for a protocol string (TCP for example) */
@@ -62,5 +63,8 @@ short   proto_inttostr(int proto, char *proto_str, size_t proto_size);
 short   proto_strtoint(const char *pr_str);
 int     strtoargv(char *args_str, char **argv_new, int *argc_new, fko_cli_options_t *opts);
 void    free_argv(char **argv_new, int *argc_new);
+#ifndef WIN32
+int     time_left_ms(const struct timeval *deadline);
+#endif
 
 #endif  /* UTILS_H */
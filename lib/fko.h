@@ -324,6 +324,25 @@ typedef enum {
 struct fko_context;
 typedef struct fko_context *fko_ctx_t;
 
+/* A pre-initialized GnuPG engine context (with the recipient key already
+ * looked up) that can be lent to one FKO context at a time via
+ * fko_set_gpg_handle(). This is an opaque pointer.
+*/
+struct fko_gpg_handle;
+typedef struct fko_gpg_handle *fko_gpg_handle_t;
+
+/* Per-packet overrides for fko_spa_data_batch().  A zero or NULL field
+ * keeps the value of the template context, except rand_val where NULL
+ * means a fresh random value is generated for the packet.
+*/
+typedef struct fko_batch_item
+{
+    uint32_t    sdp_id;
+    time_t      timestamp;
+    const char *rand_val;
+    const char *message;
+} fko_batch_item_t;
+
 /* Function pointer for SPA packet field parsing
  */
 typedef int (*field_parser_ptr_t)(char *tbuf, char **ndx, int *t_size, fko_ctx_t ctx);
@@ -356,6 +375,11 @@ DLL_API int fko_new_with_data(fko_ctx_t *ctx, const char * const enc_msg,
 DLL_API int fko_destroy(fko_ctx_t ctx);
 DLL_API int fko_spa_data_final(fko_ctx_t ctx, const char * const enc_key,
     const int enc_key_len, const char * const hmac_key, const int hmac_key_len);
+DLL_API int fko_spa_data_batch(fko_ctx_t tmpl, const fko_batch_item_t * const items,
+    const int count, const char * const enc_key, const int enc_key_len,
+    const char * const hmac_key, const int hmac_key_len,
+    char * const spa_buf, const size_t spa_buf_len,
+    size_t * const spa_offsets, int * const results, const int num_threads);
 
 /* Set context data functions
 */
@@ -447,6 +471,11 @@ DLL_API int fko_get_gpg_signer(fko_ctx_t ctx, char **signer);
 DLL_API int fko_set_gpg_home_dir(fko_ctx_t ctx, const char * const gpg_home_dir);
 DLL_API int fko_get_gpg_home_dir(fko_ctx_t ctx, char **gpg_home_dir);
 
+DLL_API int fko_gpg_handle_new(fko_gpg_handle_t *gh, const char * const gpg_exe,
+    const char * const gpg_home_dir, const char * const recip);
+DLL_API void fko_gpg_handle_destroy(fko_gpg_handle_t gh);
+DLL_API int fko_set_gpg_handle(fko_ctx_t ctx, fko_gpg_handle_t gh);
+
 DLL_API const char* fko_gpg_errstr(fko_ctx_t ctx);
 
 DLL_API int fko_set_gpg_signature_verify(fko_ctx_t ctx,
@@ -0,0 +1,389 @@
+/*
+ *****************************************************************************
+ *
+ * File:    fko_batch.c
+ *
+ * Purpose: Generate many SPA packets from a template context in one call.
+ *
+ *  Fwknop is developed primarily by the people listed in the file 'AUTHORS'.
+ *  Copyright (C) 2009-2014 fwknop developers and contributors. For a full
+ *  list of contributors, see the file 'CREDITS'.
+ *
+ *  License (GNU General Public License):
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *  USA
+ *
+ *****************************************************************************
+*/
+#include "fko_common.h"
+#include "fko.h"
+#include "cipher_funcs.h"
+
+#ifndef WIN32
+  #include <pthread.h>
+#endif
+
+/* Items are handed to the workers in chunks of this many, and each chunk
+ * is copied into the output buffer with a single reservation.
+*/
+#define FKO_BATCH_CHUNK         64
+#define FKO_BATCH_MAX_THREADS   64
+
+/* Room for the largest SPA packet (encrypted data plus a base64 SHA512
+ * HMAC) and its NULL terminator.
+*/
+#define FKO_BATCH_SLOT_LEN      (MAX_SPA_ENCODED_MSG_SIZE + 128)
+
+/* State shared by the batch workers
+*/
+typedef struct fko_batch
+{
+    fko_ctx_t                   tmpl;
+    const fko_batch_item_t     *items;
+    int                         count;
+    const char                 *enc_key;
+    int                         enc_key_len;
+    const char                 *hmac_key;
+    int                         hmac_key_len;
+    char                       *spa_buf;
+    size_t                      spa_buf_len;
+    size_t                     *spa_offsets;
+    int                        *results;
+
+#ifndef WIN32
+    pthread_mutex_t             lock;
+#endif
+    int                         next_item;  /* first item not yet claimed */
+    size_t                      buf_used;
+    int                         buf_full;
+} fko_batch_t;
+
+/* Create a worker context with the settings of the template context.
+ * This is done once per worker so the username lookup and the other
+ * fko_new() work is not repeated for every packet.
+*/
+static int
+batch_ctx_new(fko_ctx_t tmpl, fko_ctx_t *r_ctx)
+{
+    fko_ctx_t   ctx = NULL;
+    int         res;
+
+    if((res = fko_new(&ctx)) != FKO_SUCCESS)
+        return(res);
+
+    if(tmpl->username != NULL)
+        res = fko_set_username(ctx, tmpl->username);
+    if(res == FKO_SUCCESS)
+        res = fko_set_spa_message_type(ctx, tmpl->message_type);
+    if(res == FKO_SUCCESS && tmpl->client_timeout > 0)
+        res = fko_set_spa_client_timeout(ctx, tmpl->client_timeout);
+    if(res == FKO_SUCCESS && tmpl->nat_access != NULL)
+        res = fko_set_spa_nat_access(ctx, tmpl->nat_access);
+    if(res == FKO_SUCCESS && tmpl->server_auth != NULL)
+        res = fko_set_spa_server_auth(ctx, tmpl->server_auth);
+    if(res == FKO_SUCCESS)
+        res = fko_set_spa_digest_type(ctx, tmpl->digest_type);
+    if(res == FKO_SUCCESS)
+        res = fko_set_spa_encryption_type(ctx, tmpl->encryption_type);
+    if(res == FKO_SUCCESS)
+        res = fko_set_spa_encryption_mode(ctx, tmpl->encryption_mode);
+    if(res == FKO_SUCCESS && tmpl->hmac_type != FKO_HMAC_UNKNOWN)
+        res = fko_set_spa_hmac_type(ctx, tmpl->hmac_type);
+    if(res == FKO_SUCCESS)
+        res = fko_set_disable_sdp_mode(ctx, tmpl->disable_sdp_mode);
+
+    if(res != FKO_SUCCESS)
+    {
+        fko_destroy(ctx);
+        return(res);
+    }
+
+    *r_ctx = ctx;
+    return(FKO_SUCCESS);
+}
+
+/* Make a random value the way fko_set_rand_value() does (16 digits), but
+ * from the given random bytes rather than from the shared rand() state,
+ * which the workers would otherwise reseed under each other.
+*/
+static void
+batch_rand_value(const unsigned char *bytes, char *rand_val)
+{
+    uint64_t    r = 0;
+    int         i;
+
+    for(i=0; i < 8; i++)
+        r = (r << 8) | bytes[i];
+
+    snprintf(rand_val, FKO_RAND_VAL_SIZE+1, "%llu",
+            (unsigned long long)(1000000000000000ULL + r % 9000000000000000ULL));
+    return;
+}
+
+/* Build one SPA packet in the worker context
+*/
+static int
+batch_build_one(fko_batch_t *b, fko_ctx_t ctx, const fko_batch_item_t *item,
+        const char *rand_val, char **spa_data)
+{
+    fko_ctx_t   tmpl = b->tmpl;
+    const char *msg  = item->message != NULL ? item->message : tmpl->message;
+    int         res;
+
+    res = fko_set_rand_value(ctx, item->rand_val != NULL ? item->rand_val : rand_val);
+    if(res != FKO_SUCCESS)
+        return(res);
+
+    if(msg == NULL)
+        return(FKO_ERROR_INCOMPLETE_SPA_DATA);
+
+    if((res = fko_set_spa_message(ctx, msg)) != FKO_SUCCESS)
+        return(res);
+
+    if((res = fko_set_sdp_id(ctx, item->sdp_id != 0 ? item->sdp_id : tmpl->sdp_id)) != FKO_SUCCESS)
+        return(res);
+
+    ctx->timestamp  = item->timestamp != 0 ? item->timestamp : tmpl->timestamp;
+    ctx->state     |= FKO_DATA_MODIFIED;
+
+    res = fko_spa_data_final(ctx, b->enc_key, b->enc_key_len,
+            b->hmac_key, b->hmac_key_len);
+    if(res != FKO_SUCCESS)
+        return(res);
+
+    return(fko_get_spa_data(ctx, spa_data));
+}
+
+/* Reserve room for a chunk of packets in the output buffer
+*/
+static int
+batch_reserve(fko_batch_t *b, const size_t len, size_t *offset)
+{
+    int     res = 0;
+
+#ifndef WIN32
+    pthread_mutex_lock(&b->lock);
+#endif
+    if(! b->buf_full && b->buf_used + len <= b->spa_buf_len)
+    {
+        *offset      = b->buf_used;
+        b->buf_used += len;
+        res = 1;
+    }
+    else
+        b->buf_full = 1;
+#ifndef WIN32
+    pthread_mutex_unlock(&b->lock);
+#endif
+
+    return(res);
+}
+
+static int
+batch_claim(fko_batch_t *b, int *full)
+{
+    int     first;
+
+#ifndef WIN32
+    pthread_mutex_lock(&b->lock);
+#endif
+    first         = b->next_item;
+    b->next_item += FKO_BATCH_CHUNK;
+    *full         = b->buf_full;
+#ifndef WIN32
+    pthread_mutex_unlock(&b->lock);
+#endif
+
+    return(first);
+}
+
+static void *
+batch_worker(void *arg)
+{
+    fko_batch_t    *b = (fko_batch_t *)arg;
+    fko_ctx_t       ctx = NULL;
+    char           *stage, *spa_data = NULL;
+    unsigned char   rand_bytes[FKO_BATCH_CHUNK * 8];
+    char            rand_val[FKO_RAND_VAL_SIZE+1];
+    size_t          lens[FKO_BATCH_CHUNK], staged, offset;
+    int             ctx_res, first, last, i, full;
+
+    ctx_res = batch_ctx_new(b->tmpl, &ctx);
+
+    stage = malloc(FKO_BATCH_CHUNK * FKO_BATCH_SLOT_LEN);
+    if(stage == NULL && ctx_res == FKO_SUCCESS)
+        ctx_res = FKO_ERROR_MEMORY_ALLOCATION;
+
+    while((first = batch_claim(b, &full)) < b->count)
+    {
+        last = first + FKO_BATCH_CHUNK < b->count ? first + FKO_BATCH_CHUNK : b->count;
+
+        if(ctx_res != FKO_SUCCESS || full)
+        {
+            for(i=first; i < last; i++)
+                b->results[i] = full ? FKO_ERROR_DATA_TOO_LARGE : ctx_res;
+            continue;
+        }
+
+        get_random_data(rand_bytes, sizeof(rand_bytes));
+
+        staged = 0;
+        for(i=first; i < last; i++)
+        {
+            lens[i-first] = 0;
+            batch_rand_value(rand_bytes + (i-first)*8, rand_val);
+
+            b->results[i] = batch_build_one(b, ctx, &b->items[i], rand_val, &spa_data);
+            if(b->results[i] != FKO_SUCCESS)
+                continue;
+
+            lens[i-first] = strnlen(spa_data, FKO_BATCH_SLOT_LEN) + 1;
+            if(lens[i-first] > FKO_BATCH_SLOT_LEN)
+            {
+                b->results[i] = FKO_ERROR_DATA_TOO_LARGE;
+                lens[i-first] = 0;
+                continue;
+            }
+            memcpy(stage + staged, spa_data, lens[i-first]);
+            staged += lens[i-first];
+        }
+
+        if(staged == 0)
+            continue;
+
+        if(! batch_reserve(b, staged, &offset))
+        {
+            for(i=first; i < last; i++)
+                if(b->results[i] == FKO_SUCCESS)
+                    b->results[i] = FKO_ERROR_DATA_TOO_LARGE;
+            continue;
+        }
+
+        memcpy(b->spa_buf + offset, stage, staged);
+        for(i=first; i < last; i++)
+        {
+            if(lens[i-first] == 0)
+                continue;
+            b->spa_offsets[i] = offset;
+            offset += lens[i-first];
+        }
+    }
+
+    if(stage != NULL)
+    {
+        zero_buf(stage, FKO_BATCH_CHUNK * FKO_BATCH_SLOT_LEN);
+        free(stage);
+    }
+    if(ctx != NULL)
+        fko_destroy(ctx);
+
+    return(NULL);
+}
+
+/* Generate count SPA packets from a template context, each with the
+ * overrides of its fko_batch_item_t.  The packets are written to spa_buf
+ * as NULL terminated strings, with the offset of packet i stored in
+ * spa_offsets[i] and its status in results[i].  The work is spread over
+ * num_threads threads.
+*/
+int
+fko_spa_data_batch(fko_ctx_t tmpl, const fko_batch_item_t * const items,
+    const int count, const char * const enc_key, const int enc_key_len,
+    const char * const hmac_key, const int hmac_key_len,
+    char * const spa_buf, const size_t spa_buf_len,
+    size_t * const spa_offsets, int * const results, const int num_threads)
+{
+    fko_batch_t     b;
+    int             i, nthreads = num_threads, res = FKO_SUCCESS;
+#ifndef WIN32
+    pthread_t       threads[FKO_BATCH_MAX_THREADS];
+    int             started = 0;
+#endif
+
+    /* Must be initialized
+    */
+    if(!CTX_INITIALIZED(tmpl))
+        return(FKO_ERROR_CTX_NOT_INITIALIZED);
+
+    if(count < 0 || (count > 0 && (items == NULL || spa_buf == NULL
+                    || spa_offsets == NULL || results == NULL)))
+        return(FKO_ERROR_INVALID_DATA);
+
+    if(enc_key == NULL || enc_key_len < 0 || hmac_key_len < 0)
+        return(FKO_ERROR_INVALID_KEY_LEN);
+
+    /* GnuPG encryption is driven through the gpg engine one packet at a
+     * time, so only Rijndael templates can be batched.
+    */
+    if(tmpl->encryption_type != FKO_ENCRYPTION_RIJNDAEL)
+        return(FKO_ERROR_UNSUPPORTED_FEATURE);
+
+    memset(&b, 0x0, sizeof(b));
+    b.tmpl          = tmpl;
+    b.items         = items;
+    b.count         = count;
+    b.enc_key       = enc_key;
+    b.enc_key_len   = enc_key_len;
+    b.hmac_key      = hmac_key;
+    b.hmac_key_len  = hmac_key_len;
+    b.spa_buf       = spa_buf;
+    b.spa_buf_len   = spa_buf_len;
+    b.spa_offsets   = spa_offsets;
+    b.results       = results;
+
+    if(nthreads < 1)
+        nthreads = 1;
+    if(nthreads > FKO_BATCH_MAX_THREADS)
+        nthreads = FKO_BATCH_MAX_THREADS;
+    if(nthreads > (count + FKO_BATCH_CHUNK - 1) / FKO_BATCH_CHUNK)
+        nthreads = (count + FKO_BATCH_CHUNK - 1) / FKO_BATCH_CHUNK;
+
+#ifdef WIN32
+    batch_worker(&b);
+#else
+    if(pthread_mutex_init(&b.lock, NULL) != 0)
+        return(FKO_ERROR_UNKNOWN);
+
+    /* The calling thread is one of the workers
+    */
+    for(i=1; i < nthreads; i++)
+    {
+        if(pthread_create(&threads[started], NULL, batch_worker, &b) != 0)
+            break;
+        started++;
+    }
+
+    batch_worker(&b);
+
+    for(i=0; i < started; i++)
+        pthread_join(threads[i], NULL);
+
+    pthread_mutex_destroy(&b.lock);
+#endif
+
+    for(i=0; i < count; i++)
+    {
+        if(results[i] != FKO_SUCCESS)
+        {
+            res = results[i];
+            break;
+        }
+    }
+
+    return(res);
+}
+
+/***EOF***/
@@ -50,6 +50,15 @@ struct fko_gpg_sig {
 };
 
 typedef struct fko_gpg_sig *fko_gpg_sig_t;
+
+/* A reusable gpgme context with its engine info set and its recipient
+ * key resolved up front (see fko_gpg_handle_new()).
+*/
+struct fko_gpg_handle {
+    gpgme_ctx_t         gpg_ctx;
+    char               *gpg_recipient;
+    gpgme_key_t         recipient_key;
+};
 #endif /* HAVE_LIBGPGME */
 
 /* The pieces we need to make an FKO  SPA data packet.
@@ -112,6 +121,7 @@ struct fko_context {
     char           *gpg_home_dir;
 
     unsigned char   have_gpgme_context;
+    unsigned char   gpg_ctx_borrowed;   /* gpg_ctx belongs to an fko_gpg_handle */
 
     gpgme_ctx_t     gpg_ctx;
     gpgme_key_t     recipient_key;
@@ -941,6 +941,138 @@ fko_get_gpg_home_dir(fko_ctx_t ctx, char **home_dir)
 #endif  /* HAVE_LIBGPGME */
 }
 
+/* Create a reusable GPG handle: a gpgme context bound to the given gpg
+ * executable and home directory, with the recipient key (if any) looked
+ * up once here instead of for every SPA packet.
+*/
+int
+fko_gpg_handle_new(fko_gpg_handle_t *r_gh, const char * const gpg_exe,
+        const char * const gpg_home_dir, const char * const recip)
+{
+#if HAVE_LIBGPGME
+    fko_gpg_handle_t    gh;
+    gpgme_error_t       gpg_err;
+    int                 res;
+
+    if(r_gh == NULL)
+        return(FKO_ERROR_INVALID_DATA);
+
+    *r_gh = NULL;
+
+    gh = calloc(1, sizeof *gh);
+    if(gh == NULL)
+        return(FKO_ERROR_MEMORY_ALLOCATION);
+
+    res = new_gpgme_ctx(&(gh->gpg_ctx), gpg_exe, gpg_home_dir, &gpg_err);
+    if(res != FKO_SUCCESS)
+    {
+        free(gh);
+        return(res);
+    }
+
+    if(recip != NULL)
+    {
+        gh->gpg_recipient = strdup(recip);
+        if(gh->gpg_recipient == NULL)
+        {
+            fko_gpg_handle_destroy(gh);
+            return(FKO_ERROR_MEMORY_ALLOCATION);
+        }
+
+        res = find_gpg_key(gh->gpg_ctx, recip, 0,
+                &(gh->recipient_key), &gpg_err);
+        if(res != FKO_SUCCESS)
+        {
+            fko_gpg_handle_destroy(gh);
+            return(res);
+        }
+    }
+
+    *r_gh = gh;
+
+    return(FKO_SUCCESS);
+#else
+    return(FKO_ERROR_UNSUPPORTED_FEATURE);
+#endif  /* HAVE_LIBGPGME */
+}
+
+/* Free a GPG handle.  It must not be lent to any FKO context at this point.
+*/
+void
+fko_gpg_handle_destroy(fko_gpg_handle_t gh)
+{
+#if HAVE_LIBGPGME
+    if(gh == NULL)
+        return;
+
+    if(gh->recipient_key != NULL)
+        gpgme_key_unref(gh->recipient_key);
+
+    if(gh->gpg_recipient != NULL)
+        free(gh->gpg_recipient);
+
+    if(gh->gpg_ctx != NULL)
+        gpgme_release(gh->gpg_ctx);
+
+    free(gh);
+#endif  /* HAVE_LIBGPGME */
+    return;
+}
+
+/* Lend the gpgme context (and recipient key) of a GPG handle to this FKO
+ * context.  This takes the place of fko_set_gpg_exe(),
+ * fko_set_gpg_home_dir() and fko_set_gpg_recipient(), and the handle must
+ * not be used by another FKO context until this one is destroyed or the
+ * handle is detached again by passing a NULL handle.
+*/
+int
+fko_set_gpg_handle(fko_ctx_t ctx, fko_gpg_handle_t gh)
+{
+#if HAVE_LIBGPGME
+    /* Must be initialized
+    */
+    if(!CTX_INITIALIZED(ctx))
+        return(FKO_ERROR_CTX_NOT_INITIALIZED);
+
+    if(gh == NULL)
+    {
+        if(ctx->gpg_ctx_borrowed)
+            release_gpgme_ctx(ctx);
+        return(FKO_SUCCESS);
+    }
+
+    if(gh->gpg_ctx == NULL)
+        return(FKO_ERROR_INVALID_DATA);
+
+    if(ctx->gpg_ctx != NULL)
+        release_gpgme_ctx(ctx);
+
+    ctx->gpg_ctx            = gh->gpg_ctx;
+    ctx->gpg_ctx_borrowed   = 1;
+    ctx->have_gpgme_context = 1;
+
+    if(gh->gpg_recipient != NULL)
+    {
+        if(ctx->gpg_recipient != NULL)
+            free(ctx->gpg_recipient);
+
+        ctx->gpg_recipient = strdup(gh->gpg_recipient);
+        if(ctx->gpg_recipient == NULL)
+            return(FKO_ERROR_MEMORY_ALLOCATION);
+
+        if(ctx->recipient_key != NULL)
+            gpgme_key_unref(ctx->recipient_key);
+
+        gpgme_key_ref(gh->recipient_key);
+        ctx->recipient_key = gh->recipient_key;
+    }
+
+    return(FKO_SUCCESS);
+#else
+    return(FKO_ERROR_UNSUPPORTED_FEATURE);
+#endif  /* HAVE_LIBGPGME */
+}
+
 int
 fko_set_gpg_signature_verify(fko_ctx_t ctx, const unsigned char val)
 {
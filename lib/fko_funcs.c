@@ -385,7 +385,7 @@ fko_destroy(fko_ctx_t ctx)
     if(ctx->signer_key != NULL)
         gpgme_key_unref(ctx->signer_key);
 
-    if(ctx->gpg_ctx != NULL)
+    if(ctx->gpg_ctx != NULL && ! ctx->gpg_ctx_borrowed)
         gpgme_release(ctx->gpg_ctx);
 
     gsig = ctx->gpg_sigs;
@@ -82,6 +82,72 @@ init_gpgme(fko_ctx_t fko_ctx)
     return(FKO_SUCCESS);
 }
 
+/* Create a standalone gpgme context that uses the given gpg executable
+ * and home directory (either may be NULL for the defaults).  Unlike
+ * init_gpgme(), the engine info is set on the context itself rather than
+ * globally, so several of these can coexist with different keyrings.
+*/
+int
+new_gpgme_ctx(gpgme_ctx_t *gpg_ctx, const char * const gpg_exe,
+        const char * const gpg_home_dir, gpgme_error_t *gpg_err)
+{
+    gpgme_ctx_t         ctx = NULL;
+    gpgme_error_t       err;
+
+    gpgme_check_version(NULL);
+
+    err = gpgme_engine_check_version(GPGME_PROTOCOL_OpenPGP);
+    if(gpg_err_code(err) != GPG_ERR_NO_ERROR)
+    {
+        *gpg_err = err;
+        return(FKO_ERROR_GPGME_NO_OPENPGP);
+    }
+
+    err = gpgme_new(&ctx);
+    if(gpg_err_code(err) != GPG_ERR_NO_ERROR)
+    {
+        *gpg_err = err;
+        return(FKO_ERROR_GPGME_CONTEXT);
+    }
+
+    err = gpgme_ctx_set_engine_info(ctx, GPGME_PROTOCOL_OpenPGP,
+            (gpg_exe != NULL) ? gpg_exe : GPG_EXE, gpg_home_dir);
+    if(gpg_err_code(err) != GPG_ERR_NO_ERROR)
+    {
+        gpgme_release(ctx);
+        *gpg_err = err;
+        return(FKO_ERROR_GPGME_CONTEXT);
+    }
+
+    err = gpgme_set_protocol(ctx, GPGME_PROTOCOL_OpenPGP);
+    if(gpg_err_code(err) != GPG_ERR_NO_ERROR)
+    {
+        gpgme_release(ctx);
+        *gpg_err = err;
+        return(FKO_ERROR_GPGME_SET_PROTOCOL);
+    }
+
+    gpgme_set_armor(ctx, 0);
+
+    *gpg_ctx = ctx;
+
+    return(FKO_SUCCESS);
+}
+
+/* Drop the gpgme context from an FKO context.  A context that was lent
+ * by an fko_gpg_handle is only detached (the handle still owns it).
+*/
+void
+release_gpgme_ctx(fko_ctx_t fko_ctx)
+{
+    if(fko_ctx->gpg_ctx != NULL && ! fko_ctx->gpg_ctx_borrowed)
+        gpgme_release(fko_ctx->gpg_ctx);
+
+    fko_ctx->gpg_ctx            = NULL;
+    fko_ctx->gpg_ctx_borrowed   = 0;
+    fko_ctx->have_gpgme_context = 0;
+}
+
 /* Callback function that supplies the password when gpgme needs it.
 */
 gpgme_error_t
@@ -178,45 +244,21 @@ process_sigs(fko_ctx_t fko_ctx, gpgme_verify_result_t vres)
     return(FKO_SUCCESS);
 }
 
-/* Get the GPG key for the given name or ID.
+/* Look up the GPG key for the given name or ID using the given gpgme
+ * context.  The name must match exactly one key.
 */
 int
-get_gpg_key(fko_ctx_t fko_ctx, gpgme_key_t *mykey, const int signer)
+find_gpg_key(gpgme_ctx_t list_ctx, const char * const name, const int signer,
+        gpgme_key_t *mykey, gpgme_error_t *gpg_err)
 {
-    int             res;
-    const char     *name;
-
-    gpgme_ctx_t     list_ctx    = NULL;
     gpgme_key_t     key         = NULL;
     gpgme_key_t     key2        = NULL;
     gpgme_error_t   err;
 
-    /* Create a gpgme context for the list
-    */
-    /* Initialize gpgme
-    */
-    res = init_gpgme(fko_ctx);
-    if(res != FKO_SUCCESS)
-    {
-        if(signer)
-            return(FKO_ERROR_GPGME_CONTEXT_SIGNER_KEY);
-        else
-            return(FKO_ERROR_GPGME_CONTEXT_RECIPIENT_KEY);
-    }
-
-    list_ctx = fko_ctx->gpg_ctx;
-
-    if(signer)
-        name = fko_ctx->gpg_signer;
-    else
-        name = fko_ctx->gpg_recipient;
-
     err = gpgme_op_keylist_start(list_ctx, name, signer);
     if (err)
     {
-        gpgme_release(list_ctx);
-
-        fko_ctx->gpg_err = err;
+        *gpg_err = err;
 
         if(signer)
             return(FKO_ERROR_GPGME_SIGNER_KEYLIST_START);
@@ -231,7 +273,7 @@ get_gpg_key(fko_ctx_t fko_ctx, gpgme_key_t *mykey, const int signer)
     {
         /* Key not found
         */
-        fko_ctx->gpg_err = err;
+        *gpg_err = err;
 
         if(signer)
             return(FKO_ERROR_GPGME_SIGNER_KEY_NOT_FOUND);
@@ -250,7 +292,7 @@ get_gpg_key(fko_ctx_t fko_ctx, gpgme_key_t *mykey, const int signer)
         gpgme_key_unref(key);
         gpgme_key_unref(key2);
 
-        fko_ctx->gpg_err = err;
+        *gpg_err = err;
 
         if(signer)
             return(FKO_ERROR_GPGME_SIGNER_KEY_AMBIGUOUS);
@@ -267,6 +309,40 @@ get_gpg_key(fko_ctx_t fko_ctx, gpgme_key_t *mykey, const int signer)
     return(FKO_SUCCESS);
 }
 
+/* Get the GPG key for the given name or ID.
+*/
+int
+get_gpg_key(fko_ctx_t fko_ctx, gpgme_key_t *mykey, const int signer)
+{
+    int             res;
+    const char     *name;
+
+    /* Initialize gpgme
+    */
+    res = init_gpgme(fko_ctx);
+    if(res != FKO_SUCCESS)
+    {
+        if(signer)
+            return(FKO_ERROR_GPGME_CONTEXT_SIGNER_KEY);
+        else
+            return(FKO_ERROR_GPGME_CONTEXT_RECIPIENT_KEY);
+    }
+
+    if(signer)
+        name = fko_ctx->gpg_signer;
+    else
+        name = fko_ctx->gpg_recipient;
+
+    res = find_gpg_key(fko_ctx->gpg_ctx, name, signer, mykey,
+            &(fko_ctx->gpg_err));
+
+    if(res == FKO_ERROR_GPGME_SIGNER_KEYLIST_START
+            || res == FKO_ERROR_GPGME_RECIPIENT_KEYLIST_START)
+        release_gpgme_ctx(fko_ctx);
+
+    return(res);
+}
+
 /* The main GPG encryption routine for libfko.
 */
 int
@@ -295,8 +371,7 @@ gpgme_encrypt(fko_ctx_t fko_ctx, unsigned char *indata, size_t in_len,
     err = gpgme_data_new_from_mem(&plaintext, (char*)indata, in_len, 1);
     if(gpg_err_code(err) != GPG_ERR_NO_ERROR)
     {
-        gpgme_release(gpg_ctx);
-        fko_ctx->gpg_ctx = NULL;
+        release_gpgme_ctx(fko_ctx);
         fko_ctx->gpg_err = err;
 
         return(FKO_ERROR_GPGME_PLAINTEXT_DATA_OBJ);
@@ -308,8 +383,7 @@ gpgme_encrypt(fko_ctx_t fko_ctx, unsigned char *indata, size_t in_len,
     if(gpg_err_code(err) != GPG_ERR_NO_ERROR)
     {
         gpgme_data_release(plaintext);
-        gpgme_release(gpg_ctx);
-        fko_ctx->gpg_ctx = NULL;
+        release_gpgme_ctx(fko_ctx);
 
         fko_ctx->gpg_err = err;
 
@@ -332,8 +406,7 @@ gpgme_encrypt(fko_ctx_t fko_ctx, unsigned char *indata, size_t in_len,
     if(gpg_err_code(err) != GPG_ERR_NO_ERROR)
     {
         gpgme_data_release(plaintext);
-        gpgme_release(gpg_ctx);
-        fko_ctx->gpg_ctx = NULL;
+        release_gpgme_ctx(fko_ctx);
 
         fko_ctx->gpg_err = err;
 
@@ -349,8 +422,7 @@ gpgme_encrypt(fko_ctx_t fko_ctx, unsigned char *indata, size_t in_len,
         {
             gpgme_data_release(plaintext);
             gpgme_data_release(cipher);
-            gpgme_release(gpg_ctx);
-            fko_ctx->gpg_ctx = NULL;
+            release_gpgme_ctx(fko_ctx);
 
             fko_ctx->gpg_err = err;
 
@@ -377,8 +449,7 @@ gpgme_encrypt(fko_ctx_t fko_ctx, unsigned char *indata, size_t in_len,
     {
         gpgme_data_release(plaintext);
         gpgme_data_release(cipher);
-        gpgme_release(gpg_ctx);
-        fko_ctx->gpg_ctx = NULL;
+        release_gpgme_ctx(fko_ctx);
 
         fko_ctx->gpg_err = err;
 
@@ -438,8 +509,7 @@ gpgme_decrypt(fko_ctx_t fko_ctx, unsigned char *indata,
     err = gpgme_data_new(&plaintext);
     if(gpg_err_code(err) != GPG_ERR_NO_ERROR)
     {
-        gpgme_release(gpg_ctx);
-        fko_ctx->gpg_ctx = NULL;
+        release_gpgme_ctx(fko_ctx);
 
         fko_ctx->gpg_err = err;
 
@@ -452,8 +522,7 @@ gpgme_decrypt(fko_ctx_t fko_ctx, unsigned char *indata,
     if(gpg_err_code(err) != GPG_ERR_NO_ERROR)
     {
         gpgme_data_release(plaintext);
-        gpgme_release(gpg_ctx);
-        fko_ctx->gpg_ctx = NULL;
+        release_gpgme_ctx(fko_ctx);
 
         fko_ctx->gpg_err = err;
 
@@ -471,8 +540,7 @@ gpgme_decrypt(fko_ctx_t fko_ctx, unsigned char *indata,
     {
         gpgme_data_release(plaintext);
         gpgme_data_release(cipher);
-        gpgme_release(gpg_ctx);
-        fko_ctx->gpg_ctx = NULL;
+        release_gpgme_ctx(fko_ctx);
 
         fko_ctx->gpg_err = err;
 
@@ -490,8 +558,7 @@ gpgme_decrypt(fko_ctx_t fko_ctx, unsigned char *indata,
     if(decrypt_res->unsupported_algorithm)
     {
         gpgme_data_release(plaintext);
-        gpgme_release(gpg_ctx);
-        fko_ctx->gpg_ctx = NULL;
+        release_gpgme_ctx(fko_ctx);
 
         return(FKO_ERROR_GPGME_DECRYPT_UNSUPPORTED_ALGORITHM);
     }
@@ -507,8 +574,7 @@ gpgme_decrypt(fko_ctx_t fko_ctx, unsigned char *indata,
         if(res != FKO_SUCCESS)
         {
             gpgme_data_release(plaintext);
-            gpgme_release(gpg_ctx);
-            fko_ctx->gpg_ctx = NULL;
+            release_gpgme_ctx(fko_ctx);
 
             return(res);
         }
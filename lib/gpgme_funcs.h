@@ -41,6 +41,11 @@ int gpgme_encrypt(fko_ctx_t ctx, unsigned char *in, size_t len, const char *pw,
 int gpgme_decrypt(fko_ctx_t ctx, unsigned char *in, size_t len, const char *pw, unsigned char **out, size_t *out_len);
 #if HAVE_LIBGPGME
   int get_gpg_key(fko_ctx_t fko_ctx, gpgme_key_t *mykey, const int signer);
+  int new_gpgme_ctx(gpgme_ctx_t *gpg_ctx, const char * const gpg_exe,
+          const char * const gpg_home_dir, gpgme_error_t *gpg_err);
+  int find_gpg_key(gpgme_ctx_t list_ctx, const char * const name,
+          const int signer, gpgme_key_t *mykey, gpgme_error_t *gpg_err);
+  void release_gpgme_ctx(fko_ctx_t fko_ctx);
 #endif
 
 #endif /* GPGME_FUNCS_H */
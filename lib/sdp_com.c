@@ -4,13 +4,26 @@
  *  Created on: Apr 12, 2016
  *      Author: Daniel Bailey
  */
+#if HAVE_CONFIG_H
+  #include "config.h"
+#endif
 #include "sdp_ctrl_client.h"
 #include "sdp_com.h"
 #include "sdp_errors.h"
 #include "sdp_message.h"
 #include "sdp_log_msg.h"
+#include <ctype.h>
 #include <netdb.h>
 #include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <openssl/rand.h>
+#if HAVE_LIBZ
+  #include <zlib.h>
+#endif
 #include <stdlib.h>
 #include <string.h>
 #include <sys/time.h>
@@ -215,13 +228,361 @@ static int sdp_com_get_ssl_error(SSL *ssl, int rv, char *r_ssl_error)
     return value;
 }
 
+/* Pick a retry delay somewhere in the upper half of interval so a fleet
+ * of clients that lost the controller at the same moment does not come
+ * back in lock step.
+ */
+static unsigned int sdp_com_jitter(unsigned int interval, unsigned int floor)
+{
+    unsigned int r = 0;
+
+    if(interval <= floor)
+        return interval;
+
+    if(RAND_bytes((unsigned char *)&r, sizeof(r)) != 1)
+        r = (unsigned int)random();
+
+    return floor + r % (interval - floor + 1);
+}
+
+/* OpenSSL calls this whenever the controller issues a new session ID or
+ * ticket. We keep our own reference so it survives SSL_free(), and save
+ * it to disk so that a restarted client can resume as well.
+ */
+static int sdp_com_new_session_cb(SSL *ssl, SSL_SESSION *session)
+{
+    sdp_com_t com = SSL_get_app_data(ssl);
+    FILE *fp = NULL;
+    int fd = -1;
+
+    if(com == NULL)
+        return 0;
+
+    if(com->tls_session != NULL)
+        SSL_SESSION_free(com->tls_session);
+    com->tls_session = session;
+
+    if(com->tls_session_file == NULL)
+        return 1;
+
+    if((fd = open(com->tls_session_file, O_WRONLY|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR)) < 0
+            || (fp = fdopen(fd, "w")) == NULL)
+    {
+        log_msg(LOG_WARNING, "Could not open TLS session file %s: %s",
+                com->tls_session_file, strerror(errno));
+        if(fd >= 0)
+            close(fd);
+        return 1;
+    }
+
+    if(!PEM_write_SSL_SESSION(fp, session))
+        log_msg(LOG_WARNING, "Could not write TLS session file %s",
+                com->tls_session_file);
+
+    fclose(fp);
+    return 1;
+}
+
+/* Pick up the session saved by a previous run, if it has not expired.
+ */
+static void sdp_com_load_session(sdp_com_t com)
+{
+    SSL_SESSION *session = NULL;
+    FILE *fp = NULL;
+
+    if(com->tls_session_file == NULL)
+        return;
+
+    if((fp = fopen(com->tls_session_file, "r")) == NULL)
+        return;
+
+    session = PEM_read_SSL_SESSION(fp, NULL, NULL, NULL);
+    fclose(fp);
+
+    if(session == NULL)
+    {
+        log_msg(LOG_WARNING, "Ignoring unreadable TLS session file %s",
+                com->tls_session_file);
+        return;
+    }
+
+    if(SSL_SESSION_get_time(session) + SSL_SESSION_get_timeout(session) <= time(NULL))
+    {
+        log_msg(LOG_DEBUG, "Saved TLS session has expired");
+        SSL_SESSION_free(session);
+        return;
+    }
+
+    com->tls_session = session;
+}
+
+/* Expand a compressed message body into a new NUL terminated string
+ */
+static int sdp_com_inflate(const char *in, int in_len, char **r_msg, int *r_len)
+{
+#if HAVE_LIBZ
+    uLongf out_len = SDP_MSG_MAX_LEN;
+    char *out = NULL, *tmp = NULL;
+
+    if((out = malloc(SDP_MSG_MAX_LEN + 1)) == NULL)
+        return SDP_ERROR_MEMORY_ALLOCATION;
+
+    if(uncompress((Bytef *)out, &out_len, (const Bytef *)in, in_len) != Z_OK)
+    {
+        log_msg(LOG_ERR, "Failed to inflate compressed message (or it exceeds %d bytes)",
+                SDP_MSG_MAX_LEN);
+        free(out);
+        return SDP_ERROR_INVALID_MSG;
+    }
+
+    if(out_len < SDP_MSG_MIN_LEN)
+    {
+        log_msg(LOG_ERR, "Inflated message was shorter than minimum message size");
+        free(out);
+        return SDP_ERROR_INVALID_MSG_SHORT;
+    }
+
+    out[out_len] = '\0';
+
+    // give back the unused part of the maximum size buffer
+    if((tmp = realloc(out, out_len + 1)) != NULL)
+        out = tmp;
+
+    *r_msg = out;
+    *r_len = (int)out_len;
+    return SDP_SUCCESS;
+#else
+    log_msg(LOG_ERR, "Received a compressed message, but built without zlib support");
+    return SDP_ERROR_INVALID_MSG;
+#endif
+}
+
+/**
+ * @brief Check whether a message advertises compression support
+ *
+ * True if the message object starts with the "compression": "deflate"
+ * member (see SDP_COM_DEFLATE_ADVERT), with any whitespace around the
+ * tokens.
+ *
+ * @param msg - NUL terminated message body
+ *
+ * @return 1 if it does, 0 if not
+ */
+int sdp_com_msg_advertises_deflate(const char *msg)
+{
+    const char *tokens[] = { "{", "\"compression\"", ":", "\"deflate\"" };
+    size_t idx = 0;
+
+    if(msg == NULL)
+        return 0;
+
+    for(idx = 0; idx < sizeof(tokens)/sizeof(tokens[0]); idx++)
+    {
+        while(isspace((unsigned char)*msg))
+            msg++;
+
+        if(strncmp(msg, tokens[idx], strlen(tokens[idx])) != 0)
+            return 0;
+
+        msg += strlen(tokens[idx]);
+    }
+
+    return 1;
+}
+
+static int sdp_com_buf_reserve(char **buf, size_t *size, size_t needed)
+{
+    size_t new_size = *size ? *size : SDP_COM_MAX_MSG_BLOCK_LEN;
+    char *new_buf = NULL;
+
+    if(needed <= *size)
+        return SDP_SUCCESS;
+
+    while(new_size < needed)
+        new_size *= 2;
+
+    if((new_buf = realloc(*buf, new_size)) == NULL)
+        return SDP_ERROR_MEMORY_ALLOCATION;
+
+    *buf = new_buf;
+    *size = new_size;
+    return SDP_SUCCESS;
+}
+
+/* Hand as much of the send queue to OpenSSL as the socket will take
+ * without blocking. Everything queued is passed in one SSL_write, so
+ * several small messages share a TLS record. Whatever is left goes out
+ * the next time the socket polls writable.
+ */
+static int sdp_com_flush(sdp_com_t com)
+{
+    int bytes = 0;
+    int ssl_error = 0;
+    char ssl_error_string[SDP_MAX_LINE_LEN];
+
+    while(com->send_off < com->send_len)
+    {
+        if((bytes = SSL_write(com->ssl, com->send_buf + com->send_off,
+                (int)(com->send_len - com->send_off))) <= 0)
+        {
+            ssl_error = sdp_com_get_ssl_error(com->ssl, bytes, ssl_error_string);
+
+            if(ssl_error == SSL_ERROR_WANT_READ || ssl_error == SSL_ERROR_WANT_WRITE)
+                return SDP_SUCCESS;
+
+            log_msg(LOG_ERR, "Error from SSL_write: %s", ssl_error_string);
+
+            // All other cases, tear down and start again
+            com->send_off = com->send_len = 0;
+            sdp_com_disconnect(com);
+            return SDP_ERROR_SOCKET_WRITE;
+        }
+
+        com->send_off += bytes;
+    }
+
+    com->send_off = com->send_len = 0;
+    return SDP_SUCCESS;
+}
+
+/* Give queued messages a last chance to go out before the connection
+ * is closed, waiting at most the write timeout. Messages sent just
+ * before disconnecting, like a credential update ack, would otherwise
+ * never leave the queue.
+ */
+static void sdp_com_drain(sdp_com_t com)
+{
+    struct pollfd pfd;
+    int bytes = 0;
+    int ssl_error = 0;
+    int timeout_ms = (int)(com->write_timeout.tv_sec * 1000
+                   + com->write_timeout.tv_usec / 1000);
+
+    memset(&pfd, 0, sizeof(pfd));
+    pfd.fd = com->socket_descriptor;
+
+    while(com->send_off < com->send_len)
+    {
+        if((bytes = SSL_write(com->ssl, com->send_buf + com->send_off,
+                (int)(com->send_len - com->send_off))) > 0)
+        {
+            com->send_off += bytes;
+            continue;
+        }
+
+        ssl_error = SSL_get_error(com->ssl, bytes);
+        if(ssl_error == SSL_ERROR_WANT_WRITE)
+            pfd.events = POLLOUT;
+        else if(ssl_error == SSL_ERROR_WANT_READ)
+            pfd.events = POLLIN;
+        else
+            break;
+
+        if(poll(&pfd, 1, timeout_ms) <= 0)
+            break;
+    }
+
+    if(com->send_off < com->send_len)
+        log_msg(LOG_WARNING, "Dropping %u unsent bytes on disconnect",
+                (unsigned int)(com->send_len - com->send_off));
+}
+
+/* Pull everything OpenSSL can give us right now into the receive
+ * buffer, stopping once a maximum size frame is buffered so a peer
+ * cannot make us grow without bound.
+ */
+static int sdp_com_fill(sdp_com_t com)
+{
+    int rv = SDP_SUCCESS;
+    int bytes = 0;
+    int ssl_error = 0;
+    char ssl_error_string[SDP_MAX_LINE_LEN];
+
+    // frames already handed out are dropped here, once per read,
+    // instead of shifting the buffer after every message
+    if(com->recv_off > 0)
+    {
+        com->recv_len -= com->recv_off;
+        if(com->recv_len > 0)
+            memmove(com->recv_buf, com->recv_buf + com->recv_off, com->recv_len);
+        com->recv_off = 0;
+    }
+
+    while(com->recv_len < SDP_COM_HEADER_LEN + SDP_MSG_MAX_LEN)
+    {
+        if((rv = sdp_com_buf_reserve(&(com->recv_buf), &(com->recv_size),
+                com->recv_len + SDP_COM_MAX_MSG_BLOCK_LEN)) != SDP_SUCCESS)
+            return rv;
+
+        if((bytes = SSL_read(com->ssl, com->recv_buf + com->recv_len,
+                SDP_COM_MAX_MSG_BLOCK_LEN)) <= 0)
+        {
+            ssl_error = sdp_com_get_ssl_error(com->ssl, bytes, ssl_error_string);
+
+            if(ssl_error == SSL_ERROR_WANT_READ || ssl_error == SSL_ERROR_WANT_WRITE)
+                return SDP_SUCCESS;
+
+            if(ssl_error == SSL_ERROR_ZERO_RETURN)
+                log_msg(LOG_WARNING, "Controller closed the connection");
+            else
+                log_msg(LOG_ERR, "Error from SSL_read: %s", ssl_error_string);
+
+            sdp_com_disconnect(com);
+            return SDP_ERROR_CONN_DOWN;
+        }
+
+        com->recv_len += bytes;
+    }
+
+    return SDP_SUCCESS;
+}
+
+/* Returns the length of the body in the first complete frame of the
+ * receive buffer, 0 if no frame is complete yet, or -1 if the header
+ * announces a length outside the protocol limits. r_deflated, if not
+ * NULL, is set when the body is compressed.
+ */
+static int sdp_com_frame_ready(sdp_com_t com, int *r_deflated)
+{
+    uint32_t data_length = 0;
+    int deflated = 0;
+    unsigned char *p = (unsigned char *)com->recv_buf + com->recv_off;
+    size_t avail = com->recv_len - com->recv_off;
+
+    if(avail < SDP_COM_HEADER_LEN)
+        return 0;
+
+    data_length = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16)
+                | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+
+    if(data_length & SDP_COM_HEADER_DEFLATED)
+    {
+        deflated = 1;
+        data_length &= ~SDP_COM_HEADER_DEFLATED;
+    }
+
+    // a compressed body is checked against the minimum once inflated
+    if(data_length > SDP_MSG_MAX_LEN
+            || data_length == 0
+            || (!deflated && data_length < SDP_MSG_MIN_LEN))
+        return -1;
+
+    if(r_deflated != NULL)
+        *r_deflated = deflated;
+
+    if(avail < SDP_COM_HEADER_LEN + data_length)
+        return 0;
+
+    return (int)data_length;
+}
+
 
 static int sdp_com_socket_connect(sdp_com_t com)
 {
     int rv = SDP_SUCCESS;
     char ssl_error_string[SDP_MAX_LINE_LEN];
     int ssl_error = 0;
-    int sd, true, conn_success = 0;
+    int sd, true, flags, conn_success = 0;
     struct sockaddr_in addr;
     struct addrinfo *server_info=NULL, *rp, hints;
     char   port[SDP_COM_MAX_PORT_STRING_BUFFER_LEN] = {0};
@@ -343,6 +704,18 @@ static int sdp_com_socket_connect(sdp_com_t com)
     // so set the socket_descriptor field for such situations
     com->socket_descriptor = sd;
 
+    // the send queue may be moved or trimmed between retries of a write
+    SSL_set_mode(com->ssl, SSL_MODE_ENABLE_PARTIAL_WRITE |
+                           SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+    // lets sdp_com_new_session_cb find its way back to us
+    SSL_set_app_data(com->ssl, com);
+
+    // offer the last session so the controller can skip the full
+    // handshake, it falls back on its own if the session is unknown
+    if(com->tls_session != NULL && !SSL_set_session(com->ssl, com->tls_session))
+        log_msg(LOG_WARNING, "Failed to set cached TLS session");
+
     log_msg(LOG_DEBUG, "Created new SSL object, setting socket descriptor field in the SSL object");
 
     // set the socket descriptor field in the ssl object
@@ -364,17 +737,35 @@ static int sdp_com_socket_connect(sdp_com_t com)
 
         log_msg(LOG_ERR, "Error from SSL_connect: %d - %s", ssl_error, ssl_error_string);
 
+        // do not keep offering a session that may be the problem
+        if(com->tls_session != NULL)
+        {
+            SSL_SESSION_free(com->tls_session);
+            com->tls_session = NULL;
+        }
+
         sdp_com_disconnect(com);
         return SDP_ERROR_SSL_HANDSHAKE;
     }
 
-    log_msg(LOG_NOTICE, "Connected with %s encryption", SSL_get_cipher(com->ssl));
+    log_msg(LOG_NOTICE, "Connected with %s encryption%s", SSL_get_cipher(com->ssl),
+            SSL_session_reused(com->ssl) ? " (resumed session)" : "");
     if((rv = sdp_com_show_certs(com)) != SDP_SUCCESS)
     {
         sdp_com_disconnect(com);
         return rv;
     }
 
+    // the handshake above relies on the socket timeouts, everything
+    // after it is driven by sdp_com_wait()
+    if((flags = fcntl(sd, F_GETFL, 0)) < 0
+            || fcntl(sd, F_SETFL, flags | O_NONBLOCK) < 0)
+    {
+        log_msg(LOG_ERR, "Failed to make controller socket non-blocking");
+        sdp_com_disconnect(com);
+        return SDP_ERROR_SOCKET_OPTION;
+    }
+
     return SDP_SUCCESS;
 }
 
@@ -483,6 +874,22 @@ int sdp_com_init(sdp_com_t com)
     if((rv = sdp_com_load_certs(com->ssl_ctx, com->cert_file, com->key_file)) != SDP_SUCCESS)
         return rv;
 
+#if ! HAVE_LIBZ
+    if(com->compress_msgs)
+    {
+        log_msg(LOG_WARNING, "COMPRESS_MESSAGES is set, but built without zlib support. "
+                "Sending uncompressed messages.");
+        com->compress_msgs = 0;
+    }
+#endif
+
+    // there is only ever one server, so skip OpenSSL's internal session
+    // cache and hold on to the latest session ourselves
+    SSL_CTX_set_session_cache_mode(com->ssl_ctx,
+            SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(com->ssl_ctx, sdp_com_new_session_cb);
+    sdp_com_load_session(com);
+
     // disable the SIGPIPE signal and handle dropped connections as needed
     signal(SIGPIPE, SIG_IGN);
 
@@ -538,6 +945,15 @@ void sdp_com_destroy(sdp_com_t com)
     if(com->ssl_ctx != NULL)
         SSL_CTX_free(com->ssl_ctx);
 
+    if(com->tls_session != NULL)
+        SSL_SESSION_free(com->tls_session);
+
+    if(com->tls_session_file != NULL)
+        free(com->tls_session_file);
+
+    free(com->recv_buf);
+    free(com->send_buf);
+
     // free the OpenSSL digests and algorithms
     EVP_cleanup();
 
@@ -574,7 +990,7 @@ int sdp_com_state_get(sdp_com_t com, int *state)
 int sdp_com_connect(sdp_com_t com)
 {
     int rv = SDP_SUCCESS;
-    uint32_t interval;
+    uint32_t interval, retry_wait;
     int attempts_remaining;
     char *plural;
 
@@ -583,6 +999,16 @@ int sdp_com_connect(sdp_com_t com)
 
     interval = com->initial_conn_attempt_interval;
 
+    // after losing an established connection, every client of this
+    // controller is about to reconnect, so spread out the first attempt
+    if(com->had_connection && com->conn_attempts == 0)
+    {
+        interval = sdp_com_jitter(com->initial_conn_attempt_interval, 0);
+        log_msg(LOG_NOTICE, "Reconnecting to controller in %u seconds", interval);
+        sleep(interval);
+        interval = com->initial_conn_attempt_interval;
+    }
+
     while(com->conn_state != SDP_COM_CONNECTED)
     {
         com->conn_attempts += 1;
@@ -631,10 +1057,11 @@ int sdp_com_connect(sdp_com_t com)
                 }
             }
 
+            retry_wait = sdp_com_jitter(interval, interval / 2);
             log_msg(LOG_WARNING,
-                    "Waiting %d seconds until retry",
-                    interval);
-            sleep(interval);
+                    "Waiting %u seconds until retry",
+                    retry_wait);
+            sleep(retry_wait);
 
             interval *= 2;
             if(interval > SDP_COM_MAX_RETRY_INTERVAL_SECONDS)
@@ -645,6 +1072,7 @@ int sdp_com_connect(sdp_com_t com)
             // have successfully connected
             com->conn_attempts = 0;
             com->conn_state = SDP_COM_CONNECTED;
+            com->had_connection = 1;
             break;
         }
     }
@@ -662,6 +1090,9 @@ int sdp_com_disconnect(sdp_com_t com)
 
     if(com->ssl != NULL)
     {
+        if(com->conn_state == SDP_COM_CONNECTED && com->send_off < com->send_len)
+            sdp_com_drain(com);
+
         log_msg(LOG_DEBUG, "Tearing down SSL object");
         SSL_shutdown(com->ssl);
         SSL_free(com->ssl);
@@ -679,6 +1110,12 @@ int sdp_com_disconnect(sdp_com_t com)
         com->socket_descriptor = 0;
     }
 
+    // partial frames from the old session are meaningless on a new one,
+    // and compression has to be negotiated again
+    com->recv_off = com->recv_len = 0;
+    com->send_off = com->send_len = 0;
+    com->peer_deflate = 0;
+
     com->conn_state = SDP_COM_DISCONNECTED;
 
     log_msg(LOG_DEBUG, "Exiting sdp_com_disconnect");
@@ -722,11 +1159,14 @@ int sdp_com_show_certs(sdp_com_t com)
 int sdp_com_send_msg(sdp_com_t com, const char *msg)
 {
     uint32_t msg_len = 0;
-    int bytes_sent = 0;
-    char ssl_error_string[SDP_MAX_LINE_LEN];
-    int ssl_error = 0;
-    //sdp_header header;
-    char header[4];
+    uint32_t header = 0;
+    size_t max_body_len = 0;
+    int rv = SDP_SUCCESS;
+    char *frame = NULL;
+    char *adv_msg = NULL;
+#if HAVE_LIBZ
+    uLongf z_len = 0;
+#endif
 
     log_msg(LOG_DEBUG, "Entered sdp_com_send_msg");
 
@@ -754,58 +1194,103 @@ int sdp_com_send_msg(sdp_com_t com, const char *msg)
         return SDP_ERROR_INVALID_MSG_SHORT;
     }
 
+    // until the controller has said it can inflate messages, tell it
+    // that we can (it may then start compressing, which also counts as
+    // its go-ahead), but send everything uncompressed
+    if(com->compress_msgs && !com->peer_deflate && msg[0] == '{' && msg[1] != '}'
+            && msg_len + strlen(SDP_COM_DEFLATE_ADVERT) - 1 < SDP_MSG_MAX_LEN)
+    {
+        if((adv_msg = malloc(msg_len + strlen(SDP_COM_DEFLATE_ADVERT))) == NULL)
+            return SDP_ERROR_MEMORY_ALLOCATION;
+
+        strcpy(adv_msg, SDP_COM_DEFLATE_ADVERT);
+        strcat(adv_msg, msg + 1);
+        msg = adv_msg;
+        msg_len = strlen(msg);
+    }
+
     log_msg(LOG_DEBUG, "Message to send: ");
     log_msg(LOG_DEBUG, "  %s", msg);
 
-    //header.length = htonl(msg_len);
-    header[0] = (char)( (msg_len >> 24) & 0xFF );
-    header[1] = (char)( (msg_len >> 16) & 0xFF );
-    header[2] = (char)( (msg_len >> 8) & 0xFF );
-    header[3] = (char)(  msg_len & 0xFF );
+    max_body_len = msg_len;
 
-    if((bytes_sent = SSL_write(com->ssl, header, SDP_COM_HEADER_LEN)) != SDP_COM_HEADER_LEN){
-        ssl_error = sdp_com_get_ssl_error(com->ssl, bytes_sent, ssl_error_string);
+#if HAVE_LIBZ
+    if(com->compress_msgs && com->peer_deflate && msg_len >= SDP_COM_COMPRESS_MIN_LEN)
+        max_body_len = compressBound(msg_len);
+#endif
 
-        log_msg(LOG_ERR, "Error from SSL_write: %s", ssl_error_string);
+    // move what is still unsent to the front before adding to it
+    if(com->send_off > 0)
+    {
+        com->send_len -= com->send_off;
+        memmove(com->send_buf, com->send_buf + com->send_off, com->send_len);
+        com->send_off = 0;
+    }
 
-        // All other cases, tear down and start again
+    // a controller that stops reading will eventually fill the queue,
+    // treat that like any other dead connection
+    if(com->send_len + SDP_COM_HEADER_LEN + max_body_len > SDP_COM_MAX_SEND_Q_LEN)
+    {
+        log_msg(LOG_ERR, "Send queue to controller is full, dropping connection");
+        com->send_len = 0;
         sdp_com_disconnect(com);
+        free(adv_msg);
         return SDP_ERROR_SOCKET_WRITE;
     }
-    
-    // encrypt and send
-    if((bytes_sent = SSL_write(com->ssl, msg, msg_len)) != msg_len)
-    {
-        ssl_error = sdp_com_get_ssl_error(com->ssl, bytes_sent, ssl_error_string);
 
-        log_msg(LOG_ERR, "Error from SSL_write: %s", ssl_error_string);
+    if((rv = sdp_com_buf_reserve(&(com->send_buf), &(com->send_size),
+            com->send_len + SDP_COM_HEADER_LEN + max_body_len)) != SDP_SUCCESS)
+    {
+        free(adv_msg);
+        return rv;
+    }
 
-        if(ssl_error == SSL_ERROR_WANT_READ || ssl_error == SSL_ERROR_WANT_WRITE)
-        {
-            // retry one time
-            if((bytes_sent = SSL_write(com->ssl, msg, msg_len)) == msg_len)
-            {
-                log_msg(LOG_ERR, "SSL_write succeeded on second attempt");
-                return SDP_SUCCESS;
-            }
-        }
+    // header and body are queued together so they go out in as few
+    // TLS records as the socket allows
+    frame = com->send_buf + com->send_len;
+    header = msg_len;
 
-        // All other cases, tear down and start again
-        sdp_com_disconnect(com);
-        return SDP_ERROR_SOCKET_WRITE;
+#if HAVE_LIBZ
+    // compress straight into the queue, keeping the result only if it
+    // actually saves something
+    if(max_body_len > msg_len)
+    {
+        z_len = max_body_len;
+        if(compress2((Bytef *)frame + SDP_COM_HEADER_LEN, &z_len,
+                    (const Bytef *)msg, msg_len, Z_DEFAULT_COMPRESSION) == Z_OK
+                && z_len < msg_len)
+            header = (uint32_t)z_len | SDP_COM_HEADER_DEFLATED;
     }
-    // if we got here, all is well
-    return SDP_SUCCESS;
+#endif
+
+    if(!(header & SDP_COM_HEADER_DEFLATED))
+        memcpy(frame + SDP_COM_HEADER_LEN, msg, msg_len);
+
+    frame[0] = (char)( (header >> 24) & 0xFF );
+    frame[1] = (char)( (header >> 16) & 0xFF );
+    frame[2] = (char)( (header >> 8) & 0xFF );
+    frame[3] = (char)(  header & 0xFF );
+    com->send_len += SDP_COM_HEADER_LEN + (header & ~SDP_COM_HEADER_DEFLATED);
+    free(adv_msg);
+
+    // hold small messages back so that everything a run loop pass
+    // produces (acks, connection updates, a keep-alive) is written
+    // together by sdp_com_wait or sdp_com_get_msg; once a full TLS
+    // record's worth is queued there is nothing to gain by waiting
+    if(com->send_len < SDP_COM_MAX_MSG_BLOCK_LEN)
+        return SDP_SUCCESS;
+
+    return sdp_com_flush(com);
 }
 
 
 int sdp_com_get_msg(sdp_com_t com, char **r_msg, int *r_bytes)
 {
-    int bytes = 0;
-    int total_bytes = 0;
+    int rv = SDP_SUCCESS;
+    int data_length = 0;
+    int deflated = 0;
+    size_t frame_len = 0;
     char *msg = NULL;
-    unsigned int data_length = 0;
-    sdp_header header;
 
     if(com == NULL || !com->initialized)
         return SDP_ERROR_UNINITIALIZED;
@@ -813,84 +1298,135 @@ int sdp_com_get_msg(sdp_com_t com, char **r_msg, int *r_bytes)
     if(com->conn_state == SDP_COM_DISCONNECTED)
         return SDP_ERROR_CONN_DOWN;
 
-    /* Always returns 0, even when data is available
-    if((bytes = SSL_pending(com->ssl)) == 0)
+    *r_bytes = 0;
+
+    // only go to OpenSSL when the buffer does not already hold a message
+    if((data_length = sdp_com_frame_ready(com, &deflated)) == 0)
     {
-        log_msg(LOG_DEBUG, "No data waiting to be retrieved from socket");
-        *r_bytes = 0;
-        *r_msg = NULL;
-        return SDP_SUCCESS;
+        if(com->send_off < com->send_len)
+            sdp_com_flush(com);
+
+        // a lost connection is not an error for the caller, the run
+        // loops see the state change and reconnect
+        if(com->conn_state == SDP_COM_DISCONNECTED
+                || sdp_com_fill(com) == SDP_ERROR_CONN_DOWN)
+            return SDP_SUCCESS;
+
+        data_length = sdp_com_frame_ready(com, &deflated);
     }
-    */
 
-    if((bytes = SSL_read(com->ssl, &header, SDP_COM_HEADER_LEN)) <= 0) {
+    if(data_length == 0)
+    {
         log_msg(LOG_DEBUG, "No data to read right now");
-        *r_bytes = 0;
         return SDP_SUCCESS;
     }
 
-    if (bytes != SDP_COM_HEADER_LEN) {
-        log_msg(LOG_ERR, "Header found was shorter than minimum message size");
-        return SDP_ERROR_INVALID_MSG_SHORT;
-    }
-
-    data_length = ntohl(header.length);
+    if(data_length < 0)
+    {
+        log_msg(LOG_ERR, "Header length field indicates message size outside of %d to %d bytes",
+                SDP_MSG_MIN_LEN, SDP_MSG_MAX_LEN);
 
-    if (data_length > SDP_COM_MAX_MSG_BLOCK_LEN) {
-        log_msg(LOG_ERR, "Header length field indicates message sizes longer than the maximum");
-        log_msg(LOG_ERR, "Length field: %u; maximum: %d", data_length, SDP_COM_MAX_MSG_BLOCK_LEN);
+        // there is no way to find the next frame boundary
+        sdp_com_disconnect(com);
         return SDP_ERROR_INVALID_MSG_LONG;
     }
 
-    if((bytes = SSL_read(com->ssl, com->recv_buffer, data_length)) <= 0)
+    frame_len = SDP_COM_HEADER_LEN + data_length;
+
+    if(deflated)
     {
-        log_msg(LOG_ERR, "Data found was shorter than minimum message size");
-        return SDP_ERROR_INVALID_MSG_SHORT;
+        if((rv = sdp_com_inflate(com->recv_buf + com->recv_off + SDP_COM_HEADER_LEN,
+                        data_length, &msg, &data_length)) != SDP_SUCCESS)
+        {
+            // the stream itself is intact, but something is badly wrong
+            // with the peer, so start over with a fresh connection
+            sdp_com_disconnect(com);
+            return rv;
+        }
     }
+    else
+    {
+        if((msg = malloc(data_length + 1)) == NULL)
+            return SDP_ERROR_MEMORY_ALLOCATION;
 
-    if (bytes != data_length) {
-        log_msg(LOG_ERR, "Data read was short %d of %d", bytes, data_length);
-        return SDP_ERROR_INVALID_MSG_SHORT;
+        memcpy(msg, com->recv_buf + com->recv_off + SDP_COM_HEADER_LEN, data_length);
+        msg[data_length] = '\0';
     }
 
-    log_msg(LOG_DEBUG, "Initial socket read returned %d bytes", bytes);
+    com->recv_off += frame_len;
+    if(com->recv_off == com->recv_len)
+        com->recv_off = com->recv_len = 0;
 
-    if(bytes < SDP_MSG_MIN_LEN)
+    log_msg(LOG_DEBUG, "Retrieved %d byte message from controller%s", data_length,
+            deflated ? " (compressed)" : "");
+
+    if(!com->peer_deflate && (deflated || sdp_com_msg_advertises_deflate(msg)))
     {
-        log_msg(LOG_ERR, "Data found was shorter than minimum message size");
-        return SDP_ERROR_INVALID_MSG_SHORT;
+        com->peer_deflate = 1;
+        if(com->compress_msgs)
+            log_msg(LOG_INFO, "Controller accepts compressed messages");
     }
 
-    if((msg = strndup(com->recv_buffer, (size_t)bytes)) == NULL)
-        return SDP_ERROR_MEMORY_ALLOCATION;
+    *r_msg = msg;
+    *r_bytes = data_length;
+    return rv;
+}
 
-    total_bytes = bytes;
 
-    // if necessary, keep reading input from controller
-    while(bytes >= SDP_COM_MAX_MSG_BLOCK_LEN)
-    {
-        log_msg(LOG_DEBUG, "Checking for additional data waiting in stream");
-        if((bytes = SSL_read(com->ssl, com->recv_buffer, SDP_COM_MAX_MSG_BLOCK_LEN)) > 0)
-        {
-            if((msg = strncat(msg, com->recv_buffer, (size_t)bytes)) == NULL)
-                return SDP_ERROR_MEMORY_ALLOCATION;
+/**
+ * @brief Wait for the controller connection to need attention
+ *
+ * Blocks until a message can be retrieved with sdp_com_get_msg or
+ * timeout_ms milliseconds pass, whichever comes first. Queued outgoing
+ * data is flushed whenever the socket becomes writable in the meantime.
+ * Returns immediately if a message is already buffered.
+ *
+ * @param com - sdp_com_t object
+ *
+ * @param timeout_ms - maximum time to wait, in milliseconds
+ *
+ * @return SDP_SUCCESS or error code
+ */
+int sdp_com_wait(sdp_com_t com, int timeout_ms)
+{
+    struct pollfd pfd;
+    int rv = 0;
 
-            if((total_bytes += bytes) > SDP_MSG_MAX_LEN)
-            {
-                log_msg(LOG_ERR,
-                        "Socket read resulted in too much data: %d bytes. Possible attack.",
-                        total_bytes);
-                free(msg);
-                return SDP_ERROR_INVALID_MSG_LONG;
-            }
-        }
+    if(com == NULL || !com->initialized)
+        return SDP_ERROR_UNINITIALIZED;
+
+    if(com->conn_state == SDP_COM_DISCONNECTED || com->ssl == NULL)
+        return SDP_SUCCESS;
+
+    // messages queued since the last pass go out together now
+    if(com->send_off < com->send_len)
+    {
+        sdp_com_flush(com);
+        if(com->conn_state == SDP_COM_DISCONNECTED)
+            return SDP_SUCCESS;
     }
 
-    *r_msg = msg;
-    *r_bytes = total_bytes;
-    return SDP_SUCCESS;
-}
+    // decrypted bytes inside OpenSSL never show up on the socket
+    if(sdp_com_frame_ready(com, NULL) != 0 || SSL_pending(com->ssl) > 0)
+        return SDP_SUCCESS;
+
+    memset(&pfd, 0, sizeof(pfd));
+    pfd.fd = com->socket_descriptor;
+    pfd.events = POLLIN;
+    if(com->send_off < com->send_len)
+        pfd.events |= POLLOUT;
 
+    if((rv = poll(&pfd, 1, timeout_ms)) < 0)
+    {
+        if(errno == EINTR)
+            return SDP_SUCCESS;
 
+        log_msg(LOG_ERR, "poll() on controller socket failed: %s", strerror(errno));
+        return SDP_ERROR_SOCKET;
+    }
 
+    if(rv > 0 && (pfd.revents & POLLOUT) && com->send_off < com->send_len)
+        sdp_com_flush(com);
 
+    return SDP_SUCCESS;
+}
@@ -12,6 +12,7 @@
 #include <openssl/ssl.h>
 #include <openssl/crypto.h>
 #include <openssl/err.h>
+#include <openssl/pem.h>
 
 
 
@@ -21,6 +22,19 @@ typedef struct sdp_header {
 
 #define SDP_COM_HEADER_LEN sizeof(sdp_header)
 
+/* Set in the length header when the body is a zlib stream. Message
+ * lengths never come near this bit, so peers that do not compress
+ * simply never see it.
+*/
+#define SDP_COM_HEADER_DEFLATED 0x80000000U
+
+/* Compression is negotiated per connection. A peer that can inflate
+ * messages says so by starting a message object with this member, and
+ * a side with compression enabled only deflates once the other has
+ * advertised it (or has sent a compressed frame itself).
+*/
+#define SDP_COM_DEFLATE_ADVERT "{\"compression\":\"deflate\","
+
 enum {
 	SDP_COM_SSL_CONNECT_SUCCESS = 1,
 	SDP_COM_MAX_PORT_STRING_BUFFER_LEN = 6,
@@ -31,6 +45,8 @@ enum {
 	SDP_COM_MAX_LINE_LEN = 1024,
 	SDP_COM_MAX_MSG_BLOCK_LEN = 16384,
 	SDP_COM_MAX_Q_LEN = 100,
+	SDP_COM_MAX_SEND_Q_LEN = 1048576,
+	SDP_COM_COMPRESS_MIN_LEN = 256,
 	SDP_COM_MAX_FWKNOP_ARGS = 6,
 	SDP_COM_MAX_FWKNOP_CMD_LEN = SDP_COM_MAX_PATH_LEN + SDP_COM_MAX_LINE_LEN + 100
 };
@@ -67,7 +83,29 @@ struct sdp_com{
 	unsigned int max_conn_attempts;
 	unsigned int conn_attempts;
 	unsigned int initial_conn_attempt_interval;
-	char recv_buffer[SDP_COM_MAX_MSG_BLOCK_LEN];
+	int had_connection;
+	int compress_msgs;
+	// set once the controller has advertised compression on this
+	// connection, messages are only deflated after that
+	int peer_deflate;
+	// last TLS session handed out by the controller, offered again on
+	// reconnect and optionally kept in tls_session_file across restarts
+	SSL_SESSION *tls_session;
+	char *tls_session_file;
+	// the socket is non-blocking once connected; bytes read from the
+	// SSL stream wait in recv_buf until a whole frame is present and
+	// framed messages wait in send_buf until SSL_write accepts them.
+	// recv_off and send_off mark how much of each buffer has already
+	// been parsed or written, so the buffers are only compacted once
+	// per read or queued message rather than once per frame.
+	char *recv_buf;
+	size_t recv_off;
+	size_t recv_len;
+	size_t recv_size;
+	char *send_buf;
+	size_t send_off;
+	size_t send_len;
+	size_t send_size;
 	//char **message_queue;
 	//unsigned int message_queue_len;
 };
@@ -83,5 +121,7 @@ int  sdp_com_disconnect(sdp_com_t com);
 int  sdp_com_show_certs(sdp_com_t com);
 int  sdp_com_send_msg(sdp_com_t com, const char *msg);
 int  sdp_com_get_msg(sdp_com_t com, char **r_msg, int *r_bytes);
+int  sdp_com_wait(sdp_com_t com, int timeout_ms);
+int  sdp_com_msg_advertises_deflate(const char *msg);
 
 #endif /* SDP_COM_H_ */
@@ -257,6 +257,10 @@ int sdp_ctrl_client_listen(sdp_ctrl_client_t client, int max_time, int *r_action
             client->initial_conn_time = client->last_contact = time(NULL);
         }
 
+        // wait for the controller, but no longer than the timers allow
+        if((rv = sdp_ctrl_client_wait(client, SDP_CTRL_CLIENT_WAIT_MS)) != SDP_SUCCESS)
+            break;
+
         // check for incoming messages
         if((rv = sdp_ctrl_client_check_inbox(client, &action, &data)) != SDP_SUCCESS)
             break;
@@ -289,8 +293,6 @@ int sdp_ctrl_client_listen(sdp_ctrl_client_t client, int max_time, int *r_action
         // watch the time
         if( max_time && (time(NULL) > stop_time) )
             break;
-
-        sleep(1);
     }
 
     return rv;
@@ -558,6 +560,9 @@ void sdp_ctrl_client_describe(sdp_ctrl_client_t client)
     cp += sdp_append_msg_to_buf(dump_buf+cp, buf_len-cp, "                           fwknoprc file: %s\n", client->com->fwknoprc_file);
     cp += sdp_append_msg_to_buf(dump_buf+cp, buf_len-cp, "                            TLS key file: %s\n", client->com->key_file);
     cp += sdp_append_msg_to_buf(dump_buf+cp, buf_len-cp, "                           TLS cert file: %s\n", client->com->cert_file);
+    cp += sdp_append_msg_to_buf(dump_buf+cp, buf_len-cp, "                       Compress messages: %s\n", YES_OR_NO(client->com->compress_msgs) );
+    cp += sdp_append_msg_to_buf(dump_buf+cp, buf_len-cp, "                        TLS session file: %s\n",
+            client->com->tls_session_file ? client->com->tls_session_file : "<not set>");
           sdp_append_msg_to_buf(dump_buf+cp, buf_len-cp, "                PID lock file descriptor: %d\n", client->pid_lock_fd);
 
     log_msg(LOG_DEBUG, "\n%s\n", dump_buf);
@@ -588,6 +593,28 @@ int sdp_ctrl_client_get_addr(sdp_ctrl_client_t client, char **r_addr)
 }
 
 
+/**
+ * @brief Sleep until the controller sends something or timeout_ms passes
+ *
+ * Run loops call this in place of a fixed sleep so that controller
+ * messages are handled as soon as they arrive while the periodic
+ * consider_* checks still run at least once per timeout.
+ *
+ * @param client - sdp_ctrl_client_t object.
+ *
+ * @param timeout_ms - maximum time to wait, in milliseconds
+ *
+ * @return SDP_SUCCESS or an error code.
+ */
+int sdp_ctrl_client_wait(sdp_ctrl_client_t client, int timeout_ms)
+{
+    if(client == NULL || !client->initialized)
+        return SDP_ERROR_UNINITIALIZED;
+
+    return sdp_com_wait(client->com, timeout_ms);
+}
+
+
 int sdp_ctrl_client_check_inbox(sdp_ctrl_client_t client, int *r_action, void **r_data)
 {
     int rv = SDP_SUCCESS;
@@ -1530,6 +1557,10 @@ int sdp_ctrl_client_loop(sdp_ctrl_client_t client)
             client->controller_ready = 0;
         }
 
+        // wait for the controller, but no longer than the timers allow
+        if((rv = sdp_ctrl_client_wait(client, SDP_CTRL_CLIENT_WAIT_MS)) != SDP_SUCCESS)
+            break;
+
         // check for incoming messages
         if((rv = sdp_ctrl_client_check_inbox(client, &action, &data)) != SDP_SUCCESS)
             break;
@@ -1553,8 +1584,6 @@ int sdp_ctrl_client_loop(sdp_ctrl_client_t client)
         // is a keep alive due
         if((rv = sdp_ctrl_client_consider_keep_alive(client)) != SDP_SUCCESS)
             break;
-
-        sleep(1);
     }
 
     sdp_com_disconnect(client->com);
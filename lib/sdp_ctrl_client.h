@@ -36,7 +36,8 @@ enum {
     SDP_MAX_MSG_Q_LEN       = 100,
     SDP_MAX_POST_SPA_DELAY  = 10,
     SDP_MAX_CLIENT_ID_STR_LEN = 11,
-	SDP_MAX_SERVICE_ID_STR_LEN = 11
+	SDP_MAX_SERVICE_ID_STR_LEN = 11,
+    SDP_CTRL_CLIENT_WAIT_MS = 1000
 };
 
 
@@ -162,6 +163,7 @@ void sdp_ctrl_client_describe(sdp_ctrl_client_t client);
 int  sdp_ctrl_client_get_port(sdp_ctrl_client_t client, int *r_port);
 int  sdp_ctrl_client_get_addr(sdp_ctrl_client_t client, char **r_addr);
 int  sdp_ctrl_client_check_inbox(sdp_ctrl_client_t client, int *r_action, void **r_data);
+int  sdp_ctrl_client_wait(sdp_ctrl_client_t client, int timeout_ms);
 int  sdp_ctrl_client_request_keep_alive(sdp_ctrl_client_t client);
 void sdp_ctrl_client_process_keep_alive(sdp_ctrl_client_t client);
 int  sdp_ctrl_client_request_cred_update(sdp_ctrl_client_t client);
@@ -45,7 +45,9 @@ const char *sdp_ctrl_client_config_map[SDP_CTRL_CLIENT_CONFIG_ENTRIES] = {
     "KEEP_ALIVE_INTERVAL",
     "MAX_REQUEST_ATTEMPTS",
     "INITIAL_REQUEST_RETRY_INTERVAL",
-    "PID_FILE"
+    "PID_FILE",
+    "TLS_SESSION_FILE",
+    "COMPRESS_MESSAGES"
 };
 
 
@@ -510,6 +512,17 @@ int sdp_ctrl_client_set_config_entry(sdp_ctrl_client_t client, int var, const ch
             }
             break;
 
+        case SDP_CTRL_CLIENT_CONFIG_TLS_SESSION_FILE:
+            if((rv = sdp_make_absolute_path(val, &(client->com->tls_session_file))) != SDP_SUCCESS)
+            {
+                log_msg(LOG_ERR, "Error storing TLS session file path");
+            }
+            break;
+
+        case SDP_CTRL_CLIENT_CONFIG_COMPRESS_MESSAGES:
+            client->com->compress_msgs = yes_or_no(val);
+            break;
+
         default:
             // do nothing
             break;
@@ -67,6 +67,8 @@ enum {
 	SDP_CTRL_CLIENT_CONFIG_MAX_REQUEST_ATTEMPTS,
 	SDP_CTRL_CLIENT_CONFIG_INIT_REQUEST_RETRY_INTERVAL,
 	SDP_CTRL_CLIENT_CONFIG_PID_FILE,
+	SDP_CTRL_CLIENT_CONFIG_TLS_SESSION_FILE,
+	SDP_CTRL_CLIENT_CONFIG_COMPRESS_MESSAGES,
 	SDP_CTRL_CLIENT_CONFIG_ENTRIES
 };
 
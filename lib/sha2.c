@@ -45,6 +45,11 @@
   #include <sys/byteorder.h>
 #endif
 
+#ifdef HAVE_SHA_NI_INTRINSICS
+  #include <cpuid.h>
+  #include <immintrin.h>
+#endif
+
 /*
  * ASSERT NOTE:
  * Some sanity checking code is included using assert().  On my FreeBSD
@@ -242,6 +247,23 @@ typedef u_int64_t sha2_word64;	/* Exactly 8 bytes */
 void SHA512_Last(SHA512_CTX*);
 void SHA256_Transform(SHA256_CTX*, const sha2_word32*);
 void SHA512_Transform(SHA512_CTX*, const sha2_word64*);
+static void SHA256_Transform_Portable(SHA256_CTX*, const sha2_word32*);
+static void SHA256_Transform_Resolve(SHA256_CTX*, const sha2_word32*);
+
+/*
+ * SHA-256 BLOCK TRANSFORM DISPATCH NOTE:
+ *
+ * The SHA-256 block transform is called through the pointer below.  It
+ * starts out pointing at a resolver that checks the CPU once (on the
+ * first digest computed) and then swaps in the fastest available
+ * transform: the x86 SHA extensions (SHA-NI) when both the compiler
+ * and the CPU support them, and the portable C code otherwise.  The
+ * resolver is idempotent, so a race between two threads hashing for
+ * the first time at once is harmless.
+ */
+static void (*sha256_transform)(SHA256_CTX*, const sha2_word32*) =
+	SHA256_Transform_Resolve;
+static int sha256_backend = SHA256_BACKEND_AUTO;
 
 
 /*** SHA-XYZ INITIAL HASH VALUES AND CONSTANTS ************************/
@@ -393,7 +415,7 @@ void SHA256_Init(SHA256_CTX* context) {
 	(h) = T1 + Sigma0_256(a) + Maj((a), (b), (c)); \
 	j++
 
-void SHA256_Transform(SHA256_CTX* context, const sha2_word32* data) {
+static void SHA256_Transform_Portable(SHA256_CTX* context, const sha2_word32* data) {
 	sha2_word32	a, b, c, d, e, f, g, h, s0, s1;
 	sha2_word32	T1, *W256;
 	int		j;
@@ -451,7 +473,7 @@ void SHA256_Transform(SHA256_CTX* context, const sha2_word32* data) {
 
 #else /* SHA2_UNROLL_TRANSFORM */
 
-void SHA256_Transform(SHA256_CTX* context, const sha2_word32* data) {
+static void SHA256_Transform_Portable(SHA256_CTX* context, const sha2_word32* data) {
 	sha2_word32	a, b, c, d, e, f, g, h, s0, s1;
 	sha2_word32	T1, T2, *W256;
 	int		j;
@@ -531,6 +553,140 @@ void SHA256_Transform(SHA256_CTX* context, const sha2_word32* data) {
 
 #endif /* SHA2_UNROLL_TRANSFORM */
 
+#ifdef HAVE_SHA_NI_INTRINSICS
+
+/*
+ * SHA-256 transform using the x86 SHA extensions.  The eight state words
+ * are kept in the ABEF/CDGH register layout that sha256rnds2 expects,
+ * and each loop iteration performs four rounds while sha256msg1/msg2
+ * expand the message schedule four words at a time.
+ */
+__attribute__((target("sha,sse4.1,ssse3")))
+static void SHA256_Transform_SHANI(SHA256_CTX* context, const sha2_word32* data) {
+	const __m128i	mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+					      0x0405060700010203ULL);
+	const sha2_byte	*bytes = (const sha2_byte*)data;
+	__m128i		state0, state1, abef_save, cdgh_save;
+	__m128i		msg[4], tmp;
+	int		j;
+
+	/* Load the state and shuffle it into ABEF/CDGH order */
+	tmp    = _mm_loadu_si128((const __m128i*)&context->state[0]);
+	state1 = _mm_loadu_si128((const __m128i*)&context->state[4]);
+	tmp    = _mm_shuffle_epi32(tmp, 0xB1);		/* CDAB */
+	state1 = _mm_shuffle_epi32(state1, 0x1B);	/* EFGH */
+	state0 = _mm_alignr_epi8(tmp, state1, 8);	/* ABEF */
+	state1 = _mm_blend_epi16(state1, tmp, 0xF0);	/* CDGH */
+
+	abef_save = state0;
+	cdgh_save = state1;
+
+	/* Load the block while converting to host byte order */
+	for (j = 0; j < 4; j++) {
+		msg[j] = _mm_shuffle_epi8(
+			_mm_loadu_si128((const __m128i*)(bytes + 16 * j)), mask);
+	}
+
+	for (j = 0; j < 16; j++) {
+		tmp = _mm_add_epi32(msg[j & 3],
+			_mm_loadu_si128((const __m128i*)&K256[4 * j]));
+		state1 = _mm_sha256rnds2_epu32(state1, state0, tmp);
+		tmp = _mm_shuffle_epi32(tmp, 0x0E);
+		state0 = _mm_sha256rnds2_epu32(state0, state1, tmp);
+
+		if (j < 12) {
+			/* W[t] for the next four words of the schedule */
+			tmp = _mm_sha256msg1_epu32(msg[j & 3], msg[(j + 1) & 3]);
+			tmp = _mm_add_epi32(tmp,
+				_mm_alignr_epi8(msg[(j + 3) & 3], msg[(j + 2) & 3], 4));
+			msg[j & 3] = _mm_sha256msg2_epu32(tmp, msg[(j + 3) & 3]);
+		}
+	}
+
+	state0 = _mm_add_epi32(state0, abef_save);
+	state1 = _mm_add_epi32(state1, cdgh_save);
+
+	/* Shuffle back to ABCD/EFGH order and store */
+	tmp    = _mm_shuffle_epi32(state0, 0x1B);	/* FEBA */
+	state1 = _mm_shuffle_epi32(state1, 0xB1);	/* DCHG */
+	state0 = _mm_blend_epi16(tmp, state1, 0xF0);	/* DCBA */
+	state1 = _mm_alignr_epi8(state1, tmp, 8);	/* ABEF */
+	_mm_storeu_si128((__m128i*)&context->state[0], state0);
+	_mm_storeu_si128((__m128i*)&context->state[4], state1);
+}
+
+/* Return non-zero if the CPU has the SHA extensions (plus the SSSE3 and
+ * SSE4.1 instructions the transform above also relies on).
+ */
+static int sha256_cpu_has_sha_ni(void) {
+	unsigned int	eax, ebx, ecx, edx;
+
+	if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) == 0) {
+		return 0;
+	}
+	if ((ecx & (1 << 9)) == 0 || (ecx & (1 << 19)) == 0) {
+		/* No SSSE3 or SSE4.1 */
+		return 0;
+	}
+	if (__get_cpuid_max(0, NULL) < 7) {
+		return 0;
+	}
+	__cpuid_count(7, 0, eax, ebx, ecx, edx);
+	return (ebx & (1 << 29)) != 0;
+}
+
+#endif /* HAVE_SHA_NI_INTRINSICS */
+
+static void SHA256_Transform_Resolve(SHA256_CTX* context, const sha2_word32* data) {
+	SHA256_Set_Backend(sha256_backend);
+	sha256_transform(context, data);
+}
+
+void SHA256_Transform(SHA256_CTX* context, const sha2_word32* data) {
+	sha256_transform(context, data);
+}
+
+int SHA256_Set_Backend(int backend) {
+	switch (backend) {
+	case SHA256_BACKEND_AUTO:
+#ifdef HAVE_SHA_NI_INTRINSICS
+		if (sha256_cpu_has_sha_ni()) {
+			sha256_transform = SHA256_Transform_SHANI;
+			break;
+		}
+#endif
+		sha256_transform = SHA256_Transform_Portable;
+		break;
+	case SHA256_BACKEND_PORTABLE:
+		sha256_transform = SHA256_Transform_Portable;
+		break;
+	case SHA256_BACKEND_SHANI:
+#ifdef HAVE_SHA_NI_INTRINSICS
+		if (sha256_cpu_has_sha_ni()) {
+			sha256_transform = SHA256_Transform_SHANI;
+			break;
+		}
+#endif
+		return -1;
+	default:
+		return -1;
+	}
+	sha256_backend = backend;
+	return 0;
+}
+
+const char* SHA256_Backend_Name(void) {
+	if (sha256_transform == SHA256_Transform_Resolve) {
+		SHA256_Set_Backend(sha256_backend);
+	}
+#ifdef HAVE_SHA_NI_INTRINSICS
+	if (sha256_transform == SHA256_Transform_SHANI) {
+		return "sha-ni";
+	}
+#endif
+	return "portable";
+}
+
 void SHA256_Update(SHA256_CTX* context, const sha2_byte *data, size_t len) {
 	unsigned int	freespace, usedspace;
 
@@ -553,7 +709,7 @@ void SHA256_Update(SHA256_CTX* context, const sha2_byte *data, size_t len) {
 			context->bitcount += freespace << 3;
 			len -= freespace;
 			data += freespace;
-			SHA256_Transform(context, (sha2_word32*)context->buffer);
+			sha256_transform(context, (sha2_word32*)context->buffer);
 		} else {
 			/* The buffer is not yet full */
 			MEMCPY_BCOPY(&context->buffer[usedspace], data, len);
@@ -565,7 +721,7 @@ void SHA256_Update(SHA256_CTX* context, const sha2_byte *data, size_t len) {
 	}
 	while (len >= SHA256_BLOCK_LEN) {
 		/* Process as many complete blocks as we can */
-		SHA256_Transform(context, (sha2_word32*)data);
+		sha256_transform(context, (sha2_word32*)data);
 		context->bitcount += SHA256_BLOCK_LEN << 3;
 		len -= SHA256_BLOCK_LEN;
 		data += SHA256_BLOCK_LEN;
@@ -605,7 +761,7 @@ void SHA256_Final(sha2_byte digest[], SHA256_CTX* context) {
 					MEMSET_BZERO(&context->buffer[usedspace], SHA256_BLOCK_LEN - usedspace);
 				}
 				/* Do second-to-last transform: */
-				SHA256_Transform(context, (sha2_word32*)context->buffer);
+				sha256_transform(context, (sha2_word32*)context->buffer);
 
 				/* And set-up for the last transform: */
 				MEMSET_BZERO(context->buffer, SHA256_SHORT_BLOCK_LEN);
@@ -621,7 +777,7 @@ void SHA256_Final(sha2_byte digest[], SHA256_CTX* context) {
 		memcpy(&(context->buffer[SHA256_SHORT_BLOCK_LEN]), &(context->bitcount), sizeof(sha2_word64));
 
 		/* Final transform: */
-		SHA256_Transform(context, (sha2_word32*)context->buffer);
+		sha256_transform(context, (sha2_word32*)context->buffer);
 
 #if BYTE_ORDER == LITTLE_ENDIAN
 		{
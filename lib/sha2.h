@@ -140,6 +140,19 @@ typedef struct _SHA512_CTX {
 typedef SHA512_CTX SHA384_CTX;
 
 
+/*** SHA-256 Transform Backends ***************************************/
+/* The SHA-256 block transform is selected at runtime.  AUTO picks the
+ * fastest one the CPU supports; the others force a specific transform
+ * (SHA256_Set_Backend() returns -1 if it is not available).
+ */
+#define SHA256_BACKEND_AUTO     0
+#define SHA256_BACKEND_PORTABLE 1
+#define SHA256_BACKEND_SHANI    2
+
+int SHA256_Set_Backend(int backend);
+const char* SHA256_Backend_Name(void);
+
+
 /*** SHA-256/384/512 Function Prototypes ******************************/
 #ifndef NOPROTO
 #ifdef SHA2_USE_INTTYPES_H
@@ -611,6 +611,24 @@ class Fko:
 
         _fko.spa_data_final(self.ctx, key, hmac_key)
 
+    def spa_data_batch(self, items, key, hmac_key, num_threads=1):
+        """Generate many SPA data strings from this context.
+
+        Each item in the items list is either a message string or an
+        (sdp_id, timestamp, rand_value, message) tuple, where a 0 or None
+        field keeps the value set in this context (and a None rand_value
+        gets a new random value).  The work is spread over num_threads
+        threads inside libfko, and the Python GIL is released while it
+        runs.
+
+        Returns a list of (status, spa_data) tuples in item order, where
+        spa_data is None if status is not FKO_SUCCESS.
+        """
+        if hmac_key and not _fko.get_spa_hmac_type(self.ctx):
+            _fko.set_spa_hmac_type(self.ctx, FKO_HMAC_SHA256)
+
+        return _fko.spa_data_batch(self.ctx, items, key, hmac_key, num_threads)
+
     def gen_spa_data(self, key):
         """Alias for "spa_data_final()".
         """
@@ -1006,6 +1024,30 @@ class Fko:
             return None
 
 
+def decode_spa_batch(packets, key, hmac_key=None, enc_mode=FKO_ENC_MODE_CBC,
+        hmac_type=FKO_HMAC_SHA256, sdp_id=0):
+    """Decrypt, verify, and decode many SPA packets in one call.
+
+    The packets are given either as a list of strings (or other objects
+    supporting the buffer protocol), or as a single buffer object such as
+    a bytearray or mmap holding one packet per line.  The Python GIL is
+    released while libfko decrypts and decodes the packets, so several
+    threads can call this at once.
+
+    Returns a list with one tuple per packet:
+
+        (status, rand_value, username, timestamp, message_type, message,
+         nat_access, server_auth, client_timeout)
+
+    All fields but status are None when status is not FKO_SUCCESS.
+    """
+    if not hmac_key:
+        hmac_type = FKO_HMAC_UNKNOWN
+
+    return _fko.decode_spa_batch(packets, key, enc_mode, hmac_key,
+            hmac_type, sdp_id)
+
+
 class FkoAccess():
     """Class for creating SPA Access Request message strings.
     """
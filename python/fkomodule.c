@@ -102,6 +102,11 @@ static PyObject * get_gpg_signature_status(PyObject *self, PyObject *args);
 static PyObject * gpg_signature_id_match(PyObject *self, PyObject *args);
 static PyObject * gpg_signature_fpr_match(PyObject *self, PyObject *args);
 
+/* FKO batch functions.
+*/
+static PyObject * decode_spa_batch(PyObject *self, PyObject *args);
+static PyObject * spa_data_batch(PyObject *self, PyObject *args);
+
 /* FKO error message functions.
 */
 static PyObject * errstr(PyObject *self, PyObject *args);
@@ -250,6 +255,10 @@ static PyMethodDef FKOMethods[] = {
     {"gpg_signature_fpr_match",  gpg_signature_fpr_match, METH_VARARGS,
      "Returns a true value if the GPG fingerprint of GPG-encoded message matches the given fingerprint string"},
 
+    {"decode_spa_batch",  decode_spa_batch, METH_VARARGS,
+     "Decrypts and decodes a list or buffer of SPA packets and returns a list of field tuples"},
+    {"spa_data_batch",  spa_data_batch, METH_VARARGS,
+     "Creates a list of SPA packets from this context and per-packet overrides"},
 
     {"errstr",  errstr, METH_VARARGS,
      "Returns the error message for the given error code"},
@@ -1794,6 +1803,357 @@ gpg_signature_fpr_match(PyObject *self, PyObject *args)
 }
 
 
+/*****************************************************************************
+ * FKO batch functions.
+ *
+ * These handle many SPA packets per call and release the GIL while libfko
+ * does the crypto work, so several Python threads can decode or create
+ * packets at the same time.
+*/
+/* Packets are decoded this many at a time, which bounds the number of
+ * contexts held between releasing and re-acquiring the GIL.
+*/
+#define FKO_PY_BATCH_CHUNK      256
+
+/* Output space reserved for each packet created by spa_data_batch
+*/
+#define FKO_PY_BATCH_SLOT_LEN   2048
+
+typedef struct fko_py_packet
+{
+    const char *data;
+    PyObject   *ref;    /* str object that data points into */
+    char       *copy;   /* or our own copy of a buffer object */
+} fko_py_packet_t;
+
+static void
+free_packets(fko_py_packet_t *pkts, const Py_ssize_t count)
+{
+    Py_ssize_t  i;
+
+    for(i=0; i < count; i++)
+    {
+        Py_XDECREF(pkts[i].ref);
+        free(pkts[i].copy);
+    }
+    free(pkts);
+}
+
+/* Copy the contents of an object supporting the buffer protocol into a
+ * NULL terminated string.
+*/
+static char *
+buffer_to_str(PyObject *obj, Py_ssize_t *len)
+{
+    Py_buffer   view;
+    char       *str;
+
+    if(PyObject_GetBuffer(obj, &view, PyBUF_SIMPLE) != 0)
+        return NULL;
+
+    str = malloc(view.len + 1);
+    if(str == NULL)
+    {
+        PyBuffer_Release(&view);
+        PyErr_NoMemory();
+        return NULL;
+    }
+    memcpy(str, view.buf, view.len);
+    str[view.len] = '\0';
+    *len = view.len;
+
+    PyBuffer_Release(&view);
+    return str;
+}
+
+/* Collect the SPA packets given to decode_spa_batch.  This is either a
+ * list or tuple with one packet per item (str items are used in place),
+ * or a single buffer object (bytearray, mmap, ...) holding one packet
+ * per line.
+*/
+static fko_py_packet_t *
+get_packets(PyObject *packets, Py_ssize_t *count)
+{
+    fko_py_packet_t    *pkts;
+    PyObject           *item;
+    char               *buf, *p, *end;
+    Py_ssize_t          i, n, len;
+
+    if(PyList_Check(packets) || PyTuple_Check(packets))
+    {
+        n = PySequence_Fast_GET_SIZE(packets);
+        pkts = calloc(n > 0 ? n : 1, sizeof(fko_py_packet_t));
+        if(pkts == NULL)
+            return (fko_py_packet_t *)PyErr_NoMemory();
+
+        for(i=0; i < n; i++)
+        {
+            item = PySequence_Fast_GET_ITEM(packets, i);
+            if(PyString_Check(item))
+            {
+                Py_INCREF(item);
+                pkts[i].ref  = item;
+                pkts[i].data = PyString_AS_STRING(item);
+            }
+            else if((pkts[i].copy = buffer_to_str(item, &len)) != NULL)
+                pkts[i].data = pkts[i].copy;
+            else
+            {
+                free_packets(pkts, n);
+                return NULL;
+            }
+        }
+        *count = n;
+        return pkts;
+    }
+
+    if((buf = buffer_to_str(packets, &len)) == NULL)
+        return NULL;
+
+    n = 0;
+    end = buf + len;
+    for(p = buf; p < end; p++)
+    {
+        if(*p == '\n' || *p == '\r')
+            *p = '\0';
+        if(*p != '\0' && (p == buf || *(p-1) == '\0'))
+            n++;
+    }
+
+    pkts = calloc(n > 0 ? n : 1, sizeof(fko_py_packet_t));
+    if(pkts == NULL)
+    {
+        free(buf);
+        return (fko_py_packet_t *)PyErr_NoMemory();
+    }
+
+    /* The first packet owns the copy of the buffer
+    */
+    if(n > 0)
+        pkts[0].copy = buf;
+    else
+        free(buf);
+    for(i=0, p = buf; p < end; p++)
+        if(*p != '\0' && (p == buf || *(p-1) == '\0'))
+            pkts[i++].data = p;
+
+    *count = n;
+    return pkts;
+}
+
+/* Build the field tuple for one decoded packet:
+ *
+ *   (status, rand_value, username, timestamp, message_type, message,
+ *    nat_access, server_auth, client_timeout)
+ *
+ * All but the status are None if the packet could not be decoded.
+*/
+static PyObject *
+decoded_fields(fko_ctx_t ctx, const int status)
+{
+    char   *rand_val, *username, *message, *nat_access, *server_auth;
+    time_t  timestamp;
+    short   message_type;
+    int     client_timeout;
+
+    if(status != FKO_SUCCESS)
+        return Py_BuildValue("(iOOOOOOOO)", status, Py_None, Py_None, Py_None,
+                Py_None, Py_None, Py_None, Py_None, Py_None);
+
+    fko_get_rand_value(ctx, &rand_val);
+    fko_get_username(ctx, &username);
+    fko_get_timestamp(ctx, &timestamp);
+    fko_get_spa_message_type(ctx, &message_type);
+    fko_get_spa_message(ctx, &message);
+    fko_get_spa_nat_access(ctx, &nat_access);
+    fko_get_spa_server_auth(ctx, &server_auth);
+    fko_get_spa_client_timeout(ctx, &client_timeout);
+
+    return Py_BuildValue("(izzkhzzzi)", status, rand_val, username,
+            (unsigned long)timestamp, message_type, message, nat_access,
+            server_auth, client_timeout);
+}
+
+/* decode_spa_batch
+*/
+static PyObject *
+decode_spa_batch(PyObject *self, PyObject *args)
+{
+    PyObject *packets;
+    PyObject *result;
+    PyObject *fields;
+    fko_py_packet_t *pkts;
+    fko_ctx_t ctxs[FKO_PY_BATCH_CHUNK];
+    int results[FKO_PY_BATCH_CHUNK];
+    char *dec_key;
+    int dec_key_len;
+    int enc_mode;
+    char *hmac_key;
+    int hmac_key_len;
+    int hmac_type;
+    int sdp_id;
+    Py_ssize_t count = 0, first, last, i;
+
+    if(!PyArg_ParseTuple(args, "Os#iz#ii", &packets, &dec_key, &dec_key_len,
+                         &enc_mode, &hmac_key, &hmac_key_len, &hmac_type, &sdp_id))
+        return NULL;
+
+    if((pkts = get_packets(packets, &count)) == NULL)
+        return NULL;
+
+    if((result = PyList_New(count)) == NULL)
+    {
+        free_packets(pkts, count);
+        return NULL;
+    }
+
+    for(first=0; first < count; first += FKO_PY_BATCH_CHUNK)
+    {
+        last = first + FKO_PY_BATCH_CHUNK < count ? first + FKO_PY_BATCH_CHUNK : count;
+
+        Py_BEGIN_ALLOW_THREADS
+        for(i=first; i < last; i++)
+        {
+            ctxs[i-first] = NULL;
+            results[i-first] = fko_new_with_data(&ctxs[i-first], pkts[i].data,
+                    dec_key, dec_key_len, enc_mode, hmac_key, hmac_key_len,
+                    hmac_type, (uint32_t)sdp_id);
+        }
+        Py_END_ALLOW_THREADS
+
+        for(i=first; i < last; i++)
+        {
+            fields = decoded_fields(ctxs[i-first], results[i-first]);
+            if(ctxs[i-first] != NULL)
+                fko_destroy(ctxs[i-first]);
+            ctxs[i-first] = NULL;
+
+            if(fields == NULL)
+            {
+                for(i++; i < last; i++)
+                    if(ctxs[i-first] != NULL)
+                        fko_destroy(ctxs[i-first]);
+                Py_DECREF(result);
+                free_packets(pkts, count);
+                return NULL;
+            }
+            PyList_SET_ITEM(result, i, fields);
+        }
+    }
+
+    free_packets(pkts, count);
+    return result;
+}
+
+/* spa_data_batch
+*/
+static PyObject *
+spa_data_batch(PyObject *self, PyObject *args)
+{
+    fko_ctx_t ctx;
+    PyObject *items;
+    PyObject *item;
+    PyObject *result = NULL;
+    PyObject *spa;
+    fko_batch_item_t *batch = NULL;
+    char *enc_key;
+    int enc_key_len;
+    char *hmac_key;
+    int hmac_key_len;
+    int num_threads;
+    char *spa_buf = NULL;
+    size_t *offsets = NULL;
+    int *results = NULL;
+    unsigned long timestamp;
+    Py_ssize_t count, i;
+    int res;
+
+    if(!PyArg_ParseTuple(args, "kOs#z#i", &ctx, &items, &enc_key, &enc_key_len,
+                         &hmac_key, &hmac_key_len, &num_threads))
+        return NULL;
+
+    /* Hold our own reference to the item list, since the GIL is
+     * released while libfko reads the strings it refers to.
+    */
+    if((items = PySequence_Tuple(items)) == NULL)
+        return NULL;
+
+    count   = PyTuple_GET_SIZE(items);
+    batch   = calloc(count > 0 ? count : 1, sizeof(fko_batch_item_t));
+    offsets = calloc(count > 0 ? count : 1, sizeof(size_t));
+    results = malloc((count > 0 ? count : 1) * sizeof(int));
+    spa_buf = malloc((count > 0 ? count : 1) * FKO_PY_BATCH_SLOT_LEN);
+    if(batch == NULL || offsets == NULL || results == NULL || spa_buf == NULL)
+    {
+        PyErr_NoMemory();
+        goto cleanup;
+    }
+
+    /* Each item is a message string, or a (sdp_id, timestamp, rand_value,
+     * message) tuple where 0 or None keeps the value of the context.
+    */
+    for(i=0; i < count; i++)
+    {
+        item = PyTuple_GET_ITEM(items, i);
+        if(PyString_Check(item))
+            batch[i].message = PyString_AS_STRING(item);
+        else if(!PyTuple_Check(item))
+        {
+            PyErr_SetString(PyExc_TypeError,
+                    "batch items must be message strings or tuples");
+            goto cleanup;
+        }
+        else
+        {
+            timestamp = 0;
+            if(!PyArg_ParseTuple(item, "|Ikzz", &batch[i].sdp_id, &timestamp,
+                                 &batch[i].rand_val, &batch[i].message))
+                goto cleanup;
+            batch[i].timestamp = (time_t)timestamp;
+        }
+        results[i] = -1;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    res = fko_spa_data_batch(ctx, batch, (int)count, enc_key, enc_key_len,
+            hmac_key, hmac_key_len, spa_buf, count * FKO_PY_BATCH_SLOT_LEN,
+            offsets, results, num_threads);
+    Py_END_ALLOW_THREADS
+
+    /* Nothing was attempted if the call itself was rejected
+    */
+    if(res != FKO_SUCCESS && count > 0 && results[0] == -1)
+    {
+        PyErr_SetString(FKOError, fko_errstr(res));
+        goto cleanup;
+    }
+
+    if((result = PyList_New(count)) == NULL)
+        goto cleanup;
+
+    for(i=0; i < count; i++)
+    {
+        if(results[i] == FKO_SUCCESS)
+            spa = Py_BuildValue("(is)", results[i], spa_buf + offsets[i]);
+        else
+            spa = Py_BuildValue("(iO)", results[i], Py_None);
+        if(spa == NULL)
+        {
+            Py_CLEAR(result);
+            goto cleanup;
+        }
+        PyList_SET_ITEM(result, i, spa);
+    }
+
+cleanup:
+    Py_DECREF(items);
+    free(spa_buf);
+    free(results);
+    free(offsets);
+    free(batch);
+    return result;
+}
+
 /*****************************************************************************
  * FKO error message function.
 */
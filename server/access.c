@@ -41,6 +41,7 @@
 #include "utils.h"
 #include "log_msg.h"
 #include "cmd_cycle.h"
+#include "gpg_pool.h"
 #include "bstrlib.h"
 #include <json-c/json.h>
 #include "fwknopd_errors.h"
@@ -62,6 +63,18 @@
 static fko_srv_options_t *access_opts_g = NULL;
 static int access_counter_g = 0;
 
+/* set_one_acc_defaults() works on the globals above, so stanzas built
+ * by concurrent controller data threads take turns there
+*/
+static pthread_mutex_t acc_defaults_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t acc_refs_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Controller access data is only split across threads when each thread
+ * gets at least this many stanzas, and threads claim this many at a time
+*/
+#define ACC_STANZA_BUILD_MIN_PER_THREAD 32
+#define ACC_STANZA_BUILD_CHUNK          16
+
 // JSON message strings
 const char *sdp_key_data_refresh        = "access_refresh";
 const char *sdp_key_data_update         = "access_update";
@@ -960,6 +973,7 @@ zero_buf_wrapper(char *buf, int len)
 static void
 free_acc_stanza_data(acc_stanza_t *acc)
 {
+    gpg_pool_free(acc);
 
     if(acc->source != NULL)
     {
@@ -1215,15 +1229,65 @@ free_acc_stanzas(fko_srv_options_t *opts)
     return;
 }
 
+/* The SDP access stanzas live in acc_stanza_hash_tbl, and the control
+ * client thread can remove or replace them at any time.  A stanza that
+ * is used after acc_hash_tbl_mutex is released (while a packet is being
+ * processed, or while a GPG job for it is queued) is held with
+ * acc_stanza_hold(), which must be called with acc_hash_tbl_mutex held or
+ * with another hold in place.  If the hash table lets go of a held
+ * stanza, it is only marked as orphaned and the last release frees it.
+*/
+void
+acc_stanza_hold(acc_stanza_t *acc)
+{
+    pthread_mutex_lock(&acc_refs_mutex);
+    acc->refs++;
+    pthread_mutex_unlock(&acc_refs_mutex);
+}
+
+static void
+free_orphaned_acc_stanza(acc_stanza_t *acc)
+{
+    pthread_mutex_lock(&acc_refs_mutex);
+    if(acc->refs > 0)
+    {
+        acc->orphaned = 1;
+        pthread_mutex_unlock(&acc_refs_mutex);
+        return;
+    }
+    pthread_mutex_unlock(&acc_refs_mutex);
+
+    free_acc_stanza_data(acc);
+    free(acc);
+}
+
+void
+acc_stanza_release(acc_stanza_t *acc)
+{
+    int do_free = 0;
+
+    if(acc == NULL)
+        return;
+
+    pthread_mutex_lock(&acc_refs_mutex);
+    if(acc->refs > 0)
+        acc->refs--;
+    do_free = (acc->refs == 0 && acc->orphaned);
+    pthread_mutex_unlock(&acc_refs_mutex);
+
+    if(do_free)
+    {
+        free_acc_stanza_data(acc);
+        free(acc);
+    }
+}
+
 static void
 destroy_hash_node_cb(hash_table_node_t *node)
 {
   if(node->key != NULL) bdestroy((bstring)(node->key));
   if(node->data != NULL)
-  {
-      free_acc_stanza_data((acc_stanza_t*)(node->data));
-      free(node->data);
-  }
+      free_orphaned_acc_stanza((acc_stanza_t*)(node->data));
 }
 
 static int
@@ -1509,6 +1573,11 @@ set_one_acc_defaults(acc_stanza_t *acc)
         acc->hmac_type = FKO_DEFAULT_HMAC_MODE;
     }
 
+    /* Preload the GPG handle(s) for this stanza now that the GPG
+     * parameters are final.
+    */
+    gpg_pool_init(acc);
+
     return;
 }
 
@@ -1522,6 +1591,110 @@ traverse_set_acc_defaults_cb(hash_table_node_t *node, void *arg)
 }
 
 
+/* Order stanzas by their Rijndael and HMAC parameters, keeping the
+ * access.conf order for stanzas with the same parameters
+*/
+typedef struct acc_key_sort
+{
+    acc_stanza_t   *acc;
+    int             pos;
+} acc_key_sort_t;
+
+static int
+compare_acc_key_params(const acc_stanza_t *x, const acc_stanza_t *y)
+{
+    int res;
+
+    if(x->key_len != y->key_len)
+        return x->key_len < y->key_len ? -1 : 1;
+    if((res = memcmp(x->key, y->key, x->key_len)) != 0)
+        return res;
+
+    if(x->hmac_key_len != y->hmac_key_len)
+        return x->hmac_key_len < y->hmac_key_len ? -1 : 1;
+    if(x->hmac_key_len > 0
+            && (res = memcmp(x->hmac_key, y->hmac_key, x->hmac_key_len)) != 0)
+        return res;
+
+    if(x->encryption_mode != y->encryption_mode)
+        return x->encryption_mode < y->encryption_mode ? -1 : 1;
+    if(x->hmac_type != y->hmac_type)
+        return x->hmac_type < y->hmac_type ? -1 : 1;
+
+    return 0;
+}
+
+static int
+compare_acc_keys(const void *a, const void *b)
+{
+    const acc_key_sort_t   *x = a, *y = b;
+    int                     res;
+
+    if((res = compare_acc_key_params(x->acc, y->acc)) != 0)
+        return res;
+
+    return x->pos - y->pos;
+}
+
+/* Point each legacy mode stanza that uses Rijndael at the first stanza
+ * with the same keys, so that incoming_spa_pkt() decrypts a packet at most
+ * once per distinct key instead of once per stanza.
+*/
+static void
+group_acc_stanza_keys(fko_srv_options_t *opts)
+{
+    acc_key_sort_t *sorted;
+    acc_stanza_t   *acc;
+    int             count = 0, groups = 0, i;
+
+    for(acc = opts->acc_stanzas; acc != NULL; acc = acc->next)
+    {
+        acc->key_group = NULL;
+        if(acc->use_rijndael && acc->key != NULL)
+            count++;
+    }
+
+    if(count == 0)
+        return;
+
+    if((sorted = calloc(count, sizeof(acc_key_sort_t))) == NULL)
+    {
+        /* Every stanza then simply decrypts on its own
+        */
+        log_msg(LOG_WARNING, "group_acc_stanza_keys: Memory allocation error.");
+        return;
+    }
+
+    for(i = 0, acc = opts->acc_stanzas; acc != NULL; acc = acc->next)
+    {
+        if(acc->use_rijndael && acc->key != NULL)
+        {
+            sorted[i].acc = acc;
+            sorted[i].pos = i;
+            i++;
+        }
+    }
+
+    qsort(sorted, count, sizeof(acc_key_sort_t), compare_acc_keys);
+
+    for(i = 0; i < count; i++)
+    {
+        if(i > 0 && compare_acc_key_params(sorted[i-1].acc, sorted[i].acc) == 0)
+            sorted[i].acc->key_group = sorted[i-1].acc->key_group;
+        else
+        {
+            sorted[i].acc->key_group = sorted[i].acc;
+            groups++;
+        }
+    }
+
+    log_msg(LOG_DEBUG, "%d Rijndael access stanzas use %d distinct keys",
+        count, groups);
+
+    free(sorted);
+    return;
+}
+
 /* Scan the access options for entries that have not been set, but need
  * a default value.
 */
@@ -1729,6 +1902,23 @@ acc_data_is_valid(fko_srv_options_t *opts,
 }
 
 
+/* getpwnam() hands back static storage, which is not safe when several
+ * controller data threads look up users at once
+*/
+#define ACC_PW_BUF_LEN 1024
+
+static struct passwd *
+acc_getpwnam(const char *name, struct passwd *pwd, char *buf)
+{
+    struct passwd  *result = NULL;
+    int             err;
+
+    if((err = getpwnam_r(name, pwd, buf, ACC_PW_BUF_LEN, &result)) != 0)
+        errno = err;
+
+    return result;
+}
+
 /* Take a json doc and make an acc stanza data struct from it
  *
  */
@@ -1740,6 +1930,10 @@ make_acc_stanza_from_json(fko_srv_options_t *opts, json_object *jdata, acc_stanz
     struct passwd  *user_pw = NULL;
     struct passwd  *sudo_user_pw = NULL;
     struct passwd  *tmp_pw = NULL;
+    struct passwd   user_pwd, sudo_user_pwd, tmp_pwd;
+    char            user_pwd_buf[ACC_PW_BUF_LEN];
+    char            sudo_user_pwd_buf[ACC_PW_BUF_LEN];
+    char            tmp_pwd_buf[ACC_PW_BUF_LEN];
     char *service_list = NULL;
     acc_stanza_t *stanza = calloc(1, sizeof(acc_stanza_t));
 
@@ -1915,7 +2109,7 @@ make_acc_stanza_from_json(fko_srv_options_t *opts, json_object *jdata, acc_stanz
     if(sdp_get_json_string_field("cmd_sudo_exec_user", jdata, &(stanza->cmd_sudo_exec_user)) == SDP_SUCCESS)
     {
         errno = 0;
-        sudo_user_pw = getpwnam(stanza->cmd_sudo_exec_user);
+        sudo_user_pw = acc_getpwnam(stanza->cmd_sudo_exec_user, &sudo_user_pwd, sudo_user_pwd_buf);
 
         if(sudo_user_pw == NULL)
         {
@@ -1931,7 +2125,7 @@ make_acc_stanza_from_json(fko_srv_options_t *opts, json_object *jdata, acc_stanz
     if(sdp_get_json_string_field("cmd_exec_user", jdata, &(stanza->cmd_exec_user)) == SDP_SUCCESS)
     {
         errno = 0;
-        user_pw = getpwnam(stanza->cmd_exec_user);
+        user_pw = acc_getpwnam(stanza->cmd_exec_user, &user_pwd, user_pwd_buf);
 
         if(user_pw == NULL)
         {
@@ -1947,7 +2141,7 @@ make_acc_stanza_from_json(fko_srv_options_t *opts, json_object *jdata, acc_stanz
     if(sdp_get_json_string_field("cmd_sudo_exec_group", jdata, &(stanza->cmd_sudo_exec_group)) == SDP_SUCCESS)
     {
         errno = 0;
-        tmp_pw = getpwnam(stanza->cmd_sudo_exec_group);
+        tmp_pw = acc_getpwnam(stanza->cmd_sudo_exec_group, &tmp_pwd, tmp_pwd_buf);
 
         if(tmp_pw == NULL)
         {
@@ -1963,7 +2157,7 @@ make_acc_stanza_from_json(fko_srv_options_t *opts, json_object *jdata, acc_stanz
     if(sdp_get_json_string_field("cmd_exec_group", jdata, &(stanza->cmd_exec_group)) == SDP_SUCCESS)
     {
         errno = 0;
-        tmp_pw = getpwnam(stanza->cmd_exec_group);
+        tmp_pw = acc_getpwnam(stanza->cmd_exec_group, &tmp_pwd, tmp_pwd_buf);
 
         if(tmp_pw == NULL)
         {
@@ -2189,7 +2383,9 @@ make_acc_stanza_from_json(fko_srv_options_t *opts, json_object *jdata, acc_stanz
         rv = FWKNOPD_ERROR_BAD_STANZA_DATA;
     }
 
+    pthread_mutex_lock(&acc_defaults_mutex);
     set_one_acc_defaults(stanza);
+    pthread_mutex_unlock(&acc_defaults_mutex);
 
 cleanup:
     if(rv != FWKNOPD_SUCCESS)
@@ -2245,55 +2441,206 @@ remove_access_stanzas(hash_table_t *acc_table, int access_array_len, json_object
     }
 }
 
-/* Take a json data array from a controller message
- * add/replace stanzas in the hash table
+static void
+free_acc_stanza_list(acc_stanza_t **stanzas, int count)
+{
+    int idx;
+
+    for(idx = 0; idx < count; idx++)
+    {
+        if(stanzas[idx] == NULL)
+            continue;
+        free_acc_stanza_data(stanzas[idx]);
+        free(stanzas[idx]);
+    }
+    free(stanzas);
+}
+
+/* Shared state for the threads converting one controller access array
+*/
+typedef struct acc_build_job
+{
+    fko_srv_options_t  *opts;
+    json_object        *jdata;
+    acc_stanza_t      **stanzas;    /* one slot per array element */
+    int                 array_len;
+    int                 next_idx;   /* next element not yet claimed */
+    int                 fatal;
+    pthread_mutex_t     mutex;
+} acc_build_job_t;
+
+/* Claim chunks of the access array until it is used up, converting each
+ * element into the stanza slot with the same index. Each array element
+ * is released as soon as it has been converted, so for a large refresh
+ * the json tree shrinks as the stanzas are built instead of both being
+ * held in full.
  */
-static int
-modify_access_table(fko_srv_options_t *opts, int access_array_len, json_object *jdata)
+static void *
+acc_build_worker(void *arg)
 {
-    int rv = FWKNOPD_SUCCESS;
-    acc_stanza_t *new_acc = NULL;
-    int idx = 0;
-    int nodes = 0;
-    json_object *jstanza = NULL;
-    bstring key = NULL;
-    char id[SDP_MAX_CLIENT_ID_STR_LEN + 1] = {0};
+    acc_build_job_t *job = (acc_build_job_t *)arg;
+    json_object     *jstanza = NULL;
+    int              idx, end, rv;
 
-    // walk through the access array
-    for(idx = 0; idx < access_array_len; idx++)
+    while(1)
     {
-        jstanza = json_object_array_get_idx(jdata, idx);
-        if((rv = make_acc_stanza_from_json(opts, jstanza, &new_acc)) != FWKNOPD_SUCCESS)
+        pthread_mutex_lock(&(job->mutex));
+        idx = job->next_idx;
+        job->next_idx += ACC_STANZA_BUILD_CHUNK;
+        end = job->fatal ? idx : job->next_idx;
+        pthread_mutex_unlock(&(job->mutex));
+
+        if(idx >= job->array_len || idx == end)
+            break;
+
+        if(end > job->array_len)
+            end = job->array_len;
+
+        for(; idx < end; idx++)
         {
+            jstanza = json_object_array_get_idx(job->jdata, idx);
+            rv = make_acc_stanza_from_json(job->opts, jstanza, &(job->stanzas[idx]));
+
+            // the stanza holds its own copies of everything it needs
+            json_object_array_put_idx(job->jdata, idx, NULL);
+
             if(rv == FKO_ERROR_MEMORY_ALLOCATION)
             {
-                log_msg(LOG_ERR, "Memory allocation error while parsing json data, time to die");
-                return FKO_ERROR_MEMORY_ALLOCATION;
+                pthread_mutex_lock(&(job->mutex));
+                job->fatal = 1;
+                pthread_mutex_unlock(&(job->mutex));
+                return NULL;
             }
 
-            log_msg(LOG_ERR, "Failed to parse json stanza, attempting to carry on");
-            continue;
+            if(rv != FWKNOPD_SUCCESS)
+                log_msg(LOG_ERR, "Failed to parse json stanza, attempting to carry on");
         }
+    }
+
+    return NULL;
+}
+
+/* Turn a json data array from a controller message into access stanzas,
+ * spreading the work over ACC_STANZA_BUILD_THREADS threads (the calling
+ * thread being one of them) when the array is large enough. The stanzas
+ * come back in array order with failed entries dropped. This does not
+ * touch the access table and so runs without the table lock.
+ */
+static int
+make_acc_stanzas_from_json(fko_srv_options_t *opts, int access_array_len,
+        json_object *jdata, acc_stanza_t ***r_stanzas, int *r_count)
+{
+    acc_build_job_t job;
+    pthread_t      *threads = NULL;
+    int             nthreads = 0, started = 0;
+    int             idx, count = 0, is_err = 0;
+
+    memset(&job, 0x0, sizeof(job));
+    job.opts      = opts;
+    job.jdata     = jdata;
+    job.array_len = access_array_len;
+
+    if((job.stanzas = calloc(access_array_len, sizeof(acc_stanza_t *))) == NULL)
+    {
+        log_msg(LOG_ERR, "Memory allocation error while parsing json data, time to die");
+        return FKO_ERROR_MEMORY_ALLOCATION;
+    }
 
+    if(pthread_mutex_init(&(job.mutex), NULL) != 0)
+    {
+        free(job.stanzas);
+        return FWKNOPD_ERROR_MUTEX;
+    }
+
+    nthreads = strtol_wrapper(opts->config[CONF_ACC_STANZA_BUILD_THREADS],
+            0, RCHK_MAX_ACC_STANZA_BUILD_THREADS, NO_EXIT_UPON_ERR, &is_err);
+    if(is_err != FKO_SUCCESS)
+        nthreads = 1;
+    else if(nthreads == 0)
+        nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if(nthreads > access_array_len / ACC_STANZA_BUILD_MIN_PER_THREAD)
+        nthreads = access_array_len / ACC_STANZA_BUILD_MIN_PER_THREAD;
+    if(nthreads > RCHK_MAX_ACC_STANZA_BUILD_THREADS)
+        nthreads = RCHK_MAX_ACC_STANZA_BUILD_THREADS;
+
+    // if extra threads can't be had, fewer of them just do more work
+    if(nthreads > 1 && (threads = calloc(nthreads - 1, sizeof(pthread_t))) != NULL)
+    {
+        for(started = 0; started < nthreads - 1; started++)
+            if(pthread_create(&(threads[started]), NULL, acc_build_worker, &job) != 0)
+                break;
+
+        log_msg(LOG_DEBUG, "Building %d access stanzas with %d threads",
+                access_array_len, started + 1);
+    }
+
+    acc_build_worker(&job);
+
+    for(idx = 0; idx < started; idx++)
+        pthread_join(threads[idx], NULL);
+
+    free(threads);
+    pthread_mutex_destroy(&(job.mutex));
+
+    if(job.fatal)
+    {
+        log_msg(LOG_ERR, "Memory allocation error while parsing json data, time to die");
+        free_acc_stanza_list(job.stanzas, access_array_len);
+        return FKO_ERROR_MEMORY_ALLOCATION;
+    }
+
+    // close up the slots of entries that failed, keeping array order so
+    // the last entry for a given SDP ID still wins in the table
+    for(idx = 0; idx < access_array_len; idx++)
+        if(job.stanzas[idx] != NULL)
+            job.stanzas[count++] = job.stanzas[idx];
+
+    *r_stanzas = job.stanzas;
+    *r_count = count;
+    return FWKNOPD_SUCCESS;
+}
+
+/* Add/replace stanzas in the hash table. On return the table owns every
+ * stanza in the list, and the list itself is freed.
+ */
+static int
+add_acc_stanzas_to_table(hash_table_t *acc_table, acc_stanza_t **stanzas,
+        int count, int access_array_len)
+{
+    int rv = FWKNOPD_SUCCESS;
+    int idx = 0;
+    int nodes = 0;
+    bstring key = NULL;
+    char id[SDP_MAX_CLIENT_ID_STR_LEN + 1] = {0};
+
+    for(idx = 0; idx < count; idx++)
+    {
         // convert the sdp id integer to a bstring
-        snprintf(id, SDP_MAX_CLIENT_ID_STR_LEN, "%d", new_acc->sdp_id);
+        snprintf(id, SDP_MAX_CLIENT_ID_STR_LEN, "%d", stanzas[idx]->sdp_id);
         key = bfromcstr(id);
 
-        if( hash_table_set(opts->acc_stanza_hash_tbl, key, new_acc) != FKO_SUCCESS )
+        if( hash_table_set(acc_table, key, stanzas[idx]) != FKO_SUCCESS )
         {
             log_msg(LOG_ERR,
                 "Fatal error creating access stanza hash table node"
             );
             bdestroy(key);
-            free_acc_stanza_data(new_acc);
-            free(new_acc);
+            for(; idx < count; idx++)
+            {
+                free_acc_stanza_data(stanzas[idx]);
+                free(stanzas[idx]);
+            }
+            free(stanzas);
             return FKO_ERROR_MEMORY_ALLOCATION;
         }
 
-        log_msg(LOG_NOTICE, "Added access entry for SDP ID %d", new_acc->sdp_id);
+        log_msg(LOG_NOTICE, "Added access entry for SDP ID %d", stanzas[idx]->sdp_id);
         nodes++;
     }
 
+    free(stanzas);
+
     if(nodes > 0)
     {
         log_msg(LOG_INFO, "Created %d hash table nodes from %d json stanzas", nodes, access_array_len);
@@ -2306,6 +2653,43 @@ modify_access_table(fko_srv_options_t *opts, int access_array_len, json_object *
 
 }
 
+static int
+create_acc_stanza_table(fko_srv_options_t *opts, hash_table_t **r_table)
+{
+    int hash_table_len = 0;
+    int is_err = 0;
+
+    hash_table_len = strtol_wrapper(opts->config[CONF_ACC_STANZA_HASH_TABLE_LENGTH],
+                           MIN_ACC_STANZA_HASH_TABLE_LENGTH,
+                           MAX_ACC_STANZA_HASH_TABLE_LENGTH,
+                           NO_EXIT_UPON_ERR,
+                           &is_err);
+
+    if(is_err != FKO_SUCCESS)
+    {
+        // this error should be impossible because the config variable
+        // is checked at startup
+        log_msg(LOG_ERR, "[*] var %s value '%s' not in the range %d-%d",
+                "ACC_STANZA_HASH_TABLE_LENGTH",
+                opts->config[CONF_ACC_STANZA_HASH_TABLE_LENGTH],
+                MIN_ACC_STANZA_HASH_TABLE_LENGTH,
+                MAX_ACC_STANZA_HASH_TABLE_LENGTH);
+
+        return FWKNOPD_ERROR_BAD_CONFIG;
+    }
+
+    *r_table = hash_table_create(hash_table_len, NULL, NULL, destroy_hash_node_cb);
+    if(*r_table == NULL)
+    {
+        log_msg(LOG_ERR,
+            "[*] Fatal memory allocation error creating access stanza hash table"
+        );
+        return FKO_ERROR_MEMORY_ALLOCATION;
+    }
+
+    return FWKNOPD_SUCCESS;
+}
+
 /* Take a json data array from a controller message
  * Alter/recreate the hash table based on the action
  */
@@ -2313,9 +2697,11 @@ int
 process_access_msg(fko_srv_options_t *opts, int action, json_object *jdata)
 {
     int rv = FWKNOPD_SUCCESS;
-    int hash_table_len = 0;
     int access_array_len = 0;
-    int is_err = 0;
+    int count = 0;
+    acc_stanza_t **stanzas = NULL;
+    hash_table_t *new_table = NULL;
+    hash_table_t *old_table = NULL;
 
     if(jdata == NULL || json_object_get_type(jdata) == json_type_null)
     {
@@ -2332,16 +2718,15 @@ process_access_msg(fko_srv_options_t *opts, int action, json_object *jdata)
 
     log_msg(LOG_DEBUG, "jdata contains %d objects", access_array_len);
 
-
-    // lock the hash table mutex
-    if(pthread_mutex_lock(&(opts->acc_hash_tbl_mutex)))
-    {
-        log_msg(LOG_ERR, "Mutex lock error.");
-        return FWKNOPD_ERROR_MUTEX;
-    }
-
     if(action == CTRL_ACTION_ACCESS_REMOVE)
     {
+        // lock the hash table mutex
+        if(pthread_mutex_lock(&(opts->acc_hash_tbl_mutex)))
+        {
+            log_msg(LOG_ERR, "Mutex lock error.");
+            return FWKNOPD_ERROR_MUTEX;
+        }
+
         if(opts->acc_stanza_hash_tbl == NULL)
         {
             //table is not initialized, nothing to do
@@ -2357,61 +2742,74 @@ process_access_msg(fko_srv_options_t *opts, int action, json_object *jdata)
         return FWKNOPD_SUCCESS;
     }
 
-    // if this is an access data refresh, destroy the hash table
+    // control message is either REFRESH or UPDATE, in either case the
+    // stanzas are built before the table is locked so incoming SPA
+    // packets are not held up by json parsing and access list expansion
+    if((rv = make_acc_stanzas_from_json(opts, access_array_len, jdata,
+                    &stanzas, &count)) != FWKNOPD_SUCCESS)
+        return rv;
+
+    // a refresh builds a complete replacement table, which is then
+    // swapped in with the lock held only for the pointer exchange
     if(action == CTRL_ACTION_ACCESS_REFRESH)
     {
-        if(opts->acc_stanza_hash_tbl != NULL)
+        if((rv = create_acc_stanza_table(opts, &new_table)) != FWKNOPD_SUCCESS)
         {
-            // destroy the table
-            hash_table_destroy(opts->acc_stanza_hash_tbl);
-            opts->acc_stanza_hash_tbl = NULL;
+            free_acc_stanza_list(stanzas, count);
+            return rv;
         }
-    }
 
-    // create the hash table if necessary
-    if(opts->acc_stanza_hash_tbl == NULL)
-    {
-        //need to initialize hash table
-        hash_table_len = strtol_wrapper(opts->config[CONF_ACC_STANZA_HASH_TABLE_LENGTH],
-                               MIN_ACC_STANZA_HASH_TABLE_LENGTH,
-                               MAX_ACC_STANZA_HASH_TABLE_LENGTH,
-                               NO_EXIT_UPON_ERR,
-                               &is_err);
+        // keep the current access data if the new table is incomplete
+        if((rv = add_acc_stanzas_to_table(new_table, stanzas, count,
+                        access_array_len)) != FWKNOPD_SUCCESS)
+        {
+            log_msg(LOG_ERR, "add_acc_stanzas_to_table was unsuccessful, "
+                    "keeping the current access data");
+            hash_table_destroy(new_table);
+            return rv;
+        }
 
-        if(is_err != FKO_SUCCESS)
+        if(pthread_mutex_lock(&(opts->acc_hash_tbl_mutex)))
         {
-            // this error should be impossible because the config variable
-            // is checked at startup
+            log_msg(LOG_ERR, "Mutex lock error.");
+            hash_table_destroy(new_table);
+            return FWKNOPD_ERROR_MUTEX;
+        }
 
-            pthread_mutex_unlock(&(opts->acc_hash_tbl_mutex));
+        old_table = opts->acc_stanza_hash_tbl;
+        opts->acc_stanza_hash_tbl = new_table;
 
-            log_msg(LOG_ERR, "[*] var %s value '%s' not in the range %d-%d",
-                    "ACC_STANZA_HASH_TABLE_LENGTH",
-                    opts->config[CONF_ACC_STANZA_HASH_TABLE_LENGTH],
-                    MIN_ACC_STANZA_HASH_TABLE_LENGTH,
-                    MAX_ACC_STANZA_HASH_TABLE_LENGTH);
+        pthread_mutex_unlock(&(opts->acc_hash_tbl_mutex));
 
-            return FWKNOPD_ERROR_BAD_CONFIG;
-        }
+        if(old_table != NULL)
+            hash_table_destroy(old_table);
 
-        opts->acc_stanza_hash_tbl = hash_table_create(hash_table_len,
-                NULL, NULL, destroy_hash_node_cb);
-        if(opts->acc_stanza_hash_tbl == NULL)
+        return rv;
+    }
+
+    // lock the hash table mutex
+    if(pthread_mutex_lock(&(opts->acc_hash_tbl_mutex)))
+    {
+        log_msg(LOG_ERR, "Mutex lock error.");
+        free_acc_stanza_list(stanzas, count);
+        return FWKNOPD_ERROR_MUTEX;
+    }
+
+    // create the hash table if necessary
+    if(opts->acc_stanza_hash_tbl == NULL)
+    {
+        if((rv = create_acc_stanza_table(opts, &(opts->acc_stanza_hash_tbl))) != FWKNOPD_SUCCESS)
         {
             pthread_mutex_unlock(&(opts->acc_hash_tbl_mutex));
-
-            log_msg(LOG_ERR,
-                "[*] Fatal memory allocation error creating access stanza hash table"
-            );
-            return FKO_ERROR_MEMORY_ALLOCATION;
+            free_acc_stanza_list(stanzas, count);
+            return rv;
         }
     }
 
-    // control message is either REFRESH or UPDATE
-    // in either case, use data array to modify the table
-    if((rv = modify_access_table(opts, access_array_len, jdata)) != FWKNOPD_SUCCESS)
+    if((rv = add_acc_stanzas_to_table(opts->acc_stanza_hash_tbl, stanzas,
+                    count, access_array_len)) != FWKNOPD_SUCCESS)
     {
-        log_msg(LOG_ERR, "modify_access_table was unsuccessful");
+        log_msg(LOG_ERR, "add_acc_stanzas_to_table was unsuccessful");
     }
 
     // release lock on the table
@@ -2972,6 +3370,9 @@ parse_access_file(fko_srv_options_t *opts)
     */
     set_acc_defaults(opts);
 
+    if(strncasecmp(opts->config[CONF_DISABLE_SDP_MODE], "Y", 1) == 0)
+        group_acc_stanza_keys(opts);
+
     return;
 }
 
@@ -52,6 +52,8 @@ void dump_access_list(fko_srv_options_t *opts);
 int expand_acc_service_list(acc_service_list_t **slist, char *slist_str);
 int expand_acc_port_list(acc_port_list_t **plist, char *plist_str);
 void free_acc_stanzas(fko_srv_options_t *opts);
+void acc_stanza_hold(acc_stanza_t *acc);
+void acc_stanza_release(acc_stanza_t *acc);
 void free_acc_service_list(acc_service_list_t *slist);
 void free_acc_port_list(acc_port_list_t *plist);
 
@@ -201,41 +201,19 @@ cmd_open(fko_srv_options_t *opts, acc_stanza_t *acc,
     return 1;
 }
 
-static int
-add_cmd_close(fko_srv_options_t *opts, acc_stanza_t *acc,
-        spa_data_t *spadat, const int stanza_num)
+/* Append a pending close command to the cmd cycle list.  This is also
+ * used to rebuild the list handed over by a previous fwknopd (see
+ * hot_restart.c).
+*/
+int
+cmd_cycle_restore(fko_srv_options_t *opts, const char *src_ip,
+        const char *close_cmd, const time_t expire, const int stanza_num)
 {
     cmd_cycle_list_t   *last_clist=NULL, *new_clist=NULL, *tmp_clist=NULL;
-    time_t              now;
     int                 cmd_close_len = 0;
 
-    /* CMD_CYCLE_CLOSE: Build the close command, but don't execute it until
-     * the expiration timer has passed.
-    */
-    if(build_cmd(spadat, acc->cmd_cycle_close, acc->cmd_cycle_timer))
-    {
-        /* Now the corresponding close command is now in cmd_buf
-         * for later execution when the timer expires.
-        */
-        cmd_close_len = strnlen(cmd_buf, CMD_CYCLE_BUFSIZE-1)+1;
-        log_msg(LOG_INFO,
-                "[%s] (stanza #%d) Running CMD_CYCLE_CLOSE command in %d seconds: %s",
-                spadat->pkt_source_ip, stanza_num,
-                (spadat->client_timeout == 0 ? acc->cmd_cycle_timer :
-                spadat->client_timeout), cmd_buf);
-    }
-    else
-    {
-        log_msg(LOG_ERR,
-            "[%s] (stanza #%d) Could not build CMD_CYCLE_CLOSE command.",
-            spadat->pkt_source_ip, stanza_num
-        );
-        return 0;
-    }
+    cmd_close_len = strnlen(close_cmd, CMD_CYCLE_BUFSIZE-1)+1;
 
-    /* Add the corresponding close command - to be executed after the
-     * designated timer has expired.
-    */
     if((new_clist = calloc(1, sizeof(cmd_cycle_list_t))) == NULL)
     {
         log_msg(LOG_ERR,
@@ -261,14 +239,11 @@ add_cmd_close(fko_srv_options_t *opts, acc_stanza_t *acc,
 
     /* Set the source IP
     */
-    strlcpy(new_clist->src_ip, spadat->use_src_ip,
-            sizeof(new_clist->src_ip));
+    strlcpy(new_clist->src_ip, src_ip, sizeof(new_clist->src_ip));
 
     /* Set the expiration timer
     */
-    time(&now);
-    new_clist->expire = now + (spadat->client_timeout == 0 ?
-            acc->cmd_cycle_timer : spadat->client_timeout);
+    new_clist->expire = expire;
 
     /* Set the close command
     */
@@ -279,7 +254,7 @@ add_cmd_close(fko_srv_options_t *opts, acc_stanza_t *acc,
         );
         clean_exit(opts, FW_CLEANUP, EXIT_FAILURE);
     }
-    strlcpy(new_clist->close_cmd, cmd_buf, cmd_close_len);
+    strlcpy(new_clist->close_cmd, close_cmd, cmd_close_len);
 
     /* Set the access.conf stanza number
     */
@@ -288,6 +263,47 @@ add_cmd_close(fko_srv_options_t *opts, acc_stanza_t *acc,
     return 1;
 }
 
+static int
+add_cmd_close(fko_srv_options_t *opts, acc_stanza_t *acc,
+        spa_data_t *spadat, const int stanza_num)
+{
+    time_t              now;
+
+    /* CMD_CYCLE_CLOSE: Build the close command, but don't execute it until
+     * the expiration timer has passed.
+    */
+    if(build_cmd(spadat, acc->cmd_cycle_close, acc->cmd_cycle_timer))
+    {
+        /* Now the corresponding close command is now in cmd_buf
+         * for later execution when the timer expires.
+        */
+        log_msg(LOG_INFO,
+                "[%s] (stanza #%d) Running CMD_CYCLE_CLOSE command in %d seconds: %s",
+                spadat->pkt_source_ip, stanza_num,
+                (spadat->client_timeout == 0 ? acc->cmd_cycle_timer :
+                spadat->client_timeout), cmd_buf);
+    }
+    else
+    {
+        log_msg(LOG_ERR,
+            "[%s] (stanza #%d) Could not build CMD_CYCLE_CLOSE command.",
+            spadat->pkt_source_ip, stanza_num
+        );
+        return 0;
+    }
+
+    /* Add the corresponding close command - to be executed after the
+     * designated timer has expired.
+    */
+    time(&now);
+    cmd_cycle_restore(opts, spadat->use_src_ip, cmd_buf,
+            now + (spadat->client_timeout == 0 ?
+                acc->cmd_cycle_timer : spadat->client_timeout),
+            stanza_num);
+
+    return 1;
+}
+
 /* This is the main driver for open/close command cycles
 */
 int
@@ -36,6 +36,8 @@
 int cmd_cycle_open(fko_srv_options_t *opts, acc_stanza_t *acc,
         spa_data_t *spadat, const int stanza_num, int *res);
 void cmd_cycle_close(fko_srv_options_t *opts);
+int cmd_cycle_restore(fko_srv_options_t *opts, const char *src_ip,
+        const char *close_cmd, const time_t expire, const int stanza_num);
 void free_cmd_cycle_list(fko_srv_options_t *opts);
 
 #endif  /* CMD_CYCLE_H */
@@ -87,6 +87,7 @@ static char *config_map[NUMBER_OF_CONFIG_ENTRIES] = {
     "FIREWD_SNAT_ACCESS",
     "FIREWD_MASQUERADE_ACCESS",
     "ENABLE_FIREWD_COMMENT_CHECK",
+    "ENABLE_FIREWD_DBUS",
 #elif FIREWALL_IPTABLES
     "ENABLE_IPT_FORWARDING",
     "ENABLE_IPT_LOCAL_NAT",
@@ -121,6 +122,8 @@ static char *config_map[NUMBER_OF_CONFIG_ENTRIES] = {
     "FWKNOP_CONF_DIR",
     "ACCESS_FILE",
     "FWKNOP_PID_FILE",
+    "ENABLE_GRANT_JOURNAL",
+    "GRANT_JOURNAL_FILE",
 #if USE_FILE_CACHE
     "DIGEST_FILE",
 #else
@@ -128,7 +131,11 @@ static char *config_map[NUMBER_OF_CONFIG_ENTRIES] = {
 #endif
     "GPG_HOME_DIR",
     "GPG_EXE",
+    "GPG_WORKERS",
+    "GPG_WORKER_QUEUE_MAX",
+    "GPG_DECRYPT_TIMEOUT",
     "SUDO_EXE",
+    "FIREWALL_BACKEND",
     "FIREWALL_EXE",
     "VERBOSE",
 #if AFL_FUZZING
@@ -138,6 +145,7 @@ static char *config_map[NUMBER_OF_CONFIG_ENTRIES] = {
 	"DISABLE_SDP_MODE",
 	"ALLOW_LEGACY_ACCESS_REQUESTS",
 	"ACC_STANZA_HASH_TABLE_LENGTH",
+	"ACC_STANZA_BUILD_THREADS",
 	"SERVICE_HASH_TABLE_LENGTH",
 	"DISABLE_SDP_CTRL_CLIENT",
 	"DISABLE_CONNECTION_TRACKING",
@@ -185,6 +193,7 @@ enum {
 	SDP_CTRL_CLIENT_CONF,
 	FWKNOP_CLIENT_CONF,
 	CONFIG_DUMP_OUTPUT_PATH,
+    HOT_RESTART,
     NOOP /* Just to be a marker for the end */
 };
 
@@ -220,6 +229,7 @@ static struct option cmd_opts[] =
     {"foreground",           0, NULL, 'f'},
     {"fault-injection-tag",  1, NULL, FAULT_INJECTION_TAG},
     {"help",                 0, NULL, 'h'},
+    {"hot-restart",          0, NULL, HOT_RESTART },
     {"interface",            1, NULL, 'i'},
     {"key-gen",              0, NULL, 'k'},
     {"key-gen-file",         1, NULL, KEY_GEN_FILE },
@@ -36,6 +36,7 @@
 #include "cmd_opts.h"
 #include "utils.h"
 #include "log_msg.h"
+#include "gpg_worker.h"
 #include <pthread.h>
 #include <time.h>
 
@@ -132,6 +133,10 @@ free_configs(fko_srv_options_t *opts)
 {
     int i;
 
+    /* The GPG workers reference the access stanzas
+    */
+    gpg_workers_stop(opts);
+
     free_acc_stanzas(opts);
 
     destroy_service_table(opts);
@@ -179,8 +184,16 @@ validate_int_var_ranges(fko_srv_options_t *opts)
         1, RCHK_MAX_UDPSERV_SELECT_TIMEOUT);
     range_check(opts, "ACC_STANZA_HASH_TABLE_LENGTH", opts->config[CONF_ACC_STANZA_HASH_TABLE_LENGTH],
         MIN_ACC_STANZA_HASH_TABLE_LENGTH, MAX_ACC_STANZA_HASH_TABLE_LENGTH);
+    range_check(opts, "ACC_STANZA_BUILD_THREADS", opts->config[CONF_ACC_STANZA_BUILD_THREADS],
+        0, RCHK_MAX_ACC_STANZA_BUILD_THREADS);
     range_check(opts, "MAX_WAIT_ACC_DATA", opts->config[CONF_MAX_WAIT_ACC_DATA],
         1, RCHK_MAX_WAIT_ACC_DATA);
+    range_check(opts, "GPG_WORKERS", opts->config[CONF_GPG_WORKERS],
+        0, RCHK_MAX_GPG_WORKERS);
+    range_check(opts, "GPG_WORKER_QUEUE_MAX", opts->config[CONF_GPG_WORKER_QUEUE_MAX],
+        1, RCHK_MAX_GPG_WORKER_QUEUE_MAX);
+    range_check(opts, "GPG_DECRYPT_TIMEOUT", opts->config[CONF_GPG_DECRYPT_TIMEOUT],
+        1, RCHK_MAX_GPG_DECRYPT_TIMEOUT);
     range_check(opts, "SERVICE_HASH_TABLE_LENGTH", opts->config[CONF_SERVICE_HASH_TABLE_LENGTH],
         MIN_SERVICE_HASH_TABLE_LENGTH, MAX_SERVICE_HASH_TABLE_LENGTH);
 
@@ -451,6 +464,24 @@ validate_options(fko_srv_options_t *opts)
         set_config_entry(opts, CONF_FWKNOP_PID_FILE, tmp_path);
     }
 
+    if(opts->config[CONF_ENABLE_GRANT_JOURNAL] == NULL)
+        set_config_entry(opts, CONF_ENABLE_GRANT_JOURNAL, DEF_ENABLE_GRANT_JOURNAL);
+
+    if(opts->config[CONF_FIREWALL_BACKEND] == NULL)
+        set_config_entry(opts, CONF_FIREWALL_BACKEND, DEF_FIREWALL_BACKEND);
+
+    if(opts->config[CONF_GRANT_JOURNAL_FILE] == NULL)
+    {
+        strlcpy(tmp_path, opts->config[CONF_FWKNOP_RUN_DIR], sizeof(tmp_path));
+
+        if(tmp_path[strlen(tmp_path)-1] != '/')
+            strlcat(tmp_path, "/", sizeof(tmp_path));
+
+        strlcat(tmp_path, DEF_GRANT_JOURNAL_FILENAME, sizeof(tmp_path));
+
+        set_config_entry(opts, CONF_GRANT_JOURNAL_FILE, tmp_path);
+    }
+
 #if USE_FILE_CACHE
     if(opts->config[CONF_DIGEST_FILE] == NULL)
 #else
@@ -699,6 +730,12 @@ validate_options(fko_srv_options_t *opts)
         set_config_entry(opts, CONF_ENABLE_FIREWD_COMMENT_CHECK,
             DEF_ENABLE_FIREWD_COMMENT_CHECK);
 
+    /* Talk to firewalld over D-Bus instead of running firewall-cmd
+    */
+    if(opts->config[CONF_ENABLE_FIREWD_DBUS] == NULL)
+        set_config_entry(opts, CONF_ENABLE_FIREWD_DBUS,
+            DEF_ENABLE_FIREWD_DBUS);
+
 #elif FIREWALL_IPTABLES
     /* Enable IPT forwarding.
     */
@@ -918,6 +955,17 @@ validate_options(fko_srv_options_t *opts)
     if(opts->config[CONF_GPG_EXE] == NULL)
         set_config_entry(opts, CONF_GPG_EXE, DEF_GPG_EXE);
 
+    /* GPG worker threads
+    */
+    if(opts->config[CONF_GPG_WORKERS] == NULL)
+        set_config_entry(opts, CONF_GPG_WORKERS, DEF_GPG_WORKERS);
+
+    if(opts->config[CONF_GPG_WORKER_QUEUE_MAX] == NULL)
+        set_config_entry(opts, CONF_GPG_WORKER_QUEUE_MAX, DEF_GPG_WORKER_QUEUE_MAX);
+
+    if(opts->config[CONF_GPG_DECRYPT_TIMEOUT] == NULL)
+        set_config_entry(opts, CONF_GPG_DECRYPT_TIMEOUT, DEF_GPG_DECRYPT_TIMEOUT);
+
     /* sudo executable
     */
     if(opts->config[CONF_SUDO_EXE] == NULL)
@@ -1012,6 +1060,11 @@ validate_options(fko_srv_options_t *opts)
         set_config_entry(opts, CONF_ACC_STANZA_HASH_TABLE_LENGTH, DEF_ACC_HASH_TABLE_LENGTH_STR);
     }
 
+    /* Threads used to build access stanzas from controller data
+     */
+    if(opts->config[CONF_ACC_STANZA_BUILD_THREADS] == NULL)
+        set_config_entry(opts, CONF_ACC_STANZA_BUILD_THREADS, DEF_ACC_STANZA_BUILD_THREADS);
+
     if(opts->config[CONF_SERVICE_HASH_TABLE_LENGTH] == NULL)
     {
         set_config_entry(opts, CONF_SERVICE_HASH_TABLE_LENGTH, DEF_SERVICE_HASH_TABLE_LENGTH_STR);
@@ -1385,7 +1438,7 @@ config_init(fko_srv_options_t *opts, int argc, char **argv)
             case CONN_ID_FILE:
                 set_config_entry(opts, CONF_CONN_ID_FILE, optarg);
                 break;
-            case CONF_CONN_REPORT_INTERVAL:
+            case CONN_REPORT_INTERVAL:
                 set_config_entry(opts, CONF_CONN_REPORT_INTERVAL, optarg);
                 break;
             case MAX_WAIT_ACC_DATA:
@@ -1487,6 +1540,9 @@ config_init(fko_srv_options_t *opts, int argc, char **argv)
             case 'R':
                 opts->restart = 1;
                 break;
+            case HOT_RESTART:
+                opts->hot_restart = 1;
+                break;
             case 'r':
                 set_config_entry(opts, CONF_FWKNOP_RUN_DIR, optarg);
                 break;
@@ -1611,6 +1667,8 @@ usage(void)
       " -P, --pcap-filter       - Specify a Berkeley packet filter statement to\n"
       "                           override the PCAP_FILTER variable in fwknopd.conf.\n"
       " -R, --restart           - Force the currently running fwknopd to restart.\n"
+      "     --hot-restart       - Start up by taking over the SPA socket and state\n"
+      "                           of the currently running fwknopd, which then exits.\n"
       "     --rotate-digest-cache\n"
       "                         - Rotate the digest cache file by renaming the file\n"
       "                           to the same path with the -old suffix.\n"
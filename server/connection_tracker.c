@@ -22,6 +22,11 @@
 #include "service.h"
 #include "connection_tracker.h"
 
+#ifdef HAVE_C_UNIT_TESTS
+  #include "cunit_common.h"
+  DECLARE_TEST_SUITE(connection_tracker, "Connection tracker test suite");
+#endif
+
 //const char *conn_id_key = "connection_id";
 const char *sdp_id_key  = "sdp_id";
 
@@ -48,11 +53,13 @@ static hash_table_t *connection_hash_tbl = NULL;
 static hash_table_t *latest_connection_hash_tbl = NULL;
 //static uint64_t last_conn_id = 0;
 static connection_t msg_conn_list = NULL;
+static connection_t handed_over_conns = NULL;
 static int verbosity = 0;
-static time_t next_ctrl_msg_due = 0;
+static time_t msg_conn_list_since = 0;
 static char conntrack_buf[CONNTRACK_CMD_OUT_BUFSIZE] = {0};
 
 static int close_connections(fko_srv_options_t *opts, char *criteria);
+static int restore_handed_over_conns(void);
 
 
 static void print_connection_item(connection_t this_conn)
@@ -226,16 +233,16 @@ static int create_connection_item( //uint64_t connection_id,
 //    this_conn->connection_id = connection_id;
     this_conn->sdp_id     = sdp_id;
     this_conn->service_id = service_id;
-    strncpy(this_conn->protocol, protocol, MAX_PROTO_STR_LEN+1);
-    strncpy(this_conn->src_ip_str, src_ip_str, MAX_IPV4_STR_LEN);
+    strlcpy(this_conn->protocol, protocol, sizeof(this_conn->protocol));
+    strlcpy(this_conn->src_ip_str, src_ip_str, sizeof(this_conn->src_ip_str));
     this_conn->src_port   = src_port;
-    strncpy(this_conn->dst_ip_str, dst_ip_str, MAX_IPV4_STR_LEN);
+    strlcpy(this_conn->dst_ip_str, dst_ip_str, sizeof(this_conn->dst_ip_str));
     this_conn->dst_port   = dst_port;
     this_conn->start_time = start_time;
     this_conn->end_time   = end_time;
 
     if(nat_dst_ip_str != NULL)
-        strncpy(this_conn->nat_dst_ip_str, nat_dst_ip_str, MAX_IPV4_STR_LEN);
+        strlcpy(this_conn->nat_dst_ip_str, nat_dst_ip_str, sizeof(this_conn->nat_dst_ip_str));
 
     this_conn->nat_dst_port = nat_dst_port;
 
@@ -1680,9 +1687,105 @@ int init_connection_tracker(fko_srv_options_t *opts)
         clean_exit(opts, NO_FW_CLEANUP, EXIT_FAILURE);
     }
 
+    if(restore_handed_over_conns() != FWKNOPD_SUCCESS)
+    {
+        log_msg(LOG_ERR,
+            "[*] Failed to restore the connections handed over by the previous fwknopd"
+        );
+        clean_exit(opts, NO_FW_CLEANUP, EXIT_FAILURE);
+    }
+
     return is_err;
 }
 
+/* Known connections handed over by a previous fwknopd (see hot_restart.c)
+ * are held here until init_connection_tracker() creates the table.
+*/
+static int restore_handed_over_conns(void)
+{
+    connection_t this_conn = NULL;
+    int rv = FWKNOPD_SUCCESS;
+
+    while(handed_over_conns != NULL)
+    {
+        this_conn = handed_over_conns;
+        handed_over_conns = this_conn->next;
+        this_conn->next = NULL;
+
+        if( (rv = store_in_connection_hash_tbl(connection_hash_tbl, this_conn))
+                != FWKNOPD_SUCCESS)
+        {
+            destroy_connection_item(this_conn);
+            break;
+        }
+    }
+
+    return rv;
+}
+
+
+int import_known_connection(const char *line)
+{
+    char protocol[MAX_PROTO_STR_LEN+1] = {0};
+    char src_ip_str[MAX_IPV4_STR_LEN] = {0};
+    char dst_ip_str[MAX_IPV4_STR_LEN] = {0};
+    char nat_dst_ip_str[MAX_IPV4_STR_LEN] = {0};
+    uint32_t sdp_id = 0, service_id = 0;
+    unsigned int src_port = 0, dst_port = 0, nat_dst_port = 0;
+    long start_time = 0, end_time = 0;
+    connection_t this_conn = NULL;
+    int rv = FWKNOPD_SUCCESS;
+
+    if(sscanf(line, "%"SCNu32" %"SCNu32" %4s %15s %u %15s %u %15s %u %ld %ld",
+                &sdp_id, &service_id, protocol, src_ip_str, &src_port,
+                dst_ip_str, &dst_port, nat_dst_ip_str, &nat_dst_port,
+                &start_time, &end_time) != 11)
+    {
+        log_msg(LOG_ERR, "import_known_connection() Bad connection line: %s", line);
+        return FWKNOPD_ERROR_CONNTRACK;
+    }
+
+    if( (rv = create_connection_item(sdp_id, service_id, protocol,
+            src_ip_str, src_port, dst_ip_str, dst_port,
+            strcmp(nat_dst_ip_str, "-") == 0 ? NULL : nat_dst_ip_str,
+            nat_dst_port, (time_t)start_time, (time_t)end_time,
+            &this_conn)) != FWKNOPD_SUCCESS)
+        return rv;
+
+    return add_to_connection_list(&handed_over_conns, this_conn);
+}
+
+
+static int traverse_export_conns_cb(hash_table_node_t *node, void *arg)
+{
+    FILE *out = (FILE*)arg;
+    connection_t this_conn = (connection_t)(node->data);
+
+    for(; this_conn != NULL; this_conn = this_conn->next)
+    {
+        fprintf(out, "conn %"PRIu32" %"PRIu32" %s %s %u %s %u %s %u %ld %ld\n",
+                this_conn->sdp_id, this_conn->service_id,
+                this_conn->protocol, this_conn->src_ip_str,
+                this_conn->src_port, this_conn->dst_ip_str,
+                this_conn->dst_port,
+                this_conn->nat_dst_ip_str[0] ? this_conn->nat_dst_ip_str : "-",
+                this_conn->nat_dst_port,
+                (long)this_conn->start_time, (long)this_conn->end_time);
+    }
+
+    return FWKNOPD_SUCCESS;
+}
+
+
+int export_known_connections(FILE *out)
+{
+    if(connection_hash_tbl == NULL)
+        return FWKNOPD_SUCCESS;
+
+    return hash_table_traverse(connection_hash_tbl, traverse_export_conns_cb, out);
+}
+
+
 void destroy_connection_tracker(fko_srv_options_t *opts)
 {
 //    store_last_conn_id(opts);
@@ -1704,6 +1807,14 @@ void destroy_connection_tracker(fko_srv_options_t *opts)
         destroy_connection_list(msg_conn_list);
         msg_conn_list = NULL;
     }
+    msg_conn_list_count = 0;
+    msg_conn_list_since = 0;
+
+    if(handed_over_conns != NULL)
+    {
+        destroy_connection_list(handed_over_conns);
+        handed_over_conns = NULL;
+    }
 }
 
 #ifdef DEBUG_CONNECTION_TRACKER
@@ -1883,92 +1994,290 @@ static int make_json_from_conn_item(connection_t conn, json_object **jconn_r)
     return FWKNOPD_SUCCESS;
 }
 
-static int send_connection_report(fko_srv_options_t *opts, connection_t msg_list)
+/* Order two pending connection events by SDP ID and then by connection,
+ * ignoring when (or whether) the connection closed.
+ */
+static int compare_conn_keys(connection_t x, connection_t y)
 {
-    int rv = FWKNOPD_SUCCESS;
-    json_object *jarray = NULL;
-    json_object *jconn = NULL;
-    connection_t this_conn = msg_list;
-    int conn_count = 0;
+    int rv = 0;
 
-#ifdef DEBUG_CONNECTION_TRACKER
-    const char *json_string = NULL;
-    float avg = 0;
-    int msg_len = 0;
-#endif
+    if(x->sdp_id != y->sdp_id)
+        return x->sdp_id < y->sdp_id ? -1 : 1;
 
-    if(msg_list == NULL)
+    if(x->service_id != y->service_id)
+        return x->service_id < y->service_id ? -1 : 1;
+
+    if(x->src_port != y->src_port)
+        return x->src_port < y->src_port ? -1 : 1;
+
+    if(x->dst_port != y->dst_port)
+        return x->dst_port < y->dst_port ? -1 : 1;
+
+    if((rv = strncmp(x->src_ip_str, y->src_ip_str, MAX_IPV4_STR_LEN)) != 0)
         return rv;
 
-    if(verbosity >= LOG_DEBUG)
+    if((rv = strncmp(x->dst_ip_str, y->dst_ip_str, MAX_IPV4_STR_LEN)) != 0)
+        return rv;
+
+    if((rv = strncmp(x->protocol, y->protocol, MAX_PROTO_STR_LEN)) != 0)
+        return rv;
+
+    if(x->start_time != y->start_time)
+        return x->start_time < y->start_time ? -1 : 1;
+
+    return 0;
+}
+
+// qsort callback, puts the open event for a connection ahead of its close
+static int compare_conn_events(const void *a, const void *b)
+{
+    connection_t x = *(connection_t *)a;
+    connection_t y = *(connection_t *)b;
+    int rv = 0;
+
+    if((rv = compare_conn_keys(x, y)) != 0)
+        return rv;
+
+    if(x->end_time != y->end_time)
+        return x->end_time < y->end_time ? -1 : 1;
+
+    return 0;
+}
+
+/* Group the pending events by SDP ID and drop those made redundant by
+ * a later event for the same connection. A connection that opened and
+ * closed since the last report goes out once, as closed, and an open
+ * connection queued twice (e.g. by report_open_connections while it was
+ * still waiting to be reported) goes out once.
+ */
+static int coalesce_connection_list(connection_t *list, int *count_r)
+{
+    connection_t this_conn = *list;
+    connection_t last_kept = NULL;
+    connection_t *items = NULL;
+    int count = 0, kept = 0, idx = 0;
+
+    while(this_conn != NULL)
     {
-        log_msg(LOG_DEBUG, "\n\nDumping message list for controller:");
-        print_connection_list(msg_list);
+        count++;
+        this_conn = this_conn->next;
     }
 
-    jarray = json_object_new_array();
+    if(count < 2)
+    {
+        *count_r = count;
+        return FWKNOPD_SUCCESS;
+    }
 
-    // send in blocks of MSG_CONN_LIST_COUNT_THRESHOLD connections max
-    while(this_conn != NULL)
+    if((items = calloc(count, sizeof(connection_t))) == NULL)
+    {
+        log_msg(LOG_ERR, "coalesce_connection_list() FATAL MEMORY ERROR. ABORTING.");
+        return FWKNOPD_ERROR_MEMORY_ALLOCATION;
+    }
+
+    for(this_conn = *list; this_conn != NULL; this_conn = this_conn->next)
+        items[idx++] = this_conn;
+
+    qsort(items, count, sizeof(connection_t), compare_conn_events);
+
+    *list = NULL;
+    for(idx = 0; idx < count; idx++)
+    {
+        items[idx]->next = NULL;
+
+        if(idx + 1 < count && compare_conn_keys(items[idx], items[idx+1]) == 0)
+        {
+            destroy_connection_item(items[idx]);
+            continue;
+        }
+
+        if(last_kept == NULL)
+            *list = items[idx];
+        else
+            last_kept->next = items[idx];
+
+        last_kept = items[idx];
+        kept++;
+    }
+
+    if(kept < count)
+        log_msg(LOG_DEBUG, "coalesce_connection_list() dropped %d superseded "
+                "connection events", count - kept);
+
+    free(items);
+    *count_r = kept;
+    return FWKNOPD_SUCCESS;
+}
+
+/* Keep at most MSG_CONN_LIST_BACKLOG_MAX unreported events while the
+ * controller cannot be reached. Open events go first since the open
+ * connection report that follows every reconnect repeats them anyway.
+ */
+static void trim_connection_backlog(connection_t *list, int *count)
+{
+    connection_t this_conn = *list;
+    connection_t prev_conn = NULL;
+    connection_t next_conn = NULL;
+    int dropped = 0, kept = 0;
+
+    if(*count <= MSG_CONN_LIST_BACKLOG_MAX)
+        return;
+
+    while(this_conn != NULL && *count - dropped > MSG_CONN_LIST_BACKLOG_MAX)
+    {
+        next_conn = this_conn->next;
+
+        if(this_conn->end_time == 0)
+        {
+            if(prev_conn != NULL)
+                prev_conn->next = next_conn;
+            else
+                *list = next_conn;
+
+            destroy_connection_item(this_conn);
+            dropped++;
+        }
+        else
+            prev_conn = this_conn;
+
+        this_conn = next_conn;
+    }
+
+    // still too many, so cut the closed events off the tail
+    for(prev_conn = NULL, this_conn = *list; this_conn != NULL;
+            prev_conn = this_conn, this_conn = this_conn->next)
+    {
+        if(kept++ < MSG_CONN_LIST_BACKLOG_MAX)
+            continue;
+
+        prev_conn->next = NULL;
+        while(this_conn != NULL)
+        {
+            next_conn = this_conn->next;
+            destroy_connection_item(this_conn);
+            dropped++;
+            this_conn = next_conn;
+        }
+        break;
+    }
+
+    log_msg(LOG_WARNING, "Connection report backlog full, dropped %d "
+            "unreported connection events", dropped);
+    *count -= dropped;
+}
+
+/* Pack events from the head of list into one connection_update array,
+ * as many as fit in MSG_CONN_REPORT_MAX_LEN bytes (and always at least
+ * one, however big).
+ */
+static int make_connection_report_msg(connection_t list, json_object **jarray_r,
+        int *conn_count_r, size_t *msg_len_r)
+{
+    int rv = FWKNOPD_SUCCESS;
+    json_object *jarray = json_object_new_array();
+    json_object *jconn = NULL;
+    connection_t this_conn = NULL;
+    int conn_count = 0;
+    size_t msg_len = 0;
+    size_t item_len = 0;
+
+    for(this_conn = list; this_conn != NULL; this_conn = this_conn->next)
     {
-        conn_count++;
         if( (rv = make_json_from_conn_item(this_conn, &jconn)) != FWKNOPD_SUCCESS)
         {
             json_object_put(jarray);
             return rv;
         }
-        json_object_array_add(jarray, jconn);
 
-        if(conn_count >= MSG_CONN_LIST_COUNT_THRESHOLD)
+        item_len = strlen(json_object_to_json_string(jconn)) + 2;
+        if(conn_count > 0 && msg_len + item_len > MSG_CONN_REPORT_MAX_LEN)
         {
-            log_msg(LOG_WARNING, "Sending connection_update message (%d connections) to controller", conn_count);
+            json_object_put(jconn);
+            break;
+        }
 
-#ifdef DEBUG_CONNECTION_TRACKER
-            json_string = json_object_to_json_string(jarray);
-            avg = msg_len/conn_count;
-            log_msg(LOG_ALERT, "\nconnection update...");
-            log_msg(LOG_ALERT, "                      connections: %10d", conn_count);
-            log_msg(LOG_ALERT, "      data string length in bytes: %10d", msg_len);
-            log_msg(LOG_ALERT, "average conn data length in bytes: %10.2f\n", avg);
-#endif
+        json_object_array_add(jarray, jconn);
+        msg_len += item_len;
+        conn_count++;
+    }
 
-            rv = sdp_ctrl_client_send_message(opts->ctrl_client, "connection_update", jarray);
+    *jarray_r = jarray;
+    *conn_count_r = conn_count;
+    *msg_len_r = msg_len;
+    return rv;
+}
 
-            json_object_put(jarray);
+/* Send the pending connection events, packing as many into each
+ * connection_update message as fit in MSG_CONN_REPORT_MAX_LEN bytes.
+ * Events are removed from the list as their message is handed to the
+ * control client, so on failure the list holds only what was not sent.
+ */
+static int send_connection_report(fko_srv_options_t *opts, connection_t *msg_list, int *msg_count)
+{
+    int rv = FWKNOPD_SUCCESS;
+    json_object *jarray = NULL;
+    connection_t this_conn = NULL;
+    connection_t next_conn = NULL;
+    int conn_count = 0;
+    size_t msg_len = 0;
 
-            if(rv != SDP_SUCCESS)
-                return rv;
+    if(*msg_list == NULL)
+        return rv;
 
-            if(this_conn->next != NULL)
-            {
-                jarray = json_object_new_array();
-                conn_count = 0;
-            }
-            else
-                return rv;
-        }
-        this_conn = this_conn->next;
+    if( (rv = coalesce_connection_list(msg_list, msg_count)) != FWKNOPD_SUCCESS)
+        return rv;
+
+    if(verbosity >= LOG_DEBUG)
+    {
+        log_msg(LOG_DEBUG, "\n\nDumping message list for controller:");
+        print_connection_list(*msg_list);
     }
 
-    log_msg(LOG_WARNING, "Sending connection_update message (%d connections) to controller", conn_count);
+    while(*msg_list != NULL)
+    {
+        if( (rv = make_connection_report_msg(*msg_list, &jarray,
+                        &conn_count, &msg_len)) != FWKNOPD_SUCCESS)
+            return rv;
+
+        log_msg(LOG_WARNING, "Sending connection_update message (%d connections) to controller", conn_count);
 
 #ifdef DEBUG_CONNECTION_TRACKER
-    json_string = json_object_to_json_string(jarray);
-    avg = msg_len/conn_count;
-    log_msg(LOG_ALERT, "\nconnection update...");
-    log_msg(LOG_ALERT, "                      connections: %10d", conn_count);
-    log_msg(LOG_ALERT, "      data string length in bytes: %10d", msg_len);
-    log_msg(LOG_ALERT, "average conn data length in bytes: %10.2f\n", avg);
+        log_msg(LOG_ALERT, "\nconnection update...");
+        log_msg(LOG_ALERT, "                      connections: %10d", conn_count);
+        log_msg(LOG_ALERT, "      data string length in bytes: %10d", (int)msg_len);
+        log_msg(LOG_ALERT, "average conn data length in bytes: %10.2f\n", (float)msg_len/conn_count);
 #endif
 
-    rv = sdp_ctrl_client_send_message(opts->ctrl_client, "connection_update", jarray);
+        rv = sdp_ctrl_client_send_message(opts->ctrl_client, "connection_update", jarray);
 
-    json_object_put(jarray);
+        json_object_put(jarray);
+
+        if(rv != SDP_SUCCESS)
+            return rv;
+
+        // these went out, drop them from the pending list
+        this_conn = *msg_list;
+        while(conn_count-- > 0)
+        {
+            next_conn = this_conn->next;
+            destroy_connection_item(this_conn);
+            this_conn = next_conn;
+            (*msg_count)--;
+        }
+        *msg_list = this_conn;
+    }
 
     return rv;
 }
 
 
+/*
+ * Report pending connection events once the oldest has waited for the
+ * report interval, or sooner if MSG_CONN_LIST_COUNT_THRESHOLD events
+ * are pending. Waiting from the first event rather than from the last
+ * report lets connections that open and close in quick succession be
+ * reported once instead of twice.
+ */
 int consider_reporting_connections(fko_srv_options_t *opts)
 {
     int rv = FWKNOPD_SUCCESS;
@@ -1983,12 +2292,19 @@ int consider_reporting_connections(fko_srv_options_t *opts)
         return rv;
     }
 
-    // if it's not time, just return success
-    if(msg_conn_list_count < MSG_CONN_LIST_COUNT_THRESHOLD && now < next_ctrl_msg_due)
-        return rv;
-
     // if nothing new to report, just return success
     if(msg_conn_list == NULL)
+    {
+        msg_conn_list_since = 0;
+        return rv;
+    }
+
+    if(msg_conn_list_since == 0)
+        msg_conn_list_since = now;
+
+    // if it's not time, just return success
+    if(msg_conn_list_count < MSG_CONN_LIST_COUNT_THRESHOLD
+            && now - msg_conn_list_since < interval)
         return rv;
 
     // time to send
@@ -2000,46 +2316,55 @@ int consider_reporting_connections(fko_srv_options_t *opts)
         log_msg(LOG_DEBUG, "Dumping known connections hash table:");
         hash_table_traverse(connection_hash_tbl, traverse_print_conn_items_cb, NULL);
 
-        log_msg(LOG_DEBUG, "\n\nDumping message list for controller:");
-        print_connection_list(msg_conn_list);
-
         log_msg(LOG_DEBUG, "\n\n");
     }
 
     // send message
-    if( (rv = send_connection_report(opts, msg_conn_list)) != FWKNOPD_SUCCESS)
+    if( (rv = send_connection_report(opts, &msg_conn_list, &msg_conn_list_count)) != FWKNOPD_SUCCESS)
     {
-        if(rv == SDP_ERROR_MEMORY_ALLOCATION)
+        if(rv == FWKNOPD_ERROR_MEMORY_ALLOCATION || rv == SDP_ERROR_MEMORY_ALLOCATION)
         {
             log_msg(LOG_ERR, "consider_reporting_connections() experienced a fatal memory error.");
             return rv;
         }
-        else
-        {
-            log_msg(LOG_ERR, "consider_reporting_connections() failed to send a report. Dropping the message.");
-        }
-    }
 
-    // free message list
-    destroy_connection_list(msg_conn_list);
-    msg_conn_list = NULL;
-    msg_conn_list_count = 0;
+        log_msg(LOG_ERR, "consider_reporting_connections() failed to send a report. "
+                "Holding %d connection events for the next attempt.", msg_conn_list_count);
+        trim_connection_backlog(&msg_conn_list, &msg_conn_list_count);
 
-    // update next_ctrl_msg_due
-    next_ctrl_msg_due = now + interval;
-
-    if(next_ctrl_msg_due < now)
-    {
-        log_msg(LOG_ERR, "consider_reporting_connections() variable next_ctrl_msg_due "
-                "has overflowed, possibly due to a large report interval. Report "
-                "interval is %d seconds.", interval);
-        return FWKNOPD_ERROR_CONNTRACK;
+        // try again after another interval rather than on every pass
+        msg_conn_list_since = now;
+        return FWKNOPD_SUCCESS;
     }
 
+    msg_conn_list_since = 0;
     return FWKNOPD_SUCCESS;
 }
 
 
+/*
+ * Send whatever connection events are still pending, used on shutdown
+ * and before the control client is torn down for a config reload.
+ */
+int flush_connection_reports(fko_srv_options_t *opts)
+{
+    int rv = FWKNOPD_SUCCESS;
+
+    if(msg_conn_list == NULL || opts->ctrl_client == NULL
+            || sdp_ctrl_client_connection_status(opts->ctrl_client) != SDP_COM_CONNECTED)
+        return rv;
+
+    log_msg(LOG_INFO, "Flushing %d pending connection events to controller",
+            msg_conn_list_count);
+
+    if( (rv = send_connection_report(opts, &msg_conn_list, &msg_conn_list_count)) != FWKNOPD_SUCCESS)
+        log_msg(LOG_ERR, "flush_connection_reports() failed to send %d connection events",
+                msg_conn_list_count);
+
+    msg_conn_list_since = 0;
+    return rv;
+}
+
 
 static int traverse_copy_open_conns_cb(hash_table_node_t *node, void *arg)
 {
@@ -2103,7 +2428,8 @@ int report_open_connections(fko_srv_options_t *opts)
         return rv;
     }
 
-    // gather copies of all open connections into msg_list
+    // gather copies of all open connections into msg_list, alongside
+    // any events still waiting to be reported
     if( (rv = hash_table_traverse(connection_hash_tbl, traverse_copy_open_conns_cb, NULL))  != FWKNOPD_SUCCESS )
     {
         // free message list
@@ -2119,15 +2445,11 @@ int report_open_connections(fko_srv_options_t *opts)
         return FWKNOPD_SUCCESS;
     }
 
-    // send message
-    rv = send_connection_report(opts, msg_conn_list);
+    // send message, duplicates of pending open events are dropped
+    rv = send_connection_report(opts, &msg_conn_list, &msg_conn_list_count);
+    msg_conn_list_since = 0;
 
-    // free message list
-    destroy_connection_list(msg_conn_list);
-    msg_conn_list = NULL;
-    msg_conn_list_count = 0;
-
-    if(rv == SDP_ERROR_MEMORY_ALLOCATION)
+    if(rv == FWKNOPD_ERROR_MEMORY_ALLOCATION || rv == SDP_ERROR_MEMORY_ALLOCATION)
     {
         log_msg(LOG_ERR, "report_open_connections() experienced a fatal memory error.");
         return rv;
@@ -2135,6 +2457,7 @@ int report_open_connections(fko_srv_options_t *opts)
     else if(rv != FWKNOPD_SUCCESS)
     {
         log_msg(LOG_ERR, "report_open_connections() failed to send a report. Carrying on.");
+        trim_connection_backlog(&msg_conn_list, &msg_conn_list_count);
         return FWKNOPD_SUCCESS;
     }
     else
@@ -2145,4 +2468,145 @@ int report_open_connections(fko_srv_options_t *opts)
     return FWKNOPD_SUCCESS;
 }
 
+#ifdef HAVE_C_UNIT_TESTS
+
+static connection_t ut_conn(uint32_t sdp_id, unsigned int src_port,
+        time_t start_time, time_t end_time)
+{
+    connection_t conn = NULL;
+
+    create_connection_item(sdp_id, 1, "tcp", "10.0.0.2", src_port,
+            "10.0.1.2", 22, NULL, 0, start_time, end_time, &conn);
+    return conn;
+}
+
+static int ut_list_len(connection_t list)
+{
+    int count = 0;
+
+    for(; list != NULL; list = list->next)
+        count++;
+    return count;
+}
+
+DECLARE_UTEST(coalesce_connection_list, "check coalesce_connection_list function")
+{
+    connection_t list = NULL;
+    int count = 0;
+
+    /* A connection that opened and closed, one queued open twice and
+     * one only open, for two SDP IDs
+    */
+    add_to_connection_list(&list, ut_conn(2, 40000, 100, 0));
+    add_to_connection_list(&list, ut_conn(1, 40001, 100, 0));
+    add_to_connection_list(&list, ut_conn(2, 40000, 100, 150));
+    add_to_connection_list(&list, ut_conn(1, 40001, 100, 0));
+    add_to_connection_list(&list, ut_conn(1, 40002, 120, 0));
+
+    CU_ASSERT(coalesce_connection_list(&list, &count) == FWKNOPD_SUCCESS);
+    CU_ASSERT(count == 3);
+    CU_ASSERT(ut_list_len(list) == 3);
+
+    /* grouped by SDP ID, and the closed event is the one kept */
+    CU_ASSERT(list->sdp_id == 1 && list->src_port == 40001 && list->end_time == 0);
+    CU_ASSERT(list->next->sdp_id == 1 && list->next->src_port == 40002);
+    CU_ASSERT(list->next->next->sdp_id == 2 && list->next->next->end_time == 150);
+
+    destroy_connection_list(list);
+}
+
+DECLARE_UTEST(trim_connection_backlog_open, "check trim_connection_backlog drops open events first")
+{
+    connection_t list = NULL, conn = NULL;
+    int count = 0, idx, open_left = 0;
+
+    for(idx = 0; idx < MSG_CONN_LIST_BACKLOG_MAX + 50; idx++)
+    {
+        add_to_connection_list(&list, ut_conn(1, idx, 100, (idx % 10 == 0) ? 0 : 200));
+        count++;
+    }
+
+    trim_connection_backlog(&list, &count);
+    CU_ASSERT(count == MSG_CONN_LIST_BACKLOG_MAX);
+    CU_ASSERT(ut_list_len(list) == MSG_CONN_LIST_BACKLOG_MAX);
+
+    for(conn = list; conn != NULL; conn = conn->next)
+        if(conn->end_time == 0)
+            open_left++;
+
+    /* 50 of the (MSG_CONN_LIST_BACKLOG_MAX + 50) / 10 open events went */
+    CU_ASSERT(open_left == (MSG_CONN_LIST_BACKLOG_MAX + 50) / 10 - 50);
+
+    destroy_connection_list(list);
+}
+
+DECLARE_UTEST(trim_connection_backlog_closed, "check trim_connection_backlog cuts closed events off the tail")
+{
+    connection_t list = NULL, conn = NULL;
+    int count = 0, idx;
+
+    for(idx = 0; idx < MSG_CONN_LIST_BACKLOG_MAX + 50; idx++)
+    {
+        add_to_connection_list(&list, ut_conn(1, idx, 100, 200));
+        count++;
+    }
+
+    trim_connection_backlog(&list, &count);
+    CU_ASSERT(count == MSG_CONN_LIST_BACKLOG_MAX);
+    CU_ASSERT(ut_list_len(list) == MSG_CONN_LIST_BACKLOG_MAX);
+
+    for(conn = list; conn->next != NULL; conn = conn->next);
+    CU_ASSERT(conn->src_port == MSG_CONN_LIST_BACKLOG_MAX - 1);
+
+    /* nothing to trim */
+    trim_connection_backlog(&list, &count);
+    CU_ASSERT(count == MSG_CONN_LIST_BACKLOG_MAX);
+
+    destroy_connection_list(list);
+}
+
+DECLARE_UTEST(make_connection_report_msg, "check connection reports are split under MSG_CONN_REPORT_MAX_LEN")
+{
+    connection_t list = NULL, conn = NULL;
+    json_object *jarray = NULL;
+    int idx, conn_count = 0, total = 0, msgs = 0;
+    size_t msg_len = 0;
+
+    for(idx = 0; idx < 2000; idx++)
+        add_to_connection_list(&list, ut_conn(idx, idx, 100, 200));
+
+    /* walk the list the way send_connection_report() does */
+    for(conn = list; conn != NULL; msgs++)
+    {
+        CU_ASSERT(make_connection_report_msg(conn, &jarray,
+                    &conn_count, &msg_len) == FWKNOPD_SUCCESS);
+        CU_ASSERT(conn_count > 0);
+        CU_ASSERT(msg_len <= MSG_CONN_REPORT_MAX_LEN);
+        CU_ASSERT(strlen(json_object_to_json_string(jarray)) <= MSG_CONN_REPORT_MAX_LEN);
+        CU_ASSERT((int)json_object_array_length(jarray) == conn_count);
+        json_object_put(jarray);
+
+        total += conn_count;
+        while(conn_count-- > 0)
+            conn = conn->next;
+    }
+
+    CU_ASSERT(total == 2000);
+    CU_ASSERT(msgs > 1);
+
+    destroy_connection_list(list);
+}
+
+int register_ts_connection_tracker(void)
+{
+    ts_init(&TEST_SUITE(connection_tracker), TEST_SUITE_DESCR(connection_tracker), NULL, NULL);
+    ts_add_utest(&TEST_SUITE(connection_tracker), UTEST_FCT(coalesce_connection_list), UTEST_DESCR(coalesce_connection_list));
+    ts_add_utest(&TEST_SUITE(connection_tracker), UTEST_FCT(trim_connection_backlog_open), UTEST_DESCR(trim_connection_backlog_open));
+    ts_add_utest(&TEST_SUITE(connection_tracker), UTEST_FCT(trim_connection_backlog_closed), UTEST_DESCR(trim_connection_backlog_closed));
+    ts_add_utest(&TEST_SUITE(connection_tracker), UTEST_FCT(make_connection_report_msg), UTEST_DESCR(make_connection_report_msg));
+
+    return register_ts(&TEST_SUITE(connection_tracker));
+}
+#endif /* HAVE_C_UNIT_TESTS */
+
 //#endif
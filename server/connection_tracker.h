@@ -15,7 +15,12 @@
 //#define CONN_ID_BUF_LEN                 21
 #define CRITERIA_BUF_LEN                CMD_BUFSIZE - 20
 
+// pending connection events that trigger a report before the interval
 #define MSG_CONN_LIST_COUNT_THRESHOLD   100
+// most unreported events held while the controller can't be reached
+#define MSG_CONN_LIST_BACKLOG_MAX       10000
+// connection_update data per message, under the 64KB message limit
+#define MSG_CONN_REPORT_MAX_LEN         60000
 
 #define CONNMARK_SEARCH_ARGS "-m %"PRIu32" -p %s -s %s --sport %d -d %s --dport %d --reply-port-src %d"
 
@@ -42,5 +47,12 @@ int update_connections(fko_srv_options_t *opts);
 int validate_connections(fko_srv_options_t *opts);
 int consider_reporting_connections(fko_srv_options_t *opts);
 int report_open_connections(fko_srv_options_t *opts);
+int flush_connection_reports(fko_srv_options_t *opts);
+int export_known_connections(FILE *out);
+int import_known_connection(const char *line);
+
+#ifdef HAVE_C_UNIT_TESTS
+int register_ts_connection_tracker(void);
+#endif
 
 #endif /* SERVER_CONNECTION_TRACKER_H_ */
@@ -147,6 +147,10 @@ int get_management_data_from_controller(fko_srv_options_t *opts)
             }
         }
 
+        // wait for the controller, but no longer than the timers allow
+        if((rv = sdp_ctrl_client_wait(opts->ctrl_client, SDP_CTRL_CLIENT_WAIT_MS)) != SDP_SUCCESS)
+            break;
+
         // check for incoming messages
         if((rv = sdp_ctrl_client_check_inbox(opts->ctrl_client, &action, (void**)&jdata)) != SDP_SUCCESS)
             break;
@@ -202,8 +206,6 @@ int get_management_data_from_controller(fko_srv_options_t *opts)
             log_msg(LOG_ERR, "Failed to get service and/or access data from controller.");
             return FWKNOPD_ERROR_CTRL_COM;
         }
-
-        sleep(1);
     }
 
     return rv;
@@ -261,6 +263,10 @@ void *control_client_thread_func(void *arg)
             send_open_conn_report = 1;
         }
 
+        // wait for the controller, but no longer than the timers allow
+        if((rv = sdp_ctrl_client_wait(opts->ctrl_client, SDP_CTRL_CLIENT_WAIT_MS)) != SDP_SUCCESS)
+            break;
+
         // check for incoming messages
         if((rv = sdp_ctrl_client_check_inbox(opts->ctrl_client, &action, (void**)&jdata)) != SDP_SUCCESS)
             break;
@@ -330,8 +336,6 @@ void *control_client_thread_func(void *arg)
             if((rv = consider_reporting_connections(opts)) != FWKNOPD_SUCCESS)
                 break;
         }
-
-        sleep(1);
     }
 
     // send kill signal for main thread to catch and exit safely
@@ -35,8 +35,202 @@
 #include "extcmd.h"
 #include "access.h"
 
-/* --DSS This is a place holder for now.  We may put the generalized external
- *       firewall script code here ( or not).
+/* The firewall backends fwknopd can use.  The native one for the firewall
+ * type fwknopd was built for comes first, so it is picked for the default
+ * FIREWALL_BACKEND value of "native".
 */
+static const fw_backend_t * const fw_backends[] = {
+#if FIREWALL_FIREWALLD
+    &fw_backend_firewalld,
+#elif FIREWALL_IPTABLES
+    &fw_backend_iptables,
+#elif FIREWALL_IPFW
+    &fw_backend_ipfw,
+#elif FIREWALL_PF
+    &fw_backend_pf,
+#elif FIREWALL_IPF
+    &fw_backend_ipf,
+#endif
+    &fw_backend_memory,
+    NULL
+};
+
+static const fw_backend_t *
+fw_backend_lookup(const char * const name)
+{
+    int     i;
+
+    if(name == NULL || strcasecmp(name, "native") == 0)
+        return fw_backends[0];
+
+    for(i=0; fw_backends[i] != NULL; i++)
+        if(strcasecmp(name, fw_backends[i]->name) == 0)
+            return fw_backends[i];
+
+    return NULL;
+}
+
+int
+fw_config_init(fko_srv_options_t * const opts)
+{
+    opts->fw_backend = fw_backend_lookup(opts->config[CONF_FIREWALL_BACKEND]);
+
+    if(opts->fw_backend == NULL)
+    {
+        log_msg(LOG_ERR, "[*] Unknown FIREWALL_BACKEND '%s', expected 'native', '%s', or '%s'",
+                opts->config[CONF_FIREWALL_BACKEND], fw_backends[0]->name,
+                fw_backend_memory.name);
+        return 0;
+    }
+
+    log_msg(LOG_DEBUG, "Using the '%s' firewall backend", opts->fw_backend->name);
+
+    return opts->fw_backend->config_init(opts);
+}
+
+int
+fw_initialize(const fko_srv_options_t * const opts)
+{
+    int     res;
+
+    res = opts->fw_backend->initialize(opts);
+
+    /* After a hot restart without the grant journal, the rules inherited
+     * from the previous fwknopd are not counted yet, so they would only be
+     * removed by the garbage collection pass.  Count them now.
+    */
+    if(res == 1 && opts->took_over && opts->fw_backend->resync != NULL
+            && strncasecmp(opts->config[CONF_ENABLE_GRANT_JOURNAL], "Y", 1) != 0)
+        opts->fw_backend->resync(opts);
+
+    return res;
+}
+
+int
+fw_cleanup(const fko_srv_options_t * const opts)
+{
+    /* We can get here from clean_exit() before fw_config_init() has run
+    */
+    if(opts->fw_backend == NULL)
+        return 0;
+
+    return opts->fw_backend->cleanup(opts);
+}
+
+int
+fw_commit(const fko_srv_options_t * const opts)
+{
+    if(opts->fw_backend->commit == NULL)
+        return 1;
+
+    return opts->fw_backend->commit(opts);
+}
+
+int
+fw_resync(const fko_srv_options_t * const opts)
+{
+    if(opts->fw_backend->resync == NULL)
+    {
+        log_msg(LOG_WARNING, "The '%s' firewall backend does not support resync",
+                opts->fw_backend->name);
+        return 0;
+    }
+
+    return opts->fw_backend->resync(opts);
+}
+
+void
+check_firewall_rules(const fko_srv_options_t * const opts,
+        const int chk_rm_all)
+{
+    opts->fw_backend->expire(opts, chk_rm_all);
+}
+
+int
+fw_dump_rules(const fko_srv_options_t * const opts)
+{
+    return opts->fw_backend->dump(opts);
+}
+
+/* Write out the rules for a hot restart as "fw <rule>" lines.  There is
+ * nothing to do for the native backends, their rules stay in place.
+*/
+int
+fw_export_rules(const fko_srv_options_t * const opts, FILE *out)
+{
+    if(opts->fw_backend == NULL || opts->fw_backend->export_rules == NULL)
+        return 1;
+
+    return opts->fw_backend->export_rules(opts, out);
+}
+
+int
+fw_import_rule(const fko_srv_options_t * const opts,
+        const char * const line)
+{
+    /* The previous fwknopd used a different FIREWALL_BACKEND
+    */
+    if(opts->fw_backend->import_rule == NULL)
+    {
+        log_msg(LOG_WARNING, "Ignoring a rule that the '%s' firewall backend cannot take over: %s",
+                opts->fw_backend->name, line);
+        return 1;
+    }
+
+    return opts->fw_backend->import_rule(opts, line);
+}
+
+int
+process_spa_request(const fko_srv_options_t * const opts,
+        const acc_stanza_t * const acc, spa_data_t * const spadat)
+{
+    return opts->fw_backend->grant(opts, acc, spadat);
+}
+
+/* Work out the NAT IP and port for a NAT access request, either from the
+ * FORCE_NAT stanza setting or from the SPA message itself.  nat_ip and
+ * nat_port are left alone if the message does not carry a NAT address.
+*/
+int
+fw_nat_access(const acc_stanza_t * const acc,
+        const spa_data_t * const spadat, char * const nat_ip,
+        const size_t nat_ip_len, unsigned int * const nat_port)
+{
+    char   *ndx;
+    size_t  len;
+    int     is_err;
+
+    if(acc->force_nat)
+    {
+        strlcpy(nat_ip, acc->force_nat_ip, nat_ip_len);
+        *nat_port = acc->force_nat_port;
+        return FKO_SUCCESS;
+    }
+
+    ndx = strchr(spadat->nat_access, ',');
+    if(ndx == NULL)
+        return FKO_SUCCESS;
+
+    len = (ndx - spadat->nat_access) + 1;
+    if(len > nat_ip_len)
+        len = nat_ip_len;
+
+    strlcpy(nat_ip, spadat->nat_access, len);
+    if (! is_valid_ipv4_addr(nat_ip))
+    {
+        log_msg(LOG_INFO, "Invalid NAT IP in SPA message");
+        return FKO_ERROR_INVALID_DATA;
+    }
+
+    *nat_port = strtol_wrapper(ndx+1, 0, MAX_PORT,
+            NO_EXIT_UPON_ERR, &is_err);
+    if(is_err != FKO_SUCCESS)
+    {
+        log_msg(LOG_INFO, "Invalid NAT port in SPA message");
+        return is_err;
+    }
+
+    return FKO_SUCCESS;
+}
 
 /***EOF***/
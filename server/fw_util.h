@@ -41,6 +41,57 @@
 #define TMP_COMMENT "__TMPCOMMENT__"
 #define DUMMY_IP "127.0.0.2"
 
+/* Firewall backend operations.  The native backend for the firewall type
+ * fwknopd was built for and the in-memory backend each provide one of
+ * these, and the fw_*() functions below call into the one selected with
+ * FIREWALL_BACKEND.  The commit, resync, export_rules and import_rule
+ * operations may be NULL.
+*/
+typedef struct fw_backend {
+    const char *name;
+
+    /* Parse the firewall configuration (no firewall changes yet)
+    */
+    int  (*config_init)(fko_srv_options_t * const opts);
+
+    /* Create the chains/anchors/sets and flush or pick up old rules
+    */
+    int  (*initialize)(const fko_srv_options_t * const opts);
+    int  (*cleanup)(const fko_srv_options_t * const opts);
+
+    /* Grant the access in an authenticated SPA request
+    */
+    int  (*grant)(const fko_srv_options_t * const opts,
+            const acc_stanza_t * const acc, spa_data_t * const spadat);
+
+    /* Apply the grants made since the last call, for backends that queue
+     * them up
+    */
+    int  (*commit)(const fko_srv_options_t * const opts);
+
+    /* Remove the rules that have expired
+    */
+    void (*expire)(const fko_srv_options_t * const opts, const int chk_rm_all);
+
+    /* Bring the active rule counts and expire times back in line with the
+     * rules that are actually in place
+    */
+    int  (*resync)(const fko_srv_options_t * const opts);
+
+    /* Print the current rules (--fw-list)
+    */
+    int  (*dump)(const fko_srv_options_t * const opts);
+
+    /* Hand the rules over to a new fwknopd on a hot restart, for backends
+     * whose rules go away with the fwknopd process (one line per rule)
+    */
+    int  (*export_rules)(const fko_srv_options_t * const opts, FILE *out);
+    int  (*import_rule)(const fko_srv_options_t * const opts,
+            const char * const line);
+} fw_backend_t;
+
+#include "fw_util_memory.h"
+
 #if FIREWALL_FIREWALLD
   #include "fw_util_firewalld.h"
 #elif FIREWALL_IPTABLES
@@ -60,18 +111,29 @@
 /* Function prototypes.
  *
  * Note: These are the public functions for managing firewall rules.
- *       They should be implemented in each of the corresponding
- *       fw_util_<fw-type>.c files.
+ *       They call the corresponding operation of the firewall backend
+ *       (see fw_util_<fw-type>.c and fw_util_memory.c).
 */
 int fw_config_init(fko_srv_options_t * const opts);
 int fw_initialize(const fko_srv_options_t * const opts);
 int fw_cleanup(const fko_srv_options_t * const opts);
+int fw_commit(const fko_srv_options_t * const opts);
+int fw_resync(const fko_srv_options_t * const opts);
 void check_firewall_rules(const fko_srv_options_t * const opts,
         const int chk_rm_all);
 int fw_dump_rules(const fko_srv_options_t * const opts);
+int fw_export_rules(const fko_srv_options_t * const opts, FILE *out);
+int fw_import_rule(const fko_srv_options_t * const opts,
+        const char * const line);
 int process_spa_request(const fko_srv_options_t * const opts,
         const acc_stanza_t * const acc, spa_data_t * const spadat);
 
+/* Helpers shared by the backends
+*/
+int fw_nat_access(const acc_stanza_t * const acc,
+        const spa_data_t * const spadat, char * const nat_ip,
+        const size_t nat_ip_len, unsigned int * const nat_port);
+
 #endif /* FW_UTIL_H */
 
 /***EOF***/
@@ -35,10 +35,15 @@
 
 #include "fw_util.h"
 #include "utils.h"
+#include "grant_journal.h"
 #include "log_msg.h"
 #include "extcmd.h"
 #include "access.h"
 
+#if HAVE_LIBDBUS
+  #include <dbus/dbus.h>
+#endif
+
 static struct fw_config fwc;
 static char   cmd_buf[CMD_BUFSIZE];
 static char   err_buf[CMD_BUFSIZE];
@@ -59,6 +64,275 @@ zero_cmd_buffers(void)
 
 static int pid_status = 0;
 
+#if HAVE_LIBDBUS
+/* Private connection to firewalld on the system bus, opened on first use
+*/
+static DBusConnection *firewd_bus = NULL;
+static int firewd_bus_tried = 0;
+
+static void
+firewd_dbus_close(void)
+{
+    if(firewd_bus != NULL)
+    {
+        dbus_connection_close(firewd_bus);
+        dbus_connection_unref(firewd_bus);
+        firewd_bus = NULL;
+    }
+    return;
+}
+
+static DBusConnection *
+firewd_dbus_get(const fko_srv_options_t * const opts)
+{
+    DBusError   err;
+
+    if(firewd_bus != NULL || firewd_bus_tried)
+        return firewd_bus;
+
+    firewd_bus_tried = 1;
+
+    if(strncasecmp(opts->config[CONF_ENABLE_FIREWD_DBUS], "Y", 1) != 0)
+        return NULL;
+
+    dbus_error_init(&err);
+
+    firewd_bus = dbus_bus_get_private(DBUS_BUS_SYSTEM, &err);
+    if(firewd_bus == NULL)
+    {
+        log_msg(LOG_WARNING,
+            "Could not connect to the system bus (%s), using firewall-cmd",
+            err.message);
+        dbus_error_free(&err);
+        return NULL;
+    }
+    dbus_connection_set_exit_on_disconnect(firewd_bus, FALSE);
+
+    if(! dbus_bus_name_has_owner(firewd_bus, FIREWD_DBUS_NAME, &err))
+    {
+        log_msg(LOG_WARNING,
+            "firewalld is not on the system bus%s%s, using firewall-cmd",
+            dbus_error_is_set(&err) ? ": " : "",
+            dbus_error_is_set(&err) ? err.message : "");
+        dbus_error_free(&err);
+        firewd_dbus_close();
+        return NULL;
+    }
+
+    log_msg(LOG_INFO, "Talking to firewalld over D-Bus");
+    return firewd_bus;
+}
+
+/* Send a direct passthrough call for the firewall-cmd command line in cmd
+ * without waiting for the reply.  Returns 0 if there is no connection to
+ * firewalld, in which case the command has to be run instead.
+*/
+static int
+firewd_dbus_send(const char *cmd, DBusPendingCall **pending,
+        const fko_srv_options_t * const opts)
+{
+    DBusMessage        *msg;
+    DBusMessageIter     iter, arr;
+    DBusConnection     *bus;
+    char                args_buf[CMD_BUFSIZE] = {0};
+    char               *argv[FIREWD_DBUS_MAX_ARGS];
+    char               *tok, *save = NULL;
+    const char         *ipv = "ipv4";
+    const size_t        prefix_len = strlen(fwc.fw_command);
+    int                 argc = 0, i, ok;
+
+    *pending = NULL;
+
+    if((bus = firewd_dbus_get(opts)) == NULL
+            || strncmp(cmd, fwc.fw_command, prefix_len) != 0)
+        return 0;
+
+    /* Everything after the firewall-cmd prefix is handed to firewalld
+     * as one argument each (there are no quoted arguments).
+    */
+    strlcpy(args_buf, cmd + prefix_len, sizeof(args_buf));
+    for(tok = strtok_r(args_buf, " \t\n", &save); tok != NULL;
+            tok = strtok_r(NULL, " \t\n", &save))
+    {
+        if(strcmp(tok, "2>&1") == 0)
+            continue;
+        if(argc == FIREWD_DBUS_MAX_ARGS)
+            return 0;
+        argv[argc++] = tok;
+    }
+
+    msg = dbus_message_new_method_call(FIREWD_DBUS_NAME, FIREWD_DBUS_PATH,
+            FIREWD_DBUS_DIRECT_IF, "passthrough");
+    if(msg == NULL)
+        return 0;
+
+    dbus_message_iter_init_append(msg, &iter);
+    ok = dbus_message_iter_append_basic(&iter, DBUS_TYPE_STRING, &ipv)
+        && dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY,
+                DBUS_TYPE_STRING_AS_STRING, &arr);
+    for(i=0; ok && i < argc; i++)
+        ok = dbus_message_iter_append_basic(&arr, DBUS_TYPE_STRING, &argv[i]);
+    ok = ok && dbus_message_iter_close_container(&iter, &arr);
+
+    if(ok)
+        ok = dbus_connection_send_with_reply(bus, msg, pending,
+                FIREWD_DBUS_TIMEOUT) && *pending != NULL;
+
+    dbus_message_unref(msg);
+
+    if(! ok)
+    {
+        log_msg(LOG_WARNING, "Lost the D-Bus connection to firewalld");
+        firewd_dbus_close();
+        firewd_bus_tried = 0;
+    }
+    return ok;
+}
+
+/* Wait for the reply to a call made with firewd_dbus_send() and return the
+ * output the way firewall-cmd prints it: the command output (or "success"
+ * if there is none), or "Error: <reason>" if firewalld refused it.  A NULL
+ * so_buf sends the output to stdout like run_extcmd() does.
+*/
+static int
+firewd_dbus_wait(DBusPendingCall *pending, char *so_buf,
+        const size_t so_buf_sz, const int want_stderr, int *pid_status)
+{
+    DBusMessage    *reply;
+    DBusError       err;
+    const char     *out = NULL;
+    char           *ndx;
+    int             res = EXTCMD_SUCCESS_ALL_OUTPUT;
+
+    dbus_pending_call_block(pending);
+    reply = dbus_pending_call_steal_reply(pending);
+    dbus_pending_call_unref(pending);
+
+    dbus_error_init(&err);
+    *pid_status = 0;
+
+    if(reply == NULL)
+    {
+        dbus_set_error_const(&err, DBUS_ERROR_NO_REPLY, "no reply from firewalld");
+    }
+    else if(dbus_set_error_from_message(&err, reply) == FALSE)
+    {
+        if(! dbus_message_get_args(reply, NULL, DBUS_TYPE_STRING, &out,
+                    DBUS_TYPE_INVALID) || out[0] == '\0')
+            out = "success";
+    }
+
+    if(out != NULL)
+    {
+        if(so_buf == NULL)
+        {
+            fprintf(stdout, "%s\n", out);
+            fflush(stdout);
+        }
+        else if(strlcpy(so_buf, out, so_buf_sz) >= so_buf_sz)
+        {
+            /* Make sure we only have complete lines
+            */
+            if((ndx = strrchr(so_buf, '\n')) != NULL)
+                *(ndx+1) = '\0';
+        }
+    }
+    else
+    {
+        *pid_status = 1;
+
+        if(so_buf == NULL)
+            fprintf(stderr, "Error: %s\n", err.message);
+        else if(want_stderr)
+            snprintf(so_buf, so_buf_sz, "Error: %s", err.message);
+
+        if(dbus_error_has_name(&err, DBUS_ERROR_NO_REPLY)
+                || dbus_error_has_name(&err, DBUS_ERROR_DISCONNECTED))
+        {
+            log_msg(LOG_WARNING, "firewalld D-Bus call failed: %s", err.message);
+            firewd_dbus_close();
+            firewd_bus_tried = 0;
+            res = EXTCMD_EXECUTION_ERROR;
+        }
+    }
+
+    dbus_error_free(&err);
+    if(reply != NULL)
+        dbus_message_unref(reply);
+
+    return res;
+}
+#endif /* HAVE_LIBDBUS */
+
+/* The firewall-cmd commands below are built as usual and sent through
+ * these, which hand them to firewalld over D-Bus if possible and run
+ * firewall-cmd otherwise.
+*/
+static int
+firewd_run_cmd(const char *cmd, char *so_buf, const size_t so_buf_sz,
+        const int want_stderr, const int timeout, int *pid_status,
+        const fko_srv_options_t * const opts)
+{
+#if HAVE_LIBDBUS
+    DBusPendingCall *pending;
+
+    if(firewd_dbus_send(cmd, &pending, opts))
+    {
+        if(so_buf != NULL)
+            memset(so_buf, 0x0, so_buf_sz);
+        return firewd_dbus_wait(pending, so_buf, so_buf_sz,
+                want_stderr, pid_status);
+    }
+#endif
+    return run_extcmd(cmd, so_buf, so_buf_sz, want_stderr,
+            timeout, pid_status, opts);
+}
+
+/* Like search_extcmd_getline(): return the number of the first output line
+ * that contains substr_search (copied to so_buf if not NULL), or zero.
+*/
+static int
+firewd_search_cmd_getline(const char *cmd, char *so_buf,
+        const size_t so_buf_sz, const int timeout, const char *substr_search,
+        int *pid_status, const fko_srv_options_t * const opts)
+{
+#if HAVE_LIBDBUS
+    DBusPendingCall *pending;
+    char             out_buf[STANDARD_CMD_OUT_BUFSIZE] = {0};
+    char            *line, *next;
+    int              line_ctr = 0;
+
+    if(firewd_dbus_send(cmd, &pending, opts))
+    {
+        firewd_dbus_wait(pending, out_buf, sizeof(out_buf), WANT_STDERR,
+                pid_status);
+
+        for(line = out_buf; *line != '\0'; line = next)
+        {
+            line_ctr++;
+            if((next = strchr(line, '\n')) != NULL)
+                *next++ = '\0';
+            else
+                next = line + strlen(line);
+
+            if(! IS_EMPTY_LINE(line[0]) && strstr(line, substr_search) != NULL)
+            {
+                if(so_buf != NULL)
+                    strlcpy(so_buf, line, so_buf_sz);
+                return line_ctr;
+            }
+        }
+        return 0;
+    }
+#endif
+    if(so_buf == NULL)
+        return search_extcmd(cmd, WANT_STDERR, timeout,
+                substr_search, pid_status, opts);
+
+    return search_extcmd_getline(cmd, so_buf, so_buf_sz, timeout,
+            substr_search, pid_status, opts);
+}
+
 static int
 rule_exists_no_chk_support(const fko_srv_options_t * const opts,
         const struct fw_chain * const fwc,
@@ -125,7 +399,7 @@ rule_exists_no_chk_support(const fko_srv_options_t * const opts,
     /* search for each of the substrings - the rule expiration time is the
      * primary search method
     */
-    if(search_extcmd_getline(cmd_buf, fw_line_buf,
+    if(firewd_search_cmd_getline(cmd_buf, fw_line_buf,
                 CMD_BUFSIZE, NO_TIMEOUT, exp_ts_search, &pid_status, opts))
     {
         chop_newline(fw_line_buf);
@@ -197,7 +471,7 @@ rule_exists_chk_support(const fko_srv_options_t * const opts,
     snprintf(cmd_buf, CMD_BUFSIZE-1, "%s " FIREWD_CHK_RULE_ARGS,
             opts->fw_config->fw_command, chain, rule);
 
-    res = run_extcmd(cmd_buf, err_buf, CMD_BUFSIZE,
+    res = firewd_run_cmd(cmd_buf, err_buf, CMD_BUFSIZE,
             WANT_STDERR, NO_TIMEOUT, &pid_status, opts);
     chop_newline(err_buf);
 
@@ -273,7 +547,7 @@ firewd_chk_support(const fko_srv_options_t * const opts)
         in_chain->target
     );
 
-    res = run_extcmd(cmd_buf, err_buf, CMD_BUFSIZE,
+    res = firewd_run_cmd(cmd_buf, err_buf, CMD_BUFSIZE,
             WANT_STDERR, NO_TIMEOUT, &pid_status, opts);
     chop_newline(err_buf);
 
@@ -291,7 +565,7 @@ firewd_chk_support(const fko_srv_options_t * const opts)
         in_chain->target
     );
 
-    res = run_extcmd(cmd_buf, err_buf, CMD_BUFSIZE,
+    res = firewd_run_cmd(cmd_buf, err_buf, CMD_BUFSIZE,
             WANT_STDERR, NO_TIMEOUT, &pid_status, opts);
     chop_newline(err_buf);
 
@@ -319,7 +593,7 @@ firewd_chk_support(const fko_srv_options_t * const opts)
         in_chain->from_chain,
         1
     );
-    run_extcmd(cmd_buf, err_buf, CMD_BUFSIZE,
+    firewd_run_cmd(cmd_buf, err_buf, CMD_BUFSIZE,
             WANT_STDERR, NO_TIMEOUT, &pid_status, opts);
 
     return;
@@ -346,7 +620,7 @@ comment_match_exists(const fko_srv_options_t * const opts)
         in_chain->target
     );
 
-    res = run_extcmd(cmd_buf, err_buf, CMD_BUFSIZE,
+    res = firewd_run_cmd(cmd_buf, err_buf, CMD_BUFSIZE,
             WANT_STDERR, NO_TIMEOUT, &pid_status, opts);
     chop_newline(err_buf);
 
@@ -361,7 +635,7 @@ comment_match_exists(const fko_srv_options_t * const opts)
         in_chain->from_chain
     );
 
-    res = run_extcmd(cmd_buf, cmd_out, STANDARD_CMD_OUT_BUFSIZE,
+    res = firewd_run_cmd(cmd_buf, cmd_out, STANDARD_CMD_OUT_BUFSIZE,
             WANT_STDERR, NO_TIMEOUT, &pid_status, opts);
     chop_newline(cmd_out);
 
@@ -387,7 +661,7 @@ comment_match_exists(const fko_srv_options_t * const opts)
             in_chain->from_chain,
             1
         );
-        run_extcmd(cmd_buf, err_buf, CMD_BUFSIZE,
+        firewd_run_cmd(cmd_buf, err_buf, CMD_BUFSIZE,
                 WANT_STDERR, NO_TIMEOUT, &pid_status, opts);
     }
 
@@ -409,7 +683,7 @@ add_jump_rule(const fko_srv_options_t * const opts, const int chain_num)
         fwc.chain[chain_num].to_chain
     );
 
-    res = run_extcmd(cmd_buf, err_buf, CMD_BUFSIZE,
+    res = firewd_run_cmd(cmd_buf, err_buf, CMD_BUFSIZE,
             WANT_STDERR, NO_TIMEOUT, &pid_status, opts);
 
     log_msg(LOG_DEBUG, "add_jump_rule() CMD: '%s' (res: %d, err: %s)",
@@ -442,7 +716,7 @@ chain_exists(const fko_srv_options_t * const opts, const int chain_num)
         fwc.chain[chain_num].to_chain
     );
 
-    res = run_extcmd(cmd_buf, err_buf, CMD_BUFSIZE,
+    res = firewd_run_cmd(cmd_buf, err_buf, CMD_BUFSIZE,
             WANT_STDERR, NO_TIMEOUT, &pid_status, opts);
     chop_newline(err_buf);
 
@@ -504,7 +778,7 @@ jump_rule_exists_no_chk_support(const fko_srv_options_t * const opts,
     snprintf(chain_search, CMD_BUFSIZE-1, " %s ",
         fwc.chain[chain_num].to_chain);
 
-    if(search_extcmd(cmd_buf, WANT_STDERR,
+    if(firewd_search_cmd_getline(cmd_buf, NULL, 0,
                 NO_TIMEOUT, chain_search, &pid_status, opts) > 0)
         exists = 1;
 
@@ -534,8 +808,8 @@ jump_rule_exists(const fko_srv_options_t * const opts, const int chain_num)
 /* Print all firewall rules currently instantiated by the running fwknopd
  * daemon to stdout.
 */
-int
-fw_dump_rules(const fko_srv_options_t * const opts)
+static int
+firewd_dump(const fko_srv_options_t * const opts)
 {
     int     i;
     int     res, got_err = 0;
@@ -561,16 +835,16 @@ fw_dump_rules(const fko_srv_options_t * const opts)
                 ch[i].table
             );
 
-            res = run_extcmd(cmd_buf, NULL, 0, NO_STDERR,
+            res = firewd_run_cmd(cmd_buf, NULL, 0, NO_STDERR,
                         NO_TIMEOUT, &pid_status, opts);
 
-            log_msg(LOG_DEBUG, "fw_dump_rules() CMD: '%s' (res: %d)",
+            log_msg(LOG_DEBUG, "firewd_dump() CMD: '%s' (res: %d)",
                 cmd_buf, res);
 
             /* Expect full success on this */
             if(! EXTCMD_IS_SUCCESS(res))
             {
-                log_msg(LOG_ERR, "fw_dump_rules() Error %i from cmd:'%s': %s",
+                log_msg(LOG_ERR, "firewd_dump() Error %i from cmd:'%s': %s",
                         res, cmd_buf, err_buf);
                 got_err++;
             }
@@ -599,16 +873,16 @@ fw_dump_rules(const fko_srv_options_t * const opts)
             fprintf(stdout, "\n");
             fflush(stdout);
 
-            res = run_extcmd(cmd_buf, NULL, 0, NO_STDERR,
+            res = firewd_run_cmd(cmd_buf, NULL, 0, NO_STDERR,
                         NO_TIMEOUT, &pid_status, opts);
 
-            log_msg(LOG_DEBUG, "fw_dump_rules() CMD: '%s' (res: %d)",
+            log_msg(LOG_DEBUG, "firewd_dump() CMD: '%s' (res: %d)",
                 cmd_buf, res);
 
             /* Expect full success on this */
             if(! EXTCMD_IS_SUCCESS(res))
             {
-                log_msg(LOG_ERR, "fw_dump_rules() Error %i from cmd:'%s': %s",
+                log_msg(LOG_ERR, "firewd_dump() Error %i from cmd:'%s': %s",
                         res, cmd_buf, err_buf);
                 got_err++;
             }
@@ -645,7 +919,7 @@ delete_all_chains(const fko_srv_options_t * const opts)
                 fwc.chain[i].to_chain
             );
 
-            res = run_extcmd(cmd_buf, err_buf, CMD_BUFSIZE,
+            res = firewd_run_cmd(cmd_buf, err_buf, CMD_BUFSIZE,
                     WANT_STDERR, NO_TIMEOUT, &pid_status, opts);
             chop_newline(err_buf);
 
@@ -670,7 +944,7 @@ delete_all_chains(const fko_srv_options_t * const opts)
             fwc.chain[i].to_chain
         );
 
-        res = run_extcmd(cmd_buf, err_buf, CMD_BUFSIZE, WANT_STDERR,
+        res = firewd_run_cmd(cmd_buf, err_buf, CMD_BUFSIZE, WANT_STDERR,
                 NO_TIMEOUT, &pid_status, opts);
         chop_newline(err_buf);
 
@@ -690,7 +964,7 @@ delete_all_chains(const fko_srv_options_t * const opts)
             fwc.chain[i].to_chain
         );
 
-        res = run_extcmd(cmd_buf, err_buf, CMD_BUFSIZE, WANT_STDERR,
+        res = firewd_run_cmd(cmd_buf, err_buf, CMD_BUFSIZE, WANT_STDERR,
                 NO_TIMEOUT, &pid_status, opts);
         chop_newline(err_buf);
 
@@ -721,7 +995,7 @@ create_chain(const fko_srv_options_t * const opts, const int chain_num)
         fwc.chain[chain_num].to_chain
     );
 
-    res = run_extcmd(cmd_buf, err_buf, CMD_BUFSIZE, WANT_STDERR,
+    res = firewd_run_cmd(cmd_buf, err_buf, CMD_BUFSIZE, WANT_STDERR,
                 NO_TIMEOUT, &pid_status, opts);
     chop_newline(err_buf);
 
@@ -869,11 +1143,18 @@ set_fw_chain_conf(const int type, const char * const conf_str)
     return 1;
 }
 
-int
-fw_config_init(fko_srv_options_t * const opts)
+static int
+firewd_config_init(fko_srv_options_t * const opts)
 {
     memset(&fwc, 0x0, sizeof(struct fw_config));
 
+#if HAVE_LIBDBUS
+    /* (Re)connect to firewalld with the new config on first use
+    */
+    firewd_dbus_close();
+    firewd_bus_tried = 0;
+#endif
+
     /* Set our firewall exe command path (firewall-cmd or iptables in most cases).
     */
 #if FIREWALL_FIREWALLD
@@ -943,8 +1224,8 @@ fw_config_init(fko_srv_options_t * const opts)
     return 1;
 }
 
-int
-fw_initialize(const fko_srv_options_t * const opts)
+static int
+firewd_initialize(const fko_srv_options_t * const opts)
 {
     int res = 1;
 
@@ -956,17 +1237,29 @@ fw_initialize(const fko_srv_options_t * const opts)
     else
         firewd_chk_support(opts);
 
-    /* Flush the chains (just in case) so we can start fresh.
+    /* Flush the chains (just in case) so we can start fresh.  After a hot
+     * restart the existing rules belong to us.
     */
-    if(strncasecmp(opts->config[CONF_FLUSH_FIREWD_AT_INIT], "Y", 1) == 0)
+    if(strncasecmp(opts->config[CONF_FLUSH_FIREWD_AT_INIT], "Y", 1) == 0
+            && ! opts->took_over)
+    {
         delete_all_chains(opts);
+        grant_journal_clear(opts);
+    }
+    else
+    {
+        /* Pick up the rules that are still in place from before the
+         * restart (if ENABLE_GRANT_JOURNAL is set).
+        */
+        grant_journal_restore(opts, fwc.chain);
+    }
 
     /* Now create any configured chains.
     */
     if(create_fw_chains(opts) != 0)
     {
         log_msg(LOG_WARNING,
-                "fw_initialize() Warning: Errors detected during fwknop custom chain creation");
+                "firewd_initialize() Warning: Errors detected during fwknop custom chain creation");
         res = 0;
     }
 
@@ -988,14 +1281,15 @@ fw_initialize(const fko_srv_options_t * const opts)
     return(res);
 }
 
-int
-fw_cleanup(const fko_srv_options_t * const opts)
+static int
+firewd_cleanup(const fko_srv_options_t * const opts)
 {
     if(strncasecmp(opts->config[CONF_FLUSH_FIREWD_AT_EXIT], "N", 1) == 0
             && opts->fw_flush == 0)
         return(0);
 
     delete_all_chains(opts);
+    grant_journal_clear(opts);
     return(0);
 }
 
@@ -1010,7 +1304,7 @@ create_rule(const fko_srv_options_t * const opts,
     snprintf(cmd_buf, CMD_BUFSIZE-1, "%s -A %s %s",
             opts->fw_config->fw_command, fw_chain, fw_rule);
 
-    res = run_extcmd(cmd_buf, err_buf, CMD_BUFSIZE, WANT_STDERR,
+    res = firewd_run_cmd(cmd_buf, err_buf, CMD_BUFSIZE, WANT_STDERR,
                 NO_TIMEOUT, &pid_status, opts);
     chop_newline(err_buf);
 
@@ -1081,6 +1375,7 @@ firewd_rule(const fko_srv_options_t * const opts,
             );
 
             chain->active_rules++;
+            grant_journal_add(opts, chain->type, exp_ts, proto, srcip, dstip, port);
 
             /* Reset the next expected expire time for this chain if it
             * is warranted.
@@ -1314,8 +1609,8 @@ static void snat_rule(const fko_srv_options_t * const opts,
 
 /* Rule Processing - Create an access request...
 */
-int
-process_spa_request(const fko_srv_options_t * const opts,
+static int
+firewd_grant(const fko_srv_options_t * const opts,
         const acc_stanza_t * const acc, spa_data_t * const spadat)
 {
     char            nat_ip[MAX_IPV4_STR_LEN] = {0};
@@ -1331,8 +1626,7 @@ process_spa_request(const fko_srv_options_t * const opts,
     acc_port_list_t *port_list = NULL;
     acc_port_list_t *ple = NULL;
 
-    char            *ndx = NULL;
-    int             res = 0, is_err;
+    int             res = 0;
     time_t          now;
     unsigned int    exp_ts;
 
@@ -1371,34 +1665,11 @@ process_spa_request(const fko_srv_options_t * const opts,
       || spadat->message_type == FKO_CLIENT_TIMEOUT_NAT_ACCESS_MSG
       || acc->force_nat)
     {
-        if(acc->force_nat)
-        {
-            strlcpy(nat_ip, acc->force_nat_ip, sizeof(nat_ip));
-            nat_port = acc->force_nat_port;
-        }
-        else
+        res = fw_nat_access(acc, spadat, nat_ip, sizeof(nat_ip), &nat_port);
+        if(res != FKO_SUCCESS)
         {
-            ndx = strchr(spadat->nat_access, ',');
-            if(ndx != NULL)
-            {
-                strlcpy(nat_ip, spadat->nat_access, (ndx-spadat->nat_access)+1);
-                if (! is_valid_ipv4_addr(nat_ip))
-                {
-                    log_msg(LOG_INFO, "Invalid NAT IP in SPA message");
-                    free_acc_port_list(port_list);
-                    return res;
-                }
-
-                nat_port = strtol_wrapper(ndx+1, 0, MAX_PORT,
-                        NO_EXIT_UPON_ERR, &is_err);
-                if(is_err != FKO_SUCCESS)
-                {
-                    log_msg(LOG_INFO, "Invalid NAT port in SPA message");
-                    free_acc_port_list(port_list);
-                    res = is_err;
-                    return res;
-                }
-            }
+            free_acc_port_list(port_list);
+            return res;
         }
 
         if(spadat->message_type == FKO_LOCAL_NAT_ACCESS_MSG
@@ -1461,6 +1732,33 @@ process_spa_request(const fko_srv_options_t * const opts,
     return(res);
 }
 
+/* Account for the removal of one expired rule
+*/
+static void
+expired_rule_removed(struct fw_chain *ch, int cpos, const int rule_num,
+        const time_t rule_exp, const int res)
+{
+    chop_newline(err_buf);
+
+    log_msg(LOG_DEBUG, "firewd_expire() deleted rule %d from %s (res: %d, err: %s)",
+        rule_num, ch[cpos].to_chain, res, err_buf);
+
+    if(EXTCMD_IS_SUCCESS(res))
+    {
+        log_msg(LOG_INFO, "Removed rule %d from %s with expire time of %u",
+            rule_num, ch[cpos].to_chain, rule_exp
+        );
+
+        if (ch[cpos].active_rules > 0)
+            ch[cpos].active_rules--;
+    }
+    else
+        log_msg(LOG_ERR, "rm_expired_rules() Error %i deleting rule %d from %s: %s",
+                res, rule_num, ch[cpos].to_chain, err_buf);
+
+    return;
+}
+
 static void
 rm_expired_rules(const fko_srv_options_t * const opts,
         const char * const fw_output_buf,
@@ -1470,10 +1768,17 @@ rm_expired_rules(const fko_srv_options_t * const opts,
     char        rule_num_str[6] = {0};
     char        *rn_start, *rn_end, *tmp_mark;
 
-    int         res, is_err, rn_offset=0, rule_num;
+    int         res, is_err, rule_num, i, num_expired = 0;
+    int         rule_nums[FIREWD_EXPIRE_BATCH_MAX];
+    time_t      rule_exps[FIREWD_EXPIRE_BATCH_MAX];
     time_t      rule_exp, min_exp = 0;
 
-    /* walk the list and process rules as needed.
+#if HAVE_LIBDBUS
+    DBusPendingCall *pending[FIREWD_EXPIRE_BATCH_MAX];
+    int              j;
+#endif
+
+    /* walk the list and collect the rules that have expired.
     */
     while (ndx != NULL) {
         /* Jump forward and extract the timestamp
@@ -1497,9 +1802,9 @@ rm_expired_rules(const fko_srv_options_t * const opts,
 
         rule_exp = (time_t)atoll(exp_str);
 
-        if(rule_exp <= now)
+        if(rule_exp <= now && num_expired < FIREWD_EXPIRE_BATCH_MAX)
         {
-            /* Backtrack and get the rule number and delete it.
+            /* Backtrack and get the rule number.
             */
             rn_start = ndx;
             while(--rn_start > fw_output_buf)
@@ -1542,7 +1847,7 @@ rm_expired_rules(const fko_srv_options_t * const opts,
 
             strlcpy(rule_num_str, rn_start, (rn_end - rn_start)+1);
 
-            rule_num = strtol_wrapper(rule_num_str, rn_offset, RCHK_MAX_FIREWD_RULE_NUM,
+            rule_num = strtol_wrapper(rule_num_str, 0, RCHK_MAX_FIREWD_RULE_NUM,
                     NO_EXIT_UPON_ERR, &is_err);
             if(is_err != FKO_SUCCESS)
             {
@@ -1556,44 +1861,15 @@ rm_expired_rules(const fko_srv_options_t * const opts,
                 break;
             }
 
-            zero_cmd_buffers();
-
-            snprintf(cmd_buf, CMD_BUFSIZE-1, "%s " FIREWD_DEL_RULE_ARGS,
-                opts->fw_config->fw_command,
-                ch[cpos].table,
-                ch[cpos].to_chain,
-                rule_num - rn_offset /* account for position of previously
-                                        deleted rule with rn_offset */
-            );
-
-            res = run_extcmd(cmd_buf, err_buf, CMD_BUFSIZE,
-                    WANT_STDERR, NO_TIMEOUT, &pid_status, opts);
-            chop_newline(err_buf);
-
-            log_msg(LOG_DEBUG, "check_firewall_rules() CMD: '%s' (res: %d, err: %s)",
-                cmd_buf, res, err_buf);
-
-            if(EXTCMD_IS_SUCCESS(res))
-            {
-                log_msg(LOG_INFO, "Removed rule %s from %s with expire time of %u",
-                    rule_num_str, ch[cpos].to_chain, rule_exp
-                );
-
-                rn_offset++;
-
-                if (ch[cpos].active_rules > 0)
-                    ch[cpos].active_rules--;
-            }
-            else
-                log_msg(LOG_ERR, "rm_expired_rules() Error %i from cmd:'%s': %s",
-                        res, cmd_buf, err_buf);
-
+            rule_nums[num_expired]   = rule_num;
+            rule_exps[num_expired++] = rule_exp;
         }
         else
         {
-            /* Track the minimum future rule expire time.
+            /* Track the minimum future rule expire time (expired rules
+             * beyond FIREWD_EXPIRE_BATCH_MAX are left for the next pass).
             */
-            min_exp = (min_exp < rule_exp) ? min_exp : rule_exp;
+            min_exp = (min_exp && min_exp < rule_exp) ? min_exp : rule_exp;
         }
 
         /* Push our tracking index forward beyond (just processed) _exp_
@@ -1602,6 +1878,58 @@ rm_expired_rules(const fko_srv_options_t * const opts,
         ndx = strstr(tmp_mark, EXPIRE_COMMENT_PREFIX);
     }
 
+    /* Delete the expired rules starting with the highest rule number so
+     * that deleting one does not renumber the others.  Over D-Bus all of
+     * the deletes are sent before waiting for any of the replies.
+    */
+    for(i=num_expired-1; i >= 0; i--)
+    {
+        zero_cmd_buffers();
+
+        snprintf(cmd_buf, CMD_BUFSIZE-1, "%s " FIREWD_DEL_RULE_ARGS,
+            opts->fw_config->fw_command,
+            ch[cpos].table,
+            ch[cpos].to_chain,
+            rule_nums[i]
+        );
+
+#if HAVE_LIBDBUS
+        if(firewd_dbus_send(cmd_buf, &pending[i], opts))
+            continue;
+
+        /* The deletes already sent have to be done before any lower
+         * numbered rule is deleted by firewall-cmd.
+        */
+        for(j=num_expired-1; j > i; j--)
+        {
+            if(pending[j] == NULL)
+                continue;
+            zero_cmd_buffers();
+            res = firewd_dbus_wait(pending[j], err_buf, CMD_BUFSIZE,
+                    WANT_STDERR, &pid_status);
+            pending[j] = NULL;
+            expired_rule_removed(ch, cpos, rule_nums[j], rule_exps[j], res);
+        }
+        pending[i] = NULL;
+#endif
+        res = run_extcmd(cmd_buf, err_buf, CMD_BUFSIZE,
+                WANT_STDERR, NO_TIMEOUT, &pid_status, opts);
+
+        expired_rule_removed(ch, cpos, rule_nums[i], rule_exps[i], res);
+    }
+
+#if HAVE_LIBDBUS
+    for(i=num_expired-1; i >= 0; i--)
+    {
+        if(pending[i] == NULL)
+            continue;
+        zero_cmd_buffers();
+        res = firewd_dbus_wait(pending[i], err_buf, CMD_BUFSIZE,
+                WANT_STDERR, &pid_status);
+        expired_rule_removed(ch, cpos, rule_nums[i], rule_exps[i], res);
+    }
+#endif
+
     /* Set the next pending expire time accordingly. 0 if there are no
      * more rules, or whatever the next expected (min_exp) time will be.
     */
@@ -1616,8 +1944,8 @@ rm_expired_rules(const fko_srv_options_t * const opts,
 /* Iterate over the configure firewall access chains and purge expired
  * firewall rules.
 */
-void
-check_firewall_rules(const fko_srv_options_t * const opts,
+static void
+firewd_expire(const fko_srv_options_t * const opts,
         const int chk_rm_all)
 {
     char            *ndx;
@@ -1659,18 +1987,18 @@ check_firewall_rules(const fko_srv_options_t * const opts,
             ch[i].to_chain
         );
 
-        res = run_extcmd(cmd_buf, fw_output_buf, STANDARD_CMD_OUT_BUFSIZE,
+        res = firewd_run_cmd(cmd_buf, fw_output_buf, STANDARD_CMD_OUT_BUFSIZE,
                 WANT_STDERR, NO_TIMEOUT, &pid_status, opts);
         chop_newline(fw_output_buf);
 
         log_msg(LOG_DEBUG,
-            "check_firewall_rules() CMD: '%s' (res: %d, fw_output_buf: %s)",
+            "firewd_expire() CMD: '%s' (res: %d, fw_output_buf: %s)",
             cmd_buf, res, fw_output_buf);
 
         if(!EXTCMD_IS_SUCCESS(res))
         {
             log_msg(LOG_ERR,
-                    "check_firewall_rules() Error %i from cmd:'%s': %s",
+                    "firewd_expire() Error %i from cmd:'%s': %s",
                     res, cmd_buf, fw_output_buf);
             continue;
         }
@@ -1695,9 +2023,89 @@ check_firewall_rules(const fko_srv_options_t * const opts,
         rm_expired_rules(opts, fw_output_buf, ndx, ch, i, now);
     }
 
+    /* Let the grant journal drop the entries for expired rules
+    */
+    for(i=0, res=0; i < NUM_FWKNOP_ACCESS_TYPES; i++)
+        res += ch[i].active_rules;
+
+    grant_journal_expire(opts, res);
+
     return;
 }
 
+/* Recount the rules in each access chain and recompute the next expire
+ * time from the _exp_ comments.  This is for rules that were added or
+ * removed behind our back (SIGUSR2).
+*/
+static int
+firewd_resync(const fko_srv_options_t * const opts)
+{
+    char            *ndx;
+    char            exp_str[12] = {0};
+    char            fw_output_buf[STANDARD_CMD_OUT_BUFSIZE] = {0};
+
+    int             i, res, rv = 1;
+    time_t          rule_exp, min_exp;
+
+    struct fw_chain *ch = opts->fw_config->chain;
+
+    for(i=0; i < NUM_FWKNOP_ACCESS_TYPES; i++)
+    {
+        if(ch[i].table[0] == '\0' || ch[i].to_chain[0] == '\0')
+            continue;
+
+        zero_cmd_buffers();
+        memset(fw_output_buf, 0x0, STANDARD_CMD_OUT_BUFSIZE);
+
+        snprintf(cmd_buf, CMD_BUFSIZE-1, "%s " FIREWD_LIST_RULES_ARGS,
+            opts->fw_config->fw_command,
+            ch[i].table,
+            ch[i].to_chain
+        );
+
+        res = firewd_run_cmd(cmd_buf, fw_output_buf, STANDARD_CMD_OUT_BUFSIZE,
+                WANT_STDERR, NO_TIMEOUT, &pid_status, opts);
+        chop_newline(fw_output_buf);
+
+        log_msg(LOG_DEBUG, "firewd_resync() CMD: '%s' (res: %d)", cmd_buf, res);
+
+        if(!EXTCMD_IS_SUCCESS(res))
+        {
+            log_msg(LOG_ERR, "firewd_resync() Error %i from cmd:'%s': %s",
+                    res, cmd_buf, fw_output_buf);
+            rv = 0;
+            continue;
+        }
+
+        ch[i].active_rules = 0;
+        min_exp = 0;
+
+        ndx = strstr(fw_output_buf, EXPIRE_COMMENT_PREFIX);
+        while(ndx != NULL)
+        {
+            ndx += strlen(EXPIRE_COMMENT_PREFIX);
+
+            strlcpy(exp_str, ndx, sizeof(exp_str));
+            chop_spaces(exp_str);
+            if(is_digits(exp_str))
+            {
+                rule_exp = (time_t)atoll(exp_str);
+                min_exp  = (min_exp && min_exp < rule_exp) ? min_exp : rule_exp;
+                ch[i].active_rules++;
+            }
+
+            ndx = strstr(ndx, EXPIRE_COMMENT_PREFIX);
+        }
+
+        ch[i].next_expire = min_exp;
+
+        log_msg(LOG_INFO, "Resync: %i active rule(s) in %s",
+                ch[i].active_rules, ch[i].to_chain);
+    }
+
+    return rv;
+}
+
 int
 validate_firewd_chain_conf(const char * const chain_str)
 {
@@ -1731,6 +2139,20 @@ validate_firewd_chain_conf(const char * const chain_str)
     return rv;
 }
 
+const fw_backend_t fw_backend_firewalld = {
+    "firewalld",
+    firewd_config_init,
+    firewd_initialize,
+    firewd_cleanup,
+    firewd_grant,
+    NULL,
+    firewd_expire,
+    firewd_resync,
+    firewd_dump,
+    NULL,
+    NULL
+};
+
 #endif /* FIREWALL_FIREWALLD */
 
 /***EOF***/
@@ -36,6 +36,19 @@
 #define FIREWD_CMD_FAIL_STR   "COMMAND_FAILED" /* returned by firewall-cmd */
 #define FIREWD_CMD_PREFIX     "--direct --passthrough ipv4"
 
+/* firewalld D-Bus direct interface, used instead of firewall-cmd when
+ * fwknopd is built with libdbus
+*/
+#define FIREWD_DBUS_NAME          "org.fedoraproject.FirewallD1"
+#define FIREWD_DBUS_PATH          "/org/fedoraproject/FirewallD1"
+#define FIREWD_DBUS_DIRECT_IF     "org.fedoraproject.FirewallD1.direct"
+#define FIREWD_DBUS_TIMEOUT       (EXTCMD_DEF_TIMEOUT * 1000)  /* milliseconds */
+#define FIREWD_DBUS_MAX_ARGS      64
+
+/* Maximum number of expired rules removed from a chain in one pass
+*/
+#define FIREWD_EXPIRE_BATCH_MAX   64
+
 #if HAVE_EXECVPE
   #define SH_REDIR "" /* the shell is not used when execvpe() is available */
 #else
@@ -70,6 +83,8 @@
 
 int validate_firewd_chain_conf(const char * const chain_str);
 
+extern const struct fw_backend fw_backend_firewalld;
+
 #endif /* FW_UTIL_FIREWALLD_H */
 
 /***EOF***/
@@ -46,8 +46,8 @@ static char   cmd_out[STANDARD_CMD_OUT_BUFSIZE];
 /* Print all firewall rules currently instantiated by the running fwknopd
  * daemon to stdout.
 */
-int
-fw_dump_rules(const fko_srv_options_t *opts)
+static int
+ipf_dump(const fko_srv_options_t * const opts)
 {
     int     i;
     int     res, got_err = 0;
@@ -62,8 +62,8 @@ fw_dump_rules(const fko_srv_options_t *opts)
     return(got_err);
 }
 
-void
-fw_config_init(fko_srv_options_t *opts)
+static int
+ipf_config_init(fko_srv_options_t * const opts)
 {
     /* TODO: Implement me */
 
@@ -85,8 +85,8 @@ fw_config_init(fko_srv_options_t *opts)
     return 1;
 }
 
-void
-fw_initialize(const fko_srv_options_t *opts)
+static int
+ipf_initialize(const fko_srv_options_t * const opts)
 {
     int res = 0;
 
@@ -95,14 +95,14 @@ fw_initialize(const fko_srv_options_t *opts)
     if(res != 0)
     {
         log_msg(LOG_WARNING,
-                "Warning: Errors detected during fw_initialize().");
+                "Warning: Errors detected during ipf_initialize().");
         return 0;
     }
     return 1;
 }
 
-int
-fw_cleanup(void)
+static int
+ipf_cleanup(const fko_srv_options_t * const opts)
 {
 
     /* TODO: Implement or get rid of me */
@@ -114,8 +114,9 @@ fw_cleanup(void)
 
 /* Rule Processing - Create an access request...
 */
-int
-process_spa_request(const fko_srv_options_t *opts, const acc_stanza_t *acc, spa_data_t *spadat)
+static int
+ipf_grant(const fko_srv_options_t * const opts,
+        const acc_stanza_t * const acc, spa_data_t * const spadat)
 {
     /* TODO: Implement me */
 
@@ -152,8 +153,8 @@ process_spa_request(const fko_srv_options_t *opts, const acc_stanza_t *acc, spa_
 /* Iterate over the configure firewall access chains and purge expired
  * firewall rules.
 */
-void
-check_firewall_rules(const fko_srv_options_t *opts,
+static void
+ipf_expire(const fko_srv_options_t * const opts,
         const int chk_rm_all)
 {
 
@@ -171,6 +172,20 @@ check_firewall_rules(const fko_srv_options_t *opts,
     zero_cmd_buffers();
 }
 
+const fw_backend_t fw_backend_ipf = {
+    "ipf",
+    ipf_config_init,
+    ipf_initialize,
+    ipf_cleanup,
+    ipf_grant,
+    NULL,
+    ipf_expire,
+    NULL,
+    ipf_dump,
+    NULL,
+    NULL
+};
+
 #endif /* FIREWALL_IPF */
 
 /***EOF***/
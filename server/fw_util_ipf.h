@@ -42,6 +42,8 @@
 #define IPF_LIST_RULES_ARGS ""
 #define IPF_ANY_IP ""
 
+extern const struct fw_backend fw_backend_ipf;
+
 #endif /* FW_UTIL_IPF_H */
 
 /***EOF***/
@@ -67,6 +67,8 @@ zero_cmd_buffers(void)
 
 static int pid_status = 0;
 
+static int ipfw_cleanup(const fko_srv_options_t * const opts);
+
 static int
 ipfw_set_exists(const fko_srv_options_t *opts,
     const char *fw_command, const unsigned short set_num)
@@ -98,8 +100,8 @@ ipfw_set_exists(const fko_srv_options_t *opts,
 /* Print all firewall rules currently instantiated by the running fwknopd
  * daemon to stdout.
 */
-int
-fw_dump_rules(const fko_srv_options_t * const opts)
+static int
+ipfw_dump(const fko_srv_options_t * const opts)
 {
     int     res, got_err = 0;
 
@@ -119,7 +121,7 @@ fw_dump_rules(const fko_srv_options_t * const opts)
         res = run_extcmd(cmd_buf, NULL, 0, NO_STDERR,
                         NO_TIMEOUT, &pid_status, opts);
 
-        log_msg(LOG_DEBUG, "fw_dump_rules() CMD: '%s' (res: %d)",
+        log_msg(LOG_DEBUG, "ipfw_dump() CMD: '%s' (res: %d)",
             cmd_buf, res);
 
         /* Expect full success on this */
@@ -147,7 +149,7 @@ fw_dump_rules(const fko_srv_options_t * const opts)
         res = run_extcmd(cmd_buf, NULL, 0, NO_STDERR,
                     NO_TIMEOUT, &pid_status, opts);
 
-        log_msg(LOG_DEBUG, "fw_dump_rules() CMD: '%s' (res: %d)",
+        log_msg(LOG_DEBUG, "ipfw_dump() CMD: '%s' (res: %d)",
             cmd_buf, res);
 
         /* Expect full success on this */
@@ -168,7 +170,7 @@ fw_dump_rules(const fko_srv_options_t * const opts)
         res = run_extcmd(cmd_buf, NULL, 0, NO_STDERR,
                     NO_TIMEOUT, &pid_status, opts);
 
-        log_msg(LOG_DEBUG, "fw_dump_rules() CMD: '%s' (res: %d)",
+        log_msg(LOG_DEBUG, "ipfw_dump() CMD: '%s' (res: %d)",
             cmd_buf, res);
 
         /* Expect full success on this */
@@ -182,8 +184,8 @@ fw_dump_rules(const fko_srv_options_t * const opts)
     return(got_err);
 }
 
-int
-fw_config_init(fko_srv_options_t * const opts)
+static int
+ipfw_config_init(fko_srv_options_t * const opts)
 {
     int         is_err;
 
@@ -251,17 +253,19 @@ fw_config_init(fko_srv_options_t * const opts)
     return 1;
 }
 
-int
-fw_initialize(const fko_srv_options_t * const opts)
+static int
+ipfw_initialize(const fko_srv_options_t * const opts)
 {
     int             res = 0, is_err;
     unsigned short  curr_rule;
     char           *ndx;
 
-    /* For now, we just call fw_cleanup to start with clean slate.
+    /* For now, we just call fw_cleanup to start with clean slate (unless
+     * we took over the existing rules in a hot restart).
     */
-    if(strncasecmp(opts->config[CONF_FLUSH_IPFW_AT_INIT], "Y", 1) == 0)
-        res = fw_cleanup(opts);
+    if(strncasecmp(opts->config[CONF_FLUSH_IPFW_AT_INIT], "Y", 1) == 0
+            && ! opts->took_over)
+        res = ipfw_cleanup(opts);
 
     if(res != 0)
     {
@@ -275,7 +279,7 @@ fw_initialize(const fko_srv_options_t * const opts)
 
     if(fwc.rule_map == NULL)
     {
-        log_msg(LOG_ERR, "[*] Fatal: Memory allocation error in fw_initialize().");
+        log_msg(LOG_ERR, "[*] Fatal: Memory allocation error in ipfw_initialize().");
         return 0;
     }
 
@@ -294,7 +298,7 @@ fw_initialize(const fko_srv_options_t * const opts)
         res = run_extcmd(cmd_buf, err_buf, CMD_BUFSIZE,
                     WANT_STDERR, NO_TIMEOUT, &pid_status, opts);
 
-        log_msg(LOG_DEBUG, "fw_initialize() CMD: '%s' (res: %d, err: %s)",
+        log_msg(LOG_DEBUG, "ipfw_initialize() CMD: '%s' (res: %d, err: %s)",
             cmd_buf, res, err_buf);
 
         if(EXTCMD_IS_SUCCESS(res))
@@ -325,7 +329,7 @@ fw_initialize(const fko_srv_options_t * const opts)
         res = run_extcmd(cmd_buf, err_buf, CMD_BUFSIZE,
                     WANT_STDERR, NO_TIMEOUT, &pid_status, opts);
 
-        log_msg(LOG_DEBUG, "fw_initialize() CMD: '%s' (res: %d, err: %s)",
+        log_msg(LOG_DEBUG, "ipfw_initialize() CMD: '%s' (res: %d, err: %s)",
             cmd_buf, res, err_buf);
 
         if(EXTCMD_IS_SUCCESS(res))
@@ -348,7 +352,7 @@ fw_initialize(const fko_srv_options_t * const opts)
     res = run_extcmd(cmd_buf, cmd_out, STANDARD_CMD_OUT_BUFSIZE,
                 WANT_STDERR, NO_TIMEOUT, &pid_status, opts);
 
-    log_msg(LOG_DEBUG, "fw_initialize() CMD: '%s' (res: %d)",
+    log_msg(LOG_DEBUG, "ipfw_initialize() CMD: '%s' (res: %d)",
         cmd_buf, res);
 
     if(!EXTCMD_IS_SUCCESS(res))
@@ -403,8 +407,8 @@ fw_initialize(const fko_srv_options_t * const opts)
     return 1;
 }
 
-int
-fw_cleanup(const fko_srv_options_t * const opts)
+static int
+ipfw_cleanup(const fko_srv_options_t * const opts)
 {
     int     res, got_err = 0;
 
@@ -430,7 +434,7 @@ fw_cleanup(const fko_srv_options_t * const opts)
         res = run_extcmd(cmd_buf, NULL, 0, NO_STDERR,
                     NO_TIMEOUT, &pid_status, opts);
 
-        log_msg(LOG_DEBUG, "fw_cleanup() CMD: '%s' (res: %d)",
+        log_msg(LOG_DEBUG, "ipfw_cleanup() CMD: '%s' (res: %d)",
             cmd_buf, res);
 
         /* Expect full success on this */
@@ -478,8 +482,8 @@ fw_cleanup(const fko_srv_options_t * const opts)
 
 /* Rule Processing - Create an access request...
 */
-int
-process_spa_request(const fko_srv_options_t * const opts,
+static int
+ipfw_grant(const fko_srv_options_t * const opts,
         const acc_stanza_t * const acc, spa_data_t * const spadat)
 {
     unsigned short   rule_num;
@@ -545,7 +549,7 @@ process_spa_request(const fko_srv_options_t * const opts,
             res = run_extcmd(cmd_buf, err_buf, CMD_BUFSIZE,
                             WANT_STDERR, NO_TIMEOUT, &pid_status, opts);
 
-            log_msg(LOG_DEBUG, "process_spa_request() CMD: '%s' (res: %d, err: %s)",
+            log_msg(LOG_DEBUG, "ipfw_grant() CMD: '%s' (res: %d, err: %s)",
                 cmd_buf, res, err_buf);
 
             if(EXTCMD_IS_SUCCESS(res))
@@ -600,8 +604,8 @@ process_spa_request(const fko_srv_options_t * const opts,
 /* Iterate over the current rule set and purge expired
  * firewall rules.
 */
-void
-check_firewall_rules(const fko_srv_options_t * const opts,
+static void
+ipfw_expire_active(const fko_srv_options_t * const opts,
         const int chk_rm_all)
 {
     char            exp_str[12]     = {0};
@@ -642,7 +646,7 @@ check_firewall_rules(const fko_srv_options_t * const opts,
                 WANT_STDERR, NO_TIMEOUT, &pid_status, opts);
     chop_newline(cmd_out);
 
-    log_msg(LOG_DEBUG, "check_firewall_rules() CMD: '%s' (res: %d)",
+    log_msg(LOG_DEBUG, "ipfw_expire_active() CMD: '%s' (res: %d)",
         cmd_buf, res);
 
     if(!EXTCMD_IS_SUCCESS(res))
@@ -758,7 +762,7 @@ check_firewall_rules(const fko_srv_options_t * const opts,
                 res = run_extcmd(cmd_buf, err_buf, CMD_BUFSIZE,
                             WANT_STDERR, NO_TIMEOUT, &pid_status, opts);
 
-                log_msg(LOG_DEBUG, "check_firewall_rules() CMD: '%s' (res: %d, err: %s)",
+                log_msg(LOG_DEBUG, "ipfw_expire_active() CMD: '%s' (res: %d, err: %s)",
                     cmd_buf, res, err_buf);
 
                 if(EXTCMD_IS_SUCCESS(res))
@@ -806,7 +810,7 @@ check_firewall_rules(const fko_srv_options_t * const opts,
 /* Iterate over the expired rule set and purge those that no longer have
  * corresponding dynamic rules.
 */
-void
+static void
 ipfw_purge_expired_rules(const fko_srv_options_t *opts)
 {
     char           *ndx, *co_end;
@@ -952,6 +956,42 @@ ipfw_purge_expired_rules(const fko_srv_options_t *opts)
     }
 }
 
+static void
+ipfw_expire(const fko_srv_options_t * const opts,
+        const int chk_rm_all)
+{
+    time_t  now;
+
+    ipfw_expire_active(opts, chk_rm_all);
+
+    /* Purge expired rules that no longer have any corresponding
+     * dynamic rules.
+    */
+    if(fwc.total_rules > 0)
+    {
+        time(&now);
+        if(fwc.last_purge < (now - fwc.purge_interval))
+        {
+            ipfw_purge_expired_rules(opts);
+            fwc.last_purge = now;
+        }
+    }
+}
+
+const fw_backend_t fw_backend_ipfw = {
+    "ipfw",
+    ipfw_config_init,
+    ipfw_initialize,
+    ipfw_cleanup,
+    ipfw_grant,
+    NULL,
+    ipfw_expire,
+    NULL,
+    ipfw_dump,
+    NULL,
+    NULL
+};
+
 #endif /* FIREWALL_IPFW */
 
 /***EOF***/
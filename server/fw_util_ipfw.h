@@ -63,7 +63,7 @@ enum {
   #define IPFW_LIST_SET_DYN_RULES_ARGS "-d set %u list"
 #endif
 
-void ipfw_purge_expired_rules(const fko_srv_options_t *opts);
+extern const struct fw_backend fw_backend_ipfw;
 
 #endif /* FW_UTIL_IPFW_H */
 
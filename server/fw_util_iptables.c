@@ -35,6 +35,7 @@
 
 #include "fw_util.h"
 #include "utils.h"
+#include "grant_journal.h"
 #include "log_msg.h"
 #include "extcmd.h"
 #include "access.h"
@@ -539,8 +540,8 @@ jump_rule_exists(const fko_srv_options_t * const opts, const int chain_num)
 /* Print all firewall rules currently instantiated by the running fwknopd
  * daemon to stdout.
 */
-int
-fw_dump_rules(const fko_srv_options_t * const opts)
+static int
+ipt_dump(const fko_srv_options_t * const opts)
 {
     int     i, res, got_err = 0;
 
@@ -568,13 +569,13 @@ fw_dump_rules(const fko_srv_options_t * const opts)
             res = run_extcmd(cmd_buf, NULL, 0, NO_STDERR,
                         NO_TIMEOUT, &pid_status, opts);
 
-            log_msg(LOG_DEBUG, "fw_dump_rules() CMD: '%s' (res: %d)",
+            log_msg(LOG_DEBUG, "ipt_dump() CMD: '%s' (res: %d)",
                 cmd_buf, res);
 
             /* Expect full success on this */
             if(! EXTCMD_IS_SUCCESS(res))
             {
-                log_msg(LOG_ERR, "fw_dump_rules() Error %i from cmd:'%s': %s",
+                log_msg(LOG_ERR, "ipt_dump() Error %i from cmd:'%s': %s",
                         res, cmd_buf, err_buf);
                 got_err++;
             }
@@ -606,13 +607,13 @@ fw_dump_rules(const fko_srv_options_t * const opts)
             res = run_extcmd(cmd_buf, NULL, 0, NO_STDERR,
                         NO_TIMEOUT, &pid_status, opts);
 
-            log_msg(LOG_DEBUG, "fw_dump_rules() CMD: '%s' (res: %d)",
+            log_msg(LOG_DEBUG, "ipt_dump() CMD: '%s' (res: %d)",
                 cmd_buf, res);
 
             /* Expect full success on this */
             if(! EXTCMD_IS_SUCCESS(res))
             {
-                log_msg(LOG_ERR, "fw_dump_rules() Error %i from cmd:'%s': %s",
+                log_msg(LOG_ERR, "ipt_dump() Error %i from cmd:'%s': %s",
                         res, cmd_buf, err_buf);
                 got_err++;
             }
@@ -872,8 +873,8 @@ set_fw_chain_conf(const int type, const char * const conf_str)
     return 1;
 }
 
-int
-fw_config_init(fko_srv_options_t * const opts)
+static int
+ipt_config_init(fko_srv_options_t * const opts)
 {
     memset(&fwc, 0x0, sizeof(struct fw_config));
 
@@ -939,8 +940,8 @@ fw_config_init(fko_srv_options_t * const opts)
     return 1;
 }
 
-int
-fw_initialize(const fko_srv_options_t * const opts)
+static int
+ipt_initialize(const fko_srv_options_t * const opts)
 {
     int res = 1;
 
@@ -952,17 +953,29 @@ fw_initialize(const fko_srv_options_t * const opts)
     else
         ipt_chk_support(opts);
 
-    /* Flush the chains (just in case) so we can start fresh.
+    /* Flush the chains (just in case) so we can start fresh.  After a hot
+     * restart the existing rules belong to us.
     */
-    if(strncasecmp(opts->config[CONF_FLUSH_IPT_AT_INIT], "Y", 1) == 0)
+    if(strncasecmp(opts->config[CONF_FLUSH_IPT_AT_INIT], "Y", 1) == 0
+            && ! opts->took_over)
+    {
         delete_all_chains(opts);
+        grant_journal_clear(opts);
+    }
+    else
+    {
+        /* Pick up the rules that are still in place from before the
+         * restart (if ENABLE_GRANT_JOURNAL is set).
+        */
+        grant_journal_restore(opts, fwc.chain);
+    }
 
     /* Now create any configured chains.
     */
     if(create_fw_chains(opts) != 0)
     {
         log_msg(LOG_WARNING,
-                "fw_initialize() Warning: Errors detected during fwknop custom chain creation");
+                "ipt_initialize() Warning: Errors detected during fwknop custom chain creation");
         res = 0;
     }
 
@@ -984,14 +997,15 @@ fw_initialize(const fko_srv_options_t * const opts)
     return(res);
 }
 
-int
-fw_cleanup(const fko_srv_options_t * const opts)
+static int
+ipt_cleanup(const fko_srv_options_t * const opts)
 {
     if(strncasecmp(opts->config[CONF_FLUSH_IPT_AT_EXIT], "N", 1) == 0
             && opts->fw_flush == 0)
         return(0);
 
     delete_all_chains(opts);
+    grant_journal_clear(opts);
     return(0);
 }
 
@@ -1079,6 +1093,7 @@ connmark_rule(const fko_srv_options_t * const opts,
             );
 
             chain->active_rules++;
+            grant_journal_add(opts, chain->type, exp_ts, proto, srcip, dstip, port);
 
             /* Reset the next expected expire time for this chain if it
             * is warranted.
@@ -1145,6 +1160,7 @@ ipt_rule(const fko_srv_options_t * const opts,
             );
 
             chain->active_rules++;
+            grant_journal_add(opts, chain->type, exp_ts, proto, srcip, dstip, port);
 
             /* Reset the next expected expire time for this chain if it
             * is warranted.
@@ -1407,8 +1423,8 @@ static void snat_rule(const fko_srv_options_t * const opts,
 
 /* Rule Processing - Create an access request...
 */
-int
-process_spa_request(const fko_srv_options_t * const opts,
+static int
+ipt_grant(const fko_srv_options_t * const opts,
         const acc_stanza_t * const acc, spa_data_t * const spadat)
 {
     char            nat_ip[MAX_IPV4_STR_LEN] = {0};
@@ -1426,8 +1442,7 @@ process_spa_request(const fko_srv_options_t * const opts,
 
     service_data_list_t *next_service = spadat->service_data_list;
 
-    char            *ndx = NULL;
-    int             res = 0, is_err;
+    int             res = 0;
     time_t          now;
     unsigned int    exp_ts;
 
@@ -1585,34 +1600,11 @@ process_spa_request(const fko_srv_options_t * const opts,
       || spadat->message_type == FKO_CLIENT_TIMEOUT_NAT_ACCESS_MSG
       || acc->force_nat)
     {
-        if(acc->force_nat)
+        res = fw_nat_access(acc, spadat, nat_ip, sizeof(nat_ip), &nat_port);
+        if(res != FKO_SUCCESS)
         {
-            strlcpy(nat_ip, acc->force_nat_ip, sizeof(nat_ip));
-            nat_port = acc->force_nat_port;
-        }
-        else
-        {
-            ndx = strchr(spadat->nat_access, ',');
-            if(ndx != NULL)
-            {
-                strlcpy(nat_ip, spadat->nat_access, (ndx-spadat->nat_access)+1);
-                if (! is_valid_ipv4_addr(nat_ip))
-                {
-                    log_msg(LOG_INFO, "Invalid NAT IP in SPA message");
-                    free_acc_port_list(port_list);
-                    return res;
-                }
-
-                nat_port = strtol_wrapper(ndx+1, 0, MAX_PORT,
-                        NO_EXIT_UPON_ERR, &is_err);
-                if(is_err != FKO_SUCCESS)
-                {
-                    log_msg(LOG_INFO, "Invalid NAT port in SPA message");
-                    free_acc_port_list(port_list);
-                    res = is_err;
-                    return res;
-                }
-            }
+            free_acc_port_list(port_list);
+            return res;
         }
 
         if(spadat->message_type == FKO_LOCAL_NAT_ACCESS_MSG
@@ -1830,7 +1822,7 @@ rm_expired_rules(const fko_srv_options_t * const opts,
         {
             /* Track the minimum future rule expire time.
             */
-            min_exp = (min_exp < rule_exp) ? min_exp : rule_exp;
+            min_exp = (min_exp && min_exp < rule_exp) ? min_exp : rule_exp;
         }
 
         /* Push our tracking index forward beyond (just processed) _exp_
@@ -1853,8 +1845,8 @@ rm_expired_rules(const fko_srv_options_t * const opts,
 /* Iterate over the configure firewall access chains and purge expired
  * firewall rules.
 */
-void
-check_firewall_rules(const fko_srv_options_t * const opts,
+static void
+ipt_expire(const fko_srv_options_t * const opts,
         const int chk_rm_all)
 {
     char            *ndx;
@@ -1901,13 +1893,13 @@ check_firewall_rules(const fko_srv_options_t * const opts,
         chop_newline(ipt_output_buf);
 
         log_msg(LOG_DEBUG,
-            "check_firewall_rules() CMD: '%s' (res: %d, ipt_output_buf: %s)",
+            "ipt_expire() CMD: '%s' (res: %d, ipt_output_buf: %s)",
             cmd_buf, res, ipt_output_buf);
 
         if(!EXTCMD_IS_SUCCESS(res))
         {
             log_msg(LOG_ERR,
-                    "check_firewall_rules() Error %i from cmd:'%s': %s",
+                    "ipt_expire() Error %i from cmd:'%s': %s",
                     res, cmd_buf, ipt_output_buf);
             continue;
         }
@@ -1932,9 +1924,89 @@ check_firewall_rules(const fko_srv_options_t * const opts,
         rm_expired_rules(opts, ipt_output_buf, ndx, ch, i, now);
     }
 
+    /* Let the grant journal drop the entries for expired rules
+    */
+    for(i=0, res=0; i < NUM_FWKNOP_ACCESS_TYPES; i++)
+        res += ch[i].active_rules;
+
+    grant_journal_expire(opts, res);
+
     return;
 }
 
+/* Recount the rules in each access chain and recompute the next expire
+ * time from the _exp_ comments.  This is for rules that were added or
+ * removed behind our back (SIGUSR2).
+*/
+static int
+ipt_resync(const fko_srv_options_t * const opts)
+{
+    char            *ndx;
+    char            exp_str[12] = {0};
+    char            ipt_output_buf[STANDARD_CMD_OUT_BUFSIZE] = {0};
+
+    int             i, res, rv = 1;
+    time_t          rule_exp, min_exp;
+
+    struct fw_chain *ch = opts->fw_config->chain;
+
+    for(i=0; i < NUM_FWKNOP_ACCESS_TYPES; i++)
+    {
+        if(ch[i].table[0] == '\0' || ch[i].to_chain[0] == '\0')
+            continue;
+
+        zero_cmd_buffers();
+        memset(ipt_output_buf, 0x0, STANDARD_CMD_OUT_BUFSIZE);
+
+        snprintf(cmd_buf, CMD_BUFSIZE-1, "%s " IPT_LIST_RULES_ARGS,
+            opts->fw_config->fw_command,
+            ch[i].table,
+            ch[i].to_chain
+        );
+
+        res = run_extcmd(cmd_buf, ipt_output_buf, STANDARD_CMD_OUT_BUFSIZE,
+                WANT_STDERR, NO_TIMEOUT, &pid_status, opts);
+        chop_newline(ipt_output_buf);
+
+        log_msg(LOG_DEBUG, "ipt_resync() CMD: '%s' (res: %d)", cmd_buf, res);
+
+        if(!EXTCMD_IS_SUCCESS(res))
+        {
+            log_msg(LOG_ERR, "ipt_resync() Error %i from cmd:'%s': %s",
+                    res, cmd_buf, ipt_output_buf);
+            rv = 0;
+            continue;
+        }
+
+        ch[i].active_rules = 0;
+        min_exp = 0;
+
+        ndx = strstr(ipt_output_buf, EXPIRE_COMMENT_PREFIX);
+        while(ndx != NULL)
+        {
+            ndx += strlen(EXPIRE_COMMENT_PREFIX);
+
+            strlcpy(exp_str, ndx, sizeof(exp_str));
+            chop_spaces(exp_str);
+            if(is_digits(exp_str))
+            {
+                rule_exp = (time_t)atoll(exp_str);
+                min_exp  = (min_exp && min_exp < rule_exp) ? min_exp : rule_exp;
+                ch[i].active_rules++;
+            }
+
+            ndx = strstr(ndx, EXPIRE_COMMENT_PREFIX);
+        }
+
+        ch[i].next_expire = min_exp;
+
+        log_msg(LOG_INFO, "Resync: %i active rule(s) in %s",
+                ch[i].active_rules, ch[i].to_chain);
+    }
+
+    return rv;
+}
+
 int
 validate_ipt_chain_conf(const char * const chain_str)
 {
@@ -1968,6 +2040,20 @@ validate_ipt_chain_conf(const char * const chain_str)
     return rv;
 }
 
+const fw_backend_t fw_backend_iptables = {
+    "iptables",
+    ipt_config_init,
+    ipt_initialize,
+    ipt_cleanup,
+    ipt_grant,
+    NULL,
+    ipt_expire,
+    ipt_resync,
+    ipt_dump,
+    NULL,
+    NULL
+};
+
 #endif /* FIREWALL_IPTABLES */
 
 /***EOF***/
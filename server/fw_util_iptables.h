@@ -71,6 +71,8 @@
 
 int validate_ipt_chain_conf(const char * const chain_str);
 
+extern const struct fw_backend fw_backend_iptables;
+
 #endif /* FW_UTIL_IPTABLES_H */
 
 /***EOF***/
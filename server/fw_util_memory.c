@@ -0,0 +1,674 @@
+/*
+ *****************************************************************************
+ *
+ * File:    fw_util_memory.c
+ *
+ * Purpose: In-memory firewall backend.  SPA grants are kept in a hash
+ *          table instead of being written to the firewall, for testing
+ *          fwknopd and measuring its grant/expire throughput.
+ *
+ *  Fwknop is developed primarily by the people listed in the file 'AUTHORS'.
+ *  Copyright (C) 2009-2014 fwknop developers and contributors. For a full
+ *  list of contributors, see the file 'CREDITS'.
+ *
+ *  License (GNU General Public License):
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *  USA
+ *
+ *****************************************************************************
+*/
+#include "fwknopd_common.h"
+#include "fw_util.h"
+#include "utils.h"
+#include "log_msg.h"
+#include "access.h"
+
+#include <pthread.h>
+
+/* What a rule in the table grants: access to a local port, access to a
+ * local port through NAT, or access forwarded to another host.
+*/
+enum {
+    MEMFW_ACCESS,
+    MEMFW_LOCAL_NAT,
+    MEMFW_FORWARD
+};
+
+static const char * const memfw_type_str[] = {
+    "access",
+    "local NAT",
+    "forward"
+};
+
+typedef struct memfw_rule
+{
+    int             type;
+    unsigned int    proto;
+    unsigned int    port;
+    char            src[MAX_IPV4_STR_LEN];
+    char            dst[MAX_IPV4_STR_LEN];
+    char            nat_ip[MAX_IPV4_STR_LEN];
+    unsigned int    nat_port;
+    time_t          expire;
+    unsigned int    heap_pos;   /* index in memfw.heap */
+    struct memfw_rule *next;    /* hash chain, or the pending list */
+} memfw_rule_t;
+
+/* The rules are kept in a hash table keyed on everything but the expire
+ * time, so a repeated grant just extends the rule it already has, and in
+ * a min-heap on the expire time so expiring rules does not need to walk
+ * the whole table.
+*/
+static struct {
+    memfw_rule_t  **buckets;
+    unsigned int    num_buckets;
+
+    memfw_rule_t  **heap;
+    unsigned int    heap_size;
+    unsigned int    heap_len;
+
+    /* Grants waiting for the next commit
+    */
+    memfw_rule_t   *pending;
+    memfw_rule_t  **pending_tail;
+
+    unsigned long   grants;
+    unsigned long   commits;
+    unsigned long   expired;
+} memfw;
+
+static pthread_mutex_t memfw_pending_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned int
+memfw_hash(const memfw_rule_t * const r)
+{
+    /* FNV-1a over the rule key
+    */
+    const char     *strs[3] = { r->src, r->dst, r->nat_ip };
+    const char     *s;
+    unsigned int    h = 2166136261u, i;
+
+    h = (h ^ (unsigned int)r->type)     * 16777619u;
+    h = (h ^ r->proto)                  * 16777619u;
+    h = (h ^ r->port)                   * 16777619u;
+    h = (h ^ r->nat_port)               * 16777619u;
+
+    for(i=0; i < 3; i++)
+        for(s = strs[i]; *s != '\0'; s++)
+            h = (h ^ (unsigned char)*s) * 16777619u;
+
+    return h;
+}
+
+static int
+memfw_same_rule(const memfw_rule_t * const a, const memfw_rule_t * const b)
+{
+    return a->type == b->type
+        && a->proto == b->proto
+        && a->port == b->port
+        && a->nat_port == b->nat_port
+        && strcmp(a->src, b->src) == 0
+        && strcmp(a->dst, b->dst) == 0
+        && strcmp(a->nat_ip, b->nat_ip) == 0;
+}
+
+/* Min-heap on the rule expire time
+*/
+static void
+memfw_heap_swap(const unsigned int i, const unsigned int j)
+{
+    memfw_rule_t   *tmp = memfw.heap[i];
+
+    memfw.heap[i] = memfw.heap[j];
+    memfw.heap[j] = tmp;
+    memfw.heap[i]->heap_pos = i;
+    memfw.heap[j]->heap_pos = j;
+}
+
+static void
+memfw_heap_up(unsigned int i)
+{
+    while(i > 0 && memfw.heap[(i-1)/2]->expire > memfw.heap[i]->expire)
+    {
+        memfw_heap_swap(i, (i-1)/2);
+        i = (i-1)/2;
+    }
+}
+
+static void
+memfw_heap_down(unsigned int i)
+{
+    unsigned int    l, r, min;
+
+    while(1)
+    {
+        l   = 2*i + 1;
+        r   = 2*i + 2;
+        min = i;
+
+        if(l < memfw.heap_len && memfw.heap[l]->expire < memfw.heap[min]->expire)
+            min = l;
+        if(r < memfw.heap_len && memfw.heap[r]->expire < memfw.heap[min]->expire)
+            min = r;
+        if(min == i)
+            break;
+
+        memfw_heap_swap(i, min);
+        i = min;
+    }
+}
+
+static void
+memfw_heap_push(memfw_rule_t * const rule)
+{
+    if(memfw.heap_len == memfw.heap_size)
+    {
+        memfw.heap_size *= 2;
+        memfw.heap = realloc(memfw.heap, memfw.heap_size * sizeof(*memfw.heap));
+        if(memfw.heap == NULL)
+        {
+            log_msg(LOG_ERR, "[*] Fatal memory allocation error in memfw_heap_push()");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    rule->heap_pos = memfw.heap_len;
+    memfw.heap[memfw.heap_len++] = rule;
+    memfw_heap_up(rule->heap_pos);
+}
+
+static memfw_rule_t *
+memfw_heap_pop(void)
+{
+    memfw_rule_t   *top = memfw.heap[0];
+
+    memfw.heap_len--;
+    if(memfw.heap_len > 0)
+    {
+        memfw.heap[0] = memfw.heap[memfw.heap_len];
+        memfw.heap[0]->heap_pos = 0;
+        memfw_heap_down(0);
+    }
+
+    return top;
+}
+
+static void
+memfw_grow(void)
+{
+    memfw_rule_t  **buckets, *rule, *next;
+    unsigned int    i, num_buckets = memfw.num_buckets * 2;
+
+    buckets = calloc(num_buckets, sizeof(*buckets));
+    if(buckets == NULL)
+    {
+        /* Longer chains, but still correct
+        */
+        log_msg(LOG_WARNING, "memfw_grow() could not allocate %u buckets",
+                num_buckets);
+        return;
+    }
+
+    for(i=0; i < memfw.num_buckets; i++)
+    {
+        for(rule = memfw.buckets[i]; rule != NULL; rule = next)
+        {
+            next = rule->next;
+            rule->next = buckets[memfw_hash(rule) & (num_buckets-1)];
+            buckets[memfw_hash(rule) & (num_buckets-1)] = rule;
+        }
+    }
+
+    free(memfw.buckets);
+    memfw.buckets     = buckets;
+    memfw.num_buckets = num_buckets;
+}
+
+/* Put a committed grant in the table.  Returns 1 if the rule is new, 0 if
+ * it extended an existing rule (in which case the caller still owns it).
+*/
+static int
+memfw_insert(memfw_rule_t * const rule)
+{
+    memfw_rule_t  **bucket, *cur;
+
+    bucket = &memfw.buckets[memfw_hash(rule) & (memfw.num_buckets-1)];
+
+    for(cur = *bucket; cur != NULL; cur = cur->next)
+    {
+        if(memfw_same_rule(cur, rule))
+        {
+            if(rule->expire > cur->expire)
+            {
+                cur->expire = rule->expire;
+                memfw_heap_down(cur->heap_pos);
+            }
+            return 0;
+        }
+    }
+
+    rule->next = *bucket;
+    *bucket = rule;
+    memfw_heap_push(rule);
+
+    if(memfw.heap_len > memfw.num_buckets)
+        memfw_grow();
+
+    return 1;
+}
+
+static void
+memfw_remove(const memfw_rule_t * const rule)
+{
+    memfw_rule_t  **pp;
+
+    pp = &memfw.buckets[memfw_hash(rule) & (memfw.num_buckets-1)];
+    while(*pp != NULL)
+    {
+        if(*pp == rule)
+        {
+            *pp = rule->next;
+            return;
+        }
+        pp = &(*pp)->next;
+    }
+}
+
+/* Queue up one rule for the next commit
+*/
+static void
+memfw_queue(const int type, const unsigned int proto, const unsigned int port,
+        const char * const src, const char * const dst,
+        const char * const nat_ip, const unsigned int nat_port,
+        const time_t expire)
+{
+    memfw_rule_t   *rule;
+
+    if((rule = calloc(1, sizeof(*rule))) == NULL)
+    {
+        log_msg(LOG_ERR, "[*] Fatal memory allocation error in memfw_queue()");
+        exit(EXIT_FAILURE);
+    }
+
+    rule->type     = type;
+    rule->proto    = proto;
+    rule->port     = port;
+    rule->nat_port = nat_port;
+    rule->expire   = expire;
+    strlcpy(rule->src, src, sizeof(rule->src));
+    strlcpy(rule->dst, dst, sizeof(rule->dst));
+    if(nat_ip != NULL)
+        strlcpy(rule->nat_ip, nat_ip, sizeof(rule->nat_ip));
+
+    pthread_mutex_lock(&memfw_pending_mutex);
+    *memfw.pending_tail = rule;
+    memfw.pending_tail  = &rule->next;
+    memfw.grants++;
+    pthread_mutex_unlock(&memfw_pending_mutex);
+}
+
+static void
+memfw_free_rules(void)
+{
+    memfw_rule_t   *rule, *next;
+    unsigned int    i;
+
+    for(i=0; i < memfw.heap_len; i++)
+        free(memfw.heap[i]);
+
+    pthread_mutex_lock(&memfw_pending_mutex);
+    for(rule = memfw.pending; rule != NULL; rule = next)
+    {
+        next = rule->next;
+        free(rule);
+    }
+    memfw.pending      = NULL;
+    memfw.pending_tail = &memfw.pending;
+    pthread_mutex_unlock(&memfw_pending_mutex);
+
+    free(memfw.buckets);
+    free(memfw.heap);
+    memfw.buckets     = NULL;
+    memfw.heap        = NULL;
+    memfw.num_buckets = 0;
+    memfw.heap_len    = 0;
+}
+
+static int
+memfw_config_init(fko_srv_options_t * const opts)
+{
+    unsigned int    i;
+
+    /* After a SIGHUP the rules from before the restart are still here.
+     * The other backends flush their rules when they are initialized
+     * again, so these are dropped the same way.
+    */
+    if(memfw.heap != NULL)
+    {
+        for(i=0; i < memfw.heap_len; i++)
+            log_msg(LOG_INFO, "Dropping %s rule for %s -> %s port %u with expire time of %u",
+                memfw_type_str[memfw.heap[i]->type], memfw.heap[i]->src,
+                memfw.heap[i]->dst, memfw.heap[i]->port,
+                (unsigned int)memfw.heap[i]->expire);
+
+        log_msg(LOG_WARNING, "Dropped %u in-memory firewall rule(s) on restart",
+            memfw.heap_len);
+
+        memfw_free_rules();
+    }
+
+    memset(&memfw, 0x0, sizeof(memfw));
+
+    memfw.num_buckets  = MEMFW_INIT_BUCKETS;
+    memfw.heap_size    = MEMFW_INIT_BUCKETS;
+    memfw.buckets      = calloc(memfw.num_buckets, sizeof(*memfw.buckets));
+    memfw.heap         = calloc(memfw.heap_size, sizeof(*memfw.heap));
+    memfw.pending_tail = &memfw.pending;
+
+    if(memfw.buckets == NULL || memfw.heap == NULL)
+    {
+        log_msg(LOG_ERR, "[*] Fatal memory allocation error in memfw_config_init()");
+        return 0;
+    }
+
+    return 1;
+}
+
+static int
+memfw_initialize(const fko_srv_options_t * const opts)
+{
+    log_msg(LOG_INFO,
+        "Using the in-memory firewall backend, no firewall rules will be changed");
+
+    return 1;
+}
+
+static int
+memfw_cleanup(const fko_srv_options_t * const opts)
+{
+    if(memfw.heap_len > 0)
+        log_msg(LOG_INFO, "Flushed %u in-memory firewall rule(s)", memfw.heap_len);
+
+    memfw_free_rules();
+
+    return 0;
+}
+
+static int
+memfw_grant(const fko_srv_options_t * const opts,
+        const acc_stanza_t * const acc, spa_data_t * const spadat)
+{
+    char                 nat_ip[MAX_IPV4_STR_LEN] = {0};
+    unsigned int         nat_port = 0;
+    const char          *dst;
+    time_t               now, exp_ts;
+    int                  res = 0;
+
+    acc_port_list_t     *port_list = NULL, *ple;
+    service_data_list_t *sdl;
+    service_data_t      *sd;
+
+    time(&now);
+    exp_ts = now + spadat->fw_access_timeout;
+
+    dst = strncasecmp(opts->config[CONF_ENABLE_DESTINATION_RULE], "Y", 1) == 0
+        ? spadat->pkt_destination_ip : MEMFW_ANY_IP;
+
+    /* SPA message requested service IDs
+    */
+    if(spadat->service_data_list != NULL)
+    {
+        for(sdl = spadat->service_data_list; sdl != NULL; sdl = sdl->next)
+        {
+            sd = sdl->service_data;
+
+            if(sd->nat_port == 0)
+                memfw_queue(MEMFW_ACCESS, sd->proto, sd->port,
+                        spadat->use_src_ip, dst, NULL, 0, exp_ts);
+            else if(sd->nat_ip_str[0] == '\0')
+                memfw_queue(MEMFW_LOCAL_NAT, sd->proto, sd->nat_port,
+                        spadat->use_src_ip, dst, NULL, sd->nat_port, exp_ts);
+            else
+                memfw_queue(MEMFW_FORWARD, sd->proto, sd->port,
+                        spadat->use_src_ip, dst, sd->nat_ip_str,
+                        sd->nat_port, exp_ts);
+        }
+        return res;
+    }
+
+    if(expand_acc_port_list(&port_list, spadat->spa_message_remain) != 1)
+    {
+        log_msg(LOG_WARNING, "Failed to parse port list in SPA message");
+        free_acc_port_list(port_list);
+        return res;
+    }
+
+    if(spadat->message_type == FKO_LOCAL_NAT_ACCESS_MSG
+      || spadat->message_type == FKO_CLIENT_TIMEOUT_LOCAL_NAT_ACCESS_MSG
+      || spadat->message_type == FKO_NAT_ACCESS_MSG
+      || spadat->message_type == FKO_CLIENT_TIMEOUT_NAT_ACCESS_MSG
+      || acc->force_nat)
+    {
+        /* NAT requests only use the first proto/port
+        */
+        res = fw_nat_access(acc, spadat, nat_ip, sizeof(nat_ip), &nat_port);
+        if(res == FKO_SUCCESS)
+        {
+            if(spadat->message_type == FKO_LOCAL_NAT_ACCESS_MSG
+                    || spadat->message_type == FKO_CLIENT_TIMEOUT_LOCAL_NAT_ACCESS_MSG)
+                memfw_queue(MEMFW_LOCAL_NAT, port_list->proto, nat_port,
+                        spadat->use_src_ip, dst, nat_ip, nat_port, exp_ts);
+            else
+                memfw_queue(MEMFW_FORWARD, port_list->proto, port_list->port,
+                        spadat->use_src_ip, dst, nat_ip, nat_port, exp_ts);
+        }
+    }
+    else
+    {
+        for(ple = port_list; ple != NULL; ple = ple->next)
+            memfw_queue(MEMFW_ACCESS, ple->proto, ple->port,
+                    spadat->use_src_ip, dst, NULL, 0, exp_ts);
+    }
+
+    free_acc_port_list(port_list);
+
+    return res;
+}
+
+/* Apply the grants queued up since the last commit in one go
+*/
+static int
+memfw_commit(const fko_srv_options_t * const opts)
+{
+    memfw_rule_t   *rule, *next;
+
+    pthread_mutex_lock(&memfw_pending_mutex);
+    rule = memfw.pending;
+    memfw.pending      = NULL;
+    memfw.pending_tail = &memfw.pending;
+    pthread_mutex_unlock(&memfw_pending_mutex);
+
+    if(rule == NULL)
+        return 1;
+
+    for(; rule != NULL; rule = next)
+    {
+        next = rule->next;
+
+        if(memfw_insert(rule))
+        {
+            log_msg(LOG_INFO, "Added %s rule for %s -> %s port %u, expires at %u",
+                memfw_type_str[rule->type], rule->src, rule->dst, rule->port,
+                (unsigned int)rule->expire);
+        }
+        else
+        {
+            log_msg(LOG_DEBUG, "memfw_commit() %s rule for %s -> %s port %u already exists",
+                memfw_type_str[rule->type], rule->src, rule->dst, rule->port);
+            free(rule);
+        }
+    }
+
+    memfw.commits++;
+
+    return 1;
+}
+
+static void
+memfw_expire(const fko_srv_options_t * const opts, const int chk_rm_all)
+{
+    memfw_rule_t   *rule;
+    time_t          now;
+
+    if(memfw.heap_len == 0)
+        return;
+
+    time(&now);
+
+    while(memfw.heap_len > 0 && memfw.heap[0]->expire <= now)
+    {
+        rule = memfw_heap_pop();
+        memfw_remove(rule);
+
+        log_msg(LOG_INFO, "Removed %s rule for %s -> %s port %u with expire time of %u",
+            memfw_type_str[rule->type], rule->src, rule->dst, rule->port,
+            (unsigned int)rule->expire);
+
+        free(rule);
+        memfw.expired++;
+    }
+}
+
+/* There is nothing outside of fwknopd that can change the table, so
+ * this just checks that the hash table and heap agree and logs the
+ * counters.
+*/
+static int
+memfw_resync(const fko_srv_options_t * const opts)
+{
+    memfw_rule_t   *rule;
+    unsigned int    i, count = 0;
+
+    for(i=0; i < memfw.num_buckets; i++)
+        for(rule = memfw.buckets[i]; rule != NULL; rule = rule->next)
+            count++;
+
+    if(count != memfw.heap_len)
+        log_msg(LOG_ERR, "memfw_resync() %u rules in the table but %u in the expire heap",
+                count, memfw.heap_len);
+
+    log_msg(LOG_INFO,
+        "In-memory firewall: %u active rule(s), %lu grant(s), %lu commit(s), %lu expired",
+        count, memfw.grants, memfw.commits, memfw.expired);
+
+    return count == memfw.heap_len;
+}
+
+static int
+memfw_dump(const fko_srv_options_t * const opts)
+{
+    memfw_rule_t   *rule;
+    unsigned int    i;
+
+    fprintf(stdout, "Listing in-memory firewall rules (%u active)...\n",
+            memfw.heap_len);
+
+    for(i=0; i < memfw.num_buckets; i++)
+        for(rule = memfw.buckets[i]; rule != NULL; rule = rule->next)
+            fprintf(stdout, "%-9s proto %u %s -> %s port %u nat %s:%u _exp_%u\n",
+                memfw_type_str[rule->type], rule->proto, rule->src, rule->dst,
+                rule->port, rule->nat_ip[0] != '\0' ? rule->nat_ip : "-",
+                rule->nat_port, (unsigned int)rule->expire);
+
+    fprintf(stdout, "grants: %lu, commits: %lu, expired: %lu\n",
+            memfw.grants, memfw.commits, memfw.expired);
+    fflush(stdout);
+
+    return 0;
+}
+
+/* The table goes away with this fwknopd, so on a hot restart it is
+ * handed to the new one as
+ *  <type> <proto> <port> <src> <dst> <nat_ip|-> <nat_port> <expire>
+ * lines.
+*/
+static int
+memfw_export_rules(const fko_srv_options_t * const opts, FILE *out)
+{
+    memfw_rule_t   *rule;
+    unsigned int    i;
+
+    for(i=0; i < memfw.heap_len; i++)
+    {
+        rule = memfw.heap[i];
+        fprintf(out, "fw %d %u %u %s %s %s %u %ld\n", rule->type,
+            rule->proto, rule->port, rule->src, rule->dst,
+            rule->nat_ip[0] != '\0' ? rule->nat_ip : "-", rule->nat_port,
+            (long)rule->expire);
+    }
+
+    return 1;
+}
+
+static int
+memfw_import_rule(const fko_srv_options_t * const opts,
+        const char * const line)
+{
+    memfw_rule_t   *rule;
+    long            expire;
+
+    if((rule = calloc(1, sizeof(*rule))) == NULL)
+    {
+        log_msg(LOG_ERR, "[*] Fatal memory allocation error in memfw_import_rule()");
+        return 0;
+    }
+
+    if(sscanf(line, "%d %u %u %15s %15s %15s %u %ld", &rule->type,
+            &rule->proto, &rule->port, rule->src, rule->dst, rule->nat_ip,
+            &rule->nat_port, &expire) != 8
+            || rule->type < MEMFW_ACCESS || rule->type > MEMFW_FORWARD
+            || expire <= 0)
+    {
+        log_msg(LOG_ERR, "[*] Bad in-memory firewall rule: %s", line);
+        free(rule);
+        return 0;
+    }
+
+    if(strcmp(rule->nat_ip, "-") == 0)
+        rule->nat_ip[0] = '\0';
+    rule->expire = (time_t)expire;
+
+    if(! memfw_insert(rule))
+        free(rule);
+
+    return 1;
+}
+
+const fw_backend_t fw_backend_memory = {
+    "memory",
+    memfw_config_init,
+    memfw_initialize,
+    memfw_cleanup,
+    memfw_grant,
+    memfw_commit,
+    memfw_expire,
+    memfw_resync,
+    memfw_dump,
+    memfw_export_rules,
+    memfw_import_rule
+};
+
+/***EOF***/
@@ -0,0 +1,45 @@
+/*
+ *****************************************************************************
+ *
+ * File:    fw_util_memory.h
+ *
+ * Purpose: Header file for fw_util_memory.c.
+ *
+ *  Fwknop is developed primarily by the people listed in the file 'AUTHORS'.
+ *  Copyright (C) 2009-2014 fwknop developers and contributors. For a full
+ *  list of contributors, see the file 'CREDITS'.
+ *
+ *  License (GNU General Public License):
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *  USA
+ *
+ *****************************************************************************
+*/
+#ifndef FW_UTIL_MEMORY_H
+#define FW_UTIL_MEMORY_H
+
+/* Initial number of hash buckets for the in-memory rule table (a power
+ * of two).  The table doubles whenever it holds more rules than buckets.
+*/
+#define MEMFW_INIT_BUCKETS      256
+
+#define MEMFW_ANY_IP            "0.0.0.0/0"
+
+extern const struct fw_backend fw_backend_memory;
+
+#endif /* FW_UTIL_MEMORY_H */
+
+/***EOF***/
@@ -54,8 +54,8 @@ zero_cmd_buffers(void)
 /* Print all firewall rules currently instantiated by the running fwknopd
  * daemon to stdout.
 */
-int
-fw_dump_rules(const fko_srv_options_t * const opts)
+static int
+pf_dump(const fko_srv_options_t * const opts)
 {
     int     res, got_err = 0, pid_status = 0;
 
@@ -139,8 +139,8 @@ delete_all_anchor_rules(const fko_srv_options_t *opts)
     return;
 }
 
-int
-fw_config_init(fko_srv_options_t * const opts)
+static int
+pf_config_init(fko_srv_options_t * const opts)
 {
     memset(&fwc, 0x0, sizeof(struct fw_config));
 
@@ -164,8 +164,8 @@ fw_config_init(fko_srv_options_t * const opts)
     return 1;
 }
 
-int
-fw_initialize(const fko_srv_options_t * const opts)
+static int
+pf_initialize(const fko_srv_options_t * const opts)
 {
 
     if (! anchor_active(opts))
@@ -175,15 +175,17 @@ fw_initialize(const fko_srv_options_t * const opts)
         return 0;
     }
 
-    /* Delete any existing rules in the fwknop anchor
+    /* Delete any existing rules in the fwknop anchor (unless we took
+     * them over in a hot restart)
     */
-    delete_all_anchor_rules(opts);
+    if(! opts->took_over)
+        delete_all_anchor_rules(opts);
 
     return 1;
 }
 
-int
-fw_cleanup(const fko_srv_options_t * const opts)
+static int
+pf_cleanup(const fko_srv_options_t * const opts)
 {
     delete_all_anchor_rules(opts);
     return(0);
@@ -193,8 +195,8 @@ fw_cleanup(const fko_srv_options_t * const opts)
 
 /* Rule Processing - Create an access request...
 */
-int
-process_spa_request(const fko_srv_options_t * const opts,
+static int
+pf_grant(const fko_srv_options_t * const opts,
         const acc_stanza_t * const acc, spa_data_t * const spadat)
 {
     char             new_rule[MAX_PF_NEW_RULE_LEN] = {0};
@@ -335,8 +337,8 @@ process_spa_request(const fko_srv_options_t * const opts,
 /* Iterate over the configure firewall access chains and purge expired
  * firewall rules.
 */
-void
-check_firewall_rules(const fko_srv_options_t * const opts,
+static void
+pf_expire(const fko_srv_options_t * const opts,
         const int chk_rm_all)
 {
     char            exp_str[12] = {0};
@@ -534,6 +536,20 @@ check_firewall_rules(const fko_srv_options_t * const opts,
     return;
 }
 
+const fw_backend_t fw_backend_pf = {
+    "pf",
+    pf_config_init,
+    pf_initialize,
+    pf_cleanup,
+    pf_grant,
+    NULL,
+    pf_expire,
+    NULL,
+    pf_dump,
+    NULL,
+    NULL
+};
+
 #endif /* FIREWALL_PF */
 
 /***EOF***/
@@ -53,6 +53,8 @@
 #define PF_DEL_ALL_ANCHOR_RULES       "-a %s -F all" SH_REDIR
 #define PF_ANY_IP                     "any"
 
+extern const struct fw_backend fw_backend_pf;
+
 #endif /* FW_UTIL_PF_H */
 
 /***EOF***/
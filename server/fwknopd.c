@@ -46,6 +46,8 @@
 #include "connection_tracker.h"
 #include "control_client.h"
 #include "service.h"
+#include "gpg_worker.h"
+#include "hot_restart.h"
 #include <pthread.h>
 
 #if USE_LIBPCAP
@@ -215,6 +217,13 @@ main(int argc, char **argv)
              * to pid file.
             */
             log_msg(LOG_DEBUG, "fwknopd main: I was NOT restarted, checking/setting PID.");
+
+            /* In hot restart mode, take over from the running fwknopd
+             * first - this returns after it has exited.
+            */
+            if(opts.hot_restart)
+                hot_restart_takeover(&opts);
+
             setup_pid(&opts);
         }
 
@@ -253,6 +262,16 @@ main(int argc, char **argv)
             clean_exit(&opts, NO_FW_CLEANUP, EXIT_SUCCESS);
         }
 
+        /* Let a future fwknopd take over from us with --hot-restart
+        */
+        if(!opts.afl_fuzzing)
+            hot_restart_listen(&opts);
+
+        /* Start the GPG worker threads if so configured.
+        */
+        if(! gpg_workers_start(&opts))
+            clean_exit(&opts, FW_CLEANUP, EXIT_FAILURE);
+
 #if AFL_FUZZING
         /* SPA data from STDIN. */
         if(opts.afl_fuzzing)
@@ -345,7 +364,9 @@ main(int argc, char **argv)
         kill(opts.tcp_server_pid, SIGKILL);
     }
 
-    clean_exit(&opts, FW_CLEANUP, EXIT_SUCCESS);
+    /* After a hot restart the firewall rules belong to the new fwknopd
+    */
+    clean_exit(&opts, opts.handed_off ? NO_FW_CLEANUP : FW_CLEANUP, EXIT_SUCCESS);
 
     return(EXIT_SUCCESS);  /* This never gets called */
 }
@@ -644,10 +665,16 @@ static int handle_signals(fko_srv_options_t *opts)
                     log_msg(LOG_WARNING, "Ctrl client thread joined.");
                     opts->ctrl_client_thread = 0;
                 }
+                flush_connection_reports(opts);
                 sdp_ctrl_client_disconnect(opts->ctrl_client);
                 sdp_ctrl_client_destroy(opts->ctrl_client);
                 opts->ctrl_client = NULL;
             }
+#if ! USE_FILE_CACHE
+            /* The digest cache is opened again with the new config
+            */
+            replay_cache_close(opts);
+#endif
             free_configs(opts);
             if(opts->tcp_server_pid > 0)
                 kill(opts->tcp_server_pid, SIGTERM);
@@ -687,7 +714,7 @@ static int handle_signals(fko_srv_options_t *opts)
             "Packet count limit (%d) reached. Exiting...",
             opts->packet_ctr_limit);
     }
-    else    /* got_signal was not set (should be if we are here) */
+    else if(! opts->handed_off) /* got_signal was not set (should be if we are here) */
     {
         log_msg(LOG_WARNING,
             "Capture ended without signal. Exiting...");
@@ -81,6 +81,7 @@
 /* More Conf defaults
 */
 #define DEF_PID_FILENAME                MY_NAME".pid"
+#define DEF_GRANT_JOURNAL_FILENAME      MY_NAME".grants"
 #if USE_FILE_CACHE
   #define DEF_DIGEST_CACHE_FILENAME       "digest.cache"
 #else
@@ -128,6 +129,11 @@
 #define DEF_DISABLE_SDP_CTRL_CLIENT     "N"
 #define DEF_DISABLE_CONNECTION_TRACKING "N"
 #define DEF_MAX_WAIT_ACC_DATA           "30"
+#define DEF_GPG_WORKERS                 "0"
+#define DEF_GPG_WORKER_QUEUE_MAX        "32"
+#define DEF_GPG_DECRYPT_TIMEOUT         "10" /* seconds */
+#define DEF_ENABLE_GRANT_JOURNAL        "N"
+#define DEF_FIREWALL_BACKEND            "native"
 
 
 #define DEF_FW_ACCESS_TIMEOUT           30
@@ -146,11 +152,16 @@
 #define RCHK_MIN_CMD_CYCLE_TIMER        1
 #define RCHK_MAX_RULES_CHECK_THRESHOLD  ((2 << 16) - 1)
 #define RCHK_MAX_WAIT_ACC_DATA          60
+#define RCHK_MAX_GPG_WORKERS            64
+#define RCHK_MAX_GPG_WORKER_QUEUE_MAX   4096
+#define RCHK_MAX_GPG_DECRYPT_TIMEOUT    300 /* seconds */
 
 #define MIN_ACC_STANZA_HASH_TABLE_LENGTH  10
 #define MAX_ACC_STANZA_HASH_TABLE_LENGTH  10000
 #define DEF_ACC_HASH_TABLE_LENGTH             100
 #define DEF_ACC_HASH_TABLE_LENGTH_STR         "100"
+#define DEF_ACC_STANZA_BUILD_THREADS      "0"
+#define RCHK_MAX_ACC_STANZA_BUILD_THREADS 64
 #define MIN_SERVICE_HASH_TABLE_LENGTH     10
 #define MAX_SERVICE_HASH_TABLE_LENGTH     10000
 #define DEF_SERVICE_HASH_TABLE_LENGTH_STR         "20"
@@ -167,6 +178,7 @@
   #define DEF_ENABLE_FIREWD_SNAT           "N"
   #define DEF_ENABLE_FIREWD_OUTPUT         "N"
   #define DEF_ENABLE_FIREWD_COMMENT_CHECK  "Y"
+  #define DEF_ENABLE_FIREWD_DBUS           "Y"
   #define DEF_FIREWD_INPUT_ACCESS          "ACCEPT, filter, INPUT, 1, FWKNOP_INPUT, 1"
   #define DEF_FIREWD_OUTPUT_ACCESS         "ACCEPT, filter, OUTPUT, 1, FWKNOP_OUTPUT, 1"
   #define DEF_FIREWD_FORWARD_ACCESS        "ACCEPT, filter, FORWARD, 1, FWKNOP_FORWARD, 1"
@@ -298,6 +310,7 @@ enum {
     CONF_FIREWD_SNAT_ACCESS,
     CONF_FIREWD_MASQUERADE_ACCESS,
     CONF_ENABLE_FIREWD_COMMENT_CHECK,
+    CONF_ENABLE_FIREWD_DBUS,
 #elif FIREWALL_IPTABLES
     CONF_ENABLE_IPT_FORWARDING,
     CONF_ENABLE_IPT_LOCAL_NAT,
@@ -332,6 +345,8 @@ enum {
     CONF_FWKNOP_CONF_DIR,
     CONF_ACCESS_FILE,
     CONF_FWKNOP_PID_FILE,
+    CONF_ENABLE_GRANT_JOURNAL,
+    CONF_GRANT_JOURNAL_FILE,
 #if USE_FILE_CACHE
     CONF_DIGEST_FILE,
 #else
@@ -339,7 +354,11 @@ enum {
 #endif
     CONF_GPG_HOME_DIR,
     CONF_GPG_EXE,
+    CONF_GPG_WORKERS,
+    CONF_GPG_WORKER_QUEUE_MAX,
+    CONF_GPG_DECRYPT_TIMEOUT,
     CONF_SUDO_EXE,
+    CONF_FIREWALL_BACKEND,
     CONF_FIREWALL_EXE,
     CONF_VERBOSE,
 #if AFL_FUZZING
@@ -349,6 +368,7 @@ enum {
     CONF_DISABLE_SDP_MODE,
     CONF_ALLOW_LEGACY_ACCESS_REQUESTS,
     CONF_ACC_STANZA_HASH_TABLE_LENGTH,
+    CONF_ACC_STANZA_BUILD_THREADS,
     CONF_SERVICE_HASH_TABLE_LENGTH,
     CONF_DISABLE_SDP_CTRL_CLIENT,
     CONF_DISABLE_CONNECTION_TRACKING,
@@ -452,6 +472,7 @@ typedef struct acc_stanza
     acc_string_list_t   *gpg_remote_id_list;
     char                *gpg_remote_fpr;
     acc_string_list_t   *gpg_remote_fpr_list;
+    struct gpg_handle_pool *gpg_pool;
     time_t               access_expire_time;
     int                  expired;
     int                  encryption_mode;
@@ -468,6 +489,18 @@ typedef struct acc_stanza
     char                *force_snat_ip;
     unsigned char        force_masquerade;
 
+    /* First stanza (legacy mode) sharing this stanza's Rijndael and HMAC
+     * keys, encryption mode and HMAC type
+    */
+    struct acc_stanza   *key_group;
+
+    /* Holders outside of acc_hash_tbl_mutex (SDP mode stanzas only), and
+     * whether the hash table has already let go of this stanza (see
+     * acc_stanza_hold())
+    */
+    unsigned int         refs;
+    unsigned char        orphaned;
+
     struct acc_stanza   *next;
 } acc_stanza_t;
 
@@ -643,6 +676,7 @@ typedef struct spa_pkt_info
     unsigned short  packet_dst_port;
     uint32_t        sdp_id;
     char            sdp_id_str[MAX_SDP_ID_STR_LEN];
+    int             replay_digest_added;
     unsigned char   packet_data[MAX_SPA_PACKET_LEN+1];
 } spa_pkt_info_t;
 
@@ -681,6 +715,7 @@ typedef struct fko_srv_options
     unsigned char   kill;               /* flag to initiate kill of fwknopd */
     unsigned char   rotate_digest_cache;/* flag to force rotation of digest */
     unsigned char   restart;            /* Restart fwknopd flag */
+    unsigned char   hot_restart;        /* Take over from a running fwknopd */
     unsigned char   status;             /* Get fwknopd status flag */
     unsigned char   fw_list;            /* List current firewall rules */
     unsigned char   fw_list_all;        /* List all current firewall rules */
@@ -720,10 +755,10 @@ typedef struct fko_srv_options
 
 #if USE_FILE_CACHE
     struct digest_cache_list *digest_cache;   /* In-memory digest cache list */
+#else
+    void           *digest_db;          /* Open digest cache dbm handle */
 #endif
 
-    spa_pkt_info_t  spa_pkt;            /* The current SPA packet */
-
     /* Counter set from the command line to exit after the specified
      * number of SPA packets are processed.
     */
@@ -748,9 +783,11 @@ typedef struct fko_srv_options
     sdp_ctrl_client_t ctrl_client;
     pthread_t ctrl_client_thread;
 
-    /* Firewall config info.
+    /* Firewall config info, and the backend (native or in-memory) that
+     * manages the rules (see fw_util.c).
     */
     struct fw_config *fw_config;
+    const struct fw_backend *fw_backend;
 
     /* Rule checking counter - this is for garbage cleanup mode to remove
      * any rules with an expired timer (even those that may have been
@@ -763,6 +800,15 @@ typedef struct fko_srv_options
     */
     cmd_cycle_list_t *cmd_cycle_list;
 
+    /* Worker threads for GPG SPA packets (NULL unless GPG_WORKERS is set)
+    */
+    struct gpg_worker_pool *gpg_workers;
+
+    /* Hot restart state (see hot_restart.c)
+    */
+    unsigned char   handed_off;         /* A new fwknopd has taken over */
+    unsigned char   took_over;          /* We took over from an old fwknopd */
+
     /* Set to 1 when messages have to go through syslog, 0 otherwise */
     unsigned char   syslog_enable;
 
@@ -2,6 +2,7 @@
 
 #include "fwknopd_common.h"
 #include "access.h"
+#include "connection_tracker.h"
 
 /**
  * Register test suites from FKO files.
@@ -12,6 +13,7 @@
 static void register_test_suites(void)
 {
     register_ts_access();
+    register_ts_connection_tracker();
 }
 
 /* The main() function for setting up and running the tests.
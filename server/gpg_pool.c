@@ -0,0 +1,181 @@
+/**
+ * @file    gpg_pool.c
+ *
+ * @brief   Per-stanza pools of preloaded GPG handles.  Each handle holds a
+ *          gpgme context already set up for the stanza's GPG_EXE and
+ *          GPG_HOME_DIR along with the resolved GPG_DECRYPT_ID key, so
+ *          that decrypting a GPG SPA packet does not have to repeat the
+ *          engine setup and keyring scan every time.
+ *
+ *
+ *  Fwknop is developed primarily by the people listed in the file 'AUTHORS'.
+ *  Copyright (C) 2009-2014 fwknop developers and contributors. For a full
+ *  list of contributors, see the file 'CREDITS'.
+ *
+ *  License (GNU General Public License):
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *  USA
+ *
+*/
+
+#include "fwknopd_common.h"
+#include "log_msg.h"
+#include "gpg_pool.h"
+
+static int
+new_pool_handle(acc_stanza_t *acc, fko_gpg_handle_t *gh)
+{
+    int res;
+
+    res = fko_gpg_handle_new(gh, acc->gpg_exe,
+            acc->gpg_home_dir, acc->gpg_decrypt_id);
+
+    if(res != FKO_SUCCESS && res != FKO_ERROR_UNSUPPORTED_FEATURE)
+        log_msg(LOG_WARNING,
+            "Unable to preload GPG handle for stanza source: '%s': %s",
+            acc->source, fko_errstr(res)
+        );
+
+    return res;
+}
+
+/* Set up the GPG handle pool for a stanza that accepts GPG SPA packets,
+ * and preload one handle so the first packet does not pay for it.  If
+ * that fails, the stanza is left without a pool and each packet is
+ * handled the old way (a fresh gpgme context per decrypt).
+*/
+void
+gpg_pool_init(acc_stanza_t *acc)
+{
+    gpg_handle_pool_t  *pool;
+    fko_gpg_handle_t    gh = NULL;
+
+    if(acc->gpg_pool != NULL)
+        return;
+
+    if(! acc->use_gpg
+            || (acc->gpg_decrypt_pw == NULL && ! acc->gpg_allow_no_pw))
+        return;
+
+    if(new_pool_handle(acc, &gh) != FKO_SUCCESS)
+        return;
+
+    pool = calloc(1, sizeof(gpg_handle_pool_t));
+    if(pool == NULL)
+    {
+        fko_gpg_handle_destroy(gh);
+        log_msg(LOG_ERR, "Memory allocation error for GPG handle pool");
+        return;
+    }
+
+    if(pthread_mutex_init(&(pool->mutex), NULL))
+    {
+        fko_gpg_handle_destroy(gh);
+        free(pool);
+        log_msg(LOG_ERR, "Failed to initialize GPG handle pool mutex");
+        return;
+    }
+
+    pool->handles[0] = gh;
+    pool->count      = 1;
+    acc->gpg_pool    = pool;
+
+    log_msg(LOG_DEBUG, "Preloaded GPG handle for stanza source: '%s'",
+            acc->source);
+    return;
+}
+
+/* Take an idle handle from the stanza pool, creating another one if all
+ * of them are busy and the pool is not full yet.  Returns NULL if no
+ * handle is available, in which case the caller should fall back to
+ * setting the GPG parameters on the FKO context directly.
+*/
+fko_gpg_handle_t
+gpg_pool_acquire(acc_stanza_t *acc, int *slot)
+{
+    gpg_handle_pool_t  *pool = acc->gpg_pool;
+    fko_gpg_handle_t    gh   = NULL;
+    int                 i;
+
+    *slot = -1;
+
+    if(pool == NULL)
+        return NULL;
+
+    pthread_mutex_lock(&(pool->mutex));
+
+    for(i=0; i < pool->count; i++)
+    {
+        if(! pool->in_use[i])
+        {
+            pool->in_use[i] = 1;
+            gh    = pool->handles[i];
+            *slot = i;
+            break;
+        }
+    }
+
+    if(gh == NULL && pool->count < GPG_HANDLE_POOL_MAX
+            && new_pool_handle(acc, &gh) == FKO_SUCCESS)
+    {
+        i = pool->count++;
+        pool->handles[i] = gh;
+        pool->in_use[i]  = 1;
+        *slot = i;
+    }
+
+    pthread_mutex_unlock(&(pool->mutex));
+
+    return gh;
+}
+
+/* Return a handle to the stanza pool
+*/
+void
+gpg_pool_release(acc_stanza_t *acc, const int slot)
+{
+    gpg_handle_pool_t  *pool = acc->gpg_pool;
+
+    if(pool == NULL || slot < 0 || slot >= GPG_HANDLE_POOL_MAX)
+        return;
+
+    pthread_mutex_lock(&(pool->mutex));
+    pool->in_use[slot] = 0;
+    pthread_mutex_unlock(&(pool->mutex));
+
+    return;
+}
+
+void
+gpg_pool_free(acc_stanza_t *acc)
+{
+    gpg_handle_pool_t  *pool = acc->gpg_pool;
+    int                 i;
+
+    if(pool == NULL)
+        return;
+
+    for(i=0; i < pool->count; i++)
+        fko_gpg_handle_destroy(pool->handles[i]);
+
+    pthread_mutex_destroy(&(pool->mutex));
+    free(pool);
+    acc->gpg_pool = NULL;
+
+    return;
+}
+
+/***EOF***/
@@ -0,0 +1,54 @@
+/**
+ *
+ * @file    gpg_pool.h
+ *
+ * @brief:  Per-stanza pools of preloaded GPG handles for fwknopd.
+ *
+ *  Fwknop is developed primarily by the people listed in the file 'AUTHORS'.
+ *  Copyright (C) 2009-2014 fwknop developers and contributors. For a full
+ *  list of contributors, see the file 'CREDITS'.
+ *
+ *  License (GNU General Public License):
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *  USA
+ *
+*/
+
+#ifndef GPG_POOL_H
+#define GPG_POOL_H
+
+/* Maximum number of GPG handles kept for a single access stanza
+*/
+#define GPG_HANDLE_POOL_MAX     4
+
+typedef struct gpg_handle_pool
+{
+    pthread_mutex_t     mutex;
+    int                 count;
+    unsigned char       in_use[GPG_HANDLE_POOL_MAX];
+    fko_gpg_handle_t    handles[GPG_HANDLE_POOL_MAX];
+} gpg_handle_pool_t;
+
+/* Prototypes
+*/
+void gpg_pool_init(acc_stanza_t *acc);
+fko_gpg_handle_t gpg_pool_acquire(acc_stanza_t *acc, int *slot);
+void gpg_pool_release(acc_stanza_t *acc, const int slot);
+void gpg_pool_free(acc_stanza_t *acc);
+
+#endif  /* GPG_POOL_H */
+
+/***EOF***/
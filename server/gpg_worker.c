@@ -0,0 +1,356 @@
+/**
+ * @file    gpg_worker.c
+ *
+ * @brief   A bounded pool of worker threads for GPG SPA packets.  GPG
+ *          decryption is orders of magnitude slower than Rijndael, so
+ *          when GPG_WORKERS is set, GPG packets are queued here instead
+ *          of being decrypted inline by the capture loop.  Finished jobs
+ *          are handed back to the capture loop (gpg_workers_rejoin()),
+ *          which runs the rest of the access checks, so the replay cache,
+ *          firewall and command execution code is still only ever run by
+ *          a single thread.
+ *
+ *          A job carries a deadline (GPG_DECRYPT_TIMEOUT).  Jobs that are
+ *          still queued when it passes are not decrypted at all, and
+ *          results that arrive after it are discarded.
+ *
+ *
+ *  Fwknop is developed primarily by the people listed in the file 'AUTHORS'.
+ *  Copyright (C) 2009-2014 fwknop developers and contributors. For a full
+ *  list of contributors, see the file 'CREDITS'.
+ *
+ *  License (GNU General Public License):
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *  USA
+ *
+*/
+
+#include "fwknopd_common.h"
+#include "log_msg.h"
+#include "utils.h"
+#include "incoming_spa.h"
+#include "service.h"
+#include "gpg_worker.h"
+#include "access.h"
+#include <fcntl.h>
+
+void
+free_gpg_job(gpg_job_t *job)
+{
+    if(job == NULL)
+        return;
+
+    if(job->ctx != NULL)
+    {
+        if(fko_destroy(job->ctx) == FKO_ERROR_ZERO_OUT_DATA)
+            log_msg(LOG_WARNING,
+                "[%s] fko_destroy() could not zero out sensitive data buffer.",
+                job->spadat.pkt_source_ip
+            );
+    }
+
+    if(job->raw_digest != NULL)
+        free(job->raw_digest);
+
+    if(job->spadat.service_data_list != NULL)
+        free_service_data_list(job->spadat.service_data_list);
+
+    if(! job->search_all)
+        acc_stanza_release(job->acc);
+
+    free(job);
+    return;
+}
+
+static void
+free_job_list(gpg_job_t *job)
+{
+    gpg_job_t *next;
+
+    while(job != NULL)
+    {
+        next = job->next;
+        free_gpg_job(job);
+        job = next;
+    }
+    return;
+}
+
+static void *
+gpg_worker_thread_func(void *arg)
+{
+    gpg_worker_pool_t  *pool = (gpg_worker_pool_t *)arg;
+    gpg_job_t          *job;
+    char                c = 0;
+
+    while(1)
+    {
+        pthread_mutex_lock(&(pool->mutex));
+
+        while(pool->pending_head == NULL && ! pool->stop)
+            pthread_cond_wait(&(pool->cond), &(pool->mutex));
+
+        if(pool->stop)
+        {
+            pthread_mutex_unlock(&(pool->mutex));
+            break;
+        }
+
+        job = pool->pending_head;
+        pool->pending_head = job->next;
+        if(pool->pending_head == NULL)
+            pool->pending_tail = NULL;
+        pool->pending_count--;
+
+        pthread_mutex_unlock(&(pool->mutex));
+
+        job->next = NULL;
+
+        if(time(NULL) > job->deadline)
+            job->expired = 1;
+        else
+            incoming_spa_gpg_decrypt(job);
+
+        pthread_mutex_lock(&(pool->mutex));
+        if(pool->done_tail == NULL)
+            pool->done_head = job;
+        else
+            pool->done_tail->next = job;
+        pool->done_tail = job;
+        pthread_mutex_unlock(&(pool->mutex));
+
+        if(write(pool->notify_fd[1], &c, 1) < 0 && errno != EAGAIN)
+            log_msg(LOG_WARNING, "gpg_worker: could not signal job completion: %s",
+                    strerror(errno));
+    }
+
+    return NULL;
+}
+
+static int
+set_nonblock(const int fd)
+{
+    int val;
+
+    if((val = fcntl(fd, F_GETFL, 0)) < 0)
+        return 0;
+
+    return fcntl(fd, F_SETFL, val | O_NONBLOCK) == 0;
+}
+
+/* Start the GPG worker threads if GPG_WORKERS is set.  Returns 1 on
+ * success (or if no workers are configured), and 0 on failure.
+*/
+int
+gpg_workers_start(fko_srv_options_t *opts)
+{
+    gpg_worker_pool_t  *pool;
+    int                 num_threads, queue_max, timeout, is_err, i;
+
+    num_threads = strtol_wrapper(opts->config[CONF_GPG_WORKERS],
+            0, RCHK_MAX_GPG_WORKERS, NO_EXIT_UPON_ERR, &is_err);
+    if(is_err != FKO_SUCCESS)
+    {
+        log_msg(LOG_ERR, "[*] invalid GPG_WORKERS value");
+        return 0;
+    }
+
+    if(num_threads == 0 || opts->gpg_workers != NULL)
+        return 1;
+
+    queue_max = strtol_wrapper(opts->config[CONF_GPG_WORKER_QUEUE_MAX],
+            1, RCHK_MAX_GPG_WORKER_QUEUE_MAX, NO_EXIT_UPON_ERR, &is_err);
+    if(is_err != FKO_SUCCESS)
+    {
+        log_msg(LOG_ERR, "[*] invalid GPG_WORKER_QUEUE_MAX value");
+        return 0;
+    }
+
+    timeout = strtol_wrapper(opts->config[CONF_GPG_DECRYPT_TIMEOUT],
+            1, RCHK_MAX_GPG_DECRYPT_TIMEOUT, NO_EXIT_UPON_ERR, &is_err);
+    if(is_err != FKO_SUCCESS)
+    {
+        log_msg(LOG_ERR, "[*] invalid GPG_DECRYPT_TIMEOUT value");
+        return 0;
+    }
+
+    if((pool = calloc(1, sizeof(gpg_worker_pool_t))) == NULL)
+    {
+        log_msg(LOG_ERR, "[*] Memory allocation error for GPG worker pool");
+        return 0;
+    }
+
+    if((pool->threads = calloc(num_threads, sizeof(pthread_t))) == NULL)
+    {
+        log_msg(LOG_ERR, "[*] Memory allocation error for GPG worker pool");
+        free(pool);
+        return 0;
+    }
+
+    if(pipe(pool->notify_fd) < 0)
+    {
+        log_msg(LOG_ERR, "[*] gpg_workers_start: pipe() failed: %s",
+                strerror(errno));
+        free(pool->threads);
+        free(pool);
+        return 0;
+    }
+    set_nonblock(pool->notify_fd[0]);
+    set_nonblock(pool->notify_fd[1]);
+
+    pthread_mutex_init(&(pool->mutex), NULL);
+    pthread_cond_init(&(pool->cond), NULL);
+    pool->queue_max       = queue_max;
+    pool->decrypt_timeout = timeout;
+
+    opts->gpg_workers = pool;
+
+    for(i=0; i < num_threads; i++)
+    {
+        if(pthread_create(&(pool->threads[i]), NULL,
+                    gpg_worker_thread_func, (void *)pool))
+        {
+            log_msg(LOG_ERR, "[*] Failed to start GPG worker thread");
+            gpg_workers_stop(opts);
+            return 0;
+        }
+        pool->num_threads++;
+    }
+
+    log_msg(LOG_INFO,
+        "Started %d GPG worker thread(s), queue limit %d, timeout %d seconds",
+        num_threads, queue_max, timeout);
+    return 1;
+}
+
+/* Stop the worker threads and throw away any outstanding jobs.  This has
+ * to happen before the access stanzas are freed.
+*/
+void
+gpg_workers_stop(fko_srv_options_t *opts)
+{
+    gpg_worker_pool_t  *pool = opts->gpg_workers;
+    int                 i;
+
+    if(pool == NULL)
+        return;
+
+    pthread_mutex_lock(&(pool->mutex));
+    pool->stop = 1;
+    pthread_cond_broadcast(&(pool->cond));
+    pthread_mutex_unlock(&(pool->mutex));
+
+    for(i=0; i < pool->num_threads; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    free_job_list(pool->pending_head);
+    free_job_list(pool->done_head);
+
+    close(pool->notify_fd[0]);
+    close(pool->notify_fd[1]);
+
+    pthread_cond_destroy(&(pool->cond));
+    pthread_mutex_destroy(&(pool->mutex));
+
+    free(pool->threads);
+    free(pool);
+    opts->gpg_workers = NULL;
+    return;
+}
+
+/* Queue a job for the worker threads.  Returns 0 (and leaves the job to
+ * the caller) if the queue is full.
+*/
+int
+gpg_workers_submit(fko_srv_options_t *opts, gpg_job_t *job)
+{
+    gpg_worker_pool_t  *pool = opts->gpg_workers;
+
+    pthread_mutex_lock(&(pool->mutex));
+
+    if(pool->pending_count >= pool->queue_max)
+    {
+        pthread_mutex_unlock(&(pool->mutex));
+        return 0;
+    }
+
+    job->next     = NULL;
+    job->deadline = time(NULL) + pool->decrypt_timeout;
+    if(pool->pending_tail == NULL)
+        pool->pending_head = job;
+    else
+        pool->pending_tail->next = job;
+    pool->pending_tail = job;
+    pool->pending_count++;
+
+    pthread_cond_signal(&(pool->cond));
+    pthread_mutex_unlock(&(pool->mutex));
+
+    return 1;
+}
+
+/* Descriptor that becomes readable when there are finished jobs, or -1
+ * if the worker pool is not running.
+*/
+int
+gpg_workers_notify_fd(fko_srv_options_t *opts)
+{
+    if(opts->gpg_workers == NULL)
+        return -1;
+    return opts->gpg_workers->notify_fd[0];
+}
+
+/* Called from the capture loop to finish processing any GPG packets that
+ * the workers are done with.
+*/
+void
+gpg_workers_rejoin(fko_srv_options_t *opts)
+{
+    gpg_worker_pool_t  *pool = opts->gpg_workers;
+    gpg_job_t          *job, *next;
+    char                buf[64];
+
+    if(pool == NULL)
+        return;
+
+    while(read(pool->notify_fd[0], buf, sizeof(buf)) > 0)
+        ;
+
+    pthread_mutex_lock(&(pool->mutex));
+    job = pool->done_head;
+    pool->done_head = pool->done_tail = NULL;
+    pthread_mutex_unlock(&(pool->mutex));
+
+    while(job != NULL)
+    {
+        next = job->next;
+        job->next = NULL;
+
+        if(job->expired || time(NULL) > job->deadline)
+            log_msg(LOG_WARNING,
+                "[%s] GPG SPA packet exceeded GPG_DECRYPT_TIMEOUT, ignoring",
+                job->spadat.pkt_source_ip
+            );
+        else
+            incoming_spa_gpg_finish(opts, job);
+
+        free_gpg_job(job);
+        job = next;
+    }
+    return;
+}
+
+/***EOF***/
@@ -0,0 +1,97 @@
+/**
+ *
+ * @file    gpg_worker.h
+ *
+ * @brief:  Worker threads for decrypting GPG SPA packets off of the
+ *          packet capture path.
+ *
+ *
+ *  Fwknop is developed primarily by the people listed in the file 'AUTHORS'.
+ *  Copyright (C) 2009-2014 fwknop developers and contributors. For a full
+ *  list of contributors, see the file 'CREDITS'.
+ *
+ *  License (GNU General Public License):
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *  USA
+ *
+*/
+
+#ifndef GPG_WORKER_H
+#define GPG_WORKER_H
+
+/* A GPG SPA packet handed to the worker pool.  Everything up to and
+ * including the decrypt is done by a worker thread, and the job is then
+ * handed back to the capture loop for the remaining access checks.
+*/
+typedef struct gpg_job
+{
+    struct gpg_job     *next;
+
+    spa_pkt_info_t      spa_pkt;
+    spa_data_t          spadat;
+    char               *raw_digest;
+    int                 conf_pkt_age;
+    time_t              deadline;
+
+    /* The stanza to try, and whether to go on down the list of legacy
+     * access stanzas from there if it does not match.
+    */
+    acc_stanza_t       *acc;
+    int                 search_all;
+
+    /* Set by the worker thread
+    */
+    fko_ctx_t           ctx;
+    acc_stanza_t       *match_acc;
+    int                 stanza_num;
+    int                 expired;
+} gpg_job_t;
+
+typedef struct gpg_worker_pool
+{
+    pthread_mutex_t     mutex;
+    pthread_cond_t      cond;
+    pthread_t          *threads;
+    int                 num_threads;
+    int                 stop;
+
+    gpg_job_t          *pending_head;
+    gpg_job_t          *pending_tail;
+    int                 pending_count;
+    int                 queue_max;
+    int                 decrypt_timeout;
+
+    gpg_job_t          *done_head;
+    gpg_job_t          *done_tail;
+
+    /* Written to whenever a job is done so that select() based loops
+     * wake up right away.
+    */
+    int                 notify_fd[2];
+} gpg_worker_pool_t;
+
+/* Prototypes
+*/
+int gpg_workers_start(fko_srv_options_t *opts);
+void gpg_workers_stop(fko_srv_options_t *opts);
+int gpg_workers_submit(fko_srv_options_t *opts, gpg_job_t *job);
+int gpg_workers_notify_fd(fko_srv_options_t *opts);
+void gpg_workers_rejoin(fko_srv_options_t *opts);
+void free_gpg_job(gpg_job_t *job);
+
+#endif  /* GPG_WORKER_H */
+
+/***EOF***/
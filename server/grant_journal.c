@@ -0,0 +1,270 @@
+/**
+ * @file    grant_journal.c
+ *
+ * @brief   When ENABLE_GRANT_JOURNAL is set, every rule that fwknopd adds
+ *          to one of its chains is also appended to GRANT_JOURNAL_FILE as
+ *          a single line:
+ *
+ *              <expire> <chain type> <proto> <src ip> <dst ip> <port>
+ *
+ *          If fwknopd is restarted without flushing its chains (see
+ *          FLUSH_IPT_AT_INIT and --hot-restart), the journal is read back
+ *          in fw_initialize() to restore the number of active rules and
+ *          the next expire time of each chain.  Without it, fwknopd does
+ *          not know about these rules until the next garbage collection
+ *          pass (RULES_CHECK_THRESHOLD) lists every chain.
+ *
+ *          Expired entries are dropped whenever the journal is read back
+ *          in, when all of the rules are gone, and when the journal grows
+ *          well beyond the number of active rules.
+ *
+ *
+ *  Fwknop is developed primarily by the people listed in the file 'AUTHORS'.
+ *  Copyright (C) 2009-2014 fwknop developers and contributors. For a full
+ *  list of contributors, see the file 'CREDITS'.
+ *
+ *  License (GNU General Public License):
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *  USA
+ *
+*/
+
+#include "fwknopd_common.h"
+#include "log_msg.h"
+#include "utils.h"
+#include "grant_journal.h"
+#include <fcntl.h>
+
+static FILE *journal_fp      = NULL;
+static int   journal_entries = 0;
+
+static int
+journal_enabled(const fko_srv_options_t * const opts)
+{
+    return opts->config[CONF_ENABLE_GRANT_JOURNAL] != NULL
+        && strncasecmp(opts->config[CONF_ENABLE_GRANT_JOURNAL], "Y", 1) == 0;
+}
+
+static int
+journal_open(const fko_srv_options_t * const opts, const char * const mode)
+{
+    int fd;
+
+    grant_journal_close();
+
+    if((journal_fp = fopen(opts->config[CONF_GRANT_JOURNAL_FILE], mode)) == NULL)
+    {
+        log_msg(LOG_ERR, "[*] Could not open grant journal %s: %s",
+            opts->config[CONF_GRANT_JOURNAL_FILE], strerror(errno));
+        return 0;
+    }
+
+    if((fd = fileno(journal_fp)) >= 0)
+    {
+        fchmod(fd, S_IRUSR|S_IWUSR);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+
+    return 1;
+}
+
+/* Parse a journal line, returns 1 if it is well formed
+*/
+static int
+parse_entry(const char * const line, time_t *expire, int *chain_type)
+{
+    long    exp;
+    int     type;
+
+    if(sscanf(line, "%ld %d", &exp, &type) != 2 || exp <= 0 || type < 0)
+        return 0;
+
+    *expire     = (time_t)exp;
+    *chain_type = type;
+    return 1;
+}
+
+/* Rewrite the journal with only the entries that have not yet expired.
+ * The chain counters are updated via the (optional) chains array.
+*/
+static int
+compact_journal(const fko_srv_options_t * const opts,
+        int * const active_rules, time_t * const next_expire, const int num_chains)
+{
+    char        tmp_file[MAX_PATH_LEN] = {0};
+    char        line[MAX_LINE_LEN]     = {0};
+    FILE       *in, *out;
+    time_t      now, expire;
+    int         chain_type, kept = 0;
+
+    grant_journal_close();
+
+    if((in = fopen(opts->config[CONF_GRANT_JOURNAL_FILE], "r")) == NULL)
+    {
+        journal_entries = 0;
+        return journal_open(opts, "a") ? 0 : -1;
+    }
+
+    snprintf(tmp_file, sizeof(tmp_file), "%s.tmp",
+        opts->config[CONF_GRANT_JOURNAL_FILE]);
+
+    if((out = fopen(tmp_file, "w")) == NULL)
+    {
+        log_msg(LOG_ERR, "[*] Could not open %s: %s", tmp_file, strerror(errno));
+        fclose(in);
+        return -1;
+    }
+    fchmod(fileno(out), S_IRUSR|S_IWUSR);
+
+    time(&now);
+
+    while(fgets(line, sizeof(line), in) != NULL)
+    {
+        if(! parse_entry(line, &expire, &chain_type) || expire <= now)
+            continue;
+
+        if(active_rules != NULL)
+        {
+            if(chain_type >= num_chains)
+                continue;
+
+            active_rules[chain_type]++;
+            if(next_expire[chain_type] == 0 || expire < next_expire[chain_type])
+                next_expire[chain_type] = expire;
+        }
+
+        fputs(line, out);
+        kept++;
+    }
+
+    fclose(in);
+
+    if(fclose(out) != 0 || rename(tmp_file, opts->config[CONF_GRANT_JOURNAL_FILE]) != 0)
+    {
+        log_msg(LOG_ERR, "[*] Could not rewrite grant journal %s: %s",
+            opts->config[CONF_GRANT_JOURNAL_FILE], strerror(errno));
+        unlink(tmp_file);
+        return -1;
+    }
+
+    journal_entries = kept;
+
+    if(! journal_open(opts, "a"))
+        return -1;
+
+    return kept;
+}
+
+void
+grant_journal_add(const fko_srv_options_t * const opts,
+        const int chain_type, const time_t expire, const unsigned int proto,
+        const char * const srcip, const char * const dstip,
+        const unsigned int port)
+{
+    if(! journal_enabled(opts))
+        return;
+
+    if(journal_fp == NULL && ! journal_open(opts, "a"))
+        return;
+
+    fprintf(journal_fp, "%ld %d %u %s %s %u\n", (long)expire, chain_type,
+        proto, srcip, dstip == NULL ? "-" : dstip, port);
+    fflush(journal_fp);
+
+    journal_entries++;
+    return;
+}
+
+/* Called after expired rules have been removed, with the total number
+ * of rules that are still active.
+*/
+void
+grant_journal_expire(const fko_srv_options_t * const opts,
+        const int active_rules)
+{
+    if(! journal_enabled(opts) || journal_entries == 0)
+        return;
+
+    if(active_rules == 0)
+        grant_journal_clear(opts);
+    else if(journal_entries > GRANT_JOURNAL_COMPACT_MIN
+            && journal_entries > 2 * active_rules)
+        compact_journal(opts, NULL, NULL, 0);
+
+    return;
+}
+
+/* The fwknop chains have been flushed
+*/
+void
+grant_journal_clear(const fko_srv_options_t * const opts)
+{
+    if(! journal_enabled(opts))
+        return;
+
+    journal_open(opts, "w");
+    journal_entries = 0;
+    return;
+}
+
+void
+grant_journal_close(void)
+{
+    if(journal_fp != NULL)
+    {
+        fclose(journal_fp);
+        journal_fp = NULL;
+    }
+    return;
+}
+
+#if FIREWALL_FIREWALLD || FIREWALL_IPTABLES
+/* Restore the active rule count and next expire time of each chain from
+ * the journal.  Returns the number of rules restored.
+*/
+int
+grant_journal_restore(const fko_srv_options_t * const opts,
+        struct fw_chain * const chains)
+{
+    int         active_rules[NUM_FWKNOP_ACCESS_TYPES] = {0};
+    time_t      next_expire[NUM_FWKNOP_ACCESS_TYPES]  = {0};
+    int         i, res;
+
+    if(! journal_enabled(opts))
+        return 0;
+
+    res = compact_journal(opts, active_rules, next_expire,
+            NUM_FWKNOP_ACCESS_TYPES);
+
+    for(i=0; i < NUM_FWKNOP_ACCESS_TYPES; i++)
+    {
+        if(active_rules[i] == 0 || chains[i].to_chain[0] == '\0')
+            continue;
+
+        chains[i].active_rules += active_rules[i];
+        if(chains[i].next_expire == 0 || next_expire[i] < chains[i].next_expire)
+            chains[i].next_expire = next_expire[i];
+    }
+
+    if(res > 0)
+        log_msg(LOG_INFO, "Restored %d active rule(s) from grant journal %s",
+            res, opts->config[CONF_GRANT_JOURNAL_FILE]);
+
+    return res < 0 ? 0 : res;
+}
+#endif
+
+/***EOF***/
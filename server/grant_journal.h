@@ -0,0 +1,58 @@
+/**
+ *
+ * @file    grant_journal.h
+ *
+ * @brief:  On-disk journal of the firewall rules (grants) that fwknopd has
+ *          created, so that a restarted fwknopd can pick them up again.
+ *
+ *
+ *  Fwknop is developed primarily by the people listed in the file 'AUTHORS'.
+ *  Copyright (C) 2009-2014 fwknop developers and contributors. For a full
+ *  list of contributors, see the file 'CREDITS'.
+ *
+ *  License (GNU General Public License):
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *  USA
+ *
+*/
+
+#ifndef GRANT_JOURNAL_H
+#define GRANT_JOURNAL_H
+
+/* The journal is rewritten without the expired entries once it holds
+ * more than this many entries and less than half of them are active.
+*/
+#define GRANT_JOURNAL_COMPACT_MIN   1024
+
+/* Function Prototypes
+*/
+void grant_journal_add(const fko_srv_options_t * const opts,
+        const int chain_type, const time_t expire, const unsigned int proto,
+        const char * const srcip, const char * const dstip,
+        const unsigned int port);
+void grant_journal_expire(const fko_srv_options_t * const opts,
+        const int active_rules);
+void grant_journal_clear(const fko_srv_options_t * const opts);
+void grant_journal_close(void);
+
+#if FIREWALL_FIREWALLD || FIREWALL_IPTABLES
+int grant_journal_restore(const fko_srv_options_t * const opts,
+        struct fw_chain * const chains);
+#endif
+
+#endif  /* GRANT_JOURNAL_H */
+
+/***EOF***/
@@ -0,0 +1,507 @@
+/**
+ * @file    hot_restart.c
+ *
+ * @brief   Zero-downtime restarts.  A running fwknopd listens on a Unix
+ *          socket in its run directory.  A new fwknopd started with
+ *          --hot-restart connects to it, receives the UDP server socket
+ *          (via SCM_RIGHTS) along with a snapshot of the pending
+ *          CMD_CYCLE_CLOSE commands and the known SDP connections, and
+ *          then waits for the old process to exit before it takes over
+ *          the PID file.  The old process exits without touching the
+ *          firewall, and the new one starts without flushing it, so the
+ *          active grants (whose expiry times live in the rules themselves)
+ *          are carried over as well.  The digest cache is already on disk
+ *          and is simply reloaded.
+ *
+ *          The snapshot is a simple line based format:
+ *
+ *              cmd_cycle <expire> <stanza_num> <src_ip> <close command>
+ *              conn <sdp_id> <service_id> <proto> <src_ip> <src_port> ...
+ *              end
+ *
+ *
+ *  Fwknop is developed primarily by the people listed in the file 'AUTHORS'.
+ *  Copyright (C) 2009-2014 fwknop developers and contributors. For a full
+ *  list of contributors, see the file 'CREDITS'.
+ *
+ *  License (GNU General Public License):
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *  USA
+ *
+*/
+
+#include "fwknopd_common.h"
+#include "fwknopd_errors.h"
+#include "log_msg.h"
+#include "utils.h"
+#include "cmd_cycle.h"
+#include "connection_tracker.h"
+#include "control_client.h"
+#include "fw_util.h"
+#include "hot_restart.h"
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define HOT_RESTART_HELLO   'U'     /* A UDP server socket is attached */
+#define HOT_RESTART_NO_SOCK 'N'     /* No socket (pcap mode) */
+
+static int  listen_sock  = -1;
+static int  handoff_conn = -1;
+static int  handoff_udp_sock = -1;
+static char sock_path[MAX_PATH_LEN] = {0};
+
+static int
+set_sock_path(const fko_srv_options_t *opts, struct sockaddr_un *saddr)
+{
+    memset(saddr, 0x0, sizeof(*saddr));
+    saddr->sun_family = AF_UNIX;
+
+    if(snprintf(sock_path, sizeof(sock_path), "%s/%s",
+            opts->config[CONF_FWKNOP_RUN_DIR], HOT_RESTART_SOCK_NAME)
+            >= (int)sizeof(saddr->sun_path))
+    {
+        log_msg(LOG_ERR, "[*] Hot restart socket path is too long: %s",
+            sock_path);
+        sock_path[0] = '\0';
+        return 0;
+    }
+
+    strlcpy(saddr->sun_path, sock_path, sizeof(saddr->sun_path));
+    return 1;
+}
+
+static void
+set_sock_timeout(const int sock)
+{
+    struct timeval tv;
+
+    tv.tv_sec  = HOT_RESTART_TIMEOUT;
+    tv.tv_usec = 0;
+
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+/* Send a one byte hello along with the UDP server socket (if any)
+*/
+static int
+send_udp_sock(const int conn, const int udp_sock)
+{
+    struct msghdr   msg;
+    struct iovec    iov;
+    struct cmsghdr *cmsg;
+    char            hello = HOT_RESTART_NO_SOCK;
+    union {
+        struct cmsghdr  align;
+        char            buf[CMSG_SPACE(sizeof(int))];
+    } cbuf;
+
+    memset(&msg, 0x0, sizeof(msg));
+    memset(&cbuf, 0x0, sizeof(cbuf));
+
+    iov.iov_base   = &hello;
+    iov.iov_len    = 1;
+    msg.msg_iov    = &iov;
+    msg.msg_iovlen = 1;
+
+    if(udp_sock >= 0)
+    {
+        hello = HOT_RESTART_HELLO;
+        msg.msg_control    = cbuf.buf;
+        msg.msg_controllen = sizeof(cbuf.buf);
+
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type  = SCM_RIGHTS;
+        cmsg->cmsg_len   = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &udp_sock, sizeof(int));
+    }
+
+    return sendmsg(conn, &msg, 0) == 1;
+}
+
+static int
+recv_udp_sock(const int conn, int *udp_sock)
+{
+    struct msghdr   msg;
+    struct iovec    iov;
+    struct cmsghdr *cmsg;
+    char            hello = 0;
+    union {
+        struct cmsghdr  align;
+        char            buf[CMSG_SPACE(sizeof(int))];
+    } cbuf;
+
+    *udp_sock = -1;
+
+    memset(&msg, 0x0, sizeof(msg));
+    memset(&cbuf, 0x0, sizeof(cbuf));
+
+    iov.iov_base       = &hello;
+    iov.iov_len        = 1;
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = cbuf.buf;
+    msg.msg_controllen = sizeof(cbuf.buf);
+
+    if(recvmsg(conn, &msg, 0) != 1)
+        return 0;
+
+    if(hello == HOT_RESTART_HELLO)
+    {
+        cmsg = CMSG_FIRSTHDR(&msg);
+        if(cmsg == NULL
+                || cmsg->cmsg_level != SOL_SOCKET
+                || cmsg->cmsg_type != SCM_RIGHTS
+                || cmsg->cmsg_len != CMSG_LEN(sizeof(int)))
+            return 0;
+
+        memcpy(udp_sock, CMSG_DATA(cmsg), sizeof(int));
+    }
+    else if(hello != HOT_RESTART_NO_SOCK)
+        return 0;
+
+    return 1;
+}
+
+/* Write the pending CMD_CYCLE_CLOSE commands, known connections and (for
+ * the in-memory firewall) the firewall rules
+*/
+static int
+send_snapshot(fko_srv_options_t *opts, const int conn)
+{
+    cmd_cycle_list_t   *clist;
+    FILE               *out;
+    int                 fd, res = 1;
+
+    if((fd = dup(conn)) < 0 || (out = fdopen(fd, "w")) == NULL)
+    {
+        if(fd >= 0)
+            close(fd);
+        return 0;
+    }
+
+    for(clist = opts->cmd_cycle_list; clist != NULL; clist = clist->next)
+        fprintf(out, "cmd_cycle %ld %d %s %s\n", (long)clist->expire,
+            clist->stanza_num, clist->src_ip, clist->close_cmd);
+
+    if(export_known_connections(out) != FWKNOPD_SUCCESS)
+        res = 0;
+
+    if(! fw_export_rules(opts, out))
+        res = 0;
+
+    fprintf(out, "end\n");
+
+    if(fclose(out) != 0)
+        res = 0;
+
+    return res;
+}
+
+static int
+recv_snapshot(fko_srv_options_t *opts, const int conn)
+{
+    char        line[MAX_LINE_LEN] = {0};
+    char        src_ip[MAX_IPV4_STR_LEN] = {0};
+    char       *ndx;
+    FILE       *in;
+    long        expire;
+    int         fd, stanza_num, pos, res = 0;
+    int         cmd_cnt = 0, conn_cnt = 0, fw_cnt = 0;
+
+    if((fd = dup(conn)) < 0 || (in = fdopen(fd, "r")) == NULL)
+    {
+        if(fd >= 0)
+            close(fd);
+        return 0;
+    }
+
+    while(fgets(line, sizeof(line), in) != NULL)
+    {
+        if((ndx = strchr(line, '\n')) != NULL)
+            *ndx = '\0';
+
+        if(strcmp(line, "end") == 0)
+        {
+            res = 1;
+            break;
+        }
+        else if(strncmp(line, "cmd_cycle ", 10) == 0)
+        {
+            pos = 0;
+            if(sscanf(line+10, "%ld %d %15s %n", &expire, &stanza_num,
+                    src_ip, &pos) != 3 || pos == 0)
+            {
+                log_msg(LOG_ERR, "[*] Bad hot restart cmd cycle line: %s", line);
+                break;
+            }
+            cmd_cycle_restore(opts, src_ip, line+10+pos,
+                    (time_t)expire, stanza_num);
+            cmd_cnt++;
+        }
+        else if(strncmp(line, "conn ", 5) == 0)
+        {
+            if(import_known_connection(line+5) != FWKNOPD_SUCCESS)
+                break;
+            conn_cnt++;
+        }
+        else if(strncmp(line, "fw ", 3) == 0)
+        {
+            if(! fw_import_rule(opts, line+3))
+                break;
+            fw_cnt++;
+        }
+        else
+        {
+            log_msg(LOG_ERR, "[*] Unknown hot restart line: %s", line);
+            break;
+        }
+    }
+
+    fclose(in);
+
+    if(res)
+        log_msg(LOG_INFO,
+            "Hot restart: restored %d pending CMD_CYCLE_CLOSE command(s), %d known connection(s) and %d firewall rule(s).",
+            cmd_cnt, conn_cnt, fw_cnt);
+
+    return res;
+}
+
+/* Create the hot restart socket.  This is called once we hold the PID
+ * file lock, so any existing socket file is stale.
+*/
+int
+hot_restart_listen(fko_srv_options_t *opts)
+{
+    struct sockaddr_un  saddr;
+    int                 sfd_flags;
+
+    if(listen_sock >= 0)
+        return 1;
+
+    if(! set_sock_path(opts, &saddr))
+        return 0;
+
+    if((listen_sock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+    {
+        log_msg(LOG_ERR, "[*] hot_restart_listen: socket() failed: %s",
+            strerror(errno));
+        return 0;
+    }
+
+    /* Don't leak the socket into CMD_EXEC and friends, and don't ever
+     * block the capture loop in accept().
+    */
+    fcntl(listen_sock, F_SETFD, FD_CLOEXEC);
+    if((sfd_flags = fcntl(listen_sock, F_GETFL, 0)) >= 0)
+        fcntl(listen_sock, F_SETFL, sfd_flags | O_NONBLOCK);
+
+    unlink(sock_path);
+
+    if(bind(listen_sock, (struct sockaddr *)&saddr, sizeof(saddr)) < 0
+            || chmod(sock_path, S_IRUSR|S_IWUSR) < 0
+            || listen(listen_sock, 1) < 0)
+    {
+        log_msg(LOG_ERR, "[*] hot_restart_listen: unable to listen on %s: %s",
+            sock_path, strerror(errno));
+        close(listen_sock);
+        listen_sock = -1;
+        return 0;
+    }
+
+    log_msg(LOG_DEBUG, "Listening for hot restarts on %s", sock_path);
+    return 1;
+}
+
+/* Called from the SPA capture loops.  Returns 1 if a new fwknopd has
+ * taken over, in which case the caller should stop and fwknopd should
+ * exit without any firewall cleanup.
+*/
+int
+hot_restart_check(fko_srv_options_t *opts, const int udp_sock)
+{
+    char    reply[4] = {0};
+    int     conn;
+
+    if(listen_sock < 0 || opts->handed_off)
+        return opts->handed_off;
+
+    if((conn = accept(listen_sock, NULL, NULL)) < 0)
+        return 0;
+
+    fcntl(conn, F_SETFD, FD_CLOEXEC);
+    set_sock_timeout(conn);
+
+    log_msg(LOG_INFO, "Hot restart requested, handing over to the new fwknopd.");
+
+    if(! send_udp_sock(conn, udp_sock))
+    {
+        log_msg(LOG_ERR, "[*] Hot restart: unable to send the UDP server socket: %s",
+            strerror(errno));
+        close(conn);
+        return 0;
+    }
+
+    /* The SDP control client thread updates the known connections, so
+     * it is stopped before they are written out.  The new fwknopd opens
+     * its own controller connection.
+    */
+    if(opts->ctrl_client_thread > 0)
+    {
+        pthread_cancel(opts->ctrl_client_thread);
+        pthread_join(opts->ctrl_client_thread, NULL);
+        opts->ctrl_client_thread = 0;
+    }
+
+    if(send_snapshot(opts, conn)
+            && read(conn, reply, sizeof(reply)-1) == 3
+            && strcmp(reply, "ok\n") == 0)
+    {
+        /* Keep the connection open, the new fwknopd waits for it to be
+         * closed by our exit (see hot_restart_close()).
+        */
+        handoff_conn = conn;
+        opts->handed_off = 1;
+        log_msg(LOG_INFO, "Hot restart: new fwknopd has taken over, exiting.");
+        return 1;
+    }
+
+    log_msg(LOG_ERR, "[*] Hot restart: the new fwknopd did not take over, carrying on.");
+    close(conn);
+
+    /* Start the control client back up.  Connection tracking starts
+     * over from the current conntrack state.
+    */
+    if(opts->ctrl_client != NULL
+            && strncasecmp(opts->config[CONF_DISABLE_SDP_CTRL_CLIENT], "N", 1) == 0)
+    {
+        destroy_connection_tracker(opts);
+        if(pthread_create(&(opts->ctrl_client_thread), NULL,
+                control_client_thread_func, (void*)opts))
+        {
+            log_msg(LOG_ERR, "Failed to restart SDP Control Client Thread. Aborting.");
+            clean_exit(opts, FW_CLEANUP, EXIT_FAILURE);
+        }
+    }
+
+    return 0;
+}
+
+/* Take over from the currently running fwknopd.  This is called before
+ * the PID file is set up and returns once the old process has exited.
+*/
+int
+hot_restart_takeover(fko_srv_options_t *opts)
+{
+    struct sockaddr_un  saddr;
+    char                buf[16];
+    int                 conn, udp_sock = -1;
+
+    if(! set_sock_path(opts, &saddr))
+        clean_exit(opts, NO_FW_CLEANUP, EXIT_FAILURE);
+
+    if((conn = socket(AF_UNIX, SOCK_STREAM, 0)) < 0
+            || connect(conn, (struct sockaddr *)&saddr, sizeof(saddr)) < 0)
+    {
+        log_msg(LOG_ERR, "[*] Hot restart: unable to connect to %s: %s",
+            sock_path, strerror(errno));
+        clean_exit(opts, NO_FW_CLEANUP, EXIT_FAILURE);
+    }
+
+    /* The old fwknopd only looks for us between packets, so allow for
+     * that (and for its own GPG decryption timeouts) when waiting.
+    */
+    set_sock_timeout(conn);
+
+    if(! recv_udp_sock(conn, &udp_sock) || ! recv_snapshot(opts, conn))
+    {
+        log_msg(LOG_ERR, "[*] Hot restart: failed to receive state from the running fwknopd.");
+        if(udp_sock >= 0)
+            close(udp_sock);
+        close(conn);
+        clean_exit(opts, NO_FW_CLEANUP, EXIT_FAILURE);
+    }
+
+    if(write(conn, "ok\n", 3) != 3)
+    {
+        log_msg(LOG_ERR, "[*] Hot restart: unable to confirm the hand-off: %s",
+            strerror(errno));
+        clean_exit(opts, NO_FW_CLEANUP, EXIT_FAILURE);
+    }
+
+    /* Wait for the old process to go away (and release the PID file)
+    */
+    while(read(conn, buf, sizeof(buf)) > 0)
+        ;
+    close(conn);
+
+    handoff_udp_sock = udp_sock;
+    opts->took_over  = 1;
+
+    /* The firewall rules granted by the old fwknopd stay in place (see
+     * fw_initialize()) and are expired by us from here on.
+    */
+
+    log_msg(LOG_INFO, "Hot restart: took over from the previous fwknopd.");
+    return 1;
+}
+
+/* Hand the UDP server socket received from the old fwknopd to
+ * run_udp_server() (only once), or -1 if there isn't one.
+*/
+int
+hot_restart_udp_sock(void)
+{
+    int sock = handoff_udp_sock;
+
+    handoff_udp_sock = -1;
+    return sock;
+}
+
+void
+hot_restart_close(fko_srv_options_t *opts)
+{
+    if(listen_sock >= 0)
+    {
+        close(listen_sock);
+        listen_sock = -1;
+        if(sock_path[0] != '\0')
+            unlink(sock_path);
+    }
+
+    if(handoff_udp_sock >= 0)
+    {
+        close(handoff_udp_sock);
+        handoff_udp_sock = -1;
+    }
+
+    /* Release the PID file lock before the new fwknopd sees us go away
+    */
+    if(handoff_conn >= 0)
+    {
+        if(opts->lock_fd > 0)
+            close(opts->lock_fd);
+        close(handoff_conn);
+        handoff_conn = -1;
+    }
+
+    return;
+}
+
+/***EOF***/
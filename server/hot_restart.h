@@ -0,0 +1,53 @@
+/**
+ *
+ * @file    hot_restart.h
+ *
+ * @brief:  Hand the SPA sockets and run-time state of a running fwknopd
+ *          over to a newly started one.
+ *
+ *
+ *  Fwknop is developed primarily by the people listed in the file 'AUTHORS'.
+ *  Copyright (C) 2009-2014 fwknop developers and contributors. For a full
+ *  list of contributors, see the file 'CREDITS'.
+ *
+ *  License (GNU General Public License):
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation; either version 2
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *  USA
+ *
+*/
+
+#ifndef HOT_RESTART_H
+#define HOT_RESTART_H
+
+/* Name of the hot restart Unix socket in the fwknopd run directory
+*/
+#define HOT_RESTART_SOCK_NAME   "fwknopd.sock"
+
+/* How long either side waits on the other during a hand-off (seconds)
+*/
+#define HOT_RESTART_TIMEOUT     10
+
+/* Function Prototypes
+*/
+int hot_restart_listen(fko_srv_options_t *opts);
+int hot_restart_check(fko_srv_options_t *opts, const int udp_sock);
+int hot_restart_takeover(fko_srv_options_t *opts);
+int hot_restart_udp_sock(void);
+void hot_restart_close(fko_srv_options_t *opts);
+
+#endif  /* HOT_RESTART_H */
+
+/***EOF***/
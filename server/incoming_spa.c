@@ -40,6 +40,8 @@
 #include "access.h"
 #include "extcmd.h"
 #include "cmd_cycle.h"
+#include "gpg_pool.h"
+#include "gpg_worker.h"
 #include "log_msg.h"
 #include "utils.h"
 #include "fw_util.h"
@@ -51,6 +53,32 @@
 #define KEEP_SEARCHING 1
 #define STOP_SEARCHING 0
 
+/* The firewall and command cycle code keeps its own state, so requests
+ * are granted one at a time.
+*/
+static pthread_mutex_t grant_access_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Legacy mode remembers this many Rijndael decrypt results per SPA packet
+*/
+#define DECRYPT_MEMO_MAX            16
+
+/* Result of decrypting the current packet with the keys of one access
+ * stanza key group (see group_acc_stanza_keys()).  The memo owns the
+ * contexts it holds until they are released to the caller.
+*/
+typedef struct decrypt_memo_ent
+{
+    acc_stanza_t   *key_group;
+    fko_ctx_t       ctx;
+    int             res;
+} decrypt_memo_ent_t;
+
+typedef struct decrypt_memo
+{
+    decrypt_memo_ent_t  ents[DECRYPT_MEMO_MAX];
+    int                 count;
+} decrypt_memo_t;
+
 /* Validate and in some cases preprocess/reformat the SPA data.  Return an
  * error code value if there is any indication the data is not valid spa data.
 */
@@ -391,7 +419,8 @@ src_check(fko_srv_options_t *opts, spa_pkt_info_t *spa_pkt, spa_data_t *spadat)
     return 0;
 }
 
-/* Look for the SDP Client ID in the hash table
+/* Look for the SDP Client ID in the hash table.  The stanza found is
+ * held (see acc_stanza_hold()), and must be released by the caller.
  */
 static int
 sdp_id_check(fko_srv_options_t *opts, spa_pkt_info_t *spa_pkt, acc_stanza_t **acc)
@@ -421,6 +450,8 @@ sdp_id_check(fko_srv_options_t *opts, spa_pkt_info_t *spa_pkt, acc_stanza_t **ac
     }
 
     *acc = hash_table_get(opts->acc_stanza_hash_tbl, sdp_id);
+    if(*acc)
+        acc_stanza_hold(*acc);
     pthread_mutex_unlock(&(opts->acc_hash_tbl_mutex));
 
     bdestroy(sdp_id);
@@ -448,7 +479,7 @@ replay_check(fko_srv_options_t *opts, spa_pkt_info_t *spa_pkt, char **raw_digest
         if (*raw_digest == NULL)
             return 0;
 
-        if (is_replay(opts, *raw_digest) != SPA_MSG_SUCCESS)
+        if (is_replay(opts, spa_pkt, *raw_digest) != SPA_MSG_SUCCESS)
         {
             return 0;
         }
@@ -625,17 +656,79 @@ check_mode_ctx(spa_data_t *spadat, fko_ctx_t *ctx, int attempted_decrypt,
     return 1;
 }
 
+/* Find the memo entry for the key group of acc.  A new entry (with a NULL
+ * key_group) is returned if these keys have not been tried yet, or NULL
+ * if the result cannot be remembered.
+*/
+static decrypt_memo_ent_t *
+decrypt_memo_get(decrypt_memo_t *memo, acc_stanza_t *acc)
+{
+    int i;
+
+    if(memo == NULL || acc->key_group == NULL)
+        return NULL;
+
+    for(i=0; i < memo->count; i++)
+        if(memo->ents[i].key_group == acc->key_group)
+            return &(memo->ents[i]);
+
+    if(memo->count == DECRYPT_MEMO_MAX)
+        return NULL;
+
+    memset(&(memo->ents[memo->count]), 0x0, sizeof(decrypt_memo_ent_t));
+    return &(memo->ents[memo->count++]);
+}
+
+/* Return the memo entry holding ctx, if any
+*/
+static decrypt_memo_ent_t *
+decrypt_memo_holder(decrypt_memo_t *memo, fko_ctx_t ctx)
+{
+    int i;
+
+    if(ctx == NULL)
+        return NULL;
+
+    for(i=0; i < memo->count; i++)
+        if(memo->ents[i].ctx == ctx)
+            return &(memo->ents[i]);
+
+    return NULL;
+}
+
 static void
 handle_rijndael_enc(acc_stanza_t *acc, spa_pkt_info_t *spa_pkt,
-        spa_data_t *spadat, fko_ctx_t *ctx, int *attempted_decrypt,
-        int *cmd_exec_success, const int enc_type, const int stanza_num,
-        int *res)
+        spa_data_t *spadat, fko_ctx_t *ctx, decrypt_memo_t *memo,
+        int *attempted_decrypt, int *cmd_exec_success, const int enc_type,
+        const int stanza_num, int *res)
 {
+    decrypt_memo_ent_t *ent;
+
     if(enc_type == FKO_ENCRYPTION_RIJNDAEL || acc->enable_cmd_exec)
     {
-        *res = fko_new_with_data(ctx, (char *)spa_pkt->packet_data,
-            acc->key, acc->key_len, acc->encryption_mode, acc->hmac_key,
-            acc->hmac_key_len, acc->hmac_type, spa_pkt->sdp_id);
+        ent = decrypt_memo_get(memo, acc);
+        if(ent != NULL && ent->key_group != NULL)
+        {
+            /* An earlier stanza with the same keys already did the work
+            */
+            log_msg(LOG_DEBUG,
+                "[%s] (stanza #%d) Reusing the decrypt result of an earlier stanza with the same keys",
+                spadat->pkt_source_ip, stanza_num);
+            *ctx = ent->ctx;
+            *res = ent->res;
+        }
+        else
+        {
+            *res = fko_new_with_data(ctx, (char *)spa_pkt->packet_data,
+                acc->key, acc->key_len, acc->encryption_mode, acc->hmac_key,
+                acc->hmac_key_len, acc->hmac_type, spa_pkt->sdp_id);
+            if(ent != NULL)
+            {
+                ent->key_group = acc->key_group;
+                ent->ctx = *ctx;
+                ent->res = *res;
+            }
+        }
         *attempted_decrypt = 1;
         if(*res == FKO_SUCCESS)
             *cmd_exec_success = 1;
@@ -643,12 +736,58 @@ handle_rijndael_enc(acc_stanza_t *acc, spa_pkt_info_t *spa_pkt,
     return;
 }
 
+/* Set the GPG parameters of an acc stanza on the FKO context directly
+ * (used when no preloaded GPG handle is available for the stanza).
+*/
+static int
+set_gpg_params(acc_stanza_t *acc, spa_data_t *spadat, fko_ctx_t *ctx,
+        const int stanza_num, int *res)
+{
+    /* Set whatever GPG parameters we have.
+    */
+    if(acc->gpg_exe != NULL)
+    {
+        *res = fko_set_gpg_exe(*ctx, acc->gpg_exe);
+        if(*res != FKO_SUCCESS)
+        {
+            log_msg(LOG_WARNING,
+                "[%s] (stanza #%d) Error setting GPG path %s: %s",
+                spadat->pkt_source_ip, stanza_num, acc->gpg_exe,
+                fko_errstr(*res)
+            );
+            return 0;
+        }
+    }
+
+    if(acc->gpg_home_dir != NULL)
+    {
+        *res = fko_set_gpg_home_dir(*ctx, acc->gpg_home_dir);
+        if(*res != FKO_SUCCESS)
+        {
+            log_msg(LOG_WARNING,
+                "[%s] (stanza #%d) Error setting GPG keyring path to %s: %s",
+                spadat->pkt_source_ip, stanza_num, acc->gpg_home_dir,
+                fko_errstr(*res)
+            );
+            return 0;
+        }
+    }
+
+    if(acc->gpg_decrypt_id != NULL)
+        fko_set_gpg_recipient(*ctx, acc->gpg_decrypt_id);
+
+    return 1;
+}
+
 static int
 handle_gpg_enc(acc_stanza_t *acc, spa_pkt_info_t *spa_pkt,
         spa_data_t *spadat, fko_ctx_t *ctx, int *attempted_decrypt,
         const int cmd_exec_success, const int enc_type,
         const int stanza_num, int *res)
 {
+    fko_gpg_handle_t    gh = NULL;
+    int                 gpg_slot = -1;
+
     if(acc->use_gpg && enc_type == FKO_ENCRYPTION_GPG && cmd_exec_success == 0)
     {
         /* For GPG we create the new context without decrypting on the fly
@@ -669,38 +808,25 @@ handle_gpg_enc(acc_stanza_t *acc, spa_pkt_info_t *spa_pkt,
                 return 0;
             }
 
-            /* Set whatever GPG parameters we have.
+            /* Use a preloaded GPG handle from the stanza pool if we can,
+             * otherwise set whatever GPG parameters we have.
             */
-            if(acc->gpg_exe != NULL)
+            gh = gpg_pool_acquire(acc, &gpg_slot);
+            if(gh != NULL)
             {
-                *res = fko_set_gpg_exe(*ctx, acc->gpg_exe);
+                *res = fko_set_gpg_handle(*ctx, gh);
                 if(*res != FKO_SUCCESS)
                 {
                     log_msg(LOG_WARNING,
-                        "[%s] (stanza #%d) Error setting GPG path %s: %s",
-                        spadat->pkt_source_ip, stanza_num, acc->gpg_exe,
-                        fko_errstr(*res)
+                        "[%s] (stanza #%d) Error setting GPG handle: %s",
+                        spadat->pkt_source_ip, stanza_num, fko_errstr(*res)
                     );
+                    gpg_pool_release(acc, gpg_slot);
                     return 0;
                 }
             }
-
-            if(acc->gpg_home_dir != NULL)
-            {
-                *res = fko_set_gpg_home_dir(*ctx, acc->gpg_home_dir);
-                if(*res != FKO_SUCCESS)
-                {
-                    log_msg(LOG_WARNING,
-                        "[%s] (stanza #%d) Error setting GPG keyring path to %s: %s",
-                        spadat->pkt_source_ip, stanza_num, acc->gpg_home_dir,
-                        fko_errstr(*res)
-                    );
-                    return 0;
-                }
-            }
-
-            if(acc->gpg_decrypt_id != NULL)
-                fko_set_gpg_recipient(*ctx, acc->gpg_decrypt_id);
+            else if(! set_gpg_params(acc, spadat, ctx, stanza_num, res))
+                return 0;
 
             /* If GPG_REQUIRE_SIG is set for this acc stanza, then set
              * the FKO context accordingly and check the other GPG Sig-
@@ -725,6 +851,15 @@ handle_gpg_enc(acc_stanza_t *acc, spa_pkt_info_t *spa_pkt,
             */
             *res = fko_decrypt_spa_data(*ctx, acc->gpg_decrypt_pw, 0);
             *attempted_decrypt = 1;
+
+            /* The signature data has been copied into the FKO context by
+             * now, so the handle can go back to the pool right away.
+            */
+            if(gh != NULL)
+            {
+                fko_set_gpg_handle(*ctx, NULL);
+                gpg_pool_release(acc, gpg_slot);
+            }
         }
     }
     return 1;
@@ -915,22 +1050,26 @@ check_nat_access_types(fko_srv_options_t *opts, acc_stanza_t *acc,
 }
 
 static int
-add_replay_cache(fko_srv_options_t *opts, acc_stanza_t *acc,
-        spa_data_t *spadat, char *raw_digest, int *added_replay_digest,
-        const int stanza_num, int *res)
+add_replay_cache(fko_srv_options_t *opts, spa_pkt_info_t *spa_pkt,
+        spa_data_t *spadat, char *raw_digest, const int stanza_num, int *res)
 {
-    if (!opts->test && *added_replay_digest == 0
+    if (!opts->test && spa_pkt->replay_digest_added == 0
             && strncasecmp(opts->config[CONF_ENABLE_DIGEST_PERSISTENCE], "Y", 1) == 0)
     {
 
-        *res = add_replay(opts, raw_digest);
+        /* The precheck lookup is not enough on its own, another copy
+         * of this packet may have been added since.
+        */
+        *res = add_replay(opts, spa_pkt, raw_digest);
+        if (*res == SPA_MSG_REPLAY)
+            return 0;
         if (*res != SPA_MSG_SUCCESS)
         {
             log_msg(LOG_WARNING, "[%s] (stanza #%d) Could not add digest to replay cache",
                 spadat->pkt_source_ip, stanza_num);
             return 0;
         }
-        *added_replay_digest = 1;
+        spa_pkt->replay_digest_added = 1;
     }
 
     return 1;
@@ -997,26 +1136,40 @@ check_port_proto(acc_stanza_t *acc, spa_data_t *spadat, const int stanza_num)
     return 1;
 }
 
-/* Handle grant request
- */
+static void
+destroy_spa_ctx(fko_ctx_t *ctx, spa_data_t *spadat, const int stanza_num)
+{
+    if(*ctx != NULL)
+    {
+        if(fko_destroy(*ctx) == FKO_ERROR_ZERO_OUT_DATA)
+            log_msg(LOG_WARNING,
+                "[%s] (stanza #%d) fko_destroy() could not zero out sensitive data buffer.",
+                spadat->pkt_source_ip, stanza_num
+            );
+        *ctx = NULL;
+    }
+    return;
+}
+
+/* Decrypt the SPA packet with the key(s) of an access stanza.  This is
+ * the expensive part of processing a GPG packet, and since it does not
+ * touch any shared server state it is also run from the GPG worker
+ * threads.  Returns 1 if the packet was decrypted.
+*/
 static int
-process_spa_data(fko_srv_options_t *opts, fko_ctx_t *ctx, acc_stanza_t *acc, spa_pkt_info_t *spa_pkt, spa_data_t *spadat,
-                    int stanza_num, char *raw_digest, int conf_pkt_age)
+decrypt_spa_data(fko_ctx_t *ctx, acc_stanza_t *acc, spa_pkt_info_t *spa_pkt,
+        spa_data_t *spadat, decrypt_memo_t *memo, const int stanza_num)
 {
     int res                 = FKO_SUCCESS;
-    int added_replay_digest = 0;
     int cmd_exec_success    = 0;
     int attempted_decrypt   = 0;
     int enc_type            = 0;
-    char *spa_ip_demark     = NULL;
-    char dump_buf[CTX_DUMP_BUFSIZE];
-    short msg_type          = 0;
 
     /* Check for a match for the SPA source and destination IP and the access stanza
     */
     if(! src_dst_check(acc, spa_pkt, spadat, stanza_num))
     {
-        return KEEP_SEARCHING;
+        return 0;
     }
 
     log_msg(LOG_INFO,
@@ -1029,7 +1182,7 @@ process_spa_data(fko_srv_options_t *opts, fko_ctx_t *ctx, acc_stanza_t *acc, spa
     */
     if(! check_stanza_expiration(acc, spadat, stanza_num))
     {
-        return KEEP_SEARCHING;
+        return 0;
     }
 
     /* Get encryption type and try its decoding routine first (if the key
@@ -1038,28 +1191,46 @@ process_spa_data(fko_srv_options_t *opts, fko_ctx_t *ctx, acc_stanza_t *acc, spa
     enc_type = fko_encryption_type((char *)spa_pkt->packet_data);
 
     if(acc->use_rijndael)
-        handle_rijndael_enc(acc, spa_pkt, spadat, ctx,
+        handle_rijndael_enc(acc, spa_pkt, spadat, ctx, memo,
                     &attempted_decrypt, &cmd_exec_success, enc_type,
                     stanza_num, &res);
 
     if(! handle_gpg_enc(acc, spa_pkt, spadat, ctx, &attempted_decrypt,
                 cmd_exec_success, enc_type, stanza_num, &res))
     {
-        return KEEP_SEARCHING;
+        return 0;
     }
 
     if(! check_mode_ctx(spadat, ctx, attempted_decrypt,
                 enc_type, stanza_num, res))
     {
-        return KEEP_SEARCHING;
+        return 0;
     }
 
+    return 1;
+}
+
+/* Run the access checks on a decrypted SPA packet and grant the request
+*/
+static int
+check_spa_data(fko_srv_options_t *opts, fko_ctx_t *ctx, acc_stanza_t *acc,
+        spa_pkt_info_t *spa_pkt, spa_data_t *spadat, int stanza_num,
+        char *raw_digest, int conf_pkt_age)
+{
+    int res                 = FKO_SUCCESS;
+    int enc_type            = 0;
+    char *spa_ip_demark     = NULL;
+    char dump_buf[CTX_DUMP_BUFSIZE];
+    short msg_type          = 0;
+
+    enc_type = fko_encryption_type((char *)spa_pkt->packet_data);
+
     /* Add this SPA packet into the replay detection cache
     */
-    if(! add_replay_cache(opts, acc, spadat, raw_digest,
-                &added_replay_digest, stanza_num, &res))
+    if(! add_replay_cache(opts, spa_pkt, spadat, raw_digest,
+                stanza_num, &res))
     {
-        return KEEP_SEARCHING;
+        return res == SPA_MSG_REPLAY ? STOP_SEARCHING : KEEP_SEARCHING;
     }
 
     /* At this point the SPA data is authenticated via the HMAC (if used
@@ -1253,29 +1424,232 @@ process_spa_data(fko_srv_options_t *opts, fko_ctx_t *ctx, acc_stanza_t *acc, spa
     }
     else
     {
+        pthread_mutex_lock(&grant_access_mutex);
         if(acc->cmd_cycle_open != NULL)
         {
-            if(cmd_cycle_open(opts, acc, spadat, stanza_num, &res))
-                return STOP_SEARCHING; /* successfully processed a matching access stanza */
-            else
+            if(! cmd_cycle_open(opts, acc, spadat, stanza_num, &res))
             {
+                pthread_mutex_unlock(&grant_access_mutex);
                 return KEEP_SEARCHING;
             }
+            /* successfully processed a matching access stanza */
         }
         else
         {
             process_spa_request(opts, acc, spadat);
         }
+        pthread_mutex_unlock(&grant_access_mutex);
     }
 
     return STOP_SEARCHING;
 }
 
+/* Handle grant request
+ */
+static int
+process_spa_data(fko_srv_options_t *opts, fko_ctx_t *ctx, acc_stanza_t *acc, spa_pkt_info_t *spa_pkt, spa_data_t *spadat,
+                    decrypt_memo_t *memo, int stanza_num, char *raw_digest, int conf_pkt_age)
+{
+    if(! decrypt_spa_data(ctx, acc, spa_pkt, spadat, memo, stanza_num))
+        return KEEP_SEARCHING;
+
+    return check_spa_data(opts, ctx, acc, spa_pkt, spadat, stanza_num,
+            raw_digest, conf_pkt_age);
+}
 
-/* Process the SPA packet data
+/* Loop through the legacy access stanzas (starting with acc) looking for
+ * a match.  Stanzas with the same keys share one decrypt of the packet.
+*/
+static void
+search_acc_stanzas(fko_srv_options_t *opts, fko_ctx_t *ctx, acc_stanza_t *acc,
+        int stanza_num, spa_pkt_info_t *spa_pkt, spa_data_t *spadat,
+        char *raw_digest, int conf_pkt_age)
+{
+    decrypt_memo_t      memo;
+    decrypt_memo_ent_t *ent;
+    int                 i;
+
+    memo.count = 0;
+
+    while(acc)
+    {
+        stanza_num++;
+
+        if( process_spa_data(opts, ctx, acc, spa_pkt, spadat, &memo,
+                stanza_num, raw_digest, conf_pkt_age) == KEEP_SEARCHING )
+        {
+            /* A context held by the memo is kept for later stanzas
+            */
+            if(decrypt_memo_holder(&memo, *ctx) != NULL)
+                *ctx = NULL;
+            else
+                destroy_spa_ctx(ctx, spadat, stanza_num);
+            acc = acc->next;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    /* The caller owns the context of the matching stanza
+    */
+    if((ent = decrypt_memo_holder(&memo, *ctx)) != NULL)
+        ent->ctx = NULL;
+
+    for(i=0; i < memo.count; i++)
+        destroy_spa_ctx(&(memo.ents[i].ctx), spadat, stanza_num);
+
+    return;
+}
+
+/* Hand a GPG SPA packet off to the GPG worker threads.  The raw digest
+ * goes with it.
+*/
+static void
+queue_gpg_job(fko_srv_options_t *opts, spa_pkt_info_t *spa_pkt,
+        spa_data_t *spadat, acc_stanza_t *acc, char **raw_digest,
+        const int conf_pkt_age)
+{
+    gpg_job_t *job;
+
+    if((job = calloc(1, sizeof(gpg_job_t))) == NULL)
+    {
+        log_msg(LOG_ERR, "[%s] Memory allocation error for GPG job",
+                spadat->pkt_source_ip);
+        return;
+    }
+
+    memcpy(&(job->spa_pkt), spa_pkt, sizeof(spa_pkt_info_t));
+    memcpy(&(job->spadat), spadat, sizeof(spa_data_t));
+    job->raw_digest   = *raw_digest;
+    job->conf_pkt_age = conf_pkt_age;
+    *raw_digest = NULL;
+
+    if(acc == NULL)
+    {
+        job->acc        = opts->acc_stanzas;
+        job->search_all = 1;
+    }
+    else
+    {
+        /* The job keeps the stanza alive until it is freed, even if the
+         * controller removes it in the meantime
+        */
+        job->acc = acc;
+        acc_stanza_hold(acc);
+    }
+
+    if(! gpg_workers_submit(opts, job))
+    {
+        log_msg(LOG_WARNING,
+            "[%s] GPG worker queue is full, dropping GPG SPA packet",
+            spadat->pkt_source_ip);
+        free_gpg_job(job);
+        return;
+    }
+
+    log_msg(LOG_DEBUG, "[%s] GPG SPA packet queued for the GPG workers",
+            spadat->pkt_source_ip);
+    return;
+}
+
+/* Called by a GPG worker thread: find the first access stanza that
+ * decrypts the packet.
 */
 void
-incoming_spa(fko_srv_options_t *opts)
+incoming_spa_gpg_decrypt(gpg_job_t *job)
+{
+    acc_stanza_t   *acc = job->acc;
+    int             stanza_num = 0;
+
+    while(acc)
+    {
+        if(job->search_all)
+            stanza_num++;
+
+        if(time(NULL) > job->deadline)
+        {
+            job->expired = 1;
+            return;
+        }
+
+        if(decrypt_spa_data(&(job->ctx), acc, &(job->spa_pkt),
+                    &(job->spadat), NULL, stanza_num))
+        {
+            job->match_acc  = acc;
+            job->stanza_num = stanza_num;
+            return;
+        }
+
+        destroy_spa_ctx(&(job->ctx), &(job->spadat), stanza_num);
+
+        acc = job->search_all ? acc->next : NULL;
+    }
+    return;
+}
+
+/* Called by the capture loop with a job the GPG workers are done with:
+ * run the remaining access checks on the decrypted packet.
+*/
+void
+incoming_spa_gpg_finish(fko_srv_options_t *opts, gpg_job_t *job)
+{
+    acc_stanza_t   *acc = NULL;
+    spa_pkt_info_t *spa_pkt = &(job->spa_pkt);
+
+    if(job->match_acc == NULL)
+        return;
+
+    /* Another copy of this packet may have been accepted while this one
+     * was waiting on the workers.
+    */
+    if(job->raw_digest != NULL
+            && is_replay(opts, spa_pkt, job->raw_digest) != SPA_MSG_SUCCESS)
+        return;
+
+    if(! job->search_all)
+    {
+        /* Make sure the access data for this SDP ID was not replaced
+         * in the meantime.
+        */
+        if(! sdp_id_check(opts, spa_pkt, &acc) || acc != job->match_acc)
+        {
+            log_msg(LOG_WARNING,
+                "[%s] Access data for SDP ID %"PRIu32" changed during GPG decryption, ignoring SPA packet",
+                job->spadat.pkt_source_ip, spa_pkt->sdp_id);
+            acc_stanza_release(acc);
+            return;
+        }
+        acc_stanza_release(acc);
+
+        check_spa_data(opts, &(job->ctx), job->match_acc, spa_pkt,
+                &(job->spadat), job->stanza_num, job->raw_digest,
+                job->conf_pkt_age);
+        return;
+    }
+
+    if(check_spa_data(opts, &(job->ctx), job->match_acc, spa_pkt,
+                &(job->spadat), job->stanza_num, job->raw_digest,
+                job->conf_pkt_age) == KEEP_SEARCHING)
+    {
+        destroy_spa_ctx(&(job->ctx), &(job->spadat), job->stanza_num);
+        search_acc_stanzas(opts, &(job->ctx), job->match_acc->next,
+                job->stanza_num, spa_pkt, &(job->spadat), job->raw_digest,
+                job->conf_pkt_age);
+    }
+    return;
+}
+
+/* Process one SPA packet.  Everything that belongs to the packet is
+ * reached through spa_pkt or lives on the stack of this call, and the
+ * shared server state is only touched through the access stanza, replay
+ * cache and firewall interfaces, so this may be called for different
+ * packets at the same time.  add_replay() checks and inserts the digest
+ * under one lock, so of two copies of the same packet only one is granted.
+*/
+void
+incoming_spa_pkt(fko_srv_options_t *opts, spa_pkt_info_t *spa_pkt)
 {
     /* Always a good idea to initialize ctx to null if it will be used
      * repeatedly (especially when using fko_new_with_data()).
@@ -1287,16 +1661,15 @@ incoming_spa(fko_srv_options_t *opts)
     int             is_err;
     int             conf_pkt_age = 0;
 
-    spa_pkt_info_t *spa_pkt = &(opts->spa_pkt);
-
     /* This will hold our pertinent SPA data.
     */
     spa_data_t spadat;
 
     acc_stanza_t        *acc = NULL;
 
-    log_msg(LOG_DEBUG, "incoming_spa() : just arrived, stay tuned");
+    log_msg(LOG_DEBUG, "incoming_spa_pkt() : just arrived, stay tuned");
 
+    spa_pkt->replay_digest_added = 0;
     spadat.service_data_list = NULL;
 
     inet_ntop(AF_INET, &(spa_pkt->packet_src_ip),
@@ -1337,6 +1710,16 @@ incoming_spa(fko_srv_options_t *opts)
         }
     }
 
+    /* GPG packets are handed off to the GPG worker threads (if there are
+     * any) so that slow public key operations do not hold up the rest.
+    */
+    if(opts->gpg_workers != NULL
+            && fko_encryption_type((char *)spa_pkt->packet_data) == FKO_ENCRYPTION_GPG)
+    {
+        queue_gpg_job(opts, spa_pkt, &spadat, acc, &raw_digest, conf_pkt_age);
+        goto cleanup;
+    }
+
     /* Now that we know there is a matching access.conf stanza and the
      * incoming SPA packet is not a replay, see if we should grant any
      * access
@@ -1344,52 +1727,23 @@ incoming_spa(fko_srv_options_t *opts)
 
     if(strncasecmp(opts->config[CONF_DISABLE_SDP_MODE], "Y", 1) == 0)
     {
-        acc = opts->acc_stanzas;
         /* Loop through all access stanzas looking for a match
         */
-        while(acc)
-        {
-            stanza_num++;
-
-            if( process_spa_data(opts, &ctx, acc, spa_pkt, &spadat, stanza_num,
-                    raw_digest, conf_pkt_age) == KEEP_SEARCHING )
-            {
-                if(ctx != NULL)
-                {
-                    if(fko_destroy(ctx) == FKO_ERROR_ZERO_OUT_DATA)
-                        log_msg(LOG_WARNING,
-                            "[%s] (stanza #%d) fko_destroy() could not zero out sensitive data buffer.",
-                            spadat.pkt_source_ip, stanza_num
-                        );
-                    ctx = NULL;
-                }
-
-                acc = acc->next;
-            }
-            else
-            {
-                break;
-            }
-        }
+        search_acc_stanzas(opts, &ctx, opts->acc_stanzas, stanza_num,
+                spa_pkt, &spadat, raw_digest, conf_pkt_age);
     }
     else
     {
-        process_spa_data(opts, &ctx, acc, spa_pkt, &spadat, stanza_num, raw_digest, conf_pkt_age);
+        process_spa_data(opts, &ctx, acc, spa_pkt, &spadat, NULL, stanza_num, raw_digest, conf_pkt_age);
     }
 
 cleanup:
     if (raw_digest != NULL)
         free(raw_digest);
 
-    if(ctx != NULL)
-    {
-        if(fko_destroy(ctx) == FKO_ERROR_ZERO_OUT_DATA)
-            log_msg(LOG_WARNING,
-                "[%s] (stanza #%d) fko_destroy() could not zero out sensitive data buffer.",
-                spadat.pkt_source_ip, stanza_num
-            );
-        ctx = NULL;
-    }
+    acc_stanza_release(acc);
+
+    destroy_spa_ctx(&ctx, &spadat, stanza_num);
 
 	if(spadat.service_data_list != NULL)
 	{
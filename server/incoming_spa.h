@@ -31,8 +31,12 @@
 #ifndef INCOMING_SPA_H
 #define INCOMING_SPA_H
 
+struct gpg_job;
+
 /* Prototypes
 */
-void incoming_spa(fko_srv_options_t *opts);
+void incoming_spa_pkt(fko_srv_options_t *opts, spa_pkt_info_t *spa_pkt);
+void incoming_spa_gpg_decrypt(struct gpg_job *job);
+void incoming_spa_gpg_finish(fko_srv_options_t *opts, struct gpg_job *job);
 
 #endif  /* INCOMING_SPA_H */
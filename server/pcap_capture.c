@@ -39,6 +39,8 @@
 #include "process_packet.h"
 #include "fw_util.h"
 #include "cmd_cycle.h"
+#include "gpg_worker.h"
+#include "hot_restart.h"
 #include "log_msg.h"
 #include "fwknopd_errors.h"
 #include "sig_handler.h"
@@ -73,10 +75,6 @@ pcap_capture(fko_srv_options_t *opts)
     int                 chk_rm_all = 0;
     pid_t               child_pid;
 
-#if FIREWALL_IPFW
-    time_t              now;
-#endif
-
     useconds = strtol_wrapper(opts->config[CONF_PCAP_LOOP_SLEEP],
             0, RCHK_MAX_PCAP_LOOP_SLEEP, NO_EXIT_UPON_ERR, &is_err);
     if(is_err != FKO_SUCCESS)
@@ -356,20 +354,23 @@ pcap_capture(fko_srv_options_t *opts)
             cmd_cycle_close(opts);
         }
 
-#if FIREWALL_IPFW
-        /* Purge expired rules that no longer have any corresponding
-         * dynamic rules.
+        /* Finish processing any GPG SPA packets that the GPG workers
+         * are done with.
         */
-        if(opts->fw_config->total_rules > 0)
-        {
-            time(&now);
-            if(opts->fw_config->last_purge < (now - opts->fw_config->purge_interval))
-            {
-                ipfw_purge_expired_rules(opts);
-                opts->fw_config->last_purge = now;
-            }
-        }
-#endif
+        gpg_workers_rejoin(opts);
+
+        /* Apply the grants made in this pass (for firewall backends that
+         * queue them up).
+        */
+        if(!opts->test && opts->enable_fw)
+            fw_commit(opts);
+
+        /* See if a new fwknopd wants to take over.  There is no way to
+         * hand over the pcap handle itself, so the new process opens its
+         * own capture once we are gone.
+        */
+        if(hot_restart_check(opts, -1))
+            break;
 
         usleep(useconds);
     }
@@ -71,6 +71,8 @@ process_packet(unsigned char *args, const struct pcap_pkthdr *packet_header,
 
     unsigned short      eth_type;
 
+    spa_pkt_info_t      spa_pkt;
+
     fko_srv_options_t   *opts = (fko_srv_options_t *)args;
 
     int                 offset = opts->data_link_offset;
@@ -218,16 +220,17 @@ process_packet(unsigned char *args, const struct pcap_pkthdr *packet_header,
 
     /* Copy the packet for SPA processing
     */
-    strlcpy((char *)opts->spa_pkt.packet_data, (char *)pkt_data, pkt_data_len+1);
-    opts->spa_pkt.packet_data_len = pkt_data_len;
-    opts->spa_pkt.packet_proto    = proto;
-    opts->spa_pkt.packet_src_ip   = src_ip;
-    opts->spa_pkt.packet_dst_ip   = dst_ip;
-    opts->spa_pkt.packet_src_port = src_port;
-    opts->spa_pkt.packet_dst_port = dst_port;
-    opts->spa_pkt.sdp_id = 0;
-
-    incoming_spa(opts);
+    strlcpy((char *)spa_pkt.packet_data, (char *)pkt_data, pkt_data_len+1);
+    spa_pkt.packet_data_len = pkt_data_len;
+    spa_pkt.packet_proto    = proto;
+    spa_pkt.packet_src_ip   = src_ip;
+    spa_pkt.packet_dst_ip   = dst_ip;
+    spa_pkt.packet_src_port = src_port;
+    spa_pkt.packet_dst_port = dst_port;
+    spa_pkt.sdp_id          = 0;
+    spa_pkt.sdp_id_str[0]   = '\0';
+
+    incoming_spa_pkt(opts, &spa_pkt);
 
     return;
 }
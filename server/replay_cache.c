@@ -48,10 +48,19 @@
   #define MY_DBM_STORE(d, k, v, m)  gdbm_store(d, k, v, m)
   #define MY_DBM_STRERROR(x)        gdbm_strerror(x)
   #define MY_DBM_CLOSE(d)           gdbm_close(d)
+  #define MY_DBM_SYNC(d)            gdbm_sync(d)
 
   #define MY_DBM_REPLACE            GDBM_REPLACE
   #define MY_DBM_INSERT             GDBM_INSERT
 
+  #ifdef GDBM_CLOEXEC
+    #define MY_DBM_OPEN_FLAGS       (GDBM_WRCREAT|GDBM_CLOEXEC)
+  #else
+    #define MY_DBM_OPEN_FLAGS       GDBM_WRCREAT
+  #endif
+
+  typedef GDBM_FILE                 my_dbm_t;
+
 #elif HAVE_LIBNDBM
   #include <ndbm.h>
 
@@ -59,10 +68,13 @@
   #define MY_DBM_STORE(d, k, v, m)  dbm_store(d, k, v, m)
   #define MY_DBM_STRERROR(x)        strerror(x)
   #define MY_DBM_CLOSE(d)           dbm_close(d)
+  #define MY_DBM_SYNC(d)            /* ndbm writes through on store */
 
   #define MY_DBM_REPLACE            DBM_REPLACE
   #define MY_DBM_INSERT             DBM_INSERT
 
+  typedef DBM                      *my_dbm_t;
+
 #else
   #if ! USE_FILE_CACHE
     #error "File cache method disabled, and No GDBM or NDBM header file found. WTF?"
@@ -79,6 +91,11 @@
 #define DATE_LEN 18
 #define MAX_DIGEST_SIZE 64
 
+/* The digest cache is shared by every caller of incoming_spa_pkt(), so
+ * lookups and additions are serialized here.
+*/
+static pthread_mutex_t replay_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 /* Rotate the digest file by simply renaming it.
 */
 static void
@@ -139,7 +156,7 @@ rotate_digest_cache_file(fko_srv_options_t *opts)
 }
 
 static void
-replay_warning(fko_srv_options_t *opts, digest_cache_info_t *digest_info)
+replay_warning(const spa_pkt_info_t *spa_pkt, digest_cache_info_t *digest_info)
 {
     char        src_ip[INET_ADDRSTRLEN+1] = {0};
     char        orig_src_ip[INET_ADDRSTRLEN+1] = {0};
@@ -151,7 +168,7 @@ replay_warning(fko_srv_options_t *opts, digest_cache_info_t *digest_info)
 
     /* Convert the IPs to a human readable form
     */
-    inet_ntop(AF_INET, &(opts->spa_pkt.packet_src_ip),
+    inet_ntop(AF_INET, &(spa_pkt->packet_src_ip),
         src_ip, INET_ADDRSTRLEN);
     inet_ntop(AF_INET, &(digest_info->src_ip), orig_src_ip, INET_ADDRSTRLEN);
 
@@ -189,8 +206,8 @@ replay_warning(fko_srv_options_t *opts, digest_cache_info_t *digest_info)
         "Replay count: %i",
 #endif
         src_ip,
-        opts->spa_pkt.packet_proto,
-        opts->spa_pkt.packet_dst_port,
+        spa_pkt->packet_proto,
+        spa_pkt->packet_dst_port,
         orig_src_ip,
         digest_info->proto,
         digest_info->dst_port,
@@ -359,8 +376,10 @@ replay_file_cache_init(fko_srv_options_t *opts)
 
 #else /* USE_FILE_CACHE */
 
-/* Check for the existence of the replay dbm file, and create it if it does
- * not exist.  Returns the number of db entries or -1 on error.
+/* Open the replay dbm file, creating it if it does not exist.  The handle
+ * stays open in opts->digest_db until replay_cache_close() so that SPA
+ * packets do not pay for opening and closing the database on every
+ * lookup.  Returns the number of db entries or -1 on error.
 */
 static int
 replay_db_cache_init(fko_srv_options_t *opts)
@@ -369,19 +388,15 @@ replay_db_cache_init(fko_srv_options_t *opts)
     return(-1);
 #else
 
-#ifdef HAVE_LIBGDBM
-    GDBM_FILE   rpdb;
-#elif HAVE_LIBNDBM
-    DBM        *rpdb;
-    datum       db_ent;
-#endif
-
-    datum       db_key, db_next_key;
+    my_dbm_t    rpdb;
+    datum       db_key;
     int         db_count = 0;
 
 #ifdef HAVE_LIBGDBM
+    datum       db_next_key;
+
     rpdb = gdbm_open(
-        opts->config[CONF_DIGEST_DB_FILE], 512, GDBM_WRCREAT, S_IRUSR|S_IWUSR, 0
+        opts->config[CONF_DIGEST_DB_FILE], 512, MY_DBM_OPEN_FLAGS, S_IRUSR|S_IWUSR, 0
     );
 #elif HAVE_LIBNDBM
     rpdb = dbm_open(
@@ -411,11 +426,11 @@ replay_db_cache_init(fko_srv_options_t *opts)
         db_key = db_next_key;
     }
 #elif HAVE_LIBNDBM
-    for (db_key = dbm_firstkey(rpdb); db_ent.dptr != NULL; db_key = dbm_nextkey(rpdb))
+    for (db_key = dbm_firstkey(rpdb); db_key.dptr != NULL; db_key = dbm_nextkey(rpdb))
         db_count++;
 #endif
 
-    MY_DBM_CLOSE(rpdb);
+    opts->digest_db = rpdb;
 
     return(db_count);
 #endif /* NO_DIGEST_CACHE */
@@ -424,7 +439,8 @@ replay_db_cache_init(fko_srv_options_t *opts)
 
 #if USE_FILE_CACHE
 static int
-is_replay_file_cache(fko_srv_options_t *opts, char *digest)
+is_replay_file_cache(fko_srv_options_t *opts, const spa_pkt_info_t *spa_pkt,
+        char *digest)
 {
     int         digest_len = 0;
 
@@ -441,7 +457,7 @@ is_replay_file_cache(fko_srv_options_t *opts, char *digest)
         if (constant_runtime_cmp(digest_list_ptr->cache_info.digest,
                     digest, digest_len) == 0) {
 
-            replay_warning(opts, &(digest_list_ptr->cache_info));
+            replay_warning(spa_pkt, &(digest_list_ptr->cache_info));
 
             return(SPA_MSG_REPLAY);
         }
@@ -450,7 +466,8 @@ is_replay_file_cache(fko_srv_options_t *opts, char *digest)
 }
 
 static int
-add_replay_file_cache(fko_srv_options_t *opts, char *digest)
+add_replay_file_cache(fko_srv_options_t *opts, const spa_pkt_info_t *spa_pkt,
+        char *digest)
 {
     FILE       *digest_file_ptr = NULL;
     int         digest_len = 0;
@@ -477,11 +494,11 @@ add_replay_file_cache(fko_srv_options_t *opts, char *digest)
     }
 
     strlcpy(digest_elm->cache_info.digest, digest, digest_len+1);
-    digest_elm->cache_info.proto    = opts->spa_pkt.packet_proto;
-    digest_elm->cache_info.src_ip   = opts->spa_pkt.packet_src_ip;
-    digest_elm->cache_info.dst_ip   = opts->spa_pkt.packet_dst_ip;
-    digest_elm->cache_info.src_port = opts->spa_pkt.packet_src_port;
-    digest_elm->cache_info.dst_port = opts->spa_pkt.packet_dst_port;
+    digest_elm->cache_info.proto    = spa_pkt->packet_proto;
+    digest_elm->cache_info.src_ip   = spa_pkt->packet_src_ip;
+    digest_elm->cache_info.dst_ip   = spa_pkt->packet_dst_ip;
+    digest_elm->cache_info.src_port = spa_pkt->packet_src_port;
+    digest_elm->cache_info.dst_port = spa_pkt->packet_dst_port;
     digest_elm->cache_info.created = time(NULL);
 
     /* First, add the digest at the head of the in-memory list
@@ -519,21 +536,25 @@ add_replay_file_cache(fko_srv_options_t *opts, char *digest)
 
 #if !USE_FILE_CACHE
 static int
-is_replay_dbm_cache(fko_srv_options_t *opts, char *digest)
+is_replay_dbm_cache(fko_srv_options_t *opts, const spa_pkt_info_t *spa_pkt,
+        char *digest)
 {
 #ifdef NO_DIGEST_CACHE
     return 0;
 #else
 
-#ifdef HAVE_LIBGDBM
-    GDBM_FILE   rpdb;
-#elif HAVE_LIBNDBM
-    DBM        *rpdb;
-#endif
+    my_dbm_t    rpdb = opts->digest_db;
     datum       db_key, db_ent;
 
     int         digest_len, res = SPA_MSG_SUCCESS;
 
+    if(!rpdb)
+    {
+        log_msg(LOG_WARNING, "Digest cache not open: '%s'",
+            opts->config[CONF_DIGEST_DB_FILE]);
+        return(SPA_MSG_DIGEST_CACHE_ERROR);
+    }
+
     digest_len = strlen(digest);
 
     db_key.dptr = digest;
@@ -541,24 +562,6 @@ is_replay_dbm_cache(fko_srv_options_t *opts, char *digest)
 
     /* Check the db for the key
     */
-#ifdef HAVE_LIBGDBM
-    rpdb = gdbm_open(
-         opts->config[CONF_DIGEST_DB_FILE], 512, GDBM_WRCREAT, S_IRUSR|S_IWUSR, 0
-    );
-#elif HAVE_LIBNDBM
-    rpdb = dbm_open(opts->config[CONF_DIGEST_DB_FILE], O_RDWR, 0);
-#endif
-
-    if(!rpdb)
-    {
-        log_msg(LOG_WARNING, "Error opening digest_cache: '%s': %s",
-            opts->config[CONF_DIGEST_DB_FILE],
-            MY_DBM_STRERROR(errno)
-        );
-
-        return(SPA_MSG_DIGEST_CACHE_ERROR);
-    }
-
     db_ent = MY_DBM_FETCH(rpdb, db_key);
 
     /* If the datum is not null, we have a match.  Otherwise, we add
@@ -566,7 +569,7 @@ is_replay_dbm_cache(fko_srv_options_t *opts, char *digest)
     */
     if(db_ent.dptr != NULL)
     {
-        replay_warning(opts, (digest_cache_info_t *)db_ent.dptr);
+        replay_warning(spa_pkt, (digest_cache_info_t *)db_ent.dptr);
 
         /* Save it back to the digest cache
         */
@@ -579,33 +582,36 @@ is_replay_dbm_cache(fko_srv_options_t *opts, char *digest)
 #ifdef HAVE_LIBGDBM
         free(db_ent.dptr);
 #endif
+        MY_DBM_SYNC(rpdb);
         res = SPA_MSG_REPLAY;
     }
 
-    MY_DBM_CLOSE(rpdb);
-
     return(res);
 #endif /* NO_DIGEST_CACHE */
 }
 
 static int
-add_replay_dbm_cache(fko_srv_options_t *opts, char *digest)
+add_replay_dbm_cache(fko_srv_options_t *opts, const spa_pkt_info_t *spa_pkt,
+        char *digest)
 {
 #ifdef NO_DIGEST_CACHE
     return 0;
 #else
 
-#ifdef HAVE_LIBGDBM
-    GDBM_FILE   rpdb;
-#elif HAVE_LIBNDBM
-    DBM        *rpdb;
-#endif
+    my_dbm_t    rpdb = opts->digest_db;
     datum       db_key, db_ent;
 
     int         digest_len, res = SPA_MSG_SUCCESS;
 
     digest_cache_info_t dc_info;
 
+    if(!rpdb)
+    {
+        log_msg(LOG_WARNING, "Digest cache not open: '%s'",
+            opts->config[CONF_DIGEST_DB_FILE]);
+        return(SPA_MSG_DIGEST_CACHE_ERROR);
+    }
+
     digest_len = strlen(digest);
 
     db_key.dptr = digest;
@@ -613,24 +619,6 @@ add_replay_dbm_cache(fko_srv_options_t *opts, char *digest)
 
     /* Check the db for the key
     */
-#ifdef HAVE_LIBGDBM
-    rpdb = gdbm_open(
-         opts->config[CONF_DIGEST_DB_FILE], 512, GDBM_WRCREAT, S_IRUSR|S_IWUSR, 0
-    );
-#elif HAVE_LIBNDBM
-    rpdb = dbm_open(opts->config[CONF_DIGEST_DB_FILE], O_RDWR, 0);
-#endif
-
-    if(!rpdb)
-    {
-        log_msg(LOG_WARNING, "Error opening digest_cache: '%s': %s",
-            opts->config[CONF_DIGEST_DB_FILE],
-            MY_DBM_STRERROR(errno)
-        );
-
-        return(SPA_MSG_DIGEST_CACHE_ERROR);
-    }
-
     db_ent = MY_DBM_FETCH(rpdb, db_key);
 
     /* If the datum is null, we have a new entry.
@@ -639,11 +627,11 @@ add_replay_dbm_cache(fko_srv_options_t *opts, char *digest)
     {
         /* This is a new SPA packet that needs to be added to the cache.
         */
-        dc_info.src_ip   = opts->spa_pkt.packet_src_ip;
-        dc_info.dst_ip   = opts->spa_pkt.packet_dst_ip;
-        dc_info.src_port = opts->spa_pkt.packet_src_port;
-        dc_info.dst_port = opts->spa_pkt.packet_dst_port;
-        dc_info.proto    = opts->spa_pkt.packet_proto;
+        dc_info.src_ip   = spa_pkt->packet_src_ip;
+        dc_info.dst_ip   = spa_pkt->packet_dst_ip;
+        dc_info.src_port = spa_pkt->packet_src_port;
+        dc_info.dst_port = spa_pkt->packet_dst_port;
+        dc_info.proto    = spa_pkt->packet_proto;
         dc_info.created  = time(NULL);
         dc_info.first_replay = dc_info.last_replay = dc_info.replay_count = 0;
 
@@ -659,16 +647,40 @@ add_replay_dbm_cache(fko_srv_options_t *opts, char *digest)
             res = SPA_MSG_DIGEST_CACHE_ERROR;
         }
 
+        /* The digest must be on disk before the packet is acted on so
+         * that it cannot be replayed after a crash or restart.
+        */
+        MY_DBM_SYNC(rpdb);
+
         res = SPA_MSG_SUCCESS;
     }
     else
+    {
+#ifdef HAVE_LIBGDBM
+        free(db_ent.dptr);
+#endif
         res = SPA_MSG_DIGEST_CACHE_ERROR;
-
-    MY_DBM_CLOSE(rpdb);
+    }
 
     return(res);
 #endif /* NO_DIGEST_CACHE */
 }
+
+/* Sync and close the digest cache
+*/
+void
+replay_cache_close(fko_srv_options_t *opts)
+{
+#ifndef NO_DIGEST_CACHE
+    if(opts->digest_db == NULL)
+        return;
+
+    MY_DBM_SYNC((my_dbm_t)opts->digest_db);
+    MY_DBM_CLOSE((my_dbm_t)opts->digest_db);
+    opts->digest_db = NULL;
+#endif
+    return;
+}
 #endif /* USE_FILE_CACHE */
 
 #if USE_FILE_CACHE
@@ -729,12 +741,19 @@ replay_cache_init(fko_srv_options_t *opts)
 #endif /* NO_DIGEST_CACHE */
 }
 
+/* Add the digest of the given SPA packet to the replay db (digest cache)
+ * unless it is already there, in which case SPA_MSG_REPLAY is returned.
+ * The lookup and the insert are done under one lock, so only one of two
+ * copies of a packet that are processed at the same time gets through.
+*/
 int
-add_replay(fko_srv_options_t *opts, char *digest)
+add_replay(fko_srv_options_t *opts, const spa_pkt_info_t *spa_pkt,
+        char *digest)
 {
 #ifdef NO_DIGEST_CACHE
     return(-1);
 #else
+    int         res;
 
     if(digest == NULL)
     {
@@ -742,29 +761,43 @@ add_replay(fko_srv_options_t *opts, char *digest)
         return(SPA_MSG_DIGEST_CACHE_ERROR);
     }
 
+    pthread_mutex_lock(&replay_cache_mutex);
 #if USE_FILE_CACHE
-    return add_replay_file_cache(opts, digest);
+    res = is_replay_file_cache(opts, spa_pkt, digest);
+    if(res == SPA_MSG_SUCCESS)
+        res = add_replay_file_cache(opts, spa_pkt, digest);
 #else
-    return add_replay_dbm_cache(opts, digest);
+    res = is_replay_dbm_cache(opts, spa_pkt, digest);
+    if(res == SPA_MSG_SUCCESS)
+        res = add_replay_dbm_cache(opts, spa_pkt, digest);
 #endif
+    pthread_mutex_unlock(&replay_cache_mutex);
+
+    return(res);
 #endif /* NO_DIGEST_CACHE */
 }
 
-/* Take an fko context, pull the digest and use it as the key to check the
- * replay db (digest cache).
+/* Take the digest of the given SPA packet and use it as the key to check
+ * the replay db (digest cache).
 */
 int
-is_replay(fko_srv_options_t *opts, char *digest)
+is_replay(fko_srv_options_t *opts, const spa_pkt_info_t *spa_pkt,
+        char *digest)
 {
 #ifdef NO_DIGEST_CACHE
     return(-1);
 #else
+    int         res;
 
+    pthread_mutex_lock(&replay_cache_mutex);
 #if USE_FILE_CACHE
-    return is_replay_file_cache(opts, digest);
+    res = is_replay_file_cache(opts, spa_pkt, digest);
 #else
-    return is_replay_dbm_cache(opts, digest);
+    res = is_replay_dbm_cache(opts, spa_pkt, digest);
 #endif
+    pthread_mutex_unlock(&replay_cache_mutex);
+
+    return(res);
 #endif /* NO_DIGEST_CACHE */
 }
 
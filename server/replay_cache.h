@@ -59,10 +59,14 @@ struct digest_cache_list {
 /* Prototypes
 */
 int replay_cache_init(fko_srv_options_t *opts);
-int is_replay(fko_srv_options_t *opts, char *digest);
-int add_replay(fko_srv_options_t *opts, char *digest);
+int is_replay(fko_srv_options_t *opts, const spa_pkt_info_t *spa_pkt,
+        char *digest);
+int add_replay(fko_srv_options_t *opts, const spa_pkt_info_t *spa_pkt,
+        char *digest);
 #ifdef USE_FILE_CACHE
 void free_replay_list(fko_srv_options_t *opts);
+#else
+void replay_cache_close(fko_srv_options_t *opts);
 #endif
 
 #endif  /* REPLAY_CACHE_H */
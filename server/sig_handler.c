@@ -34,6 +34,7 @@
 #include "service.h"
 #include "access.h"
 #include "config_init.h"
+#include "fw_util.h"
 
 #if HAVE_SYS_WAIT_H
   #include <sys/wait.h>
@@ -173,10 +174,11 @@ sig_do_stop(fko_srv_options_t * const opts)
         }
         else if(got_sigusr2)
         {
-            /* Not doing anything with this yet.
-            */
+            log_msg(LOG_INFO, "Got SIGUSR2. Resyncing firewall rules...");
             got_sigusr2 = 0;
             got_signal = 0;
+            if(!opts->test && opts->enable_fw)
+                fw_resync(opts);
         }
         else
             got_signal = 0;
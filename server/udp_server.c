@@ -34,6 +34,8 @@
 #include "log_msg.h"
 #include "fw_util.h"
 #include "cmd_cycle.h"
+#include "gpg_worker.h"
+#include "hot_restart.h"
 #include "utils.h"
 #include <errno.h>
 
@@ -50,10 +52,59 @@
 #include <fcntl.h>
 #include <sys/select.h>
 
+/* Create and bind the (non-blocking) UDP server socket
+*/
+static int
+open_udp_server(struct sockaddr_in *saddr)
+{
+    int s_sock, sfd_flags;
+
+    /* Now, let's make a UDP server
+    */
+    if ((s_sock = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+    {
+        log_msg(LOG_ERR, "run_udp_server: socket() failed: %s",
+            strerror(errno));
+        return -1;
+    }
+
+    /* Make our main socket non-blocking so we don't have to be stuck on
+     * listening for incoming datagrams.
+    */
+    if((sfd_flags = fcntl(s_sock, F_GETFL, 0)) < 0)
+    {
+        log_msg(LOG_ERR, "run_udp_server: fcntl F_GETFL error: %s",
+            strerror(errno));
+        close(s_sock);
+        return -1;
+    }
+
+    sfd_flags |= O_NONBLOCK;
+
+    if(fcntl(s_sock, F_SETFL, sfd_flags) < 0)
+    {
+        log_msg(LOG_ERR, "run_udp_server: fcntl F_SETFL error setting O_NONBLOCK: %s",
+            strerror(errno));
+        close(s_sock);
+        return -1;
+    }
+
+    /* Bind to the local address */
+    if (bind(s_sock, (struct sockaddr *) saddr, sizeof(*saddr)) < 0)
+    {
+        log_msg(LOG_ERR, "run_udp_server: bind() failed: %s",
+            strerror(errno));
+        close(s_sock);
+        return -1;
+    }
+
+    return s_sock;
+}
+
 int
 run_udp_server(fko_srv_options_t *opts)
 {
-    int                 s_sock, sfd_flags, selval, pkt_len;
+    int                 s_sock, selval, pkt_len, gpg_fd, max_fd;
     int                 is_err, s_timeout, rv=1, chk_rm_all=0;
     int                 rules_chk_threshold;
     fd_set              sfd_set;
@@ -61,6 +112,7 @@ run_udp_server(fko_srv_options_t *opts)
     struct timeval      tv;
     char                sipbuf[MAX_IPV4_STR_LEN] = {0};
     char                dgram_msg[MAX_SPA_PACKET_LEN+1] = {0};
+    spa_pkt_info_t      spa_pkt;
     unsigned short      port;
     socklen_t           clen;
 
@@ -88,51 +140,34 @@ run_udp_server(fko_srv_options_t *opts)
 
     log_msg(LOG_INFO, "Kicking off UDP server to listen on port %i.", port);
 
-    /* Now, let's make a UDP server
-    */
-    if ((s_sock = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
-    {
-        log_msg(LOG_ERR, "run_udp_server: socket() failed: %s",
-            strerror(errno));
-        return -1;
-    }
-
-    /* Make our main socket non-blocking so we don't have to be stuck on
-     * listening for incoming datagrams.
-    */
-    if((sfd_flags = fcntl(s_sock, F_GETFL, 0)) < 0)
-    {
-        log_msg(LOG_ERR, "run_udp_server: fcntl F_GETFL error: %s",
-            strerror(errno));
-        close(s_sock);
-        return -1;
-    }
-
-    sfd_flags |= O_NONBLOCK;
-
-    if(fcntl(s_sock, F_SETFL, sfd_flags) < 0)
-    {
-        log_msg(LOG_ERR, "run_udp_server: fcntl F_SETFL error setting O_NONBLOCK: %s",
-            strerror(errno));
-        close(s_sock);
-        return -1;
-    }
-
     /* Construct local address structure */
     memset(&saddr, 0x0, sizeof(saddr));
     saddr.sin_family      = AF_INET;           /* Internet address family */
     saddr.sin_addr.s_addr = htonl(INADDR_ANY); /* Any incoming interface */
     saddr.sin_port        = htons(port);       /* Local port */
 
-    /* Bind to the local address */
-    if (bind(s_sock, (struct sockaddr *) &saddr, sizeof(saddr)) < 0)
+    /* Use the socket handed over by the previous fwknopd in a hot restart
+     * (as long as UDPSERV_PORT has not changed), or else make a new UDP
+     * server.
+    */
+    if((s_sock = hot_restart_udp_sock()) >= 0)
     {
-        log_msg(LOG_ERR, "run_udp_server: bind() failed: %s",
-            strerror(errno));
-        close(s_sock);
-        return -1;
+        clen = sizeof(caddr);
+        if(getsockname(s_sock, (struct sockaddr *)&caddr, &clen) == 0
+                && caddr.sin_port == saddr.sin_port)
+        {
+            log_msg(LOG_INFO, "Using the UDP server socket of the previous fwknopd.");
+        }
+        else
+        {
+            close(s_sock);
+            s_sock = -1;
+        }
     }
 
+    if(s_sock < 0 && (s_sock = open_udp_server(&saddr)) < 0)
+        return -1;
+
     /* Initialize our signal handlers. You can check the return value for
      * the number of signals that were *not* set.  Those that were not set
      * will be listed in the log/stderr output.
@@ -178,16 +213,42 @@ run_udp_server(fko_srv_options_t *opts)
             cmd_cycle_close(opts);
         }
 
-        /* Initialize and setup the socket for select.
+        /* Finish processing any GPG SPA packets that the GPG workers
+         * are done with.
+        */
+        gpg_workers_rejoin(opts);
+
+        /* Apply the grants made in this pass (for firewall backends that
+         * queue them up).
+        */
+        if(!opts->test && opts->enable_fw)
+            fw_commit(opts);
+
+        /* See if a new fwknopd wants to take over
+        */
+        if(hot_restart_check(opts, s_sock))
+            break;
+
+        /* Initialize and setup the socket for select.  The GPG worker
+         * notification pipe (if any) is watched too.
         */
         FD_SET(s_sock, &sfd_set);
+        max_fd = s_sock;
+
+        gpg_fd = gpg_workers_notify_fd(opts);
+        if(gpg_fd >= 0)
+        {
+            FD_SET(gpg_fd, &sfd_set);
+            if(gpg_fd > max_fd)
+                max_fd = gpg_fd;
+        }
 
         /* Set our select timeout to (500ms by default).
         */
         tv.tv_sec = 0;
         tv.tv_usec = s_timeout;
 
-        selval = select(s_sock+1, &sfd_set, NULL, NULL, &tv);
+        selval = select(max_fd+1, &sfd_set, NULL, NULL, &tv);
 
         if(selval == -1)
         {
@@ -234,16 +295,17 @@ run_udp_server(fko_srv_options_t *opts)
 
             /* Copy the packet for SPA processing
             */
-            strlcpy((char *)opts->spa_pkt.packet_data, dgram_msg, pkt_len+1);
-            opts->spa_pkt.packet_data_len = pkt_len;
-            opts->spa_pkt.packet_proto    = IPPROTO_UDP;
-            opts->spa_pkt.packet_src_ip   = caddr.sin_addr.s_addr;
-            opts->spa_pkt.packet_dst_ip   = saddr.sin_addr.s_addr;
-            opts->spa_pkt.packet_src_port = ntohs(caddr.sin_port);
-            opts->spa_pkt.packet_dst_port = ntohs(saddr.sin_port);
-            opts->spa_pkt.sdp_id   = 0;
-
-            incoming_spa(opts);
+            strlcpy((char *)spa_pkt.packet_data, dgram_msg, pkt_len+1);
+            spa_pkt.packet_data_len = pkt_len;
+            spa_pkt.packet_proto    = IPPROTO_UDP;
+            spa_pkt.packet_src_ip   = caddr.sin_addr.s_addr;
+            spa_pkt.packet_dst_ip   = saddr.sin_addr.s_addr;
+            spa_pkt.packet_src_port = ntohs(caddr.sin_port);
+            spa_pkt.packet_dst_port = ntohs(saddr.sin_port);
+            spa_pkt.sdp_id          = 0;
+            spa_pkt.sdp_id_str[0]   = '\0';
+
+            incoming_spa_pkt(opts, &spa_pkt);
         }
 
         memset(dgram_msg, 0x0, sizeof(dgram_msg));
@@ -33,6 +33,7 @@
 #include "fw_util.h"
 #include "cmd_cycle.h"
 #include "connection_tracker.h"
+#include "hot_restart.h"
 
 #include <stdarg.h>
 
@@ -373,6 +374,22 @@ clean_exit(fko_srv_options_t *opts, unsigned int fw_cleanup_flag, unsigned int e
     }
 #endif
 
+    // stop the control client thread before touching the connection
+    // tracker it works with, then hand the controller any connection
+    // events still waiting for the next report
+    if(opts->ctrl_client != NULL)
+    {
+        if(opts->ctrl_client_thread > 0)
+        {
+            pthread_cancel(opts->ctrl_client_thread);
+            pthread_join(opts->ctrl_client_thread, NULL);
+            opts->ctrl_client_thread = 0;
+        }
+
+        flush_connection_reports(opts);
+        sdp_ctrl_client_disconnect(opts->ctrl_client);
+    }
+
     destroy_connection_tracker(opts);
 
     if(!opts->test && opts->enable_fw && (fw_cleanup_flag == FW_CLEANUP))
@@ -380,22 +397,16 @@ clean_exit(fko_srv_options_t *opts, unsigned int fw_cleanup_flag, unsigned int e
 
 #if USE_FILE_CACHE
     free_replay_list(opts);
+#else
+    replay_cache_close(opts);
 #endif
 
     if(opts->ctrl_client != NULL)
-    {
-        if(opts->ctrl_client_thread > 0)
-        {
-            pthread_cancel(opts->ctrl_client_thread);
-            pthread_join(opts->ctrl_client_thread, NULL);
-            opts->ctrl_client_thread = 0;
-        }
-
         sdp_ctrl_client_destroy(opts->ctrl_client);
-    }
 
     free_logging();
     free_cmd_cycle_list(opts);
+    hot_restart_close(opts);
     free_configs(opts);
     exit(exit_status);
 }
@@ -0,0 +1,107 @@
+#!/bin/sh -x
+
+#
+# Look for inputs that are slow or allocation heavy rather than ones that
+# crash.  The worst case SPA inputs and anything AFL has queued so far are
+# timed with test/fko-wrapper/fko_perf_fuzz, the slowest are kept under
+# $PERF_DIR, and a large generated access.conf is timed through fwknopd.
+#
+#   ./fuzzing-wrappers/perf-regress.sh           # scan and save the corpus
+#   ./fuzzing-wrappers/perf-regress.sh replay    # compare against it
+#
+
+. ./fuzzing-wrappers/fcns
+
+PERF_FUZZ="../fko-wrapper/fko_perf_fuzz"
+PERF_DIR="$TOP_DIR/perf-slowest"
+GEN_DIR="$TOP_DIR/perf-gen"
+ACCESS_FILE="$TOP_DIR/perf-access.conf"
+OVERRIDE_FILE="$TOP_DIR/perf-override.conf"
+
+ACCESS_STANZAS=${ACCESS_STANZAS:-5000}
+ACCESS_MAX_MS=${ACCESS_MAX_MS:-5000}
+REPS=${REPS:-50}
+KEEP=${KEEP:-20}
+FACTOR=${FACTOR:-3}
+
+if [ ! -x $PERF_FUZZ ]
+then
+    echo "[-] Build $PERF_FUZZ first with 'make perf_fuzz' in ../fko-wrapper/"
+    exit 1
+fi
+
+[ ! -d $PERF_DIR ] && mkdir -p $PERF_DIR
+
+RV=0
+
+if [ $@ ] && [ "$1" = "replay" ]
+then
+    for d in spa encoded
+    do
+        if [ -f $PERF_DIR/$d/BASELINE ]
+        then
+            E=''
+            [ "$d" = "encoded" ] && E='-e'
+            LD_LIBRARY_PATH=$LIB_DIR $PERF_FUZZ replay $E -r $REPS \
+                -f $FACTOR $PERF_DIR/$d || RV=1
+        fi
+    done
+else
+    LD_LIBRARY_PATH=$LIB_DIR $PERF_FUZZ gen $GEN_DIR || exit $?
+
+    ### encrypted packets
+    LD_LIBRARY_PATH=$LIB_DIR $PERF_FUZZ scan -r $REPS -n $KEEP \
+        -o $PERF_DIR/spa $GEN_DIR/spa test-cases/enc-pkts || exit $?
+
+    ### decrypted packet data, the format the spa-pkts fuzzing run uses.
+    ### This needs fwknop built with --enable-fuzzing-interfaces.
+    IN_DIRS="$GEN_DIR/encoded test-cases/spa-pkts"
+    for d in $TOP_DIR/spa-pkts.out/queue $TOP_DIR/spa-pkts.out/hangs
+    do
+        [ -d $d ] && IN_DIRS="$IN_DIRS $d"
+    done
+    LD_LIBRARY_PATH=$LIB_DIR $PERF_FUZZ scan -e -r $REPS -n $KEEP \
+        -o $PERF_DIR/encoded $IN_DIRS
+fi
+
+### access.conf parsing with many stanzas
+i=0
+: > $ACCESS_FILE
+while [ $i -lt $ACCESS_STANZAS ]
+do
+    cat >> $ACCESS_FILE <<EOF
+SDP_ID                      $((100000 + i))
+SOURCE                      10.$((i / 65536 % 256)).$((i / 256 % 256)).$((i % 256))/32, 192.168.0.0/16
+KEY                         fwknoptest$i
+HMAC_KEY                    fwknophmactest$i
+OPEN_PORTS                  tcp/22, tcp/80, tcp/443, udp/53
+FW_ACCESS_TIMEOUT           30
+
+EOF
+    i=$((i + 1))
+done
+
+### only the access.conf parsing is of interest, so leave the SDP
+### control client out of it
+cat > $OVERRIDE_FILE <<EOF
+ENABLE_DIGEST_PERSISTENCE       N;
+DISABLE_SDP_CTRL_CLIENT         Y;
+EOF
+chmod 600 $ACCESS_FILE $OVERRIDE_FILE
+
+START=`date +%s%N`
+LD_LIBRARY_PATH=$LIB_DIR $SERVER -c ../conf/ipt_snat_fwknopd.conf \
+    -O $OVERRIDE_FILE -a $ACCESS_FILE \
+    -f -t --exit-parse-config -r `pwd`/run > /dev/null 2>&1
+PARSE_RV=$?
+END=`date +%s%N`
+MS=$(((END - START) / 1000000))
+
+echo "[+] access.conf with $ACCESS_STANZAS stanzas parsed in $MS ms (rv: $PARSE_RV)"
+if [ $PARSE_RV -ne 0 ] || [ $MS -gt $ACCESS_MAX_MS ]
+then
+    echo "[-] access.conf parsing failed or took longer than $ACCESS_MAX_MS ms"
+    RV=1
+fi
+
+exit $RV
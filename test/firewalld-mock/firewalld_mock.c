@@ -0,0 +1,741 @@
+/*
+ * firewalld_mock.c
+ *
+ * Stand-in firewalld for exercising the fwknopd D-Bus firewall backend
+ * without root, firewalld or iptables.
+ *
+ * This owns org.fedoraproject.FirewallD1 on a bus (normally a private
+ * dbus-daemon) and implements the direct.passthrough method that fwknopd
+ * uses.  The iptables arguments of each call are applied to an in-memory
+ * set of tables and chains, and -L listings are produced in the same
+ * format as 'iptables -n -L --line-numbers', so the rule checks and the
+ * expiration handling in server/fw_util_firewalld.c work unchanged.
+ * Failures are returned as org.fedoraproject.FirewallD1.Exception errors
+ * with a COMMAND_FAILED reason, like firewalld does.
+ *
+ * Point fwknopd at the bus with DBUS_SYSTEM_BUS_ADDRESS.  See the README
+ * in this directory for usage.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <signal.h>
+#include <getopt.h>
+#include <dbus/dbus.h>
+
+#define MOCK_BUS_NAME           "org.fedoraproject.FirewallD1"
+#define MOCK_DIRECT_IF          "org.fedoraproject.FirewallD1.direct"
+#define MOCK_EXCEPTION          "org.fedoraproject.FirewallD1.Exception"
+#define MOCK_MAX_ARGS           64
+#define MOCK_MAX_NAME           32
+#define MOCK_MAX_SPEC           1024
+#define MOCK_POLL_MS            1000
+
+/* Iptables error strings as they appear in firewalld exceptions
+*/
+#define MOCK_ERR_NO_CHAIN       "No chain/target/match by that name."
+#define MOCK_ERR_NO_RULE        "Bad rule (does a matching rule exist in that chain?)."
+#define MOCK_ERR_INDEX          "Index of deletion too big."
+#define MOCK_ERR_INS_INDEX      "Index of insertion too big."
+#define MOCK_ERR_CHAIN_EXISTS   "Chain already exists."
+#define MOCK_ERR_NOT_EMPTY      "Directory not empty."
+#define MOCK_ERR_REFERENCED     "Too many links."
+#define MOCK_ERR_BAD_ARGS       "Bad argument."
+
+typedef struct mock_rule {
+    char                spec[MOCK_MAX_SPEC];    /* args after the chain */
+    char                target[MOCK_MAX_NAME];
+} mock_rule_t;
+
+typedef struct mock_chain {
+    char                table[MOCK_MAX_NAME];
+    char                name[MOCK_MAX_NAME];
+    int                 builtin;
+    int                 num_rules;
+    int                 max_rules;
+    mock_rule_t        *rules;
+    struct mock_chain  *next;
+} mock_chain_t;
+
+typedef struct mock_buf {
+    char   *data;
+    size_t  len;
+    size_t  size;
+} mock_buf_t;
+
+/* Calls counted by the mock, indexed by mock_cmd_names[]
+*/
+enum {
+    MOCK_CMD_APPEND,
+    MOCK_CMD_INSERT,
+    MOCK_CMD_DELETE,
+    MOCK_CMD_CHECK,
+    MOCK_CMD_LIST,
+    MOCK_CMD_NEW,
+    MOCK_CMD_FLUSH,
+    MOCK_CMD_DELETE_CHAIN,
+    MOCK_CMD_INVALID,
+    MOCK_NUM_CMDS
+};
+
+static const char *mock_cmd_names[MOCK_NUM_CMDS] = {
+    "-A", "-I", "-D", "-C", "-L", "-N", "-F", "-X", "invalid"
+};
+
+static const char *mock_builtin_chains[][2] = {
+    { "filter", "INPUT" },
+    { "filter", "FORWARD" },
+    { "filter", "OUTPUT" },
+    { "nat",    "PREROUTING" },
+    { "nat",    "INPUT" },
+    { "nat",    "OUTPUT" },
+    { "nat",    "POSTROUTING" },
+    { "mangle", "PREROUTING" },
+    { "mangle", "INPUT" },
+    { "mangle", "FORWARD" },
+    { "mangle", "OUTPUT" },
+    { "mangle", "POSTROUTING" },
+    { "raw",    "PREROUTING" },
+    { "raw",    "OUTPUT" }
+};
+
+static const char *mock_targets[] = {
+    "ACCEPT", "DROP", "REJECT", "RETURN", "LOG", "DNAT", "SNAT",
+    "MASQUERADE", "REDIRECT", "MARK", "NOTRACK"
+};
+
+static mock_chain_t            *chains = NULL;
+static unsigned long            cmd_counts[MOCK_NUM_CMDS];
+static unsigned long            num_calls = 0;
+static unsigned long            num_failed = 0;
+static int                      verbose = 0;
+static int                      no_check = 0;
+static volatile sig_atomic_t    got_signal = 0;
+static volatile sig_atomic_t    got_usr1 = 0;
+
+static void
+usage(void)
+{
+    fprintf(stderr,
+"Usage: firewalld_mock [options]\n\n"
+"Options:\n"
+"  -a, --address <addr>    Bus address (default: the system bus, which\n"
+"                          honors DBUS_SYSTEM_BUS_ADDRESS)\n"
+"  -C, --no-check          Reject -C like an iptables without it would\n"
+"  -v, --verbose           Log each passthrough call and its result\n"
+"  -h, --help              Show this help\n\n"
+"SIGUSR1 prints the call counters and the rule set, SIGINT/SIGTERM\n"
+"print them and exit.\n");
+}
+
+static void
+sig_handler(int sig)
+{
+    if(sig == SIGUSR1)
+        got_usr1 = 1;
+    else
+        got_signal = 1;
+}
+
+static int
+buf_printf(mock_buf_t *b, const char *fmt, ...)
+    __attribute__ ((format (printf, 2, 3)));
+
+static int
+buf_printf(mock_buf_t *b, const char *fmt, ...)
+{
+    va_list     ap;
+    char       *tmp;
+    int         n;
+
+    for(;;)
+    {
+        va_start(ap, fmt);
+        n = vsnprintf(b->data ? b->data + b->len : NULL,
+                b->data ? b->size - b->len : 0, fmt, ap);
+        va_end(ap);
+
+        if(n < 0)
+            return -1;
+        if(b->data != NULL && b->len + n < b->size)
+        {
+            b->len += n;
+            return 0;
+        }
+
+        if((tmp = realloc(b->data, b->size + n + 4096)) == NULL)
+            return -1;
+        b->data  = tmp;
+        b->size += n + 4096;
+    }
+}
+
+static mock_chain_t *
+find_chain(const char *table, const char *name)
+{
+    mock_chain_t   *c;
+
+    for(c = chains; c != NULL; c = c->next)
+        if(strcmp(c->table, table) == 0 && strcmp(c->name, name) == 0)
+            return c;
+    return NULL;
+}
+
+static mock_chain_t *
+add_chain(const char *table, const char *name, const int builtin)
+{
+    mock_chain_t   *c, **tail;
+
+    if((c = calloc(1, sizeof(*c))) == NULL)
+        return NULL;
+
+    snprintf(c->table, sizeof(c->table), "%s", table);
+    snprintf(c->name, sizeof(c->name), "%s", name);
+    c->builtin = builtin;
+
+    /* Keep the chains in creation order for the listings
+    */
+    for(tail = &chains; *tail != NULL; tail = &(*tail)->next)
+        ;
+    *tail = c;
+    return c;
+}
+
+static void
+remove_chain(mock_chain_t *chain)
+{
+    mock_chain_t  **p;
+
+    for(p = &chains; *p != chain; p = &(*p)->next)
+        ;
+    *p = chain->next;
+    free(chain->rules);
+    free(chain);
+}
+
+static int
+is_target(const char *table, const char *name)
+{
+    size_t  i;
+
+    for(i=0; i < sizeof(mock_targets)/sizeof(mock_targets[0]); i++)
+        if(strcmp(name, mock_targets[i]) == 0)
+            return 1;
+    return find_chain(table, name) != NULL;
+}
+
+static int
+chain_refs(const mock_chain_t *chain)
+{
+    mock_chain_t   *c;
+    int             i, refs = 0;
+
+    for(c = chains; c != NULL; c = c->next)
+        if(strcmp(c->table, chain->table) == 0)
+            for(i=0; i < c->num_rules; i++)
+                if(strcmp(c->rules[i].target, chain->name) == 0)
+                    refs++;
+    return refs;
+}
+
+static const char *
+proto_name(const char *proto)
+{
+    if(proto == NULL)
+        return "all";
+    if(strcmp(proto, "6") == 0)
+        return "tcp";
+    if(strcmp(proto, "17") == 0)
+        return "udp";
+    if(strcmp(proto, "1") == 0)
+        return "icmp";
+    return proto;
+}
+
+/* Append one rule the way 'iptables -n -L --line-numbers [-v]' prints it,
+ * with the comment match shown between the usual comment delimiters.
+*/
+static int
+list_rule(mock_buf_t *out, const mock_rule_t *rule, const int num,
+        const int list_verbose)
+{
+    char        spec[MOCK_MAX_SPEC];
+    char       *argv[MOCK_MAX_ARGS];
+    char       *tok, *save = NULL;
+    const char *proto = NULL, *src = "0.0.0.0/0", *dst = "0.0.0.0/0";
+    const char *dport = NULL, *sport = NULL, *comment = NULL, *to = NULL;
+    const char *ports = NULL;
+    int         argc = 0, i, res;
+
+    snprintf(spec, sizeof(spec), "%s", rule->spec);
+    for(tok = strtok_r(spec, " ", &save); tok != NULL && argc < MOCK_MAX_ARGS;
+            tok = strtok_r(NULL, " ", &save))
+        argv[argc++] = tok;
+
+    for(i=0; i < argc-1; i++)
+    {
+        if(strcmp(argv[i], "-p") == 0)
+            proto = argv[++i];
+        else if(strcmp(argv[i], "-s") == 0)
+            src = argv[++i];
+        else if(strcmp(argv[i], "-d") == 0)
+            dst = argv[++i];
+        else if(strcmp(argv[i], "--dport") == 0)
+            dport = argv[++i];
+        else if(strcmp(argv[i], "--sport") == 0)
+            sport = argv[++i];
+        else if(strcmp(argv[i], "--comment") == 0)
+            comment = argv[++i];
+        else if(strcmp(argv[i], "--to-destination") == 0
+                || strcmp(argv[i], "--to-source") == 0)
+            to = argv[++i];
+        else if(strcmp(argv[i], "--to-ports") == 0)
+            ports = argv[++i];
+    }
+
+    if(list_verbose)
+        res = buf_printf(out, "%-4d %8d %5d %-10s %-4s --  *      *       %-20s %-20s",
+                num, 0, 0, rule->target, proto_name(proto), src, dst);
+    else
+        res = buf_printf(out, "%-4d %-10s %-4s --  %-20s %-20s",
+                num, rule->target, proto_name(proto), src, dst);
+
+    if(res == 0 && sport != NULL)
+        res = buf_printf(out, " %s spt:%s", proto_name(proto), sport);
+    if(res == 0 && dport != NULL)
+        res = buf_printf(out, " %s dpt:%s", proto_name(proto), dport);
+    if(res == 0 && comment != NULL)
+        res = buf_printf(out, " /* %s */", comment);
+    if(res == 0 && to != NULL)
+        res = buf_printf(out, " to:%s", to);
+    if(res == 0 && ports != NULL)
+        res = buf_printf(out, " masq ports: %s", ports);
+    if(res == 0)
+        res = buf_printf(out, "\n");
+    return res;
+}
+
+static int
+list_chain(mock_buf_t *out, const mock_chain_t *c, const int list_verbose)
+{
+    int     i, res;
+
+    if(c->builtin)
+        res = buf_printf(out, "Chain %s (policy ACCEPT)\n", c->name);
+    else
+        res = buf_printf(out, "Chain %s (%d references)\n", c->name, chain_refs(c));
+
+    if(res == 0 && list_verbose)
+        res = buf_printf(out, "num   pkts bytes target     prot opt in     out     "
+                "source               destination\n");
+    else if(res == 0)
+        res = buf_printf(out, "num  target     prot opt source               "
+                "destination\n");
+
+    for(i=0; res == 0 && i < c->num_rules; i++)
+        res = list_rule(out, &c->rules[i], i+1, list_verbose);
+
+    return res;
+}
+
+static int
+insert_rule(mock_chain_t *c, const int pos, const char *spec,
+        const char *target)
+{
+    mock_rule_t    *tmp;
+    int             max;
+
+    if(c->num_rules == c->max_rules)
+    {
+        max = c->max_rules ? c->max_rules * 2 : 16;
+        if((tmp = realloc(c->rules, max * sizeof(mock_rule_t))) == NULL)
+            return -1;
+        c->rules     = tmp;
+        c->max_rules = max;
+    }
+
+    memmove(&c->rules[pos+1], &c->rules[pos],
+            (c->num_rules - pos) * sizeof(mock_rule_t));
+    snprintf(c->rules[pos].spec, sizeof(c->rules[pos].spec), "%s", spec);
+    snprintf(c->rules[pos].target, sizeof(c->rules[pos].target), "%s", target);
+    c->num_rules++;
+    return 0;
+}
+
+static void
+delete_rule(mock_chain_t *c, const int pos)
+{
+    memmove(&c->rules[pos], &c->rules[pos+1],
+            (c->num_rules - pos - 1) * sizeof(mock_rule_t));
+    c->num_rules--;
+}
+
+static int
+find_rule(const mock_chain_t *c, const char *spec)
+{
+    int     i;
+
+    for(i=0; i < c->num_rules; i++)
+        if(strcmp(c->rules[i].spec, spec) == 0)
+            return i;
+    return -1;
+}
+
+static int
+is_num(const char *str)
+{
+    if(*str == '\0')
+        return 0;
+    for(; *str != '\0'; str++)
+        if(!isdigit((unsigned char)*str))
+            return 0;
+    return 1;
+}
+
+/* Apply one passthrough argument list.  Returns NULL with the output in
+ * out, or the iptables error string.
+*/
+static const char *
+passthrough(char **argv, const int argc, mock_buf_t *out, int *cmd_idx)
+{
+    const char     *table = "filter", *chain_name = NULL, *target = "";
+    char            spec[MOCK_MAX_SPEC] = {0};
+    mock_chain_t   *c;
+    int             i, cmd = MOCK_CMD_INVALID, pos = -1, list_verbose = 0;
+    size_t          len = 0;
+
+    *cmd_idx = MOCK_CMD_INVALID;
+
+    for(i=0; i < argc; i++)
+    {
+        if(strcmp(argv[i], "-t") == 0 && i+1 < argc)
+            table = argv[++i];
+        else if(strlen(argv[i]) == 2 && argv[i][0] == '-'
+                && strchr("AIDCLNFX", argv[i][1]) != NULL)
+        {
+            if(cmd != MOCK_CMD_INVALID)
+                return MOCK_ERR_BAD_ARGS;
+            cmd = strchr("AIDCLNFX", argv[i][1]) - "AIDCLNFX";
+            if(i+1 < argc && argv[i+1][0] != '-')
+                chain_name = argv[++i];
+            if((cmd == MOCK_CMD_INSERT || cmd == MOCK_CMD_DELETE)
+                    && i+1 < argc && is_num(argv[i+1]))
+                pos = atoi(argv[++i]);
+        }
+        else if(strcmp(argv[i], "-v") == 0)
+            list_verbose = 1;
+        else if(strcmp(argv[i], "-n") == 0
+                || strcmp(argv[i], "--line-numbers") == 0)
+            continue;
+        else
+        {
+            /* Everything else is part of the rule
+            */
+            if(strcmp(argv[i], "-j") == 0 && i+1 < argc)
+                target = argv[i+1];
+            len += snprintf(spec + len, sizeof(spec) - len, "%s%s",
+                    len ? " " : "", argv[i]);
+            if(len >= sizeof(spec))
+                return MOCK_ERR_BAD_ARGS;
+        }
+    }
+
+    *cmd_idx = cmd;
+    if(cmd == MOCK_CMD_INVALID)
+        return MOCK_ERR_BAD_ARGS;
+
+    if(cmd == MOCK_CMD_LIST && chain_name == NULL)
+    {
+        for(c = chains; c != NULL; c = c->next)
+        {
+            if(strcmp(c->table, table) != 0)
+                continue;
+            if((out->len && buf_printf(out, "\n") != 0)
+                    || list_chain(out, c, list_verbose) != 0)
+                return MOCK_ERR_BAD_ARGS;
+        }
+        return NULL;
+    }
+
+    if(chain_name == NULL)
+        return MOCK_ERR_BAD_ARGS;
+
+    c = find_chain(table, chain_name);
+
+    if(cmd == MOCK_CMD_NEW)
+    {
+        if(c != NULL || is_target(table, chain_name))
+            return MOCK_ERR_CHAIN_EXISTS;
+        return add_chain(table, chain_name, 0) == NULL ? MOCK_ERR_BAD_ARGS : NULL;
+    }
+
+    if(c == NULL)
+        return MOCK_ERR_NO_CHAIN;
+
+    switch(cmd)
+    {
+        case MOCK_CMD_APPEND:
+        case MOCK_CMD_INSERT:
+            if(target[0] == '\0' || !is_target(table, target))
+                return MOCK_ERR_NO_CHAIN;
+            if(cmd == MOCK_CMD_APPEND)
+                pos = c->num_rules + 1;
+            else if(pos < 0)
+                pos = 1;
+            if(pos < 1 || pos > c->num_rules + 1)
+                return MOCK_ERR_INS_INDEX;
+            return insert_rule(c, pos-1, spec, target) ? MOCK_ERR_BAD_ARGS : NULL;
+
+        case MOCK_CMD_DELETE:
+            if(pos < 0)
+            {
+                if((pos = find_rule(c, spec)) < 0)
+                    return MOCK_ERR_NO_RULE;
+                pos++;
+            }
+            if(pos < 1 || pos > c->num_rules)
+                return MOCK_ERR_INDEX;
+            delete_rule(c, pos-1);
+            return NULL;
+
+        case MOCK_CMD_CHECK:
+            if(no_check)
+                return MOCK_ERR_BAD_ARGS;
+            return find_rule(c, spec) < 0 ? MOCK_ERR_NO_RULE : NULL;
+
+        case MOCK_CMD_LIST:
+            return list_chain(out, c, list_verbose) ? MOCK_ERR_BAD_ARGS : NULL;
+
+        case MOCK_CMD_FLUSH:
+            c->num_rules = 0;
+            return NULL;
+
+        case MOCK_CMD_DELETE_CHAIN:
+            if(c->builtin)
+                return MOCK_ERR_BAD_ARGS;
+            if(chain_refs(c) > 0)
+                return MOCK_ERR_REFERENCED;
+            if(c->num_rules > 0)
+                return MOCK_ERR_NOT_EMPTY;
+            remove_chain(c);
+            return NULL;
+    }
+
+    return MOCK_ERR_BAD_ARGS;
+}
+
+static void
+handle_passthrough(DBusConnection *conn, DBusMessage *msg)
+{
+    DBusMessageIter     iter, arr;
+    DBusMessage        *reply;
+    mock_buf_t          out = {0};
+    char               *argv[MOCK_MAX_ARGS];
+    char                reason[MOCK_MAX_SPEC + 128];
+    char                cmdline[MOCK_MAX_SPEC] = {0};
+    const char         *ipv = NULL, *err, *str;
+    int                 argc = 0, cmd_idx;
+    size_t              len = 0;
+
+    if(dbus_message_iter_init(msg, &iter)
+            && dbus_message_iter_get_arg_type(&iter) == DBUS_TYPE_STRING)
+    {
+        dbus_message_iter_get_basic(&iter, &ipv);
+        if(dbus_message_iter_next(&iter)
+                && dbus_message_iter_get_arg_type(&iter) == DBUS_TYPE_ARRAY
+                && dbus_message_iter_get_element_type(&iter) == DBUS_TYPE_STRING)
+        {
+            dbus_message_iter_recurse(&iter, &arr);
+            while(dbus_message_iter_get_arg_type(&arr) == DBUS_TYPE_STRING)
+            {
+                dbus_message_iter_get_basic(&arr, &str);
+                if(argc < MOCK_MAX_ARGS)
+                    argv[argc++] = (char *)str;
+                if(len < sizeof(cmdline))
+                    len += snprintf(cmdline + len, sizeof(cmdline) - len,
+                            "%s%s", len ? " " : "", str);
+                dbus_message_iter_next(&arr);
+            }
+        }
+    }
+
+    num_calls++;
+
+    if(ipv == NULL || argc == 0)
+    {
+        reply = dbus_message_new_error(msg, DBUS_ERROR_INVALID_ARGS,
+                "expected (s ipv, as args)");
+        cmd_idx = MOCK_CMD_INVALID;
+        err = MOCK_ERR_BAD_ARGS;
+    }
+    else if(strcmp(ipv, "ipv4") != 0)
+    {
+        snprintf(reason, sizeof(reason), "INVALID_IPV: %s", ipv);
+        reply = dbus_message_new_error(msg, MOCK_EXCEPTION, reason);
+        cmd_idx = MOCK_CMD_INVALID;
+        err = reason;
+    }
+    else if((err = passthrough(argv, argc, &out, &cmd_idx)) != NULL)
+    {
+        snprintf(reason, sizeof(reason),
+                "COMMAND_FAILED: '/usr/sbin/iptables -w10 %s' failed: iptables: %s",
+                cmdline, err);
+        reply = dbus_message_new_error(msg, MOCK_EXCEPTION, reason);
+    }
+    else
+    {
+        str = out.data ? out.data : "";
+        reply = dbus_message_new_method_return(msg);
+        if(reply != NULL)
+            dbus_message_append_args(reply, DBUS_TYPE_STRING, &str,
+                    DBUS_TYPE_INVALID);
+    }
+
+    cmd_counts[cmd_idx]++;
+    if(err != NULL)
+        num_failed++;
+
+    if(verbose)
+        fprintf(stderr, "[%lu] %s %s -> %s\n", num_calls, ipv ? ipv : "?",
+                cmdline, err ? err : "ok");
+
+    if(reply != NULL)
+    {
+        dbus_connection_send(conn, reply, NULL);
+        dbus_message_unref(reply);
+    }
+    free(out.data);
+}
+
+static void
+print_state(void)
+{
+    mock_buf_t      out = {0};
+    mock_chain_t   *c;
+    int             i;
+
+    fprintf(stderr, "passthrough calls: %lu (%lu failed)\n", num_calls, num_failed);
+    for(i=0; i < MOCK_NUM_CMDS; i++)
+        if(cmd_counts[i])
+            fprintf(stderr, "    %-8s %lu\n", mock_cmd_names[i], cmd_counts[i]);
+
+    for(c = chains; c != NULL; c = c->next)
+    {
+        if(c->num_rules == 0 && c->builtin)
+            continue;
+        out.len = 0;
+        if(buf_printf(&out, "[%s] ", c->table) == 0
+                && list_chain(&out, c, 0) == 0)
+            fputs(out.data, stderr);
+    }
+    free(out.data);
+}
+
+int
+main(int argc, char **argv)
+{
+    static struct option long_opts[] = {
+        {"address",  1, NULL, 'a'},
+        {"no-check", 0, NULL, 'C'},
+        {"verbose",  0, NULL, 'v'},
+        {"help",     0, NULL, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    DBusConnection     *conn;
+    DBusMessage        *msg;
+    DBusError           err;
+    const char         *address = NULL;
+    size_t              i;
+    int                 c;
+
+    while((c = getopt_long(argc, argv, "a:Cvh", long_opts, NULL)) != -1)
+    {
+        switch(c)
+        {
+            case 'a':
+                address = optarg;
+                break;
+            case 'C':
+                no_check = 1;
+                break;
+            case 'v':
+                verbose = 1;
+                break;
+            default:
+                usage();
+                return c == 'h' ? 0 : 1;
+        }
+    }
+
+    for(i=0; i < sizeof(mock_builtin_chains)/sizeof(mock_builtin_chains[0]); i++)
+        if(add_chain(mock_builtin_chains[i][0], mock_builtin_chains[i][1], 1) == NULL)
+            return 1;
+
+    dbus_error_init(&err);
+
+    if(address != NULL)
+    {
+        conn = dbus_connection_open_private(address, &err);
+        if(conn != NULL && !dbus_bus_register(conn, &err))
+        {
+            dbus_connection_close(conn);
+            dbus_connection_unref(conn);
+            conn = NULL;
+        }
+    }
+    else
+        conn = dbus_bus_get(DBUS_BUS_SYSTEM, &err);
+
+    if(conn == NULL)
+    {
+        fprintf(stderr, "Could not connect to the bus: %s\n",
+                dbus_error_is_set(&err) ? err.message : "unknown error");
+        return 1;
+    }
+
+    if(dbus_bus_request_name(conn, MOCK_BUS_NAME, DBUS_NAME_FLAG_DO_NOT_QUEUE,
+                &err) != DBUS_REQUEST_NAME_REPLY_PRIMARY_OWNER)
+    {
+        fprintf(stderr, "Could not own %s: %s\n", MOCK_BUS_NAME,
+                dbus_error_is_set(&err) ? err.message : "name is taken");
+        return 1;
+    }
+
+    signal(SIGINT, sig_handler);
+    signal(SIGTERM, sig_handler);
+    signal(SIGUSR1, sig_handler);
+
+    fprintf(stderr, "firewalld_mock: serving %s\n", MOCK_BUS_NAME);
+
+    while(!got_signal && dbus_connection_read_write(conn, MOCK_POLL_MS))
+    {
+        while((msg = dbus_connection_pop_message(conn)) != NULL)
+        {
+            if(dbus_message_is_method_call(msg, MOCK_DIRECT_IF, "passthrough"))
+                handle_passthrough(conn, msg);
+            else if(dbus_message_get_type(msg) == DBUS_MESSAGE_TYPE_METHOD_CALL)
+            {
+                DBusMessage *reply = dbus_message_new_error(msg,
+                        DBUS_ERROR_UNKNOWN_METHOD, "not implemented by firewalld_mock");
+                if(reply != NULL)
+                {
+                    dbus_connection_send(conn, reply, NULL);
+                    dbus_message_unref(reply);
+                }
+            }
+            dbus_message_unref(msg);
+        }
+
+        if(got_usr1)
+        {
+            got_usr1 = 0;
+            print_state();
+        }
+    }
+
+    print_state();
+    return 0;
+}
@@ -3,10 +3,55 @@
 #
 # Import the Fko class and all constants.
 #
+import sys
 from fko import *
 
+# SDP client ID carried by the batch packets
+#
+SDP_ID = 777777
+
+def batch_round_trip():
+
+    # Create a batch of SPA packets from one context, one per message, and
+    # check that each one decodes back to its own message.
+    #
+    fko = Fko()
+    fko.hmac_type(FKO_HMAC_SHA512)
+
+    msgs = ["127.0.0.2,tcp/%d" % port for port in range(2200, 2210)]
+    items = [(SDP_ID, 0, None, msg) for msg in msgs]
+
+    packets = []
+    for status, spa_data in fko.spa_data_batch(items, "testkey1", "testkey2", 2):
+        if status != FKO_SUCCESS:
+            print "Batch encode failed with status:", status
+            sys.exit(1)
+        packets.append(spa_data)
+
+    decoded = decode_spa_batch(packets, "testkey1", "testkey2",
+            hmac_type=FKO_HMAC_SHA512, sdp_id=SDP_ID)
+    for i in range(len(msgs)):
+        if decoded[i][0] != FKO_SUCCESS or decoded[i][5] != msgs[i]:
+            print "Batch decode failed for packet", i, ":", decoded[i]
+            sys.exit(1)
+
+    # A packet with a bad HMAC must not decode.
+    #
+    bad = decode_spa_batch([packets[0][:-4] + "AAAA"], "testkey1", "testkey2",
+            hmac_type=FKO_HMAC_SHA512, sdp_id=SDP_ID)
+    if bad[0][0] == FKO_SUCCESS:
+        print "Batch decode accepted a packet with a bad HMAC"
+        sys.exit(1)
+
+    print "Batch round trip:", len(decoded), "packets OK"
+
 def main():
 
+    # The batch functions take the SDP client ID with each packet, so they
+    # are checked first, with a context of their own.
+    #
+    batch_round_trip()
+
     # Create an Fko instance with an empty context.
     #
     fko = Fko()
@@ -0,0 +1,214 @@
+/*
+ * Check and benchmark fko_spa_data_batch().
+ *
+ * A batch of SPA packets is created from one template context with
+ * per-packet SDP IDs and messages, and every packet is decrypted again
+ * with fko_new_with_data() to make sure it carries the expected fields
+ * and a distinct random value.  Then the time to create the same number
+ * of packets with fko_spa_data_final() on a single context is compared
+ * with the batch call at a few thread counts.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "fko.h"
+
+#define BATCH_COUNT         20000
+#define VERIFY_COUNT        2000
+#define BATCH_MSG_LEN       64
+
+static const char *enc_key  = "fwknoptest";
+static const char *hmac_key = "fwknophmactest";
+
+static const int bench_threads[] = { 1, 2, 4, 8 };
+
+static double
+now_usec(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (double)tv.tv_sec * 1000000.0 + (double)tv.tv_usec;
+}
+
+static int
+new_template(fko_ctx_t *ctx)
+{
+    int res;
+
+    if((res = fko_new(ctx)) != FKO_SUCCESS)
+        return res;
+    if((res = fko_set_spa_message(*ctx, "127.0.0.2,tcp/22")) != FKO_SUCCESS)
+        return res;
+    if((res = fko_set_spa_hmac_type(*ctx, FKO_HMAC_SHA256)) != FKO_SUCCESS)
+        return res;
+    if((res = fko_set_disable_sdp_mode(*ctx, 0)) != FKO_SUCCESS)
+        return res;
+    return fko_set_sdp_id(*ctx, 1);
+}
+
+/* Decrypt every packet and compare it with its batch item
+*/
+static int
+verify_batch(const char *buf, const size_t *offsets, const int *results,
+        const fko_batch_item_t *items, int count)
+{
+    fko_ctx_t   ctx;
+    char       *msg, *rand_val, **seen;
+    int         i, j, res, ok = 0;
+
+    seen = calloc(count, sizeof(char *));
+    if(seen == NULL)
+        return 0;
+
+    for(i=0; i < count; i++)
+    {
+        if(results[i] != FKO_SUCCESS)
+        {
+            printf("[-] packet %d: %s\n", i, fko_errstr(results[i]));
+            goto done;
+        }
+
+        res = fko_new_with_data(&ctx, buf + offsets[i], enc_key, strlen(enc_key),
+                FKO_ENC_MODE_CBC, hmac_key, strlen(hmac_key), FKO_HMAC_SHA256,
+                items[i].sdp_id);
+        if(res != FKO_SUCCESS)
+        {
+            printf("[-] packet %d: decrypt failed: %s\n", i, fko_errstr(res));
+            goto done;
+        }
+
+        fko_get_spa_message(ctx, &msg);
+        fko_get_rand_value(ctx, &rand_val);
+        if(strcmp(msg, items[i].message) != 0)
+        {
+            printf("[-] packet %d: message mismatch '%s'\n", i, msg);
+            fko_destroy(ctx);
+            goto done;
+        }
+        seen[i] = strdup(rand_val);
+        fko_destroy(ctx);
+
+        for(j=0; j < i; j++)
+        {
+            if(strcmp(seen[i], seen[j]) == 0)
+            {
+                printf("[-] packets %d and %d share a random value\n", j, i);
+                goto done;
+            }
+        }
+    }
+    ok = 1;
+
+done:
+    for(i=0; i < count; i++)
+        free(seen[i]);
+    free(seen);
+    return ok;
+}
+
+int
+main(void)
+{
+    fko_ctx_t           tmpl, ctx;
+    fko_batch_item_t   *items;
+    char               *msgs, *buf, *spa_data;
+    size_t             *offsets, buf_len;
+    int                *results, i, res;
+    double              start, single_us, batch_us;
+
+    items   = calloc(BATCH_COUNT, sizeof(fko_batch_item_t));
+    msgs    = calloc(BATCH_COUNT, BATCH_MSG_LEN);
+    offsets = calloc(BATCH_COUNT, sizeof(size_t));
+    results = calloc(BATCH_COUNT, sizeof(int));
+    buf_len = (size_t)BATCH_COUNT * 512;
+    buf     = malloc(buf_len);
+    if(items == NULL || msgs == NULL || offsets == NULL
+            || results == NULL || buf == NULL)
+        return 1;
+
+    for(i=0; i < BATCH_COUNT; i++)
+    {
+        snprintf(msgs + i*BATCH_MSG_LEN, BATCH_MSG_LEN,
+                "10.%d.%d.%d,tcp/22", (i >> 16) & 0xff, (i >> 8) & 0xff, i & 0xff);
+        items[i].sdp_id  = 1000 + i;
+        items[i].message = msgs + i*BATCH_MSG_LEN;
+    }
+
+    if((res = new_template(&tmpl)) != FKO_SUCCESS)
+    {
+        printf("[-] template: %s\n", fko_errstr(res));
+        return 1;
+    }
+
+    res = fko_spa_data_batch(tmpl, items, VERIFY_COUNT, enc_key, strlen(enc_key),
+            hmac_key, strlen(hmac_key), buf, buf_len, offsets, results, 4);
+    if(res != FKO_SUCCESS || ! verify_batch(buf, offsets, results, items, VERIFY_COUNT))
+    {
+        printf("[-] batch verification failed\n");
+        return 1;
+    }
+    printf("[+] %d batch packets decrypted and verified\n", VERIFY_COUNT);
+
+    /* A buffer that is too small must fail cleanly
+    */
+    res = fko_spa_data_batch(tmpl, items, VERIFY_COUNT, enc_key, strlen(enc_key),
+            hmac_key, strlen(hmac_key), buf, 4096, offsets, results, 4);
+    if(res != FKO_ERROR_DATA_TOO_LARGE)
+    {
+        printf("[-] short buffer returned: %s\n", fko_errstr(res));
+        return 1;
+    }
+    printf("[+] short buffer rejected\n\n");
+
+    /* Baseline: one context, one fko_spa_data_final() per packet
+    */
+    if((res = new_template(&ctx)) != FKO_SUCCESS)
+        return 1;
+    start = now_usec();
+    for(i=0; i < BATCH_COUNT; i++)
+    {
+        fko_set_rand_value(ctx, NULL);
+        fko_set_sdp_id(ctx, items[i].sdp_id);
+        fko_set_spa_message(ctx, items[i].message);
+        if(fko_spa_data_final(ctx, enc_key, strlen(enc_key),
+                    hmac_key, strlen(hmac_key)) != FKO_SUCCESS
+                || fko_get_spa_data(ctx, &spa_data) != FKO_SUCCESS)
+            return 1;
+    }
+    single_us = now_usec() - start;
+    fko_destroy(ctx);
+
+    printf("%-20s %10s %12s %8s\n", "mode", "packets", "packets/sec", "speedup");
+    printf("%-20s %10d %12.0f %7.2fx\n", "single context",
+            BATCH_COUNT, BATCH_COUNT * 1000000.0 / single_us, 1.0);
+
+    for(i=0; i < (int)(sizeof(bench_threads)/sizeof(bench_threads[0])); i++)
+    {
+        char mode[32];
+
+        start = now_usec();
+        res = fko_spa_data_batch(tmpl, items, BATCH_COUNT, enc_key, strlen(enc_key),
+                hmac_key, strlen(hmac_key), buf, buf_len, offsets, results,
+                bench_threads[i]);
+        batch_us = now_usec() - start;
+        if(res != FKO_SUCCESS)
+        {
+            printf("[-] batch: %s\n", fko_errstr(res));
+            return 1;
+        }
+        snprintf(mode, sizeof(mode), "batch, %d thread%s",
+                bench_threads[i], bench_threads[i] > 1 ? "s" : "");
+        printf("%-20s %10d %12.0f %7.2fx\n", mode, BATCH_COUNT,
+                BATCH_COUNT * 1000000.0 / batch_us, single_us / batch_us);
+    }
+
+    fko_destroy(tmpl);
+    free(buf);
+    free(results);
+    free(offsets);
+    free(msgs);
+    free(items);
+    return 0;
+}
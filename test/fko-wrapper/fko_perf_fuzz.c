@@ -0,0 +1,706 @@
+/*
+ * Performance regression mode for the fuzzing corpora.
+ *
+ * The AFL wrappers under test/afl only look for crashes and hangs.  This
+ * program runs fuzzing inputs through the libfko decode path and records
+ * how long each one takes and how many heap allocations it makes, so that
+ * inputs with unusually high cost (pathological base64, maximum length
+ * fields, ...) stand out before they become a denial of service.
+ *
+ *   fko_perf_fuzz gen <dir>
+ *       Write worst case inputs to <dir>/spa (encrypted SPA packets) and
+ *       <dir>/encoded (decrypted packet data).
+ *
+ *   fko_perf_fuzz scan [options] <file|dir> ...
+ *       Time every input and list them slowest first.  With -o, the -n
+ *       slowest inputs are copied to a corpus directory together with a
+ *       BASELINE file recording their cost.
+ *
+ *   fko_perf_fuzz replay [options] <corpus dir>
+ *       Re-run a corpus and fail if any input makes more allocations than
+ *       its baseline, or takes more than -f times its baseline time.
+ *
+ * Inputs are encrypted SPA packets, decoded with fko_new_with_data(), or
+ * with -e, decrypted packet data fed to fko_decode_spa_data() the same way
+ * fwknopd's AFL stdin mode does (this needs a libfko built with
+ * --enable-fuzzing-interfaces and "make perf_fuzz_encoded").
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <errno.h>
+#include <limits.h>
+#include <dirent.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include "fko.h"
+
+#define PERF_MAX_INPUT          4096
+#define PERF_MAX_ENCODED        1500    /* MAX_SPA_ENCODED_MSG_SIZE */
+#define PERF_MIN_GNUPG_SIZE     400     /* MIN_GNUPG_MSG_SIZE */
+#define PERF_DEFAULT_REPS       50
+#define PERF_DEFAULT_KEEP       20
+#define PERF_DEFAULT_FACTOR     3.0
+#define PERF_DEFAULT_SDP_ID     777777
+#define PERF_BASELINE_FILE      "BASELINE"
+
+#define ENC_KEY                 "fwknoptest"
+#define HMAC_KEY                "fwknophmactest"
+
+typedef struct perf_input
+{
+    char           *path;
+    char           *data;
+    double          ns;         /* fastest of all repetitions */
+    unsigned long   allocs;     /* allocations made by one decode */
+    unsigned long   bytes;
+    int             res;
+} perf_input_t;
+
+static struct
+{
+    int         encoded;
+    int         reps;
+    int         keep;
+    double      factor;
+    uint32_t    sdp_id;
+    char       *enc_key;
+    char       *hmac_key;
+    char       *out_dir;
+} opts;
+
+/* Count heap allocations by interposing on the libc allocator.  libfko
+ * and everything it calls resolve malloc() and friends to these.
+*/
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static int              counting = 0;
+static unsigned long    alloc_count = 0;
+static unsigned long    alloc_bytes = 0;
+
+void *
+malloc(size_t size)
+{
+    if(counting)
+    {
+        alloc_count++;
+        alloc_bytes += size;
+    }
+    return __libc_malloc(size);
+}
+
+void *
+calloc(size_t nmemb, size_t size)
+{
+    if(counting)
+    {
+        alloc_count++;
+        alloc_bytes += nmemb * size;
+    }
+    return __libc_calloc(nmemb, size);
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+    if(counting)
+    {
+        alloc_count++;
+        alloc_bytes += size;
+    }
+    return __libc_realloc(ptr, size);
+}
+
+static double
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr,
+"Usage: fko_perf_fuzz gen <dir>\n"
+"       fko_perf_fuzz scan [options] <file|dir> ...\n"
+"       fko_perf_fuzz replay [options] <corpus dir>\n\n"
+"Options:\n"
+"  -e          Inputs are decrypted packet data (needs fuzzing interfaces)\n"
+"  -r <n>      Repetitions per input, the fastest is kept (%d)\n"
+"  -n <n>      Number of slowest inputs to keep with -o (%d)\n"
+"  -o <dir>    Save the slowest inputs and their BASELINE to <dir>\n"
+"  -f <x>      Replay fails on inputs slower than x times baseline (%.1f)\n"
+"  -k <key>    Rijndael key (%s)\n"
+"  -m <key>    HMAC key, empty for none (%s)\n"
+"  -s <id>     SDP ID, 0 for non-SDP packets (%d)\n",
+        PERF_DEFAULT_REPS, PERF_DEFAULT_KEEP, PERF_DEFAULT_FACTOR,
+        ENC_KEY, HMAC_KEY, PERF_DEFAULT_SDP_ID);
+}
+
+/* Decode one input the way fwknopd would and return the libfko status
+*/
+static int
+decode_input(const char *data)
+{
+    fko_ctx_t   ctx = NULL;
+    int         res;
+
+    if(opts.encoded)
+    {
+#if FUZZING_INTERFACES
+        fko_new(&ctx);
+        res = fko_set_encoded_data(ctx, data, strlen(data), 0, FKO_DIGEST_SHA256);
+        if(res == FKO_SUCCESS)
+            res = fko_set_spa_data(ctx, data);
+        if(res == FKO_SUCCESS)
+            res = fko_decode_spa_data(ctx);
+#else
+        res = FKO_ERROR_UNSUPPORTED_FEATURE;
+#endif
+    }
+    else
+    {
+        res = fko_new_with_data(&ctx, data, opts.enc_key, strlen(opts.enc_key),
+                FKO_ENC_MODE_CBC, opts.hmac_key, strlen(opts.hmac_key),
+                FKO_HMAC_SHA256, opts.sdp_id);
+    }
+
+    if(ctx != NULL)
+        fko_destroy(ctx);
+    return res;
+}
+
+static void
+measure(perf_input_t *in)
+{
+    double  start, ns;
+    int     i;
+
+    alloc_count = alloc_bytes = 0;
+    counting = 1;
+    in->res = decode_input(in->data);
+    counting = 0;
+    in->allocs = alloc_count;
+    in->bytes  = alloc_bytes;
+
+    in->ns = 0;
+    for(i=0; i < opts.reps; i++)
+    {
+        start = now_ns();
+        decode_input(in->data);
+        ns = now_ns() - start;
+        if(i == 0 || ns < in->ns)
+            in->ns = ns;
+    }
+}
+
+/* Read the first line of a file, as fwknopd's stdin mode does
+*/
+static char *
+read_input(const char *path)
+{
+    FILE   *fp;
+    char   *buf;
+
+    if((fp = fopen(path, "r")) == NULL)
+        return NULL;
+
+    if((buf = calloc(1, PERF_MAX_INPUT)) != NULL
+            && fgets(buf, PERF_MAX_INPUT, fp) != NULL)
+        buf[strcspn(buf, "\r\n")] = '\0';
+
+    fclose(fp);
+    return buf;
+}
+
+static int
+add_input(perf_input_t **inputs, int *count, int *size, const char *path)
+{
+    perf_input_t   *tmp;
+    char           *data;
+
+    if((data = read_input(path)) == NULL)
+    {
+        fprintf(stderr, "[-] Could not read %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    if(*count == *size)
+    {
+        *size = *size ? *size * 2 : 256;
+        if((tmp = realloc(*inputs, *size * sizeof(perf_input_t))) == NULL)
+            return -1;
+        *inputs = tmp;
+    }
+
+    memset(&(*inputs)[*count], 0x0, sizeof(perf_input_t));
+    (*inputs)[*count].path = strdup(path);
+    (*inputs)[*count].data = data;
+    (*count)++;
+    return 0;
+}
+
+/* Collect a file, or every regular file in a directory (AFL queue and
+ * crash directories included)
+*/
+static int
+collect_inputs(perf_input_t **inputs, int *count, int *size, const char *path)
+{
+    struct stat     st;
+    struct dirent  *de;
+    DIR            *dir;
+    char            file[PATH_MAX];
+    int             rv = 0;
+
+    if(stat(path, &st) != 0)
+    {
+        fprintf(stderr, "[-] %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    if(!S_ISDIR(st.st_mode))
+        return add_input(inputs, count, size, path);
+
+    if((dir = opendir(path)) == NULL)
+        return -1;
+
+    while(rv == 0 && (de = readdir(dir)) != NULL)
+    {
+        if(de->d_name[0] == '.' || strcmp(de->d_name, PERF_BASELINE_FILE) == 0
+                || strcmp(de->d_name, "README.txt") == 0)
+            continue;
+
+        snprintf(file, sizeof(file), "%s/%s", path, de->d_name);
+        if(stat(file, &st) == 0 && S_ISREG(st.st_mode))
+            rv = add_input(inputs, count, size, file);
+    }
+
+    closedir(dir);
+    return rv;
+}
+
+static int
+cmp_slowest(const void *a, const void *b)
+{
+    const perf_input_t *x = a, *y = b;
+
+    return x->ns < y->ns ? 1 : x->ns > y->ns ? -1 : 0;
+}
+
+static const char *
+base_name(const char *path)
+{
+    const char *p = strrchr(path, '/');
+
+    return p ? p + 1 : path;
+}
+
+static int
+write_file(const char *dir, const char *name, const char *data)
+{
+    char    path[PATH_MAX];
+    FILE   *fp;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    if((fp = fopen(path, "w")) == NULL)
+    {
+        fprintf(stderr, "[-] Could not write %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    fprintf(fp, "%s\n", data);
+    fclose(fp);
+    return 0;
+}
+
+/* Keep the slowest inputs along with what they cost on this machine
+*/
+static int
+save_corpus(perf_input_t *inputs, int count)
+{
+    FILE   *fp;
+    char    path[PATH_MAX], name[PATH_MAX];
+    int     i;
+
+    mkdir(opts.out_dir, 0755);
+
+    snprintf(path, sizeof(path), "%s/%s", opts.out_dir, PERF_BASELINE_FILE);
+    if((fp = fopen(path, "w")) == NULL)
+    {
+        fprintf(stderr, "[-] Could not write %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    fprintf(fp, "# <input> <ns> <allocs> <bytes>, written by fko_perf_fuzz scan%s\n",
+            opts.encoded ? " -e" : "");
+
+    for(i=0; i < count && i < opts.keep; i++)
+    {
+        snprintf(name, sizeof(name), "slow%03d_%s", i, base_name(inputs[i].path));
+        name[strcspn(name, " \t:,")] = '\0';
+        if(write_file(opts.out_dir, name, inputs[i].data) != 0)
+        {
+            fclose(fp);
+            return -1;
+        }
+        fprintf(fp, "%s %.0f %lu %lu\n", name, inputs[i].ns,
+                inputs[i].allocs, inputs[i].bytes);
+    }
+
+    fclose(fp);
+    printf("\n[+] Saved the %d slowest inputs to %s\n",
+            count < opts.keep ? count : opts.keep, opts.out_dir);
+    return 0;
+}
+
+static void
+print_header(void)
+{
+    printf("%12s %8s %10s %6s  %s\n", "usec", "allocs", "bytes", "res", "input");
+}
+
+static void
+print_input(const perf_input_t *in, const char *note)
+{
+    printf("%12.2f %8lu %10lu %6d  %s%s\n", in->ns / 1000.0, in->allocs,
+            in->bytes, in->res, in->path, note);
+}
+
+static int
+run_scan(int argc, char **argv)
+{
+    perf_input_t   *inputs = NULL;
+    int             count = 0, size = 0, i, shown;
+    double          total = 0;
+
+    for(i=0; i < argc; i++)
+        if(collect_inputs(&inputs, &count, &size, argv[i]) != 0)
+            return 1;
+
+    if(count == 0)
+    {
+        fprintf(stderr, "[-] No inputs found\n");
+        return 1;
+    }
+
+    for(i=0; i < count; i++)
+    {
+        measure(&inputs[i]);
+        total += inputs[i].ns;
+    }
+
+    qsort(inputs, count, sizeof(perf_input_t), cmp_slowest);
+
+    printf("[+] %d inputs, %.2f usec average, slowest first:\n\n",
+            count, total / count / 1000.0);
+    print_header();
+
+    shown = count < opts.keep ? count : opts.keep;
+    for(i=0; i < shown; i++)
+        print_input(&inputs[i], "");
+
+    if(opts.out_dir != NULL && save_corpus(inputs, count) != 0)
+        return 1;
+
+    for(i=0; i < count; i++)
+    {
+        free(inputs[i].path);
+        free(inputs[i].data);
+    }
+    free(inputs);
+    return 0;
+}
+
+static int
+run_replay(const char *dir)
+{
+    perf_input_t    in;
+    FILE           *fp;
+    char            path[PATH_MAX], line[PATH_MAX], name[NAME_MAX+1];
+    double          base_ns;
+    unsigned long   base_allocs, base_bytes;
+    int             failed = 0, count = 0;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, PERF_BASELINE_FILE);
+    if((fp = fopen(path, "r")) == NULL)
+    {
+        fprintf(stderr, "[-] Could not open %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    print_header();
+
+    while(fgets(line, sizeof(line), fp) != NULL)
+    {
+        if(line[0] == '#' || sscanf(line, "%255s %lf %lu %lu", name,
+                    &base_ns, &base_allocs, &base_bytes) != 4)
+            continue;
+
+        snprintf(path, sizeof(path), "%s/%s", dir, name);
+        memset(&in, 0x0, sizeof(in));
+        in.path = path;
+        if((in.data = read_input(path)) == NULL)
+        {
+            fprintf(stderr, "[-] Could not read %s\n", path);
+            failed++;
+            continue;
+        }
+
+        measure(&in);
+        count++;
+
+        if(in.allocs > base_allocs)
+        {
+            print_input(&in, "  <-- more allocations than baseline");
+            failed++;
+        }
+        else if(in.ns > base_ns * opts.factor)
+        {
+            print_input(&in, "  <-- slower than baseline");
+            failed++;
+        }
+        else
+            print_input(&in, "");
+
+        free(in.data);
+    }
+    fclose(fp);
+
+    printf("\n[%c] %d of %d corpus inputs regressed\n", failed ? '-' : '+',
+            failed, count);
+    return failed ? 1 : 0;
+}
+
+/* Encrypted SPA packet carrying the largest fields libfko accepts
+*/
+static int
+gen_spa(const char *dir, const char *name, short msg_type, int fill)
+{
+    fko_ctx_t   ctx;
+    char        user[64], msg[256], nat[128], auth[64], *spa;
+    int         res;
+
+    if((res = fko_new(&ctx)) != FKO_SUCCESS)
+        return -1;
+
+    memset(user, 'u', sizeof(user) - 1);
+    user[sizeof(user) - 1] = '\0';
+
+    snprintf(msg, sizeof(msg), "123.123.123.123,tcp/%d", 65535);
+
+    memset(nat, 0x0, sizeof(nat));
+    snprintf(nat, sizeof(nat), "192.168.100.100,65535");
+
+    memset(auth, 'a', sizeof(auth) - 1);
+    auth[sizeof(auth) - 1] = '\0';
+
+    res = fko_set_username(ctx, user);
+    if(res == FKO_SUCCESS)
+        res = fko_set_spa_message_type(ctx, msg_type);
+    if(res == FKO_SUCCESS)
+        res = fko_set_spa_message(ctx, msg);
+    if(res == FKO_SUCCESS && (msg_type == FKO_NAT_ACCESS_MSG
+                || msg_type == FKO_CLIENT_TIMEOUT_NAT_ACCESS_MSG))
+        res = fko_set_spa_nat_access(ctx, nat);
+    if(res == FKO_SUCCESS && msg_type == FKO_CLIENT_TIMEOUT_NAT_ACCESS_MSG)
+        res = fko_set_spa_client_timeout(ctx, 65535);
+    if(res == FKO_SUCCESS)
+        res = fko_set_spa_server_auth(ctx, auth);
+    if(res == FKO_SUCCESS)
+        res = fko_set_spa_hmac_type(ctx, FKO_HMAC_SHA256);
+    if(res == FKO_SUCCESS && opts.sdp_id > 0)
+        res = fko_set_disable_sdp_mode(ctx, 0);
+    if(res == FKO_SUCCESS && opts.sdp_id > 0)
+        res = fko_set_sdp_id(ctx, opts.sdp_id);
+    if(res == FKO_SUCCESS)
+        res = fko_spa_data_final(ctx, opts.enc_key, strlen(opts.enc_key),
+                opts.hmac_key, strlen(opts.hmac_key));
+    if(res == FKO_SUCCESS)
+        res = fko_get_spa_data(ctx, &spa);
+
+    /* Grow the port list for as long as the packet still looks like a
+     * Rijndael one (longer packets are taken for GnuPG and rejected
+     * early), the expensive case for access checks.
+    */
+    while(fill && res == FKO_SUCCESS
+            && strlen(msg) + sizeof(",tcp/65535") < sizeof(msg))
+    {
+        strcat(msg, ",tcp/65535");
+        res = fko_set_spa_message(ctx, msg);
+        if(res == FKO_SUCCESS)
+            res = fko_spa_data_final(ctx, opts.enc_key, strlen(opts.enc_key),
+                    opts.hmac_key, strlen(opts.hmac_key));
+        if(res == FKO_SUCCESS)
+            res = fko_get_spa_data(ctx, &spa);
+        if(res == FKO_SUCCESS && strlen(spa) >= PERF_MIN_GNUPG_SIZE)
+        {
+            msg[strlen(msg) - strlen(",tcp/65535")] = '\0';
+            res = fko_set_spa_message(ctx, msg);
+            if(res == FKO_SUCCESS)
+                res = fko_spa_data_final(ctx, opts.enc_key, strlen(opts.enc_key),
+                        opts.hmac_key, strlen(opts.hmac_key));
+            if(res == FKO_SUCCESS)
+                res = fko_get_spa_data(ctx, &spa);
+            break;
+        }
+    }
+
+    if(res != FKO_SUCCESS)
+    {
+        fprintf(stderr, "[-] %s: %s\n", name, fko_errstr(res));
+        fko_destroy(ctx);
+        return -1;
+    }
+
+    res = write_file(dir, name, spa);
+    fko_destroy(ctx);
+    return res;
+}
+
+static void
+fill_str(char *buf, int len, const char *pattern)
+{
+    int i, plen = strlen(pattern);
+
+    for(i=0; i < len; i++)
+        buf[i] = pattern[i % plen];
+    buf[len] = '\0';
+}
+
+static int
+gen_inputs(const char *dir)
+{
+    char    path[PATH_MAX], buf[PERF_MAX_INPUT], b64[PERF_MAX_INPUT];
+    int     rv = 0, i, n;
+
+    mkdir(dir, 0755);
+
+    /* Encrypted packets: valid ones with maximum length fields, and the
+     * longest inputs an unauthenticated sender can make libfko look at
+    */
+    snprintf(path, sizeof(path), "%s/spa", dir);
+    mkdir(path, 0755);
+
+    rv |= gen_spa(path, "max_fields_access", FKO_ACCESS_MSG, 1);
+    rv |= gen_spa(path, "max_fields_nat", FKO_NAT_ACCESS_MSG, 0);
+    rv |= gen_spa(path, "max_fields_timeout_nat", FKO_CLIENT_TIMEOUT_NAT_ACCESS_MSG, 0);
+
+    fill_str(buf, PERF_MAX_ENCODED - 1, "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/");
+    rv |= write_file(path, "max_len_b64", buf);
+
+    fill_str(buf, PERF_MAX_ENCODED - 1, "A");
+    buf[PERF_MAX_ENCODED - 2] = '!';
+    rv |= write_file(path, "max_len_b64_bad_tail", buf);
+
+    fill_str(buf, PERF_MAX_ENCODED - 1, "A=");
+    rv |= write_file(path, "max_len_b64_padding", buf);
+
+    fill_str(buf, PERF_MAX_ENCODED - 1, "U2FsdGVkX1");
+    rv |= write_file(path, "max_len_salted_prefix", buf);
+
+    /* Decrypted packet data for the -e mode: maximum field lengths, long
+     * runs of separators and base64 that only goes wrong at the end
+    */
+    snprintf(path, sizeof(path), "%s/encoded", dir);
+    mkdir(path, 0755);
+
+    fill_str(b64, 340, "QUFB");
+    n = snprintf(buf, sizeof(buf), "1234567890123456:%.88s:1397329899:2.0.4:1:%s:%.172s",
+            b64, b64, b64);
+    buf[n < PERF_MAX_ENCODED ? n : PERF_MAX_ENCODED - 1] = '\0';
+    rv |= write_file(path, "max_fields", buf);
+
+    fill_str(buf, PERF_MAX_ENCODED - 1, ":");
+    rv |= write_file(path, "all_separators", buf);
+
+    for(i=0, n=0; n < PERF_MAX_ENCODED - 8; i++)
+        n += snprintf(buf + n, sizeof(buf) - n, "%s", i % 2 ? "QUFB" : ":");
+    rv |= write_file(path, "many_short_fields", buf);
+
+    fill_str(b64, PERF_MAX_ENCODED - 60, "QUFB");
+    b64[strlen(b64) - 1] = '!';
+    snprintf(buf, sizeof(buf), "1716411011200157:%s:1397329899:2.0.1:1:MTI3LjAuMC4yLHRjcC8yMg", b64);
+    buf[PERF_MAX_ENCODED - 1] = '\0';
+    rv |= write_file(path, "long_bad_b64_user", buf);
+
+    fill_str(b64, PERF_MAX_ENCODED - 80, "MTI3LjAuMC4yLHRjcC8yMiw");
+    snprintf(buf, sizeof(buf), "1716411011200157:cm9vdA:1397329899:2.0.1:1:%s", b64);
+    buf[PERF_MAX_ENCODED - 1] = '\0';
+    rv |= write_file(path, "long_message", buf);
+
+    if(rv == 0)
+        printf("[+] Wrote worst case inputs to %s/spa and %s/encoded\n", dir, dir);
+    return rv ? 1 : 0;
+}
+
+int
+main(int argc, char **argv)
+{
+    const char *cmd;
+    int         c;
+
+    if(argc < 3)
+    {
+        usage();
+        return 1;
+    }
+
+    cmd = argv[1];
+    argc--;
+    argv++;
+
+    opts.reps     = PERF_DEFAULT_REPS;
+    opts.keep     = PERF_DEFAULT_KEEP;
+    opts.factor   = PERF_DEFAULT_FACTOR;
+    opts.sdp_id   = PERF_DEFAULT_SDP_ID;
+    opts.enc_key  = ENC_KEY;
+    opts.hmac_key = HMAC_KEY;
+
+    while((c = getopt(argc, argv, "er:n:o:f:k:m:s:h")) != -1)
+    {
+        switch(c)
+        {
+            case 'e': opts.encoded = 1; break;
+            case 'r': opts.reps = atoi(optarg); break;
+            case 'n': opts.keep = atoi(optarg); break;
+            case 'o': opts.out_dir = optarg; break;
+            case 'f': opts.factor = atof(optarg); break;
+            case 'k': opts.enc_key = optarg; break;
+            case 'm': opts.hmac_key = optarg; break;
+            case 's': opts.sdp_id = strtoul(optarg, NULL, 10); break;
+            default:  usage(); return 1;
+        }
+    }
+
+    if(optind >= argc || opts.reps < 1 || opts.keep < 1 || opts.factor <= 0)
+    {
+        usage();
+        return 1;
+    }
+
+#if ! FUZZING_INTERFACES
+    if(opts.encoded)
+    {
+        fprintf(stderr, "[-] -e needs fko_perf_fuzz built with -DFUZZING_INTERFACES\n");
+        return 1;
+    }
+#endif
+
+    if(strcmp(cmd, "gen") == 0)
+        return gen_inputs(argv[optind]);
+
+    if(strcmp(cmd, "scan") == 0)
+        return run_scan(argc - optind, argv + optind);
+
+    if(strcmp(cmd, "replay") == 0)
+        return run_replay(argv[optind]);
+
+    usage();
+    return 1;
+}
@@ -0,0 +1,156 @@
+/*
+ * Benchmark the SHA-256 transform backends on SPA-sized inputs.
+ *
+ * SPA packets are short (a few hundred bytes), so the cost of the
+ * replay digest, the inner SPA digest and HMAC-SHA256 is dominated by
+ * per-call overhead and a handful of block transforms.  This compares
+ * the portable transform against the runtime-selected one for plain
+ * SHA-256 and for HMAC-SHA256 over those sizes, after checking that
+ * both backends produce identical output.
+ *
+ * This is built directly against the libfko sources since the SHA-256
+ * and HMAC routines are not exported by the library (see the Makefile).
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "../../config.h"
+#include "sha2.h"
+#include "hmac.h"
+
+#define BENCH_ITERATIONS    200000
+#define BENCH_MAX_LEN       1024
+
+static const int bench_sizes[] = { 32, 64, 128, 256, 512, 1024 };
+
+static double
+now_usec(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (double)tv.tv_sec * 1000000.0 + (double)tv.tv_usec;
+}
+
+static void
+sha256_digest(unsigned char *out, const unsigned char *in, size_t len)
+{
+    SHA256_CTX ctx;
+
+    SHA256_Init(&ctx);
+    SHA256_Update(&ctx, in, len);
+    SHA256_Final(out, &ctx);
+}
+
+/* Return the number of nanoseconds per operation
+*/
+static double
+bench_sha256(const unsigned char *buf, int len)
+{
+    unsigned char   md[SHA256_DIGEST_LEN];
+    double          start;
+    int             i;
+
+    start = now_usec();
+    for(i=0; i < BENCH_ITERATIONS; i++)
+        sha256_digest(md, buf, len);
+    return (now_usec() - start) * 1000.0 / BENCH_ITERATIONS;
+}
+
+static double
+bench_hmac_sha256(const unsigned char *buf, int len, const char *key)
+{
+    unsigned char   hmac[SHA256_DIGEST_LEN];
+    double          start;
+    int             i;
+
+    start = now_usec();
+    for(i=0; i < BENCH_ITERATIONS; i++)
+        hmac_sha256((const char *)buf, len, hmac, key, strlen(key));
+    return (now_usec() - start) * 1000.0 / BENCH_ITERATIONS;
+}
+
+/* Make sure the selected backend agrees with the portable code (and with
+ * the FIPS 180-2 "abc" test vector) on every length up to BENCH_MAX_LEN.
+*/
+static int
+verify_backends(const unsigned char *buf, int backend)
+{
+    static const unsigned char abc_md[SHA256_DIGEST_LEN] = {
+        0xba, 0x78, 0x16, 0xbf, 0x8f, 0x01, 0xcf, 0xea,
+        0x41, 0x41, 0x40, 0xde, 0x5d, 0xae, 0x22, 0x23,
+        0xb0, 0x03, 0x61, 0xa3, 0x96, 0x17, 0x7a, 0x9c,
+        0xb4, 0x10, 0xff, 0x61, 0xf2, 0x00, 0x15, 0xad
+    };
+    unsigned char   md_ref[SHA256_DIGEST_LEN];
+    unsigned char   md[SHA256_DIGEST_LEN];
+    int             len;
+
+    SHA256_Set_Backend(backend);
+    sha256_digest(md, (const unsigned char *)"abc", 3);
+    if(memcmp(md, abc_md, SHA256_DIGEST_LEN) != 0)
+    {
+        printf("[-] %s: 'abc' test vector mismatch\n", SHA256_Backend_Name());
+        return 0;
+    }
+
+    for(len=0; len <= BENCH_MAX_LEN; len++)
+    {
+        SHA256_Set_Backend(SHA256_BACKEND_PORTABLE);
+        sha256_digest(md_ref, buf, len);
+        SHA256_Set_Backend(backend);
+        sha256_digest(md, buf, len);
+        if(memcmp(md, md_ref, SHA256_DIGEST_LEN) != 0)
+        {
+            printf("[-] %s: digest mismatch at length %d\n",
+                    SHA256_Backend_Name(), len);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int
+main(void)
+{
+    unsigned char   buf[BENCH_MAX_LEN];
+    const char     *hmac_key = "fwknop-bench-hmac-key-0123456789";
+    double          portable_ns, fast_ns;
+    int             i;
+
+    for(i=0; i < BENCH_MAX_LEN; i++)
+        buf[i] = (unsigned char)(i * 7 + 3);
+
+    SHA256_Set_Backend(SHA256_BACKEND_AUTO);
+    printf("[+] Selected SHA-256 backend: %s\n", SHA256_Backend_Name());
+
+    if(! verify_backends(buf, SHA256_BACKEND_AUTO))
+        return 1;
+    printf("[+] Backend output matches the portable transform\n\n");
+
+    printf("%-12s %6s %12s %12s %8s\n",
+            "op", "bytes", "portable ns", "selected ns", "speedup");
+
+    for(i=0; i < (int)(sizeof(bench_sizes)/sizeof(bench_sizes[0])); i++)
+    {
+        SHA256_Set_Backend(SHA256_BACKEND_PORTABLE);
+        portable_ns = bench_sha256(buf, bench_sizes[i]);
+        SHA256_Set_Backend(SHA256_BACKEND_AUTO);
+        fast_ns = bench_sha256(buf, bench_sizes[i]);
+        printf("%-12s %6d %12.1f %12.1f %7.2fx\n", "sha256",
+                bench_sizes[i], portable_ns, fast_ns, portable_ns / fast_ns);
+    }
+
+    for(i=0; i < (int)(sizeof(bench_sizes)/sizeof(bench_sizes[0])); i++)
+    {
+        SHA256_Set_Backend(SHA256_BACKEND_PORTABLE);
+        portable_ns = bench_hmac_sha256(buf, bench_sizes[i], hmac_key);
+        SHA256_Set_Backend(SHA256_BACKEND_AUTO);
+        fast_ns = bench_hmac_sha256(buf, bench_sizes[i], hmac_key);
+        printf("%-12s %6d %12.1f %12.1f %7.2fx\n", "hmac-sha256",
+                bench_sizes[i], portable_ns, fast_ns, portable_ns / fast_ns);
+    }
+
+    return 0;
+}
@@ -0,0 +1,1605 @@
+/*
+ * sdp_ctrl_sim.c
+ *
+ * Stand-in SDP controller for exercising the control channel offline.
+ *
+ * In serve mode this speaks the controller side of the framed JSON
+ * protocol used by lib/sdp_com.c and lib/sdp_ctrl_client.c: it greets
+ * each peer with credentials_good, answers credential requests with a
+ * credential_update, echoes keep-alives, serves service and access
+ * refreshes of any size (split into a refresh followed by update
+ * messages, since each message is limited to SDP_MSG_MAX_LEN), and
+ * counts acks, connection_update reports, resumed TLS sessions and
+ * compressed frames.  Point fwknopd or the fwknop client at it with
+ * USE_SPA set to N.
+ *
+ * In load mode it plays thousands of gateways against a controller:
+ * each one connects, fetches credentials, services and access data,
+ * then sends a number of connection_update + keep_alive rounds.  The
+ * latency of each exchange is recorded and summarized at the end.
+ * Only gateways are simulated, there is no load mode for clients.
+ *
+ * Bench mode forks a server on a loopback port and runs the load
+ * against it, which gives a self-contained control-plane benchmark.
+ *
+ * See the README in this directory for usage.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <zlib.h>
+#include <json-c/json.h>
+#include "fko.h"
+#include "sdp_ctrl_client.h"
+
+#define SIM_DEFAULT_PORT            5000
+#define SIM_DEFAULT_CERT            "../conf/sdp-ctrl-client/server.crt"
+#define SIM_DEFAULT_KEY             "../conf/sdp-ctrl-client/server.key"
+#define SIM_DEFAULT_CLIENT_CERT     "../conf/sdp-ctrl-client/client.crt"
+#define SIM_DEFAULT_CLIENT_KEY      "../conf/sdp-ctrl-client/client.key"
+#define SIM_DEFAULT_SERVICES        10
+#define SIM_DEFAULT_STANZAS         1000
+#define SIM_DEFAULT_GATEWAYS        100
+#define SIM_DEFAULT_ROUNDS          10
+#define SIM_DEFAULT_CONNS           20
+#define SIM_DEFAULT_MAX_CONNECTING  256
+#define SIM_FIRST_SDP_ID            100000
+#define SIM_READ_LEN                16384
+#define SIM_POLL_MS                 1000
+
+/* Leave room for the action envelope around a data array
+*/
+#define SIM_MSG_BUDGET              (SDP_MSG_MAX_LEN - 256)
+
+enum {
+    SIM_MODE_SERVE,
+    SIM_MODE_LOAD,
+    SIM_MODE_BENCH
+};
+
+/* Messages counted by the simulator, indexed by sim_action_names[]
+*/
+enum {
+    SIM_MSG_CRED_REQUEST,
+    SIM_MSG_CRED_GOOD,
+    SIM_MSG_CRED_UPDATE,
+    SIM_MSG_CRED_ACK,
+    SIM_MSG_KEEP_ALIVE,
+    SIM_MSG_SERVICE_REQUEST,
+    SIM_MSG_SERVICE_REFRESH,
+    SIM_MSG_SERVICE_UPDATE,
+    SIM_MSG_SERVICE_ACK,
+    SIM_MSG_ACCESS_REQUEST,
+    SIM_MSG_ACCESS_REFRESH,
+    SIM_MSG_ACCESS_UPDATE,
+    SIM_MSG_ACCESS_ACK,
+    SIM_MSG_CONN_UPDATE,
+    SIM_MSG_BAD_MESSAGE,
+    SIM_MSG_UNKNOWN,
+    SIM_MSG_COUNT
+};
+
+/* Exchanges timed in load mode
+*/
+enum {
+    SIM_LAT_CONNECT,
+    SIM_LAT_CREDS,
+    SIM_LAT_SERVICES,
+    SIM_LAT_ACCESS,
+    SIM_LAT_KEEP_ALIVE,
+    SIM_LAT_COUNT
+};
+
+static const char *sim_lat_names[SIM_LAT_COUNT] = {
+    "tcp+tls connect", "credentials", "service refresh",
+    "access refresh", "keep alive"
+};
+
+/* Connection states.  Server connections only use the first three.
+*/
+enum {
+    SIM_CONN_CONNECTING,
+    SIM_CONN_HANDSHAKE,
+    SIM_CONN_READY,
+    SIM_CONN_GREETING_WAIT,
+    SIM_CONN_CRED_WAIT,
+    SIM_CONN_SERVICE_WAIT,
+    SIM_CONN_ACCESS_WAIT,
+    SIM_CONN_KEEP_ALIVE_WAIT,
+    SIM_CONN_DONE,
+    SIM_CONN_FAILED
+};
+
+typedef struct sim_buf
+{
+    char   *data;
+    size_t  len;
+    size_t  size;
+} sim_buf_t;
+
+typedef struct sim_conn
+{
+    int         fd;
+    SSL        *ssl;
+    int         state;
+    int         rounds_left;
+    double      t_start;
+    int         deflate;        /* peer has advertised compression */
+    sim_buf_t   in;
+    sim_buf_t   out;
+} sim_conn_t;
+
+typedef struct sim_lat
+{
+    double     *v;
+    size_t      n;
+    size_t      size;
+} sim_lat_t;
+
+typedef struct sim_opts
+{
+    int         mode;
+    char       *addr;
+    int         port;
+    char       *cert_file;
+    char       *key_file;
+    int         services;
+    int         stanzas;
+    int         compress;
+    int         gateways;
+    int         rounds;
+    int         conns_per_update;
+    int         max_connecting;
+    int         stats_interval;
+    int         verbose;
+} sim_opts_t;
+
+/* Messages built once and queued as-is.  Each one is already framed,
+ * and with --compress there is a second, deflated set for peers that
+ * have advertised compression.
+*/
+typedef struct sim_frames
+{
+    sim_buf_t   cred_good;
+    sim_buf_t   cred_update;
+    sim_buf_t   keep_alive;
+    sim_buf_t   service_refresh;    /* service_refresh + service_updates */
+    sim_buf_t   access_refresh;     /* access_refresh + access_updates */
+    sim_buf_t   cred_request;
+    sim_buf_t   service_request;
+    sim_buf_t   access_request;
+    sim_buf_t   service_ack;
+    sim_buf_t   access_ack;
+    sim_buf_t   cred_ack;
+    sim_buf_t   conn_update;
+    int         service_msgs;
+    int         access_msgs;
+} sim_frames_t;
+
+static const char *sim_action_names[SIM_MSG_COUNT] = {
+    "credential_update_request", "credentials_good", "credential_update",
+    "credential_update_ack", "keep_alive", "service_refresh_request",
+    "service_refresh", "service_update", "service_ack",
+    "access_refresh_request", "access_refresh", "access_update",
+    "access_ack", "connection_update", "bad_message", "<unknown>"
+};
+
+static sim_opts_t       opts;
+static sim_frames_t     frames, zframes;
+static int              deflate_frames;
+static unsigned long    msgs_in[SIM_MSG_COUNT];
+static unsigned long    msgs_out;
+static unsigned long    conn_entries;
+static unsigned long    tls_resumed;
+static unsigned long    deflated_in;
+static unsigned long long bytes_in, bytes_out;
+static char             msg_buf[SDP_MSG_MAX_LEN + 1];
+static volatile sig_atomic_t got_stop = 0;
+
+static void
+stop_handler(int sig)
+{
+    got_stop = 1;
+}
+
+static double
+now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr,
+"Usage: sdp_ctrl_sim [mode] [options]\n\n"
+"Modes:\n"
+"  -S, --serve             Act as the controller (default)\n"
+"  -L, --load              Simulate gateways against a controller\n"
+"  -B, --bench             Fork a loopback controller and run the load\n\n"
+"Options:\n"
+"  -a, --addr <addr>       Controller address for --load (127.0.0.1)\n"
+"  -p, --port <port>       Controller port (%d, 0 picks one for --bench)\n"
+"  -c, --cert <file>       TLS certificate\n"
+"  -k, --key <file>        TLS private key\n"
+"  -s, --services <n>      Services in a service refresh (%d)\n"
+"  -n, --stanzas <n>       Access stanzas (clients) in an access refresh (%d)\n"
+"  -z, --compress          Advertise compression, deflate frames to peers that do\n"
+"  -g, --gateways <n>      Simulated gateways for --load (%d)\n"
+"  -r, --rounds <n>        keep_alive rounds per gateway (%d)\n"
+"  -u, --conns <n>         Connections reported per connection_update (%d)\n"
+"  -m, --max-connecting <n> Gateways in the TCP/TLS handshake at once (%d)\n"
+"  -i, --interval <sec>    Print server counters every <sec> seconds\n"
+"  -v, --verbose           Log each connection\n"
+"  -h, --help              Show this help\n",
+        SIM_DEFAULT_PORT, SIM_DEFAULT_SERVICES, SIM_DEFAULT_STANZAS,
+        SIM_DEFAULT_GATEWAYS, SIM_DEFAULT_ROUNDS, SIM_DEFAULT_CONNS,
+        SIM_DEFAULT_MAX_CONNECTING);
+}
+
+static int
+buf_reserve(sim_buf_t *b, size_t needed)
+{
+    char   *tmp;
+    size_t  size = b->size ? b->size : 4096;
+
+    if(needed <= b->size)
+        return 0;
+
+    while(size < needed)
+        size *= 2;
+
+    if((tmp = realloc(b->data, size)) == NULL)
+    {
+        fprintf(stderr, "[-] Out of memory\n");
+        return -1;
+    }
+    b->data = tmp;
+    b->size = size;
+    return 0;
+}
+
+static int
+buf_append(sim_buf_t *b, const char *data, size_t len)
+{
+    if(buf_reserve(b, b->len + len) != 0)
+        return -1;
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+    return 0;
+}
+
+/* Append one message to b the way sdp_com_send_msg() frames it
+*/
+static int
+frame_msg(sim_buf_t *b, const char *msg)
+{
+    uint32_t        msg_len = strlen(msg), header = msg_len;
+    uLongf          z_len = compressBound(msg_len);
+    unsigned char  *frame;
+
+    if(msg_len >= SDP_MSG_MAX_LEN || msg_len < SDP_MSG_MIN_LEN)
+    {
+        fprintf(stderr, "[-] Message length %u is outside the protocol limits\n",
+                msg_len);
+        return -1;
+    }
+
+    if(buf_reserve(b, b->len + SDP_COM_HEADER_LEN + z_len) != 0)
+        return -1;
+
+    frame = (unsigned char *)b->data + b->len;
+
+    if(deflate_frames && msg_len >= SDP_COM_COMPRESS_MIN_LEN
+            && compress2(frame + SDP_COM_HEADER_LEN, &z_len,
+                (const Bytef *)msg, msg_len, Z_DEFAULT_COMPRESSION) == Z_OK
+            && z_len < msg_len)
+        header = (uint32_t)z_len | SDP_COM_HEADER_DEFLATED;
+    else
+        memcpy(frame + SDP_COM_HEADER_LEN, msg, msg_len);
+
+    frame[0] = (header >> 24) & 0xFF;
+    frame[1] = (header >> 16) & 0xFF;
+    frame[2] = (header >> 8) & 0xFF;
+    frame[3] = header & 0xFF;
+    b->len += SDP_COM_HEADER_LEN + (header & ~SDP_COM_HEADER_DEFLATED);
+    return 0;
+}
+
+static int
+frame_action(sim_buf_t *b, const char *action, json_object *jdata)
+{
+    char   *msg = NULL, *adv_msg = NULL;
+    int     rv;
+
+    if(sdp_message_make(action, jdata, &msg) != SDP_SUCCESS)
+    {
+        fprintf(stderr, "[-] Failed to make '%s' message\n", action);
+        return -1;
+    }
+    /* Advertise compression the way sdp_com_send_msg() does
+    */
+    if(opts.compress && msg[0] == '{' && msg[1] != '}')
+    {
+        if((adv_msg = malloc(strlen(msg) + strlen(SDP_COM_DEFLATE_ADVERT))) == NULL)
+        {
+            free(msg);
+            return -1;
+        }
+        strcpy(adv_msg, SDP_COM_DEFLATE_ADVERT);
+        strcat(adv_msg, msg + 1);
+        free(msg);
+        msg = adv_msg;
+    }
+    rv = frame_msg(b, msg);
+    free(msg);
+    return rv;
+}
+
+/* Frame a list of entries as one refresh message followed by as many
+ * update messages as needed to keep each under the message size limit.
+ * Returns the number of messages.
+*/
+static int
+frame_entries(sim_buf_t *b, const char *refresh, const char *update,
+        json_object **entries, int count)
+{
+    json_object    *jarray;
+    const char     *action = refresh;
+    size_t          len;
+    int             i = 0, msgs = 0;
+
+    do
+    {
+        jarray = json_object_new_array();
+        len = 0;
+
+        for(; i < count; i++)
+        {
+            len += strlen(json_object_to_json_string(entries[i])) + 2;
+            if(len > SIM_MSG_BUDGET && json_object_array_length(jarray) > 0)
+                break;
+            json_object_array_add(jarray, entries[i]);
+        }
+
+        if(frame_action(b, action, jarray) != 0)
+        {
+            json_object_put(jarray);
+            return -1;
+        }
+        json_object_put(jarray);
+        action = update;
+        msgs++;
+
+    } while(i < count);
+
+    return msgs;
+}
+
+/* Deterministic per-client key material, so a run can be repeated
+*/
+static void
+sim_key_b64(uint32_t seed, int len, char *out)
+{
+    unsigned char   key[64];
+    uint32_t        x = seed * 2654435761U + 1;
+    int             i;
+
+    for(i=0; i < len; i++)
+    {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        key[i] = x & 0xFF;
+    }
+    fko_base64_encode(key, out, len);
+}
+
+static int
+read_file(const char *file, sim_buf_t *b)
+{
+    FILE   *fp;
+    char    buf[4096];
+    size_t  n;
+
+    if((fp = fopen(file, "r")) == NULL)
+    {
+        fprintf(stderr, "[-] Could not open %s: %s\n", file, strerror(errno));
+        return -1;
+    }
+    while((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+        if(buf_append(b, buf, n) != 0)
+            break;
+    fclose(fp);
+
+    return buf_append(b, "", 1);
+}
+
+/* Every peer gets the SPA keys of the first access stanza, so a client
+ * using SDP ID SIM_FIRST_SDP_ID is let in by a gateway served from here.
+ * The TLS credentials handed out are the simulator's own.
+*/
+static int
+build_cred_update_frame(sim_frames_t *f)
+{
+    json_object    *jcreds;
+    sim_buf_t       cert, key;
+    char            b64[128];
+    int             rv = -1;
+
+    memset(&cert, 0x0, sizeof(cert));
+    memset(&key, 0x0, sizeof(key));
+
+    if(read_file(opts.cert_file, &cert) != 0 || read_file(opts.key_file, &key) != 0)
+        goto cleanup;
+
+    jcreds = json_object_new_object();
+    sim_key_b64(SIM_FIRST_SDP_ID, 32, b64);
+    json_object_object_add(jcreds, "spa_encryption_key_base64", json_object_new_string(b64));
+    sim_key_b64(~SIM_FIRST_SDP_ID, 64, b64);
+    json_object_object_add(jcreds, "spa_hmac_key_base64", json_object_new_string(b64));
+    json_object_object_add(jcreds, "tls_cert", json_object_new_string(cert.data));
+    json_object_object_add(jcreds, "tls_key", json_object_new_string(key.data));
+
+    rv = frame_action(&f->cred_update, sdp_action_cred_update, jcreds);
+    json_object_put(jcreds);
+
+cleanup:
+    free(cert.data);
+    free(key.data);
+    return rv;
+}
+
+static int
+build_service_frames(sim_frames_t *f)
+{
+    json_object   **entries, *jentry;
+    char            ip[INET_ADDRSTRLEN];
+    int             i, rv;
+
+    if((entries = calloc(opts.services > 0 ? opts.services : 1, sizeof(*entries))) == NULL)
+        return -1;
+
+    for(i=0; i < opts.services; i++)
+    {
+        jentry = json_object_new_object();
+        json_object_object_add(jentry, "service_id", json_object_new_int(i + 1));
+        json_object_object_add(jentry, "proto", json_object_new_string(i % 2 ? "udp" : "tcp"));
+        json_object_object_add(jentry, "port", json_object_new_int(10000 + i % 50000));
+        if(i % 4 == 0)
+        {
+            snprintf(ip, sizeof(ip), "10.%d.%d.%d",
+                    (i >> 16) & 0xFF, (i >> 8) & 0xFF, i & 0xFF);
+            json_object_object_add(jentry, "nat_ip", json_object_new_string(ip));
+            json_object_object_add(jentry, "nat_port", json_object_new_int(20000 + i % 40000));
+        }
+        entries[i] = jentry;
+    }
+
+    rv = frame_entries(&f->service_refresh, sdp_action_service_refresh,
+            sdp_action_service_update, entries, opts.services);
+    free(entries);
+
+    if(rv < 0)
+        return -1;
+    f->service_msgs = rv;
+    return 0;
+}
+
+static int
+build_access_frames(sim_frames_t *f)
+{
+    json_object   **entries, *jentry;
+    char            key[128], service_list[64];
+    int             i, rv;
+
+    if((entries = calloc(opts.stanzas > 0 ? opts.stanzas : 1, sizeof(*entries))) == NULL)
+        return -1;
+
+    for(i=0; i < opts.stanzas; i++)
+    {
+        jentry = json_object_new_object();
+        json_object_object_add(jentry, "sdp_id", json_object_new_int(SIM_FIRST_SDP_ID + i));
+        json_object_object_add(jentry, "source", json_object_new_string("ANY"));
+        snprintf(service_list, sizeof(service_list), "%d",
+                opts.services > 0 ? i % opts.services + 1 : 1);
+        json_object_object_add(jentry, "service_list", json_object_new_string(service_list));
+        sim_key_b64(SIM_FIRST_SDP_ID + i, 32, key);
+        json_object_object_add(jentry, "spa_encryption_key_base64", json_object_new_string(key));
+        sim_key_b64(~(SIM_FIRST_SDP_ID + i), 64, key);
+        json_object_object_add(jentry, "spa_hmac_key_base64", json_object_new_string(key));
+        json_object_object_add(jentry, "hmac_type", json_object_new_string("sha256"));
+        json_object_object_add(jentry, "fw_access_timeout", json_object_new_int(30));
+        entries[i] = jentry;
+    }
+
+    rv = frame_entries(&f->access_refresh, sdp_action_access_refresh,
+            sdp_action_access_update, entries, opts.stanzas);
+    free(entries);
+
+    if(rv < 0)
+        return -1;
+    f->access_msgs = rv;
+    return 0;
+}
+
+static int
+build_conn_update_frame(sim_frames_t *f)
+{
+    json_object    *jarray, *jconn;
+    char            ip[INET_ADDRSTRLEN];
+    time_t          now = time(NULL);
+    int             i, rv;
+
+    jarray = json_object_new_array();
+    for(i=0; i < opts.conns_per_update; i++)
+    {
+        jconn = json_object_new_object();
+        snprintf(ip, sizeof(ip), "192.168.%d.%d", (i >> 8) & 0xFF, i & 0xFF);
+        json_object_object_add(jconn, "sdp_id", json_object_new_int(SIM_FIRST_SDP_ID + i));
+        json_object_object_add(jconn, "service_id", json_object_new_int(1));
+        json_object_object_add(jconn, "protocol", json_object_new_string("TCP"));
+        json_object_object_add(jconn, "source_ip", json_object_new_string(ip));
+        json_object_object_add(jconn, "source_port", json_object_new_int(40000 + i % 20000));
+        json_object_object_add(jconn, "destination_ip", json_object_new_string("10.0.0.1"));
+        json_object_object_add(jconn, "destination_port", json_object_new_int(22));
+        json_object_object_add(jconn, "nat_destination_ip", json_object_new_string(""));
+        json_object_object_add(jconn, "nat_destination_port", json_object_new_int(0));
+        json_object_object_add(jconn, "start_timestamp", json_object_new_int64(now));
+        json_object_object_add(jconn, "end_timestamp", json_object_new_int64(0));
+        json_object_array_add(jarray, jconn);
+    }
+
+    rv = frame_action(&f->conn_update, sdp_action_connection_update, jarray);
+    json_object_put(jarray);
+    return rv;
+}
+
+static int
+build_frame_set(sim_frames_t *f)
+{
+    if(frame_action(&f->keep_alive, sdp_action_keep_alive, NULL) != 0)
+        return -1;
+
+    if(opts.mode != SIM_MODE_LOAD)
+    {
+        if(frame_action(&f->cred_good, sdp_action_credentials_good, NULL) != 0
+                || build_cred_update_frame(f) != 0
+                || build_service_frames(f) != 0
+                || build_access_frames(f) != 0)
+            return -1;
+
+        fprintf(stderr, "[+] Service refresh%s: %d services in %d message(s), %lu bytes\n",
+                deflate_frames ? " (compressed)" : "",
+                opts.services, f->service_msgs, (unsigned long)f->service_refresh.len);
+        fprintf(stderr, "[+] Access refresh%s: %d stanzas in %d message(s), %lu bytes\n",
+                deflate_frames ? " (compressed)" : "",
+                opts.stanzas, f->access_msgs, (unsigned long)f->access_refresh.len);
+    }
+
+    if(opts.mode != SIM_MODE_SERVE)
+    {
+        if(frame_action(&f->cred_request, sdp_action_cred_update_request, NULL) != 0
+                || frame_action(&f->service_request, sdp_action_service_refresh_request, NULL) != 0
+                || frame_action(&f->access_request, sdp_action_access_refresh_request, NULL) != 0
+                || frame_action(&f->service_ack, sdp_action_service_ack, NULL) != 0
+                || frame_action(&f->access_ack, sdp_action_access_ack, NULL) != 0
+                || frame_action(&f->cred_ack, sdp_action_cred_ack, NULL) != 0
+                || build_conn_update_frame(f) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+/* Plain frames are always built, since every connection starts out
+ * uncompressed.  The deflated set is only used once the peer has
+ * advertised that it can inflate them.
+*/
+static int
+build_frames(void)
+{
+    if(build_frame_set(&frames) != 0)
+        return -1;
+
+    if(opts.compress)
+    {
+        deflate_frames = 1;
+        if(build_frame_set(&zframes) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+/* The frame set to send to a connection
+*/
+static const sim_frames_t *
+conn_frames(const sim_conn_t *c)
+{
+    return (opts.compress && c->deflate) ? &zframes : &frames;
+}
+
+static int
+queue_frames(sim_conn_t *c, const sim_buf_t *f, int msgs)
+{
+    msgs_out += msgs;
+    return buf_append(&c->out, f->data, f->len);
+}
+
+/* Write queued data.  Returns -1 if the connection is dead.
+*/
+static int
+conn_flush(sim_conn_t *c)
+{
+    int     n, err;
+    size_t  sent = 0;
+
+    while(sent < c->out.len)
+    {
+        n = SSL_write(c->ssl, c->out.data + sent,
+                c->out.len - sent > INT32_MAX ? INT32_MAX : (int)(c->out.len - sent));
+        if(n <= 0)
+        {
+            err = SSL_get_error(c->ssl, n);
+            if(err == SSL_ERROR_WANT_WRITE || err == SSL_ERROR_WANT_READ)
+                break;
+            return -1;
+        }
+        sent += n;
+    }
+
+    bytes_out += sent;
+    if(sent > 0)
+    {
+        memmove(c->out.data, c->out.data + sent, c->out.len - sent);
+        c->out.len -= sent;
+    }
+    return 0;
+}
+
+/* Read everything available.  Returns -1 on EOF or error.
+*/
+static int
+conn_fill(sim_conn_t *c)
+{
+    int     n, err;
+
+    while(1)
+    {
+        if(buf_reserve(&c->in, c->in.len + SIM_READ_LEN) != 0)
+            return -1;
+
+        n = SSL_read(c->ssl, c->in.data + c->in.len, SIM_READ_LEN);
+        if(n <= 0)
+        {
+            err = SSL_get_error(c->ssl, n);
+            if(err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE)
+                return 0;
+            return -1;
+        }
+        c->in.len += n;
+        bytes_in  += n;
+    }
+}
+
+/* Pull the next complete message out of the receive buffer into
+ * msg_buf.  Returns 1 if there was one, 0 if not, -1 on a bad frame.
+*/
+static int
+conn_next_msg(sim_conn_t *c, size_t *consumed)
+{
+    unsigned char  *p = (unsigned char *)c->in.data + *consumed;
+    size_t          avail = c->in.len - *consumed;
+    uint32_t        header, body_len;
+    uLongf          out_len = SDP_MSG_MAX_LEN;
+
+    if(avail < SDP_COM_HEADER_LEN)
+        return 0;
+
+    header   = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16)
+             | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+    body_len = header & ~SDP_COM_HEADER_DEFLATED;
+
+    if(body_len == 0 || body_len > SDP_MSG_MAX_LEN)
+        return -1;
+
+    if(avail < SDP_COM_HEADER_LEN + body_len)
+        return 0;
+
+    if(header & SDP_COM_HEADER_DEFLATED)
+    {
+        if(uncompress((Bytef *)msg_buf, &out_len, p + SDP_COM_HEADER_LEN, body_len) != Z_OK)
+            return -1;
+        msg_buf[out_len] = '\0';
+    }
+    else
+    {
+        memcpy(msg_buf, p + SDP_COM_HEADER_LEN, body_len);
+        msg_buf[body_len] = '\0';
+    }
+
+    if(header & SDP_COM_HEADER_DEFLATED)
+        deflated_in++;
+
+    if((header & SDP_COM_HEADER_DEFLATED) || sdp_com_msg_advertises_deflate(msg_buf))
+        c->deflate = 1;
+
+    *consumed += SDP_COM_HEADER_LEN + body_len;
+    return 1;
+}
+
+static int
+msg_type(const char *action)
+{
+    int     i;
+
+    if(action == NULL)
+        return SIM_MSG_UNKNOWN;
+
+    for(i=0; i < SIM_MSG_UNKNOWN; i++)
+        if(strcmp(action, sim_action_names[i]) == 0)
+            return i;
+
+    return SIM_MSG_UNKNOWN;
+}
+
+/* Parse msg_buf and return its SIM_MSG_* type, with the parsed message
+ * in *r_jmsg for the caller to release.
+*/
+static int
+parse_msg(json_object **r_jmsg)
+{
+    json_object    *jmsg, *jaction, *jdata;
+    int             type = SIM_MSG_UNKNOWN;
+
+    if((jmsg = json_tokener_parse(msg_buf)) != NULL
+            && json_object_object_get_ex(jmsg, sdp_key_action, &jaction)
+            && json_object_get_type(jaction) == json_type_string)
+        type = msg_type(json_object_get_string(jaction));
+
+    if(type == SIM_MSG_CONN_UPDATE
+            && json_object_object_get_ex(jmsg, sdp_key_data, &jdata)
+            && json_object_get_type(jdata) == json_type_array)
+        conn_entries += json_object_array_length(jdata);
+
+    msgs_in[type]++;
+    *r_jmsg = jmsg;
+    return type;
+}
+
+static void
+conn_close(sim_conn_t *c)
+{
+    if(c->ssl != NULL)
+    {
+        SSL_shutdown(c->ssl);
+        SSL_free(c->ssl);
+        c->ssl = NULL;
+    }
+    if(c->fd >= 0)
+        close(c->fd);
+    c->fd = -1;
+    free(c->in.data);
+    free(c->out.data);
+    memset(&c->in, 0x0, sizeof(c->in));
+    memset(&c->out, 0x0, sizeof(c->out));
+}
+
+static void
+set_nonblocking(int fd)
+{
+    int     one = 1;
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+/* Raise the open file limit as far as allowed, since every simulated
+ * gateway needs a socket.
+*/
+static void
+raise_fd_limit(void)
+{
+    struct rlimit   rl;
+
+    if(getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max)
+    {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+
+static int
+verify_any_cb(int preverify_ok, X509_STORE_CTX *ctx)
+{
+    return 1;
+}
+
+static SSL_CTX *
+make_ssl_ctx(int server)
+{
+    SSL_CTX    *ctx;
+
+    SSL_library_init();
+    SSL_load_error_strings();
+
+    ctx = SSL_CTX_new(server ? SSLv23_server_method() : SSLv23_client_method());
+    if(ctx == NULL)
+        goto err;
+
+    SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE
+            | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+    /* The certificates under test/conf use 1024 bit keys
+    */
+    SSL_CTX_set_security_level(ctx, 1);
+#endif
+
+    if(SSL_CTX_use_certificate_file(ctx, opts.cert_file, SSL_FILETYPE_PEM) <= 0
+            || SSL_CTX_use_PrivateKey_file(ctx, opts.key_file, SSL_FILETYPE_PEM) <= 0
+            || !SSL_CTX_check_private_key(ctx))
+        goto err;
+
+    /* Like the real controller, ask gateways for their certificate, but
+     * accept whatever they present.  Sessions can only be resumed once
+     * a session id context is set.
+    */
+    if(server)
+    {
+        SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, verify_any_cb);
+        SSL_CTX_set_session_id_context(ctx, (const unsigned char *)"sdp_ctrl_sim",
+                strlen("sdp_ctrl_sim"));
+    }
+
+    return ctx;
+
+err:
+    fprintf(stderr, "[-] TLS setup failed (cert: %s, key: %s)\n",
+            opts.cert_file, opts.key_file);
+    ERR_print_errors_fp(stderr);
+    if(ctx != NULL)
+        SSL_CTX_free(ctx);
+    return NULL;
+}
+
+static int
+listen_socket(int port, int *r_port)
+{
+    struct sockaddr_in  addr;
+    socklen_t           addr_len = sizeof(addr);
+    int                 fd, one = 1;
+
+    if((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+        return -1;
+
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    memset(&addr, 0x0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons(port);
+    addr.sin_addr.s_addr = opts.mode == SIM_MODE_BENCH
+        ? htonl(INADDR_LOOPBACK) : htonl(INADDR_ANY);
+
+    if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0
+            || listen(fd, SOMAXCONN) != 0
+            || getsockname(fd, (struct sockaddr *)&addr, &addr_len) != 0)
+    {
+        fprintf(stderr, "[-] Could not listen on port %d: %s\n", port, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    set_nonblocking(fd);
+    *r_port = ntohs(addr.sin_port);
+    return fd;
+}
+
+static void
+print_server_counters(FILE *out, int conns, double elapsed)
+{
+    unsigned long   total = 0;
+    int             i;
+
+    for(i=0; i < SIM_MSG_COUNT; i++)
+        total += msgs_in[i];
+
+    fprintf(out, "[server] %.1fs: %d connection(s), %lu msgs in (%.0f/s), "
+            "%lu msgs out, %llu bytes in, %llu bytes out, %lu reported connections\n",
+            elapsed, conns, total, elapsed > 0 ? total / elapsed : 0.0,
+            msgs_out, bytes_in, bytes_out, conn_entries);
+
+    for(i=0; i < SIM_MSG_COUNT; i++)
+        if(msgs_in[i] > 0)
+            fprintf(out, "         %-26s %lu\n", sim_action_names[i], msgs_in[i]);
+
+    fprintf(out, "         %-26s %lu\n", "resumed TLS sessions", tls_resumed);
+    fprintf(out, "         %-26s %lu\n", "deflated frames received", deflated_in);
+}
+
+/* Reply to one message from a gateway
+*/
+static int
+serve_msg(sim_conn_t *c)
+{
+    json_object    *jmsg = NULL;
+    int             rv = 0;
+
+    switch(parse_msg(&jmsg))
+    {
+        case SIM_MSG_CRED_REQUEST:
+            rv = queue_frames(c, &conn_frames(c)->cred_update, 1);
+            break;
+
+        case SIM_MSG_KEEP_ALIVE:
+            rv = queue_frames(c, &conn_frames(c)->keep_alive, 1);
+            break;
+
+        case SIM_MSG_SERVICE_REQUEST:
+            rv = queue_frames(c, &conn_frames(c)->service_refresh, conn_frames(c)->service_msgs);
+            break;
+
+        case SIM_MSG_ACCESS_REQUEST:
+            rv = queue_frames(c, &conn_frames(c)->access_refresh, conn_frames(c)->access_msgs);
+            break;
+
+        case SIM_MSG_UNKNOWN:
+            /* Hand it back the way the controller reports bad messages
+            */
+            msgs_out++;
+            rv = frame_action(&c->out, sdp_action_bad_message, jmsg);
+            break;
+
+        default:
+            /* acks, connection updates and bad_message notices need
+             * no answer
+            */
+            break;
+    }
+
+    if(jmsg != NULL)
+        json_object_put(jmsg);
+    return rv;
+}
+
+/* Advance a connection after poll().  Returns -1 to drop it.
+*/
+static int
+serve_conn(sim_conn_t *c, short revents)
+{
+    size_t  consumed = 0;
+    int     rv, err, closed = 0;
+
+    if(c->state == SIM_CONN_HANDSHAKE)
+    {
+        if((rv = SSL_accept(c->ssl)) <= 0)
+        {
+            err = SSL_get_error(c->ssl, rv);
+            return (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) ? 0 : -1;
+        }
+        c->state = SIM_CONN_READY;
+        if(SSL_session_reused(c->ssl))
+            tls_resumed++;
+        if(opts.verbose)
+            fprintf(stderr, "[server] TLS connection on fd %d (%s%s)\n",
+                    c->fd, SSL_get_cipher(c->ssl),
+                    SSL_session_reused(c->ssl) ? ", resumed session" : "");
+
+        /* Peers wait for the controller to speak first
+        */
+        if(queue_frames(c, &conn_frames(c)->cred_good, 1) != 0)
+            return -1;
+    }
+
+    /* A gateway may send its last messages right before closing, so
+     * handle what was read before dropping the connection
+    */
+    if(revents & (POLLIN | POLLHUP | POLLERR))
+        closed = conn_fill(c) != 0;
+
+    while((rv = conn_next_msg(c, &consumed)) == 1)
+        if(serve_msg(c) != 0)
+            closed = 1;
+
+    if(closed)
+        return -1;
+
+    if(rv < 0)
+    {
+        fprintf(stderr, "[server] Bad frame on fd %d, dropping connection\n", c->fd);
+        return -1;
+    }
+
+    if(consumed > 0)
+    {
+        memmove(c->in.data, c->in.data + consumed, c->in.len - consumed);
+        c->in.len -= consumed;
+    }
+
+    return conn_flush(c);
+}
+
+static int
+run_server(int lfd)
+{
+    SSL_CTX        *ssl_ctx;
+    sim_conn_t     *conns = NULL, *tmp;
+    struct pollfd  *pfds = NULL;
+    int             nconns = 0, size = 0, i, n, fd;
+    double          start = now_sec(), last_stats = start;
+
+    if((ssl_ctx = make_ssl_ctx(1)) == NULL)
+        return 1;
+
+    while(!got_stop)
+    {
+        if(size < nconns + 1)
+        {
+            size = size ? size * 2 : 64;
+            if((tmp = realloc(conns, size * sizeof(*conns))) == NULL
+                    || (conns = tmp, (pfds = realloc(pfds, (size + 1) * sizeof(*pfds))) == NULL))
+            {
+                fprintf(stderr, "[-] Out of memory\n");
+                return 1;
+            }
+        }
+
+        pfds[0].fd     = lfd;
+        pfds[0].events = POLLIN;
+        for(i=0; i < nconns; i++)
+        {
+            pfds[i+1].fd      = conns[i].fd;
+            pfds[i+1].events  = POLLIN | (conns[i].out.len > 0 ? POLLOUT : 0);
+            pfds[i+1].revents = 0;
+        }
+
+        n = poll(pfds, nconns + 1, SIM_POLL_MS);
+        if(n < 0 && errno != EINTR)
+            break;
+
+        if(n > 0 && (pfds[0].revents & POLLIN))
+        {
+            while(nconns < size && (fd = accept(lfd, NULL, NULL)) >= 0)
+            {
+                set_nonblocking(fd);
+                memset(&conns[nconns], 0x0, sizeof(sim_conn_t));
+                conns[nconns].fd    = fd;
+                conns[nconns].state = SIM_CONN_HANDSHAKE;
+                conns[nconns].ssl   = SSL_new(ssl_ctx);
+                SSL_set_fd(conns[nconns].ssl, fd);
+                SSL_set_accept_state(conns[nconns].ssl);
+                pfds[nconns+1].revents = POLLIN;
+                nconns++;
+            }
+        }
+
+        for(i=0; n > 0 && i < nconns; i++)
+        {
+            if(pfds[i+1].revents == 0)
+                continue;
+
+            if(serve_conn(&conns[i], pfds[i+1].revents) != 0)
+            {
+                if(opts.verbose)
+                    fprintf(stderr, "[server] Closing fd %d\n", conns[i].fd);
+                conn_close(&conns[i]);
+                conns[i] = conns[nconns-1];
+                pfds[i+1] = pfds[nconns];
+                nconns--;
+                i--;
+            }
+        }
+
+        if(opts.stats_interval > 0 && now_sec() - last_stats >= opts.stats_interval)
+        {
+            last_stats = now_sec();
+            print_server_counters(stderr, nconns, last_stats - start);
+        }
+    }
+
+    print_server_counters(stderr, nconns, now_sec() - start);
+
+    for(i=0; i < nconns; i++)
+        conn_close(&conns[i]);
+    free(conns);
+    free(pfds);
+    SSL_CTX_free(ssl_ctx);
+    return 0;
+}
+
+static void
+lat_add(sim_lat_t *l, double v)
+{
+    double  *tmp;
+
+    if(l->n == l->size)
+    {
+        l->size = l->size ? l->size * 2 : 1024;
+        if((tmp = realloc(l->v, l->size * sizeof(double))) == NULL)
+            return;
+        l->v = tmp;
+    }
+    l->v[l->n++] = v;
+}
+
+static int
+cmp_double(const void *a, const void *b)
+{
+    double  x = *(const double *)a, y = *(const double *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void
+lat_print(const char *name, sim_lat_t *l)
+{
+    double  sum = 0;
+    size_t  i;
+
+    if(l->n == 0)
+        return;
+
+    qsort(l->v, l->n, sizeof(double), cmp_double);
+    for(i=0; i < l->n; i++)
+        sum += l->v[i];
+
+    printf("%-16s %8lu %9.2f %9.2f %9.2f %9.2f %9.2f\n", name,
+            (unsigned long)l->n, l->v[0] * 1e3, sum / l->n * 1e3,
+            l->v[l->n / 2] * 1e3, l->v[(size_t)(l->n * 0.99)] * 1e3,
+            l->v[l->n - 1] * 1e3);
+}
+
+static int
+start_connect(sim_conn_t *c, struct addrinfo *ai, SSL_CTX *ssl_ctx)
+{
+    memset(c, 0x0, sizeof(*c));
+    c->fd      = -1;
+    c->t_start = now_sec();
+
+    if((c->fd = socket(ai->ai_family, SOCK_STREAM, 0)) < 0)
+        return -1;
+
+    set_nonblocking(c->fd);
+    if(connect(c->fd, ai->ai_addr, ai->ai_addrlen) != 0 && errno != EINPROGRESS)
+        return -1;
+
+    c->ssl   = SSL_new(ssl_ctx);
+    c->state = SIM_CONN_CONNECTING;
+    SSL_set_fd(c->ssl, c->fd);
+    SSL_set_connect_state(c->ssl);
+    return 0;
+}
+
+/* Start the next keep_alive round: report connections, then time the
+ * keep_alive round trip.
+*/
+static int
+next_round(sim_conn_t *c)
+{
+    if(c->rounds_left-- <= 0)
+    {
+        c->state = SIM_CONN_DONE;
+        return 0;
+    }
+
+    c->state   = SIM_CONN_KEEP_ALIVE_WAIT;
+    c->t_start = now_sec();
+    if(opts.conns_per_update > 0 && queue_frames(c, &conn_frames(c)->conn_update, 1) != 0)
+        return -1;
+    return queue_frames(c, &conn_frames(c)->keep_alive, 1);
+}
+
+/* Handle one controller message on a simulated gateway
+*/
+static int
+load_msg(sim_conn_t *c, sim_lat_t *lat)
+{
+    json_object    *jmsg = NULL;
+    double          now = now_sec();
+    int             type, rv = 0;
+
+    switch((type = parse_msg(&jmsg)))
+    {
+        case SIM_MSG_CRED_GOOD:
+            /* The controller speaks first, and only then does a gateway
+             * ask for credentials
+            */
+            if(c->state == SIM_CONN_GREETING_WAIT)
+            {
+                c->state   = SIM_CONN_CRED_WAIT;
+                c->t_start = now;
+                rv = queue_frames(c, &conn_frames(c)->cred_request, 1);
+                break;
+            }
+            /* fall through */
+
+        case SIM_MSG_CRED_UPDATE:
+            /* New credentials count as good ones once acked
+            */
+            if(type == SIM_MSG_CRED_UPDATE
+                    && (rv = queue_frames(c, &conn_frames(c)->cred_ack, 1)) != 0)
+                break;
+            if(c->state != SIM_CONN_CRED_WAIT)
+                break;
+            lat_add(&lat[SIM_LAT_CREDS], now - c->t_start);
+            c->state   = SIM_CONN_SERVICE_WAIT;
+            c->t_start = now;
+            rv = queue_frames(c, &conn_frames(c)->service_request, 1);
+            break;
+
+        case SIM_MSG_SERVICE_REFRESH:
+            if((rv = queue_frames(c, &conn_frames(c)->service_ack, 1)) != 0
+                    || c->state != SIM_CONN_SERVICE_WAIT)
+                break;
+            lat_add(&lat[SIM_LAT_SERVICES], now - c->t_start);
+            c->state   = SIM_CONN_ACCESS_WAIT;
+            c->t_start = now;
+            rv = queue_frames(c, &conn_frames(c)->access_request, 1);
+            break;
+
+        case SIM_MSG_ACCESS_REFRESH:
+            if((rv = queue_frames(c, &conn_frames(c)->access_ack, 1)) != 0
+                    || c->state != SIM_CONN_ACCESS_WAIT)
+                break;
+            lat_add(&lat[SIM_LAT_ACCESS], now - c->t_start);
+            rv = next_round(c);
+            break;
+
+        case SIM_MSG_SERVICE_UPDATE:
+            rv = queue_frames(c, &conn_frames(c)->service_ack, 1);
+            break;
+
+        case SIM_MSG_ACCESS_UPDATE:
+            rv = queue_frames(c, &conn_frames(c)->access_ack, 1);
+            break;
+
+        case SIM_MSG_KEEP_ALIVE:
+            if(c->state != SIM_CONN_KEEP_ALIVE_WAIT)
+                break;
+            lat_add(&lat[SIM_LAT_KEEP_ALIVE], now - c->t_start);
+            rv = next_round(c);
+            break;
+
+        case SIM_MSG_BAD_MESSAGE:
+            fprintf(stderr, "[load] Controller rejected a message\n");
+            rv = -1;
+            break;
+
+        default:
+            break;
+    }
+
+    if(jmsg != NULL)
+        json_object_put(jmsg);
+    return rv;
+}
+
+/* Advance a simulated gateway after poll().  Returns -1 on failure.
+*/
+static int
+load_conn(sim_conn_t *c, short revents, sim_lat_t *lat)
+{
+    size_t      consumed = 0;
+    socklen_t   len = sizeof(int);
+    int         rv, err = 0;
+
+    if(c->state == SIM_CONN_CONNECTING)
+    {
+        if(getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0 || err != 0)
+            return -1;
+        c->state = SIM_CONN_HANDSHAKE;
+    }
+
+    if(c->state == SIM_CONN_HANDSHAKE)
+    {
+        if((rv = SSL_connect(c->ssl)) <= 0)
+        {
+            err = SSL_get_error(c->ssl, rv);
+            return (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) ? 0 : -1;
+        }
+        lat_add(&lat[SIM_LAT_CONNECT], now_sec() - c->t_start);
+        c->state = SIM_CONN_GREETING_WAIT;
+    }
+
+    if(revents & (POLLIN | POLLHUP | POLLERR))
+        if(conn_fill(c) != 0)
+            return -1;
+
+    while(c->state != SIM_CONN_DONE && (rv = conn_next_msg(c, &consumed)) == 1)
+        if(load_msg(c, lat) != 0)
+            return -1;
+
+    if(rv < 0)
+        return -1;
+
+    if(consumed > 0)
+    {
+        memmove(c->in.data, c->in.data + consumed, c->in.len - consumed);
+        c->in.len -= consumed;
+    }
+
+    return conn_flush(c);
+}
+
+static int
+run_load(void)
+{
+    SSL_CTX            *ssl_ctx;
+    sim_conn_t         *conns;
+    struct pollfd      *pfds;
+    int                *active;
+    struct addrinfo     hints, *ai = NULL;
+    sim_lat_t           lat[SIM_LAT_COUNT];
+    char                port[8];
+    int                 started = 0, nactive = 0, connecting, done = 0, failed = 0;
+    int                 i, j, n, rv;
+    unsigned long       total_in = 0;
+    double              start, elapsed;
+
+    memset(lat, 0x0, sizeof(lat));
+    memset(&hints, 0x0, sizeof(hints));
+    hints.ai_family   = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(port, sizeof(port), "%d", opts.port);
+
+    if((rv = getaddrinfo(opts.addr, port, &hints, &ai)) != 0)
+    {
+        fprintf(stderr, "[-] Could not resolve %s: %s\n", opts.addr, gai_strerror(rv));
+        return 1;
+    }
+
+    if((ssl_ctx = make_ssl_ctx(0)) == NULL)
+        return 1;
+
+    conns  = calloc(opts.gateways, sizeof(*conns));
+    pfds   = calloc(opts.gateways, sizeof(*pfds));
+    active = calloc(opts.gateways, sizeof(int));
+    if(conns == NULL || pfds == NULL || active == NULL)
+    {
+        fprintf(stderr, "[-] Out of memory\n");
+        return 1;
+    }
+
+    start = now_sec();
+
+    while((started < opts.gateways || nactive > 0) && !got_stop)
+    {
+        /* Keep at most max_connecting gateways in the handshake
+        */
+        for(connecting=0, i=0; i < nactive; i++)
+            if(conns[active[i]].state <= SIM_CONN_HANDSHAKE)
+                connecting++;
+
+        while(started < opts.gateways && connecting < opts.max_connecting)
+        {
+            if(start_connect(&conns[started], ai, ssl_ctx) != 0)
+            {
+                fprintf(stderr, "[load] Gateway %d: connect failed: %s\n",
+                        started, strerror(errno));
+                conn_close(&conns[started]);
+                failed++;
+                started++;
+                continue;
+            }
+            conns[started].rounds_left = opts.rounds;
+            active[nactive++] = started++;
+            connecting++;
+        }
+
+        for(i=0; i < nactive; i++)
+        {
+            sim_conn_t *c = &conns[active[i]];
+
+            pfds[i].fd      = c->fd;
+            pfds[i].events  = c->state == SIM_CONN_CONNECTING ? POLLOUT : POLLIN;
+            if(c->out.len > 0 || (c->state == SIM_CONN_HANDSHAKE && SSL_want_write(c->ssl)))
+                pfds[i].events |= POLLOUT;
+            pfds[i].revents = 0;
+        }
+
+        n = poll(pfds, nactive, SIM_POLL_MS);
+        if(n < 0 && errno != EINTR)
+            break;
+
+        for(i=0, j=0; i < nactive; i++)
+        {
+            sim_conn_t *c = &conns[active[i]];
+
+            rv = pfds[i].revents ? load_conn(c, pfds[i].revents, lat) : 0;
+
+            if(rv != 0)
+            {
+                if(opts.verbose)
+                    fprintf(stderr, "[load] Gateway %d failed\n", active[i]);
+                c->state = SIM_CONN_FAILED;
+                failed++;
+                conn_close(c);
+                continue;
+            }
+            if(c->state == SIM_CONN_DONE && c->out.len == 0)
+            {
+                done++;
+                conn_close(c);
+                continue;
+            }
+            active[j++] = active[i];
+        }
+        nactive = j;
+    }
+
+    elapsed = now_sec() - start;
+
+    for(i=0; i < SIM_MSG_COUNT; i++)
+        total_in += msgs_in[i];
+
+    printf("Gateways: %d completed, %d failed in %.2fs\n", done, failed, elapsed);
+    printf("Messages: %lu sent, %lu received (%.0f msgs/s), %llu bytes sent, %llu bytes received\n",
+            msgs_out, total_in, elapsed > 0 ? (msgs_out + total_in) / elapsed : 0.0,
+            bytes_out, bytes_in);
+    printf("Access data: %lu access_refresh, %lu access_update messages received\n\n",
+            msgs_in[SIM_MSG_ACCESS_REFRESH], msgs_in[SIM_MSG_ACCESS_UPDATE]);
+
+    printf("%-16s %8s %9s %9s %9s %9s %9s\n", "latency (ms)", "count",
+            "min", "avg", "p50", "p99", "max");
+    for(i=0; i < SIM_LAT_COUNT; i++)
+    {
+        lat_print(sim_lat_names[i], &lat[i]);
+        free(lat[i].v);
+    }
+
+    for(i=0; i < nactive; i++)
+        conn_close(&conns[active[i]]);
+    free(active);
+    free(pfds);
+    free(conns);
+    freeaddrinfo(ai);
+    SSL_CTX_free(ssl_ctx);
+
+    return (failed > 0 || done != opts.gateways) ? 1 : 0;
+}
+
+static int
+run_bench(int lfd)
+{
+    pid_t   pid;
+    int     rv, status;
+
+    if((pid = fork()) < 0)
+    {
+        perror("fork");
+        return 1;
+    }
+
+    if(pid == 0)
+        exit(run_server(lfd));
+
+    close(lfd);
+    rv = run_load();
+
+    kill(pid, SIGTERM);
+    waitpid(pid, &status, 0);
+    return rv;
+}
+
+int
+main(int argc, char **argv)
+{
+    static struct option long_opts[] = {
+        {"serve",           0, NULL, 'S'},
+        {"load",            0, NULL, 'L'},
+        {"bench",           0, NULL, 'B'},
+        {"addr",            1, NULL, 'a'},
+        {"port",            1, NULL, 'p'},
+        {"cert",            1, NULL, 'c'},
+        {"key",             1, NULL, 'k'},
+        {"services",        1, NULL, 's'},
+        {"stanzas",         1, NULL, 'n'},
+        {"compress",        0, NULL, 'z'},
+        {"gateways",        1, NULL, 'g'},
+        {"rounds",          1, NULL, 'r'},
+        {"conns",           1, NULL, 'u'},
+        {"max-connecting",  1, NULL, 'm'},
+        {"interval",        1, NULL, 'i'},
+        {"verbose",         0, NULL, 'v'},
+        {"help",            0, NULL, 'h'},
+        {NULL,              0, NULL, 0}
+    };
+    struct sigaction    sa;
+    int                 c, lfd = -1, rv;
+
+    opts.mode             = SIM_MODE_SERVE;
+    opts.addr             = "127.0.0.1";
+    opts.port             = -1;
+    opts.services         = SIM_DEFAULT_SERVICES;
+    opts.stanzas          = SIM_DEFAULT_STANZAS;
+    opts.gateways         = SIM_DEFAULT_GATEWAYS;
+    opts.rounds           = SIM_DEFAULT_ROUNDS;
+    opts.conns_per_update = SIM_DEFAULT_CONNS;
+    opts.max_connecting   = SIM_DEFAULT_MAX_CONNECTING;
+
+    while((c = getopt_long(argc, argv, "SLBa:p:c:k:s:n:zg:r:u:m:i:vh", long_opts, NULL)) != -1)
+    {
+        switch(c)
+        {
+            case 'S': opts.mode = SIM_MODE_SERVE; break;
+            case 'L': opts.mode = SIM_MODE_LOAD; break;
+            case 'B': opts.mode = SIM_MODE_BENCH; break;
+            case 'a': opts.addr = optarg; break;
+            case 'p': opts.port = atoi(optarg); break;
+            case 'c': opts.cert_file = optarg; break;
+            case 'k': opts.key_file = optarg; break;
+            case 's': opts.services = atoi(optarg); break;
+            case 'n': opts.stanzas = atoi(optarg); break;
+            case 'z': opts.compress = 1; break;
+            case 'g': opts.gateways = atoi(optarg); break;
+            case 'r': opts.rounds = atoi(optarg); break;
+            case 'u': opts.conns_per_update = atoi(optarg); break;
+            case 'm': opts.max_connecting = atoi(optarg); break;
+            case 'i': opts.stats_interval = atoi(optarg); break;
+            case 'v': opts.verbose = 1; break;
+            case 'h': usage(); return 0;
+            default:  usage(); return 1;
+        }
+    }
+
+    if(opts.port < 0)
+        opts.port = opts.mode == SIM_MODE_BENCH ? 0 : SIM_DEFAULT_PORT;
+
+    if(opts.services < 0 || opts.stanzas < 0 || opts.gateways < 1
+            || opts.rounds < 0 || opts.conns_per_update < 0
+            || opts.max_connecting < 1 || opts.port > 65535)
+    {
+        usage();
+        return 1;
+    }
+
+    if(opts.cert_file == NULL)
+        opts.cert_file = opts.mode == SIM_MODE_LOAD ? SIM_DEFAULT_CLIENT_CERT : SIM_DEFAULT_CERT;
+    if(opts.key_file == NULL)
+        opts.key_file = opts.mode == SIM_MODE_LOAD ? SIM_DEFAULT_CLIENT_KEY : SIM_DEFAULT_KEY;
+
+    memset(&sa, 0x0, sizeof(sa));
+    sa.sa_handler = stop_handler;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    raise_fd_limit();
+
+    if(build_frames() != 0)
+        return 1;
+
+    if(opts.mode == SIM_MODE_LOAD)
+        return run_load();
+
+    if((lfd = listen_socket(opts.port, &opts.port)) < 0)
+        return 1;
+
+    if(opts.mode == SIM_MODE_BENCH)
+    {
+        opts.addr = "127.0.0.1";
+        return run_bench(lfd);
+    }
+
+    fprintf(stderr, "[+] Controller stand-in listening on port %d\n", opts.port);
+    rv = run_server(lfd);
+    close(lfd);
+    return rv;
+}
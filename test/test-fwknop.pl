@@ -22,13 +22,15 @@ our $local_spa_key  = 'fwknoptest';
 our $local_hmac_key_file = 'local_hmac_spa.key';
 my $output_dir      = 'output';
 our $conf_dir       = 'conf';
-my $run_dir         = 'run';
+our $run_dir        = 'run';
 our $sdp_tmp_dir    = 'sdptmp';
 our $run_tmp_dir_top = 'runtmp';
 our $run_tmp_dir    = "$run_tmp_dir_top/subdir1/subdir2";
 my $cmd_out_tmp     = 'cmd.out';
 my $server_cmd_tmp  = 'server_cmd.out';
 my $controller_cmd_tmp = 'controller_cmd.out';
+my $hot_restart_cmd_tmp = 'hot_restart_cmd.out';
+my $agent_cmd_tmp   = 'agent_cmd.out';
 my $openssl_cmd_tmp = 'openssl_cmd.out';
 my $data_tmp        = 'data.tmp';
 my $key_tmp         = 'key.tmp';
@@ -162,6 +164,12 @@ my $asan_dir = 'asan';
 
 my $tests_dir = 'tests';
 
+our $sdp_ctrl_sim_dir = 'sdp-ctrl-sim';
+our $firewalld_mock_dir = 'firewalld-mock';
+my $firewalld_mock_out = 'firewalld_mock.out';
+my $dbus_daemon_path = '';
+my $dbus_send_path   = '';
+
 my @test_files = (
     "$tests_dir/configure_args.pl",
     "$tests_dir/build_security.pl",
@@ -188,6 +196,8 @@ my @test_files = (
     "$tests_dir/gpg.pl",
     "$tests_dir/gpg_hmac.pl",
     "$tests_dir/sdp.pl",
+    "$tests_dir/sdp_ctrl_sim.pl",
+    "$tests_dir/firewalld_mock.pl",
 );
 #================== end config ===================
 
@@ -218,6 +228,8 @@ our @python_fko                   = ();  ### from tests/python_fko.pl
 our @os_compatibility             = ();  ### from tests/os_compatibility.pl
 our @rijndael_backwards_compatibility = ();  ### from tests/rijndael_backwards_compatibility.pl
 our @sdp                          = ();  ### from tests/sdp.pl
+our @sdp_ctrl_sim                 = ();  ### from tests/sdp_ctrl_sim.pl
+our @firewalld_mock               = ();  ### from tests/firewalld_mock.pl
 
 my $passed = 0;
 my $failed = 0;
@@ -579,6 +591,11 @@ our %cf = (
     'gpg_server_large_key_access'  => "$conf_dir/gpg_server_large_key_access.conf",
     'tcp_server'                   => "$conf_dir/tcp_server_fwknopd.conf",
     'udp_server'                   => "$conf_dir/udp_server_fwknopd.conf",
+    'memory_backend'               => "$conf_dir/memory_backend_fwknopd.conf",
+    'grant_journal'                => "$conf_dir/grant_journal_fwknopd.conf",
+    'grant_journal_access'         => "$conf_dir/grant_journal_access.conf",
+    'gpg_workers'                  => "$conf_dir/gpg_workers_fwknopd.conf",
+    'gpg_workers_memory'           => "$conf_dir/gpg_workers_memory_fwknopd.conf",
     'spa_over_http'                => "$conf_dir/spa_over_http_fwknopd.conf",
     'tcp_pcap_filter'              => "$conf_dir/tcp_pcap_filter_fwknopd.conf",
     'icmp_pcap_filter'             => "$conf_dir/icmp_pcap_filter_fwknopd.conf",
@@ -667,11 +684,28 @@ our %cf = (
     'server_fwknoprc'              => "$conf_dir/sdp-ctrl-client/server.fwknoprc",
     'sdp_fwknopd_conf'             => "$conf_dir/sdp-ctrl-client/fwknopd.conf",
     'client_ctrl_conf_bad_fwknop_path' => "$conf_dir/sdp-ctrl-client/client_sdp_ctrl_client.conf_bad_fwknop_path",
+    'ctrl_sim_fwknopd'             => "$conf_dir/sdp-ctrl-sim/fwknopd.conf",
+    'ctrl_sim_server_ctrl_conf'    => "$conf_dir/sdp-ctrl-sim/server_sdp_ctrl_client.conf",
+    'ctrl_sim_server_ctrl_conf_compress' => "$conf_dir/sdp-ctrl-sim/server_sdp_ctrl_client_compress.conf",
+    'ctrl_sim_client_ctrl_conf'    => "$conf_dir/sdp-ctrl-sim/client_sdp_ctrl_client.conf",
+    'ctrl_sim_client_fwknoprc'     => "$conf_dir/sdp-ctrl-sim/client.fwknoprc",
+    'ctrl_sim_cert'                => "$conf_dir/sdp-ctrl-sim/sim.crt",
+    'ctrl_sim_key'                 => "$conf_dir/sdp-ctrl-sim/sim.key",
 );
 
 our $lib_view_str = "LD_LIBRARY_PATH=$lib_dir";
 our $libfko_bin = "$lib_dir/libfko.so";  ### this is usually a link
 
+our $sdp_ctrl_sim_args = "$lib_view_str $sdp_ctrl_sim_dir/sdp_ctrl_sim --bench " .
+    "-c $cf{'server_ctrl_cert'} -k $cf{'server_ctrl_key'}";
+
+### the 1024 bit certificates under conf/sdp-ctrl-client are refused by
+### newer OpenSSL versions, so fwknopd and fwknop get their own in the
+### serve tests.  exec makes sure stop_ctrl() signals sdp_ctrl_sim itself
+### rather than the shell.
+our $sdp_ctrl_sim_serve_args = "$lib_view_str exec $sdp_ctrl_sim_dir/sdp_ctrl_sim --serve " .
+    "--port 5091 -c $cf{'ctrl_sim_cert'} -k $cf{'ctrl_sim_key'} --services 4";
+
 if ($enable_all or $enable_complete) {
     $enable_valgrind = 1;
     $enable_recompilation_warnings_check = 1;
@@ -736,6 +770,10 @@ our $default_client_args_sdp = "$lib_view_str $valgrind_str " .
     "$fwknopCmd --rc-file $tmp_client_rc -n service_gate " .
     "--no-save-args $verbose_str";
 
+our $ctrl_sim_client_args = "$lib_view_str $valgrind_str " .
+    "$fwknopCmd --rc-file $tmp_client_rc -n sim_gate " .
+    "--no-save-args $verbose_str";
+
 our $default_client_args_long_key = "$lib_view_str $valgrind_str " .
     "$fwknopCmd $client_sdp_options -A tcp/22 -a $fake_ip -D $loopback_ip --get-key " .
     "$long_key_file --no-save-args $verbose_str";
@@ -851,6 +889,11 @@ our $default_server_conf_args_sdp = "-c $cf{'sdp_fwknopd_conf'} " .
 
 our $server_conf_args_sdp = "-d $default_digest_file -p $default_pid_file";
 
+### conntrack is replaced by the stand-in script next to sdp_ctrl_sim
+our $ctrl_sim_server_args = "PATH=" . cwd() . "/$sdp_ctrl_sim_dir:\$PATH " .
+    "$lib_view_str $valgrind_str $fwknopdCmd -c $cf{'ctrl_sim_fwknopd'} " .
+    "$server_conf_args_sdp $intf_str";
+
 our $default_server_hmac_conf_args = "-c $cf{'def'} -a $cf{'hmac_access'} " .
     "-d $default_digest_file -p $default_pid_file";
 
@@ -938,6 +981,8 @@ my @tests = (
     @gpg,
     @gpg_hmac,
     @sdp,
+    @sdp_ctrl_sim,
+    @firewalld_mock,
 );
 
 if ($enable_profile_coverage_check) {
@@ -1009,6 +1054,10 @@ my %test_keys = (
     'set_legacy_iv'   => $OPTIONAL,
     'sleep_cycles'    => $OPTIONAL_NUMERIC,
     'write_rc_file'   => $OPTIONAL,
+    'fanout_ports'    => $OPTIONAL,
+    'agent_reload'    => $OPTIONAL,
+    'agent_socket_path' => $OPTIONAL,
+    'resolve_http_port' => $OPTIONAL,
     'save_rc_stanza'  => $OPTIONAL,
     'client_pkt_tries' => $OPTIONAL_NUMERIC,
     'max_pkt_tries'    => $OPTIONAL_NUMERIC,
@@ -1067,6 +1116,7 @@ my %test_keys = (
     'server_ctrl_key' => $OPTIONAL,
     'server_ctrl_cert' => $OPTIONAL,
     'skip_controller' => $OPTIONAL,
+    'ctrl_sim_cmdline' => $OPTIONAL,
     'wait_for_conn_close' => $OPTIONAL,
     'disable_sdp_id' => $OPTIONAL,
     'remove_service_access' => $OPTIONAL,
@@ -2588,6 +2638,370 @@ sub client_rc_file() {
     return $rv;
 }
 
+sub client_fanout_udp_targets() {
+    my $test_hr = shift;
+
+    my $rv = 1;
+    my @socks  = ();
+    my @names  = ();
+    my @rc_hr  = ();
+    my %built  = ();
+
+    ### one local UDP "server" per --fanout target, each named by an
+    ### rc stanza that points at it
+    for my $port (@{$test_hr->{'fanout_ports'}}) {
+        my $sock = IO::Socket::INET->new(
+            LocalAddr => $loopback_ip,
+            LocalPort => $port,
+            Proto     => 'udp',
+        );
+        unless ($sock) {
+            &write_test_file("[-] Could not bind udp/$port on $loopback_ip: $!\n",
+                $curr_test_file);
+            $_->close() for @socks;
+            return 0;
+        }
+        push @socks, $sock;
+        my $name = 'fanout_' . ($#socks+1);
+        push @names, $name;
+        push @rc_hr, {'name' => $name, 'vars' => {'KEY' => 'testtest',
+            'HMAC_KEY' => 'hmactest', 'SPA_SERVER' => $loopback_ip,
+            'SPA_SERVER_PORT' => $port, 'SPA_SERVER_PROTO' => 'udp',
+            'ACCESS' => 'tcp/22', 'ALLOW_IP' => $fake_ip}};
+    }
+    &write_rc_file(\@rc_hr, $rewrite_rc_file);
+
+    $rv = 0 unless &run_cmd("$test_hr->{'cmdline'} --fanout " . join(',', @names),
+            $cmd_out_tmp, $curr_test_file);
+
+    ### every packet the client built, from the per-target context dumps
+    open F, "< $cmd_out_tmp" or die "[*] Could not open $cmd_out_tmp: $!";
+    while (<F>) {
+        $built{$1} = 1 if /Final\sSPA\sData\:\s*(\S+)/;
+    }
+    close F;
+
+    ### each target must have received exactly one of them, and no two
+    ### targets the same one
+    for (my $i=0; $i <= $#socks; $i++) {
+        my $pkt = '';
+        my $rin = '';
+        vec($rin, fileno($socks[$i]), 1) = 1;
+        if (select($rin, undef, undef, 2) > 0) {
+            $socks[$i]->recv($pkt, 1500);
+        }
+        if ($pkt ne '' and $built{$pkt}) {
+            &write_test_file("[+] $names[$i] received: $pkt\n", $curr_test_file);
+            delete $built{$pkt};
+        } else {
+            &write_test_file("[-] $names[$i] did not receive a valid SPA packet: '$pkt'\n",
+                $curr_test_file);
+            $rv = 0;
+        }
+        $socks[$i]->close();
+    }
+
+    return $rv;
+}
+
+sub client_agent_knock() {
+    my $test_hr = shift;
+
+    my $rv = 1;
+    my $sock_path = "$run_dir/agent.sock";
+
+    ### two targets on the local fwknopd, each for its own port
+    my @rc_hr = ();
+    for my $port (22, 23) {
+        push @rc_hr, {'name' => "agent_$port", 'vars' => {
+            'KEY' => $local_spa_key, 'SPA_SERVER' => $loopback_ip,
+            'SPA_SERVER_PORT' => $default_spa_port, 'SPA_SERVER_PROTO' => 'udp',
+            'ACCESS' => "tcp/$port", 'ALLOW_IP' => $fake_ip}};
+    }
+
+    ### start out with the wrong key for the first target when the agent
+    ### has to pick up the right one from the rewritten rc file
+    $rc_hr[0]->{'vars'}->{'KEY'} = 'wrongkey' if $test_hr->{'agent_reload'} eq $YES;
+    &write_rc_file(\@rc_hr, $rewrite_rc_file);
+
+    &do_fwknopd_cmd($test_hr->{'fwknopd_cmdline'});
+
+    my $agent_pid = &start_agent("$test_hr->{'cmdline'} --agent $sock_path " .
+        "--fanout agent_22,agent_23");
+    unless ($agent_pid) {
+        &stop_fwknopd();
+        return 0;
+    }
+
+    if ($test_hr->{'agent_reload'} eq $YES) {
+        $rv = 0 unless &agent_request($sock_path, 'KNOCK agent_22', qr/^OK\s1\/1$/);
+        sleep 1;
+        if (&file_find_regex([qr/Added\saccess\srule\sfor\s$fake_ip\s.*\sport\s22,/],
+                $MATCH_ALL, $APPEND_RESULTS, $server_cmd_tmp)) {
+            &write_test_file("[-] access granted with the old key.\n",
+                $curr_test_file);
+            $rv = 0;
+        }
+
+        ### the agent only reads a file that has not changed for a second
+        $rc_hr[0]->{'vars'}->{'KEY'} = $local_spa_key;
+        &write_rc_file(\@rc_hr, $rewrite_rc_file);
+
+        my $tries = 0;
+        while (not &file_find_regex([qr/Keys\schanged\sfor\s1\starget/],
+                $MATCH_ALL, $NO_APPEND_RESULTS, $agent_cmd_tmp)) {
+            $tries++;
+            last if $tries == 5;
+            sleep 1;
+        }
+        $rv = 0 unless &file_find_regex([qr/Keys\schanged\sfor\s1\starget/],
+            $MATCH_ALL, $APPEND_RESULTS, $agent_cmd_tmp);
+
+        $rv = 0 unless &agent_request($sock_path, 'KNOCK agent_22', qr/^OK\s1\/1$/);
+    } else {
+        ### no target knocks them all, an unknown one none
+        $rv = 0 unless &agent_request($sock_path, 'KNOCK', qr/^OK\s2\/2$/);
+        $rv = 0 unless &agent_request($sock_path, 'KNOCK nosuchtarget',
+            qr/^ERR\sunknown\starget$/);
+        $rv = 0 unless &agent_request($sock_path, 'PING',
+            qr/^ERR\sunknown\srequest$/);
+    }
+
+    sleep 1;
+    &stop_agent($agent_pid);
+    &stop_fwknopd();
+
+    if (-e $sock_path) {
+        &write_test_file("[-] the agent did not remove $sock_path.\n",
+            $curr_test_file);
+        $rv = 0;
+    }
+
+    $rv = 0 unless &process_output_matches($test_hr);
+
+    return $rv;
+}
+
+sub client_agent_socket_path() {
+    my $test_hr = shift;
+
+    my $rv = 1;
+    my $sock_path = "$run_dir/agent.sock";
+    my $listener;
+
+    unlink $sock_path if -e $sock_path;
+
+    ### what is left at the --agent path from before
+    if ($test_hr->{'agent_socket_path'} eq 'file') {
+        open F, "> $sock_path" or die "[*] Could not open $sock_path: $!";
+        print F "not a socket\n";
+        close F;
+    } else {
+        $listener = IO::Socket::UNIX->new(
+            Type   => SOCK_STREAM,
+            Local  => $sock_path,
+            Listen => 1,
+        ) or die "[*] Could not listen on $sock_path: $!";
+
+        ### a socket nobody listens on any more
+        if ($test_hr->{'agent_socket_path'} eq 'stale') {
+            $listener->close();
+            undef $listener;
+        }
+    }
+
+    my @rc_hr = ({'name' => 'agent_22', 'vars' => {
+        'KEY' => $local_spa_key, 'SPA_SERVER' => $loopback_ip,
+        'SPA_SERVER_PORT' => $default_spa_port, 'SPA_SERVER_PROTO' => 'udp',
+        'ACCESS' => 'tcp/22', 'ALLOW_IP' => $fake_ip}});
+    &write_rc_file(\@rc_hr, $rewrite_rc_file);
+
+    my $agent_pid = &start_agent("$test_hr->{'cmdline'} --agent $sock_path " .
+        "--fanout agent_22");
+
+    if ($test_hr->{'agent_socket_path'} eq 'stale') {
+        $rv = 0 unless $agent_pid;
+        $rv = 0 unless &agent_request($sock_path, 'KNOCK nosuchtarget',
+            qr/^ERR\sunknown\starget$/);
+    } else {
+        ### the agent has to give up rather than take over the path
+        if ($agent_pid) {
+            &write_test_file("[-] the agent started on $sock_path.\n",
+                $curr_test_file);
+            $rv = 0;
+        }
+        unless (-e $sock_path) {
+            &write_test_file("[-] $sock_path was removed.\n",
+                $curr_test_file);
+            $rv = 0;
+        }
+    }
+
+    &stop_agent($agent_pid) if $agent_pid;
+    $listener->close() if $listener;
+    unlink $sock_path if -e $sock_path;
+
+    $rv = 0 unless &process_output_matches($test_hr);
+
+    return $rv;
+}
+
+### start fwknop --agent in its own process group and wait until it serves
+### its socket, returns the pid or 0 if it exited first
+sub start_agent() {
+    my $cmdline = shift;
+
+    unlink $agent_cmd_tmp if -e $agent_cmd_tmp;
+
+    my $pid = fork();
+    die "[*] Could not fork: $!" unless defined $pid;
+
+    if ($pid == 0) {
+
+        ### only the agent handles SIGTERM, so that its output still
+        ### makes it into the test file
+        setpgrp(0, 0);
+        $SIG{'TERM'} = 'IGNORE';
+        exit &run_cmd($cmdline, $agent_cmd_tmp, $curr_test_file);
+    }
+
+    my $tries = 0;
+    while (not -e $agent_cmd_tmp or not &file_find_regex(
+            [qr/fwknop\sagent\sserving/],
+            $MATCH_ALL, $NO_APPEND_RESULTS, $agent_cmd_tmp)) {
+        return 0 if waitpid($pid, WNOHANG) == $pid;
+        $tries++;
+        last if $tries == 10;
+        sleep 1;
+    }
+
+    return $pid;
+}
+
+sub stop_agent() {
+    my $pid = shift;
+
+    kill 'TERM', -$pid;
+
+    my $tries = 0;
+    while (waitpid($pid, WNOHANG) != $pid) {
+        $tries++;
+        if ($tries == 5) {
+            kill 'KILL', -$pid;
+            waitpid($pid, 0);
+            last;
+        }
+        sleep 1;
+    }
+
+    return;
+}
+
+### send one request line to the agent and match the reply against $re
+sub agent_request() {
+    my ($sock_path, $req, $re) = @_;
+
+    my $reply = '';
+
+    my $sock = IO::Socket::UNIX->new(
+        Type => SOCK_STREAM,
+        Peer => $sock_path,
+    );
+    if ($sock) {
+        print $sock "$req\n";
+        my $rin = '';
+        vec($rin, fileno($sock), 1) = 1;
+        if (select($rin, undef, undef, 10) > 0) {
+            $reply = <$sock>;
+            $reply = '' unless defined $reply;
+            $reply =~ s/\s+$//;
+        }
+        $sock->close();
+    }
+
+    &write_test_file("[.] agent request: '$req', reply: '$reply'\n",
+        $curr_test_file);
+
+    return $reply =~ $re ? 1 : 0;
+}
+
+sub client_resolve_stand_in() {
+    my $test_hr = shift;
+
+    my $rv = 1;
+    my $port = $test_hr->{'resolve_http_port'};
+    my $resolve_ip = '127.0.0.3';
+    my $home = "$run_dir/resolve_home";
+
+    ### local HTTP resolver: /ip answers with an address, anything else
+    ### with a body that is not one
+    my $server = IO::Socket::INET->new(
+        LocalAddr => $loopback_ip,
+        LocalPort => $port,
+        Proto     => 'tcp',
+        Listen    => 5,
+        ReuseAddr => 1,
+    );
+    unless ($server) {
+        &write_test_file("[-] Could not listen on tcp/$port: $!\n", $curr_test_file);
+        return 0;
+    }
+
+    my $pid = fork();
+    die "[*] Could not fork: $!" unless defined $pid;
+    if ($pid == 0) {
+        while (my $conn = $server->accept()) {
+            my $req = '';
+            while (<$conn>) {
+                $req .= $_;
+                last if /^\r?\n$/;
+            }
+            my $body = ($req =~ m|^GET\s/ip\s|) ? "$resolve_ip\n" : "no address here\n";
+            print $conn "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\n" .
+                "Content-Length: " . length($body) . "\r\nConnection: close\r\n\r\n$body";
+            close $conn;
+        }
+        exit 0;
+    }
+    close $server;
+
+    mkdir $home unless -d $home;
+    unlink "$home/.fwknop.resolve" if -e "$home/.fwknop.resolve";
+    &write_rc_file([{'name' => 'default', 'vars' => {'KEY' => 'testtest',
+        'HMAC_KEY' => 'hmactest'}}], $rewrite_rc_file);
+
+    ### nothing listens on the first resolver and the second one gives
+    ### a bad answer, so the third must win
+    my $cmd = "HOME=$home $test_hr->{'cmdline'} -R --resolve-http-only " .
+        "--resolve-cache-ttl 60 --resolve-url " .
+        "http://$loopback_ip:" . ($port+1) . "/ip," .
+        "http://$loopback_ip:$port/none," .
+        "http://$loopback_ip:$port/ip";
+
+    $rv = 0 unless &run_cmd($cmd, $cmd_out_tmp, $curr_test_file);
+    $rv = 0 unless &file_find_regex(
+        [qr/Resolved\sexternal\sIP.*\/ip\)\sas\:\s$resolve_ip/],
+        $MATCH_ALL, $APPEND_RESULTS, $cmd_out_tmp);
+    unless (-e "$home/.fwknop.resolve") {
+        &write_test_file("[-] resolve cache file was not written\n", $curr_test_file);
+        $rv = 0;
+    }
+
+    ### with the resolver gone the cached IP must be used
+    kill 'TERM', $pid;
+    waitpid($pid, 0);
+
+    $rv = 0 unless &run_cmd($cmd, $cmd_out_tmp, $curr_test_file);
+    $rv = 0 unless &file_find_regex(
+        [qr/Using\scached\sexternal\sIP\:\s$resolve_ip/],
+        $MATCH_ALL, $APPEND_RESULTS, $cmd_out_tmp);
+
+    unlink "$home/.fwknop.resolve";
+    rmdir $home;
+
+    return $rv;
+}
+
 sub validate_fko_decode() {
 
     return 0 unless -e $curr_test_file;
@@ -3388,6 +3802,67 @@ sub server_controller_interaction() {
     return ($rv, $access_data_received);
 }
 
+### fwknopd and the fwknop client against sdp_ctrl_sim in serve mode
+sub ctrl_sim_cycle() {
+    my $test_hr = shift;
+
+    my $rv = 1;
+
+    unless (&copy_sdp_config_files($test_hr)) {
+        rmtree $sdp_tmp_dir if -d $sdp_tmp_dir;
+        return 0;
+    }
+
+    &write_test_file("[+] TEST: $test_hr->{'msg'}\n", $ctrl_test_file);
+    unless (&do_controller_cmd($test_hr->{'ctrl_sim_cmdline'},
+            qr/Controller\sstand\-in\slistening/)) {
+        &write_test_file("[-] Failed to start sdp_ctrl_sim.\n", $curr_test_file);
+        &stop_ctrl();
+        rmtree $sdp_tmp_dir;
+        return 0;
+    }
+
+    ### the first fwknopd gets credentials, services and the (split)
+    ### access refresh, then keeps the connection up long enough for
+    ### a keep-alive and a connection report
+    my $pid = &start_fwknopd($test_hr);
+
+    my $tries = 0;
+    while (not &file_find_regex([qr/Keep\-alive\sresponse\sreceived/,
+            qr/Sending\sconnection_update\smessage/],
+            $MATCH_ALL, $NO_APPEND_RESULTS, $server_cmd_tmp)) {
+        $tries++;
+        last if $tries == 10;
+        sleep 1;
+    }
+    &stop_fwknopd();
+    waitpid($pid, 0);
+
+    ### the second one offers the TLS session saved by the first
+    $pid = &start_fwknopd($test_hr);
+
+    ### the first SPA packet still uses the client's old keys, the ctrl
+    ### client then stores the ones from sdp_ctrl_sim for the second
+    for (my $cycle_ctr=0; $cycle_ctr < 2; $cycle_ctr++) {
+        $rv = 0 unless &run_cmd($test_hr->{'cmdline'},
+            $cmd_out_tmp, $curr_test_file);
+        sleep 1;
+    }
+
+    &stop_fwknopd();
+    waitpid($pid, 0);
+
+    ### sdp_ctrl_sim prints its counters on the way out
+    &stop_ctrl();
+    waitpid($ctrl_ppid, 0);
+
+    rmtree $sdp_tmp_dir;
+
+    $rv = 0 unless &process_output_matches($test_hr);
+
+    return $rv;
+}
+
 sub spa_cycle() {
     my $test_hr = shift;
 
@@ -6974,6 +7449,470 @@ sub generic_exec() {
     return $rv;
 }
 
+sub memory_backend_cycle() {
+    my $test_hr = shift;
+
+    my $rv = 1;
+
+    &do_fwknopd_cmd($test_hr->{'fwknopd_cmdline'});
+
+    $rv = 0 unless &run_cmd($test_hr->{'cmdline'},
+        $cmd_out_tmp, $curr_test_file);
+
+    sleep 1;
+
+    ### SIGUSR2 has fwknopd log the in-memory rule counters
+    my $pid = &is_pid_running($default_pid_file);
+    kill 'USR2', $pid if $pid;
+    sleep 1;
+
+    ### FW_ACCESS_TIMEOUT is 3 seconds in the access.conf file
+    sleep 3;
+
+    $pid = &is_pid_running($default_pid_file);
+    kill 'USR2', $pid if $pid;
+    sleep 1;
+
+    &stop_fwknopd();
+
+    $rv = 0 unless &process_output_matches($test_hr);
+
+    return $rv;
+}
+
+sub hot_restart_cycle() {
+    my $test_hr = shift;
+
+    my $rv = 1;
+
+    &do_fwknopd_cmd($test_hr->{'fwknopd_cmdline'});
+    my $old_pid = &is_pid_running($default_pid_file);
+
+    ### the first fwknopd grants access to tcp/22
+    $rv = 0 unless &run_cmd($test_hr->{'cmdline'},
+        $cmd_out_tmp, $curr_test_file);
+
+    sleep 1;
+
+    my $expire = 0;
+    open F, "< $server_cmd_tmp" or die "[*] Could not open $server_cmd_tmp: $!";
+    while (<F>) {
+        if (/Added\saccess\srule\sfor\s$fake_ip\s.*\sport\s22,\sexpires\sat\s(\d+)/) {
+            $expire = $1;
+            last;
+        }
+    }
+    close F;
+
+    unless ($expire) {
+        &write_test_file("[-] the first fwknopd did not grant access.\n",
+            $curr_test_file);
+        &stop_fwknopd();
+        return 0;
+    }
+
+    ### the new fwknopd comes back from the hand-off once the old one
+    ### has exited
+    unlink $hot_restart_cmd_tmp if -e $hot_restart_cmd_tmp;
+
+    my $new_pid = fork();
+    die "[*] Could not fork: $!" unless defined $new_pid;
+
+    if ($new_pid == 0) {
+        exit &run_cmd("$test_hr->{'fwknopd_cmdline'} --hot-restart",
+            $hot_restart_cmd_tmp, $server_test_file);
+    }
+
+    my $tries = 0;
+    while (not -e $hot_restart_cmd_tmp or not &file_find_regex(
+            [qr/fwknopd\smain\sevent\sloop|Kicking\soff.*server/],
+            $MATCH_ANY, $NO_APPEND_RESULTS, $hot_restart_cmd_tmp)) {
+        $tries++;
+        last if $tries == 10;
+        sleep 1;
+    }
+
+    sleep 1;
+
+    if (kill 0, $old_pid) {
+        &write_test_file("[-] the old fwknopd (pid: $old_pid) is still running.\n",
+            $curr_test_file);
+        $rv = 0;
+    }
+
+    ### the old fwknopd must leave its rules to the new one
+    $rv = 0 unless &file_find_regex([qr/new\sfwknopd\shas\staken\sover/],
+        $MATCH_ALL, $APPEND_RESULTS, $server_cmd_tmp);
+    if (&file_find_regex([qr/Flushed\s\d+\sin\-memory|Removed\saccess\srule/],
+            $MATCH_ANY, $APPEND_RESULTS, $server_cmd_tmp)) {
+        &write_test_file("[-] the old fwknopd removed firewall rules.\n",
+            $curr_test_file);
+        $rv = 0;
+    }
+
+    ### the new fwknopd grants access over the inherited socket (to
+    ### another port so that the inherited rule is left alone)
+    my $cmdline = $test_hr->{'cmdline'};
+    $cmdline =~ s|\-A\stcp/22|-A tcp/23|;
+    $rv = 0 unless &run_cmd($cmdline, $cmd_out_tmp, $curr_test_file);
+
+    ### the inherited rule has to expire at the time the old fwknopd gave it
+    my $removed = 0;
+    while (time() <= $expire + 2) {
+        if (&file_find_regex([qr/Removed\saccess\srule\sfor\s$fake_ip\s.*\sport\s22\s/],
+                $MATCH_ALL, $NO_APPEND_RESULTS, $hot_restart_cmd_tmp)) {
+            $removed = 1;
+            last;
+        }
+        sleep 1;
+    }
+    unless ($removed and &file_find_regex(
+            [qr/Removed\saccess\srule\sfor\s$fake_ip\s.*\sport\s22\swith\sexpire\stime\sof\s$expire/],
+            $MATCH_ALL, $APPEND_RESULTS, $hot_restart_cmd_tmp)) {
+        &write_test_file("[-] the inherited rule was not removed at $expire.\n",
+            $curr_test_file);
+        $rv = 0;
+    }
+
+    &stop_fwknopd();
+    waitpid($new_pid, 0);
+
+    $rv = 0 unless &process_output_matches($test_hr);
+
+    return $rv;
+}
+
+sub gpg_workers_sighup() {
+    my $test_hr = shift;
+
+    my $rv = 1;
+
+    ### build a few GPG SPA packets up front so they can be sent in one
+    ### burst - with two workers at least one of them is still queued
+    ### when the SIGHUP arrives
+    my @packets = ();
+    for (my $i=0; $i < 4; $i++) {
+        unless (&run_cmd("$test_hr->{'cmdline'} --test",
+                $cmd_out_tmp, $curr_test_file)) {
+            $rv = 0;
+            last;
+        }
+        my $spa_pkt = &get_spa_packet_from_file($cmd_out_tmp);
+        unless ($spa_pkt) {
+            &write_test_file("[-] could not get SPA packet " .
+                "from file: $cmd_out_tmp\n", $curr_test_file);
+            $rv = 0;
+            last;
+        }
+        push @packets, {
+            'proto'  => 'udp',
+            'port'   => $default_spa_port,
+            'dst_ip' => $loopback_ip,
+            'data'   => $spa_pkt,
+        };
+    }
+    return $rv unless $rv;
+
+    &do_fwknopd_cmd($test_hr->{'fwknopd_cmdline'});
+
+    &send_all_pkts(\@packets);
+
+    my $pid = &is_pid_running($default_pid_file);
+    kill 'HUP', $pid if $pid;
+    sleep 3;
+
+    ### the restarted fwknopd (and its new worker pool) still has to
+    ### grant access
+    $rv = 0 unless &run_cmd($test_hr->{'cmdline'},
+        $cmd_out_tmp, $curr_test_file);
+
+    sleep 2;
+
+    &stop_fwknopd();
+
+    $rv = 0 unless &process_output_matches($test_hr);
+
+    return $rv;
+}
+
+sub firewalld_mock_start() {
+
+    ### start a private bus and firewalld_mock on it, the address is
+    ### handed to the mock, dbus-send and fwknopd
+    open DBUS, "$dbus_daemon_path --session --fork --print-address=1 " .
+        "--print-pid=1 |" or die "[*] Could not execute $dbus_daemon_path: $!";
+    my $address = <DBUS>;
+    my $bus_pid = <DBUS>;
+    close DBUS;
+
+    unless ($address and $bus_pid) {
+        &write_test_file("[-] Could not start a private D-Bus daemon.\n",
+            $curr_test_file);
+        return ();
+    }
+    chomp $address;
+    chomp $bus_pid;
+
+    unlink $firewalld_mock_out if -e $firewalld_mock_out;
+
+    my $mock_pid = fork();
+    die "[*] Could not fork: $!" unless defined $mock_pid;
+
+    if ($mock_pid == 0) {
+        open STDOUT, "> $firewalld_mock_out" or die $!;
+        open STDERR, ">&STDOUT" or die $!;
+        exec "$firewalld_mock_dir/firewalld_mock", '-v', '-a', $address;
+        exit 1;
+    }
+
+    my $tries = 0;
+    while (not &file_find_regex([qr/serving\sorg\.fedoraproject/],
+            $MATCH_ALL, $NO_APPEND_RESULTS, $firewalld_mock_out)) {
+        $tries++;
+        if ($tries == 10) {
+            &write_test_file("[-] firewalld_mock did not start.\n",
+                $curr_test_file);
+            &firewalld_mock_stop($bus_pid, $mock_pid);
+            return ();
+        }
+        sleep 1;
+    }
+
+    &write_test_file("[+] firewalld_mock pid: $mock_pid on $address\n",
+        $curr_test_file);
+
+    return ($address, $bus_pid, $mock_pid);
+}
+
+sub firewalld_mock_stop() {
+    my ($bus_pid, $mock_pid) = @_;
+
+    ### the mock prints its counters and rules when it gets SIGTERM
+    kill 15, $mock_pid;
+    waitpid($mock_pid, 0);
+    kill 15, $bus_pid;
+
+    if (-e $firewalld_mock_out) {
+        open F, "< $firewalld_mock_out" or die $!;
+        my @lines = <F>;
+        close F;
+        &write_test_file($_, $curr_test_file) for @lines;
+    }
+    return;
+}
+
+sub firewalld_mock_passthrough() {
+    my ($address, $args) = @_;
+
+    return &run_cmd("$dbus_send_path --bus=$address --print-reply " .
+        "--dest=org.fedoraproject.FirewallD1 /org/fedoraproject/FirewallD1 " .
+        "org.fedoraproject.FirewallD1.direct.passthrough string:ipv4 " .
+        "array:string:" . join(',', @$args), $cmd_out_tmp, $curr_test_file);
+}
+
+sub firewalld_mock_rules() {
+    my $test_hr = shift;
+
+    my $rv = 1;
+    my @rule = ('-s', $fake_ip, '-p', '6', '--dport', '22', '-j', 'ACCEPT');
+
+    my ($address, $bus_pid, $mock_pid) = &firewalld_mock_start();
+    return 0 unless $mock_pid;
+
+    $rv = 0 unless &firewalld_mock_passthrough($address,
+        ['-t', 'filter', '-N', 'FWKNOP_TEST']);
+    $rv = 0 unless &firewalld_mock_passthrough($address,
+        ['-t', 'filter', '-A', 'FWKNOP_TEST', @rule]);
+    $rv = 0 unless &firewalld_mock_passthrough($address,
+        ['-C', 'FWKNOP_TEST', '-t', 'filter', @rule]);
+
+    if (&firewalld_mock_passthrough($address,
+            ['-t', 'filter', '-L', 'FWKNOP_TEST', '-n'])) {
+        $rv = 0 unless &file_find_regex(
+            [qr/^1\s+ACCEPT\s+tcp\s+\-\-\s+$fake_ip\s.*dpt\:22/],
+            $MATCH_ALL, $APPEND_RESULTS, $cmd_out_tmp);
+    } else {
+        $rv = 0;
+    }
+
+    $rv = 0 unless &firewalld_mock_passthrough($address,
+        ['-t', 'filter', '-D', 'FWKNOP_TEST', '1']);
+
+    ### the rule is gone, so the check has to fail the way firewalld does
+    if (&firewalld_mock_passthrough($address,
+            ['-C', 'FWKNOP_TEST', '-t', 'filter', @rule])) {
+        $rv = 0;
+    } else {
+        $rv = 0 unless &file_find_regex([qr/COMMAND_FAILED/],
+            $MATCH_ALL, $APPEND_RESULTS, $cmd_out_tmp);
+    }
+
+    &firewalld_mock_stop($bus_pid, $mock_pid);
+
+    $rv = 0 unless &file_find_regex([qr/passthrough\scalls\:\s6\s\(1\sfailed\)/],
+        $MATCH_ALL, $APPEND_RESULTS, $firewalld_mock_out);
+
+    return $rv;
+}
+
+sub firewalld_mock_spa_cycle() {
+    my $test_hr = shift;
+
+    my $rv = 1;
+    my $rule_re = qr/ACCEPT\s+tcp\s+\-\-\s+$fake_ip\s.*dpt\:22/;
+
+    my ($address, $bus_pid, $mock_pid) = &firewalld_mock_start();
+    return 0 unless $mock_pid;
+
+    ### fwknopd finds firewalld on the "system" bus
+    local $ENV{'DBUS_SYSTEM_BUS_ADDRESS'} = $address;
+
+    &do_fwknopd_cmd($test_hr->{'fwknopd_cmdline'});
+
+    $rv = 0 unless &run_cmd($test_hr->{'cmdline'},
+        $cmd_out_tmp, $curr_test_file);
+
+    sleep 1;
+
+    if (&firewalld_mock_passthrough($address,
+            ['-t', 'filter', '-L', 'FWKNOP_INPUT', '-n'])) {
+        unless (&file_find_regex([$rule_re],
+                $MATCH_ALL, $APPEND_RESULTS, $cmd_out_tmp)) {
+            &write_test_file("[-] firewalld_mock has no rule for $fake_ip\n",
+                $curr_test_file);
+            $rv = 0;
+        }
+    } else {
+        $rv = 0;
+    }
+
+    ### FW_ACCESS_TIMEOUT is 3 seconds in the access.conf file
+    sleep 5;
+
+    if (&firewalld_mock_passthrough($address,
+            ['-t', 'filter', '-L', 'FWKNOP_INPUT', '-n'])) {
+        if (&file_find_regex([$rule_re],
+                $MATCH_ALL, $APPEND_RESULTS, $cmd_out_tmp)) {
+            &write_test_file("[-] firewalld_mock rule for $fake_ip not expired\n",
+                $curr_test_file);
+            $rv = 0;
+        }
+    } else {
+        $rv = 0;
+    }
+
+    &stop_fwknopd();
+
+    &firewalld_mock_stop($bus_pid, $mock_pid);
+
+    $rv = 0 unless &file_find_regex([qr/Talking\sto\sfirewalld\sover\sD\-Bus/],
+        $MATCH_ALL, $APPEND_RESULTS, $server_test_file);
+
+    return $rv;
+}
+
+sub firewalld_mock_grant_journal() {
+    my $test_hr = shift;
+
+    my $rv = 1;
+    my $rule_re = qr/ACCEPT\s+tcp\s+\-\-\s+$fake_ip\s.*dpt\:22/;
+
+    my ($address, $bus_pid, $mock_pid) = &firewalld_mock_start();
+    return 0 unless $mock_pid;
+
+    ### fwknopd finds firewalld on the "system" bus
+    local $ENV{'DBUS_SYSTEM_BUS_ADDRESS'} = $address;
+
+    unlink "$run_dir/fwknopd.grants" if -e "$run_dir/fwknopd.grants";
+
+    &do_fwknopd_cmd($test_hr->{'fwknopd_cmdline'});
+
+    $rv = 0 unless &run_cmd($test_hr->{'cmdline'},
+        $cmd_out_tmp, $curr_test_file);
+
+    sleep 1;
+
+    my $expire = 0;
+    open F, "< $server_cmd_tmp" or die "[*] Could not open $server_cmd_tmp: $!";
+    while (<F>) {
+        if (/Added\s.*\srule\sto\sFWKNOP_INPUT\sfor\s$fake_ip\s.*expires\sat\s(\d+)/) {
+            $expire = $1;
+            last;
+        }
+    }
+    close F;
+
+    ### FLUSH_FIREWD_AT_EXIT is off, so the rule stays in place
+    &stop_fwknopd();
+
+    unless ($expire) {
+        &write_test_file("[-] the first fwknopd did not grant access.\n",
+            $curr_test_file);
+        &firewalld_mock_stop($bus_pid, $mock_pid);
+        return 0;
+    }
+
+    ### everything firewalld_mock sees from here on comes from the
+    ### restarted fwknopd
+    open F, "< $firewalld_mock_out" or die $!;
+    my @lines = <F>;
+    close F;
+    my $mock_lines = $#lines + 1;
+
+    &do_fwknopd_cmd($test_hr->{'fwknopd_cmdline'});
+
+    if (&firewalld_mock_passthrough($address,
+            ['-t', 'filter', '-L', 'FWKNOP_INPUT', '-n'])) {
+        unless (&file_find_regex([$rule_re],
+                $MATCH_ALL, $APPEND_RESULTS, $cmd_out_tmp)) {
+            &write_test_file("[-] the rule for $fake_ip did not survive the restart\n",
+                $curr_test_file);
+            $rv = 0;
+        }
+    } else {
+        $rv = 0;
+    }
+
+    ### the restarted fwknopd has to expire the rule at its original time
+    my $removed = 0;
+    while (time() <= $expire + 2) {
+        if (&file_find_regex([qr/Removed\srule\s\d+\sfrom\sFWKNOP_INPUT\swith\sexpire\stime\sof\s$expire/],
+                $MATCH_ALL, $NO_APPEND_RESULTS, $server_cmd_tmp)) {
+            $removed = 1;
+            last;
+        }
+        sleep 1;
+    }
+    unless ($removed) {
+        &write_test_file("[-] the rule was not removed at $expire.\n",
+            $curr_test_file);
+        $rv = 0;
+    }
+
+    &stop_fwknopd();
+
+    &firewalld_mock_stop($bus_pid, $mock_pid);
+
+    ### no flush and no new rule for $fake_ip after the restart
+    open F, "< $firewalld_mock_out" or die $!;
+    @lines = <F>;
+    close F;
+    for my $line (@lines[$mock_lines .. $#lines]) {
+        if ($line =~ /^\[\d+\]\s.*\s\-(F|X)\s/
+                or $line =~ /^\[\d+\]\s.*\s\-(A|I)\sFWKNOP_INPUT\s.*$fake_ip/) {
+            &write_test_file("[-] unexpected call after the restart: $line",
+                $curr_test_file);
+            $rv = 0;
+        }
+    }
+
+    $rv = 0 unless &file_find_regex(
+        [qr/Restored\s1\sactive\srule\(s\)\sfrom\sgrant\sjournal/],
+        $MATCH_ALL, $APPEND_RESULTS, $server_test_file);
+
+    return $rv;
+}
+
 sub key_gen_uniqueness() {
     my $test_hr = shift;
 
@@ -7584,7 +8523,9 @@ sub start_fwknopd() {
 }
 
 sub do_controller_cmd() {
-    my $cmdline = shift;
+    my ($cmdline, $ready_re) = @_;
+
+    $ready_re = qr/SDP\sController\srunning\sat\sport/ unless $ready_re;
 
     my $pid = fork();
     die "[*] Could not fork: $!" unless defined $pid;
@@ -7605,14 +8546,14 @@ sub do_controller_cmd() {
         last if $tries == 5;
     }
 
-    if (&file_find_regex([qr/SDP\sController\srunning\sat\sport/],
+    if (&file_find_regex([$ready_re],
             $MATCH_ALL, $NO_APPEND_RESULTS, $controller_cmd_tmp)) {
         &write_test_file("[.] start_controller() found 'Controller running' string\n",
             $curr_test_file);
         sleep 1;
     } else {
         $tries = 0;
-        while (not &file_find_regex([qr/SDP\sController\srunning\sat\sport/],
+        while (not &file_find_regex([$ready_re],
                 $MATCH_ALL, $NO_APPEND_RESULTS, $controller_cmd_tmp)) {
             &write_test_file("[.] start_controller() looking " .
                 "for 'Controller running', try: $tries\n",
@@ -8083,6 +9024,37 @@ sub init() {
         push @tests_to_exclude, qr/python fko extension/;
     }
 
+    ### the SDP controller simulator is built here and needs the json-c,
+    ### zlib and OpenSSL headers
+    unless (&c_headers_exist(qw(json-c/json.h zlib.h openssl/ssl.h))) {
+        &logr("[-] init() : json-c, zlib or OpenSSL headers not found, " .
+            "skipping sdp_ctrl_sim tests.\n");
+        push @tests_to_exclude, qr/sdp ctrl sim/;
+    }
+
+    ### fwknopd only re-reads its config on SIGHUP in the pcap loop, the
+    ### UDP server exits instead
+    push @tests_to_exclude, qr/GPG workers.*SIGHUP/
+        unless -e '../config.h' and &file_find_regex(
+            [qr/^#define\sUSE_LIBPCAP\s1/],
+            $MATCH_ALL, $NO_APPEND_RESULTS, '../config.h');
+
+    ### firewalld_mock needs libdbus and runs on a private bus, and the
+    ### fwknopd test needs a firewalld build that talks D-Bus
+    $dbus_daemon_path = &find_command('dbus-daemon') unless $dbus_daemon_path;
+    $dbus_send_path   = &find_command('dbus-send') unless $dbus_send_path;
+    if ($dbus_daemon_path and $dbus_send_path
+            and not system('pkg-config --exists dbus-1 > /dev/null 2>&1')) {
+        push @tests_to_exclude, qr/firewalld mock.*fwknopd D\-Bus/
+            unless -e '../config.h' and &file_find_regex(
+                [qr/^#define\sHAVE_LIBDBUS\s1/],
+                $MATCH_ALL, $NO_APPEND_RESULTS, '../config.h');
+    } else {
+        &logr("[-] init() : dbus-daemon, dbus-send or libdbus not found, " .
+            "skipping firewalld_mock tests.\n");
+        push @tests_to_exclude, qr/firewalld mock/;
+    }
+
     if ($enable_perl_module_fuzzing_spa_pkt_generation) {
         push @tests_to_include, qr/perl FKO module/;
         if ($fuzzing_class eq 'bogus data') {
@@ -8940,7 +9912,8 @@ sub remove_permissions_warnings() {
 }
 
 sub rm_tmp_files() {
-    for my $file ($cmd_out_tmp, $server_cmd_tmp, $controller_cmd_tmp, $openssl_cmd_tmp) {
+    for my $file ($cmd_out_tmp, $server_cmd_tmp, $controller_cmd_tmp,
+            $hot_restart_cmd_tmp, $agent_cmd_tmp, $openssl_cmd_tmp) {
         unlink $file if -e $file;
     }
     return;
@@ -8961,6 +9934,21 @@ sub find_command() {
     return $path;
 }
 
+sub c_headers_exist() {
+    my @headers = @_;
+
+    my $cc = &find_command('cc');
+    return 0 unless $cc;
+
+    ### let CPPFLAGS point at headers outside the default include path,
+    ### the test Makefiles pass it through as well
+    my $cppflags = $ENV{'CPPFLAGS'} || '';
+
+    open CC, "| $cc $cppflags -E -x c - > /dev/null 2>&1" or return 0;
+    print CC "#include <$_>\n" for @headers;
+    return close CC;
+}
+
 sub import_test_files() {
     for my $file (@test_files) {
         die "[*] tests file: $file does not exist"
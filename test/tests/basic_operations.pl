@@ -82,6 +82,45 @@
         'server_positive_output_matches' => [qr/Error from pcap_dispatch\b/],
         'no_exit_intf_down' => $YES
     },
+    {
+        'category' => 'basic operations',
+        'subcategory' => 'server memory backend',
+        'detail'   => '--fw-list',
+        'function' => \&generic_exec,
+        'exec_err' => $NO,
+        'cmdline'  => "$lib_view_str $fwknopdCmd $srv_sdp_options -c $cf{'memory_backend'} " .
+            "-a $cf{'def_access'} -d $default_digest_file -p $default_pid_file --fw-list",
+        'positive_output_matches' => [qr/Listing\sin\-memory\sfirewall\srules\s\(0\sactive\)/,
+            qr/grants\:\s0,\scommits\:\s0,\sexpired\:\s0/],
+    },
+    {
+        'category' => 'basic operations',
+        'subcategory' => 'server memory backend',
+        'detail'   => 'rule added and expired (tcp/22)',
+        'function' => \&memory_backend_cycle,
+        'cmdline'  => $default_client_args,
+        'fwknopd_cmdline' => "$lib_view_str $fwknopdCmd $srv_sdp_options -c $cf{'memory_backend'} " .
+            "-a $cf{'def_access'} -d $default_digest_file -p $default_pid_file $intf_str",
+        'server_positive_output_matches' => [qr/Using\sthe\sin\-memory\sfirewall\sbackend/,
+            qr/Added\saccess\srule\sfor\s$fake_ip\s\-\>\s0\.0\.0\.0\/0\sport\s22/,
+            qr/In\-memory\sfirewall\:\s1\sactive\srule\(s\),\s1\sgrant/,
+            qr/Removed\saccess\srule\sfor\s$fake_ip\s/,
+            qr/In\-memory\sfirewall\:\s0\sactive\srule\(s\),\s1\sgrant.*1\sexpired/],
+    },
+    {
+        'category' => 'basic operations',
+        'subcategory' => 'server memory backend',
+        'detail'   => '--hot-restart hand-off (tcp/22)',
+        'function' => \&hot_restart_cycle,
+        'cmdline'  => $default_client_args,
+        'fwknopd_cmdline' => "$lib_view_str $fwknopdCmd $srv_sdp_options -c $cf{'memory_backend'} " .
+            "-a $cf{'def_access'} -d $default_digest_file -p $default_pid_file " .
+            "-r " . cwd() . "/$run_dir $intf_str",
+        'server_positive_output_matches' => [
+            qr/Hot\srestart\:\stook\sover\sfrom\sthe\sprevious\sfwknopd/,
+            qr/Hot\srestart\:\srestored\s0\spending.*\s1\sfirewall\srule/,
+            qr/Added\saccess\srule\sfor\s$fake_ip\s\-\>\s0\.0\.0\.0\/0\sport\s23/],
+    },
 
     {
         'category' => 'basic operations',
@@ -545,6 +584,37 @@
         'positive_output_matches' => [qr/Parameter\serror/],
     },
 
+    ### rc files of 8K and up are read through the rc cache
+    {
+        'category' => 'basic operations',
+        'subcategory' => 'client rc file',
+        'detail'   => 'large rc file stanza',
+        'function' => \&client_rc_file,
+        'cmdline'  => "$client_rewrite_rc_args -n host250",
+        'write_rc_file' => [
+            {'name' => 'default', 'vars' => {'KEY' => 'testtest', 'DIGEST_TYPE' => 'SHA1'}},
+            map { {'name' => "host$_", 'vars' => {'KEY' => "testtest$_",
+                'DIGEST_TYPE' => ($_ == 250 ? 'SHA384' : 'SHA256'),
+                'SPA_SERVER' => "host$_.example.com"}} } (1..300)
+        ],
+        'positive_output_matches' => [qr/Digest\sType\:\s.*SHA384/],
+    },
+    {
+        'category' => 'basic operations',
+        'subcategory' => 'client rc file',
+        'detail'   => 'large rc file invalid var',
+        'function' => \&client_rc_file,
+        'cmdline'  => "$client_rewrite_rc_args -n host250",
+        'write_rc_file' => [
+            {'name' => 'default', 'vars' => {'KEY' => 'testtest', 'DIGEST_TYPE' => 'SHA1'}},
+            map { {'name' => "host$_", 'vars' => {'KEY' => "testtest$_",
+                ($_ == 250 ? 'BADKEY' : 'DIGEST_TYPE') => 'SHA256',
+                'SPA_SERVER' => "host$_.example.com"}} } (1..300)
+        ],
+        'exec_err' => $YES,
+        'positive_output_matches' => [qr/Parameter\serror/],
+    },
+
     {
         'category' => 'basic operations',
         'subcategory' => 'client rc file',
@@ -847,6 +917,77 @@
                     'HMAC_DIGEST_TYPE' => 'SHA512'}}],
         'positive_output_matches' => [qr/HMAC\sType\:\s.*SHA512/],
     },
+    {
+        'category' => 'basic operations',
+        'subcategory' => 'client',
+        'detail'   => '--fanout to three UDP targets',
+        'function' => \&client_fanout_udp_targets,
+        'cmdline'  => "$lib_view_str $valgrind_str $fwknopCmd $client_sdp_options " .
+            "--rc-file $rewrite_rc_file --no-save-args $verbose_str",
+        'fanout_ports' => [62401, 62402, 62403],
+    },
+    {
+        'category' => 'basic operations',
+        'subcategory' => 'client agent',
+        'detail'   => 'KNOCK all targets, unknown target',
+        'function' => \&client_agent_knock,
+        'cmdline'  => "$lib_view_str $valgrind_str $fwknopCmd $client_sdp_options " .
+            "--rc-file $rewrite_rc_file --no-save-args $verbose_str",
+        'fwknopd_cmdline' => "$lib_view_str $fwknopdCmd $srv_sdp_options -c $cf{'memory_backend'} " .
+            "-a $cf{'def_access'} -d $default_digest_file -p $default_pid_file $intf_str",
+        'client_positive_output_matches' => [
+            qr/fwknop\sagent\sserving\s2\starget/,
+            qr/fwknop\sagent\sshutting\sdown/],
+        'server_positive_output_matches' => [
+            qr/Added\saccess\srule\sfor\s$fake_ip\s\-\>\s0\.0\.0\.0\/0\sport\s22,/,
+            qr/Added\saccess\srule\sfor\s$fake_ip\s\-\>\s0\.0\.0\.0\/0\sport\s23,/],
+    },
+    {
+        'category' => 'basic operations',
+        'subcategory' => 'client agent',
+        'detail'   => 'keys reloaded from rewritten rc file',
+        'function' => \&client_agent_knock,
+        'cmdline'  => "$lib_view_str $valgrind_str $fwknopCmd $client_sdp_options " .
+            "--rc-file $rewrite_rc_file --no-save-args $verbose_str",
+        'fwknopd_cmdline' => "$lib_view_str $fwknopdCmd $srv_sdp_options -c $cf{'memory_backend'} " .
+            "-a $cf{'def_access'} -d $default_digest_file -p $default_pid_file $intf_str",
+        'agent_reload' => $YES,
+        'client_positive_output_matches' => [
+            qr/Keys\schanged\sfor\s1\starget.*rebuilding/],
+        'server_positive_output_matches' => [
+            qr/Added\saccess\srule\sfor\s$fake_ip\s\-\>\s0\.0\.0\.0\/0\sport\s22,/],
+    },
+    {
+        'category' => 'basic operations',
+        'subcategory' => 'client agent',
+        'detail'   => 'stale socket removed',
+        'function' => \&client_agent_socket_path,
+        'cmdline'  => "$lib_view_str $valgrind_str $fwknopCmd $client_sdp_options " .
+            "--rc-file $rewrite_rc_file --no-save-args $verbose_str",
+        'agent_socket_path' => 'stale',
+        'client_positive_output_matches' => [qr/fwknop\sagent\sserving\s1\starget/],
+    },
+    {
+        'category' => 'basic operations',
+        'subcategory' => 'client agent',
+        'detail'   => 'live socket not taken over',
+        'function' => \&client_agent_socket_path,
+        'cmdline'  => "$lib_view_str $valgrind_str $fwknopCmd $client_sdp_options " .
+            "--rc-file $rewrite_rc_file --no-save-args $verbose_str",
+        'agent_socket_path' => 'live',
+        'client_positive_output_matches' => [qr/Another\sagent\sis\salready\sserving/],
+    },
+    {
+        'category' => 'basic operations',
+        'subcategory' => 'client agent',
+        'detail'   => 'regular file not removed',
+        'function' => \&client_agent_socket_path,
+        'cmdline'  => "$lib_view_str $valgrind_str $fwknopCmd $client_sdp_options " .
+            "--rc-file $rewrite_rc_file --no-save-args $verbose_str",
+        'agent_socket_path' => 'file',
+        'client_positive_output_matches' => [qr/exists\sand\sis\snot\sa\ssocket/],
+    },
+
     ### rc file saving --save-rc-stanza
     {
         'category' => 'basic operations',
@@ -1609,6 +1750,16 @@
         'exec_err' => $YES,
         'positive_output_matches' => [qr/Error\sparsing/],
     },
+    {
+        'category' => 'basic operations',
+        'subcategory' => 'client',
+        'detail'   => '-R resolver failover and cache',
+        'function' => \&client_resolve_stand_in,
+        'cmdline'  => "$lib_view_str $valgrind_str $fwknopCmd $client_sdp_options " .
+            "-A tcp/22 -D $loopback_ip --rc-file $rewrite_rc_file " .
+            "--no-save-args $verbose_str --test",
+        'resolve_http_port' => 62501,
+    },
 
     {
         'category' => 'basic operations',
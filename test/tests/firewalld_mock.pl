@@ -0,0 +1,36 @@
+@firewalld_mock = (
+    {
+        'category' => 'firewalld mock',
+        'subcategory' => 'build',
+        'detail'   => 'compile firewalld_mock',
+        'function' => \&generic_exec,
+        'exec_err' => $NO,
+        'negative_output_matches' => [qr/\swarning:\s/i],
+        'cmdline'  => "make -C $firewalld_mock_dir clean all",
+    },
+    {
+        'category' => 'firewalld mock',
+        'subcategory' => 'passthrough',
+        'detail'   => 'add, check, list and delete a rule',
+        'function' => \&firewalld_mock_rules,
+    },
+    {
+        'category' => 'firewalld mock',
+        'subcategory' => 'fwknopd D-Bus',
+        'detail'   => 'rule added and expired (tcp/22)',
+        'function' => \&firewalld_mock_spa_cycle,
+        'cmdline'  => $default_client_args,
+        'fwknopd_cmdline' => "$lib_view_str $fwknopdCmd $srv_sdp_options -c $cf{'udp_server'} " .
+            "-a $cf{'def_access'} -d $default_digest_file -p $default_pid_file $intf_str",
+    },
+    {
+        'category' => 'firewalld mock',
+        'subcategory' => 'fwknopd D-Bus',
+        'detail'   => 'grant journal across a restart',
+        'function' => \&firewalld_mock_grant_journal,
+        'cmdline'  => $default_client_args,
+        'fwknopd_cmdline' => "$lib_view_str $fwknopdCmd $srv_sdp_options -c $cf{'grant_journal'} " .
+            "-a $cf{'grant_journal_access'} -d $default_digest_file -p $default_pid_file " .
+            "-r " . cwd() . "/$run_dir $intf_str",
+    },
+);
@@ -324,4 +324,72 @@
         'positive_output_matches' => [qr/Username:\s*$spoof_user/],
         'server_positive_output_matches' => [qr/Username:\s*$spoof_user/],
     },
+
+    ### the same tests with GPG decryption handed off to worker threads
+    {
+        'category' => 'GPG (no pw)',
+        'subcategory' => 'client+server',
+        'detail'   => 'GPG workers complete cycle (tcp/22 ssh)',
+        'function' => \&spa_cycle,
+        'cmdline'  => $default_client_gpg_args_no_pw,
+        'fwknopd_cmdline' => "$fwknopdCmd $srv_sdp_options -c $cf{'gpg_workers'} " .
+            "-a $cf{'gpg_no_pw_access'} $intf_str " .
+            "-d $default_digest_file -p $default_pid_file",
+        'server_positive_output_matches' => [qr/Started\s2\sGPG\sworker\sthread/],
+        'fw_rule_created' => $NEW_RULE_REQUIRED,
+        'fw_rule_removed' => $NEW_RULE_REMOVED,
+    },
+    {
+        'category' => 'GPG (no pw)',
+        'subcategory' => 'client+server',
+        'detail'   => 'GPG workers multi gpg-IDs (tcp/22 ssh)',
+        'function' => \&spa_cycle,
+        'cmdline'  => $default_client_gpg_args_no_pw,
+        'fwknopd_cmdline' => "$fwknopdCmd $srv_sdp_options -c $cf{'gpg_workers'} " .
+            "-a $cf{'multi_gpg_no_pw_access'} $intf_str " .
+            "-d $default_digest_file -p $default_pid_file",
+        'server_positive_output_matches' => [qr/Started\s2\sGPG\sworker\sthread/],
+        'fw_rule_created' => $NEW_RULE_REQUIRED,
+        'fw_rule_removed' => $NEW_RULE_REMOVED,
+    },
+    {
+        'category' => 'GPG (no pw)',
+        'subcategory' => 'client+server',
+        'detail'   => 'GPG workers invalid sig list',
+        'function' => \&spa_cycle,
+        'cmdline'  => $default_client_gpg_args_no_pw,
+        'fwknopd_cmdline' => "$fwknopdCmd $srv_sdp_options -c $cf{'gpg_workers'} " .
+            "-a $cf{'gpg_invalid_sig_id_access'} $intf_str " .
+            "-d $default_digest_file -p $default_pid_file",
+        'fw_rule_created' => $REQUIRE_NO_NEW_RULE,
+    },
+    {
+        'category' => 'GPG (no pw)',
+        'subcategory' => 'client+server',
+        'detail'   => 'GPG workers replay attack detection',
+        'function' => \&replay_detection,
+        'cmdline'  => "$default_client_gpg_args_no_homedir "
+            . "--gpg-home-dir $gpg_client_home_dir_no_pw --gpg-no-signing-pw",
+        'fwknopd_cmdline' => "$fwknopdCmd $srv_sdp_options -c $cf{'gpg_workers'} " .
+            "-a $cf{'gpg_no_pw_access'} $intf_str " .
+            "-d $default_digest_file -p $default_pid_file",
+        'server_positive_output_matches' => [qr/Replay\sdetected\sfrom\ssource\sIP/],
+    },
+    {
+        'category' => 'GPG (no pw)',
+        'subcategory' => 'client+server',
+        'detail'   => 'GPG workers SIGHUP with queued job',
+        'function' => \&gpg_workers_sighup,
+        'cmdline'  => $default_client_gpg_args_no_pw,
+        'fwknopd_cmdline' => "$fwknopdCmd $srv_sdp_options -c $cf{'gpg_workers_memory'} " .
+            "-a $cf{'gpg_no_pw_access'} $intf_str " .
+            "-d $default_digest_file -p $default_pid_file",
+        'server_positive_output_matches' => [
+            qr/Got\sSIGHUP/,
+            qr/Added\saccess\srule\sfor\s$fake_ip/
+        ],
+        'server_positive_num_matches' => [
+            { 're' => qr/Started\s2\sGPG\sworker\sthread/, 'num' => 2 },
+        ],
+    },
 );
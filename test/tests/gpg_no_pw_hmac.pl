@@ -13,6 +13,22 @@
         'fw_rule_removed' => $NEW_RULE_REMOVED,
         'key_file' => $cf{'rc_hmac_b64_key'},
     },
+    {
+        'category' => 'GPG (no pw) HMAC',
+        'subcategory' => 'client+server',
+        'detail'   => 'GPG workers complete cycle (tcp/22 ssh)',
+        'function' => \&spa_cycle,
+        'cmdline'  => "$default_client_gpg_args_no_homedir "
+            . "--gpg-home-dir $gpg_client_home_dir_no_pw "
+            . "--rc-file $cf{'rc_hmac_b64_key'}",
+        'fwknopd_cmdline' => "$fwknopdCmd $srv_sdp_options -c $cf{'gpg_workers'} " .
+            "-a $cf{'gpg_no_pw_hmac_access'} $intf_str " .
+            "-d $default_digest_file -p $default_pid_file",
+        'server_positive_output_matches' => [qr/Started\s2\sGPG\sworker\sthread/],
+        'fw_rule_created' => $NEW_RULE_REQUIRED,
+        'fw_rule_removed' => $NEW_RULE_REMOVED,
+        'key_file' => $cf{'rc_hmac_b64_key'},
+    },
     {
         'category' => 'GPG (no pw) HMAC',
         'subcategory' => 'client+server',
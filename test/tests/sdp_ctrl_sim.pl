@@ -0,0 +1,102 @@
+@sdp_ctrl_sim = (
+    {
+        'category' => 'sdp ctrl sim',
+        'subcategory' => 'build',
+        'detail'   => 'compile sdp_ctrl_sim',
+        'function' => \&generic_exec,
+        'exec_err' => $NO,
+        'negative_output_matches' => [qr/\swarning:\s/i],
+        'cmdline'  => "make -C $sdp_ctrl_sim_dir clean all",
+    },
+    {
+        'category' => 'sdp ctrl sim',
+        'subcategory' => 'bench',
+        'detail'   => 'gateways against the simulator',
+        'function' => \&generic_exec,
+        'exec_err' => $NO,
+        'positive_output_matches' => [qr/Gateways\:\s20\scompleted,\s0\sfailed/,
+            qr/Access\sdata\:\s20\saccess_refresh/,
+            qr/keep_alive\s+40/],
+        'cmdline'  => "$sdp_ctrl_sim_args --gateways 20 --stanzas 200 --rounds 2",
+    },
+    {
+        'category' => 'sdp ctrl sim',
+        'subcategory' => 'bench',
+        'detail'   => 'split access refresh',
+        'function' => \&generic_exec,
+        'exec_err' => $NO,
+        'positive_output_matches' => [qr/Access\srefresh\:\s1000\sstanzas\sin\s5\smessage/,
+            qr/Gateways\:\s10\scompleted,\s0\sfailed/,
+            qr/Access\sdata\:\s10\saccess_refresh,\s40\saccess_update/],
+        'cmdline'  => "$sdp_ctrl_sim_args --gateways 10 --stanzas 1000 --rounds 1",
+    },
+    {
+        'category' => 'sdp ctrl sim',
+        'subcategory' => 'bench',
+        'detail'   => 'compressed frames',
+        'function' => \&generic_exec,
+        'exec_err' => $NO,
+        'positive_output_matches' => [qr/Access\srefresh\s\(compressed\)\:\s200\sstanzas/,
+            qr/Gateways\:\s20\scompleted,\s0\sfailed/],
+        'cmdline'  => "$sdp_ctrl_sim_args --gateways 20 --stanzas 200 --rounds 2 --compress",
+    },
+    {
+        'category' => 'sdp ctrl sim',
+        'subcategory' => 'serve',
+        'detail'   => 'fwknopd and fwknop against the simulator',
+        'function' => \&ctrl_sim_cycle,
+        'ctrl_sim_cmdline' => "$sdp_ctrl_sim_serve_args --stanzas 1000",
+        'cmdline'  => $ctrl_sim_client_args,
+        'fwknopd_cmdline'  => $ctrl_sim_server_args,
+        'client_fwknoprc'  => $cf{'ctrl_sim_client_fwknoprc'},
+        'client_ctrl_conf' => $cf{'ctrl_sim_client_ctrl_conf'},
+        'client_ctrl_key'  => $cf{'ctrl_sim_key'},
+        'client_ctrl_cert' => $cf{'ctrl_sim_cert'},
+        'server_ctrl_conf' => $cf{'ctrl_sim_server_ctrl_conf'},
+        'server_ctrl_key'  => $cf{'ctrl_sim_key'},
+        'server_ctrl_cert' => $cf{'ctrl_sim_cert'},
+        'client_positive_output_matches' =>
+            [qr/Credential\supdate\sreceived/,
+             qr/All\snew\scredentials\sstored\ssuccessfully/],
+        'server_positive_output_matches' =>
+            [qr/All\snew\scredentials\sstored\ssuccessfully/,
+             qr/Succeeded\sin\sretrieving\sand\sinstalling\saccess\sconfiguration/,
+             qr/Succeeded\sin\smodifying\saccess\sdata/,
+             qr/Keep\-alive\sresponse\sreceived/,
+             qr/Sending\sconnection_update\smessage\s\(1\sconnections\)/,
+             qr/encryption\s\(resumed\ssession\)/,
+             qr/HMAC_COMPAREFAIL/,
+             qr/Added\sforward\srule\sfor\s127\.0\.0\.1\s.*\sport\s10000/],
+        'ctrl_positive_output_matches' =>
+            [qr/Access\srefresh\:\s1000\sstanzas\sin\s5\smessage/,
+             qr/credential_update_ack\s+4\b/,
+             qr/access_ack\s+10\b/,
+             qr/keep_alive\s+[1-9]/,
+             qr/connection_update\s+[1-9]/,
+             qr/resumed\sTLS\ssessions\s+1\b/],
+    },
+    {
+        'category' => 'sdp ctrl sim',
+        'subcategory' => 'serve',
+        'detail'   => 'compressed frames',
+        'function' => \&ctrl_sim_cycle,
+        'ctrl_sim_cmdline' => "$sdp_ctrl_sim_serve_args --stanzas 1000 --compress",
+        'cmdline'  => $ctrl_sim_client_args,
+        'fwknopd_cmdline'  => $ctrl_sim_server_args,
+        'client_fwknoprc'  => $cf{'ctrl_sim_client_fwknoprc'},
+        'client_ctrl_conf' => $cf{'ctrl_sim_client_ctrl_conf'},
+        'client_ctrl_key'  => $cf{'ctrl_sim_key'},
+        'client_ctrl_cert' => $cf{'ctrl_sim_cert'},
+        'server_ctrl_conf' => $cf{'ctrl_sim_server_ctrl_conf_compress'},
+        'server_ctrl_key'  => $cf{'ctrl_sim_key'},
+        'server_ctrl_cert' => $cf{'ctrl_sim_cert'},
+        'server_positive_output_matches' =>
+            [qr/Controller\saccepts\scompressed\smessages/,
+             qr/Succeeded\sin\smodifying\saccess\sdata/,
+             qr/Added\sforward\srule\sfor\s127\.0\.0\.1\s.*\sport\s10000/],
+        'ctrl_positive_output_matches' =>
+            [qr/Access\srefresh\s\(compressed\)\:\s1000\sstanzas\sin\s\d+\smessage/,
+             qr/deflated\sframes\sreceived\s+[1-9]/,
+             qr/resumed\sTLS\ssessions\s+1\b/],
+    },
+);